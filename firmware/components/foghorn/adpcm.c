@@ -0,0 +1,51 @@
+#include "adpcm.h"
+
+#define ADPCM_STEP_INDEX_MAX 88
+
+// IMA/DVI ADPCM step sizes
+static const int16_t step_table[ADPCM_STEP_INDEX_MAX + 1] = {
+    7,     8,     9,     10,    11,    12,    13,    14,    16,    17,    19,    21,    23,    25,    28,
+    31,    34,    37,    41,    45,    50,    55,    60,    66,    73,    80,    88,    97,    107,   118,
+    130,   143,   157,   173,   190,   209,   230,   253,   279,   307,   337,   371,   408,   449,   494,
+    544,   598,   658,   724,   796,   876,   963,   1060,  1166,  1282,  1411,  1552,  1707,  1878,  2066,
+    2272,  2499,  2749,  3024,  3327,  3660,  4026,  4428,  4871,  5358,  5894,  6484,  7132,  7845,  8630,
+    9493,  10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767,
+};
+
+static const int8_t index_table[8] = {-1, -1, -1, -1, 2, 4, 6, 8};
+
+void adpcm_decode(adpcm_state_t *state, const uint8_t *data, uint32_t first, int16_t *out, uint32_t count)
+{
+    int32_t predictor = state->predictor;
+    int32_t step_index = state->step_index;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t sample = first + i;
+        uint8_t nibble = (data[sample / 2] >> ((sample & 1) * 4)) & 0x0f;
+
+        int32_t step = step_table[step_index];
+        int32_t diff = step >> 3;
+        if (nibble & 4)
+        {
+            diff += step;
+        }
+        if (nibble & 2)
+        {
+            diff += step >> 1;
+        }
+        if (nibble & 1)
+        {
+            diff += step >> 2;
+        }
+        predictor += (nibble & 8) ? -diff : diff;
+        predictor = predictor > INT16_MAX ? INT16_MAX : predictor < INT16_MIN ? INT16_MIN : predictor;
+
+        step_index += index_table[nibble & 7];
+        step_index = step_index < 0 ? 0 : step_index > ADPCM_STEP_INDEX_MAX ? ADPCM_STEP_INDEX_MAX : step_index;
+        out[i] = predictor;
+    }
+
+    state->predictor = predictor;
+    state->step_index = step_index;
+}
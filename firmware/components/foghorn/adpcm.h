@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @brief State of an IMA ADPCM decoder between two calls.
+ */
+typedef struct
+{
+    int16_t predictor;
+    uint8_t step_index; ///< 0-88
+} adpcm_state_t;
+
+/**
+ * @brief Decodes 4-bit IMA ADPCM samples, low nibble first, into 16-bit PCM.
+ *
+ * Reads the nibbles straight from `data`, e.g. a memory-mapped partition, and writes `out` once per sample, so
+ * `out` can be the DMA buffer itself.
+ *
+ * @param data   Start of the clip.
+ * @param first  Index of the first sample to decode; the state has to be the one after the sample before it.
+ * @param out    count samples.
+ */
+void adpcm_decode(adpcm_state_t *state, const uint8_t *data, uint32_t first, int16_t *out, uint32_t count);
@@ -0,0 +1,462 @@
+#include "foghorn.h"
+#include "adpcm.h"
+
+#include "beacon.h"
+#include "driver/i2s_std.h"
+#include "esp_attr.h"
+#include "esp_console.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "light.h"
+#include "sdkconfig.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "foghorn";
+
+#define FOGHORN_PARTITION_LABEL "foghorn"
+#define FOGHORN_MAGIC 0x31474f46 // "FOG1"
+#define FOGHORN_MAX_CLIPS 16
+#define FOGHORN_DMA_BUFFERS 4  // the ring the sound lags the request by, 60 ms at 16 kHz
+#define FOGHORN_DMA_FRAMES 240 // samples per buffer, 15 ms at 16 kHz
+#define FOGHORN_TASK_STACK_SIZE 3072
+
+typedef enum
+{
+    FOGHORN_FORMAT_PCM16 = 0,
+    FOGHORN_FORMAT_IMA_ADPCM = 1,
+} foghorn_format_t;
+
+// Clip set as written by tools/foghorn_clips.py, little endian: the header, the clip table, the sample data
+typedef struct __attribute__((packed))
+{
+    uint32_t magic;
+    uint16_t clip_count;
+    uint16_t reserved;
+    uint32_t sample_rate_hz;
+} foghorn_set_header_t;
+
+typedef struct __attribute__((packed))
+{
+    uint32_t offset; ///< of the samples, from the start of the partition
+    uint32_t size;   ///< of the samples in bytes
+    uint32_t samples;
+    uint8_t format;     ///< foghorn_format_t
+    uint8_t step_index; ///< IMA ADPCM state before the first sample
+    int16_t predictor;
+} foghorn_clip_t;
+
+/*
+ * The clips are played from the memory-mapped partition: the task decodes them straight into the DMA buffer the
+ * driver just sent, so there is neither a copy in RAM nor a queue between the task and the driver. The driver
+ * clears each sent buffer before it reports it (auto_clear_before_cb), so a buffer the task did not refill in time
+ * is sent as silence and counted as an underrun, and the buffers after the end of the clip are silent without the
+ * task touching them. The channel only runs while a clip plays; the driver holds its power management lock then.
+ */
+static const uint8_t *clip_set;
+static const foghorn_clip_t *clips;
+static uint16_t clip_count;
+static uint32_t sample_rate_hz;
+static i2s_chan_handle_t channel;
+
+static portMUX_TYPE stream_lock = portMUX_INITIALIZER_UNLOCKED;
+static int16_t *due[FOGHORN_DMA_BUFFERS]; ///< sent buffers the task has to refill
+static uint32_t due_head;
+static uint32_t due_tail;
+static int16_t *last_buffer; ///< buffer with the end of the clip
+static bool drained;         ///< the last buffer was sent, the clip is over
+static int32_t requested_clip = -1;
+static foghorn_stats_t stats;
+
+static TaskHandle_t task_handle = NULL;
+static StackType_t task_stack[FOGHORN_TASK_STACK_SIZE];
+static StaticTask_t task_buffer;
+
+// only used by the task
+static const foghorn_clip_t *clip;
+static uint32_t position; ///< next sample of the clip
+static adpcm_state_t adpcm;
+
+// only used by the beacon task
+static uint32_t periods;
+
+static bool IRAM_ATTR foghorn_sent_callback(i2s_chan_handle_t handle, i2s_event_data_t *event, void *user_ctx)
+{
+    int16_t *buffer = event->dma_buf;
+
+    portENTER_CRITICAL_ISR(&stream_lock);
+    bool pending = false;
+    for (uint32_t i = due_tail; i != due_head; i++)
+    {
+        pending = pending || due[i % FOGHORN_DMA_BUFFERS] == buffer;
+    }
+    if (pending)
+    {
+        // went out again before the task got to it
+        stats.underruns++;
+    }
+    else
+    {
+        due[due_head++ % FOGHORN_DMA_BUFFERS] = buffer;
+    }
+    drained = drained || buffer == last_buffer;
+    portEXIT_CRITICAL_ISR(&stream_lock);
+
+    BaseType_t high_task_wakeup = pdFALSE;
+    vTaskNotifyGiveFromISR(task_handle, &high_task_wakeup);
+    return high_task_wakeup == pdTRUE;
+}
+
+static void fill(int16_t *buffer)
+{
+    if (clip == NULL || position == clip->samples)
+    {
+        return;
+    }
+
+    uint32_t count = clip->samples - position;
+    count = count < FOGHORN_DMA_FRAMES ? count : FOGHORN_DMA_FRAMES;
+    const uint8_t *data = clip_set + clip->offset;
+    if (clip->format == FOGHORN_FORMAT_IMA_ADPCM)
+    {
+        adpcm_decode(&adpcm, data, position, buffer, count);
+    }
+    else
+    {
+        memcpy(buffer, data + position * sizeof(int16_t), count * sizeof(int16_t));
+    }
+    position += count;
+
+    if (position == clip->samples)
+    {
+        portENTER_CRITICAL(&stream_lock);
+        last_buffer = buffer;
+        portEXIT_CRITICAL(&stream_lock);
+    }
+}
+
+static void start(int32_t index)
+{
+    clip = &clips[index];
+    position = 0;
+    adpcm.predictor = clip->predictor;
+    adpcm.step_index = clip->step_index;
+
+    esp_err_t ret = i2s_channel_enable(channel);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to enable I2S channel: %s", esp_err_to_name(ret));
+        clip = NULL;
+        return;
+    }
+    ESP_LOGI(TAG, "Playing clip %" PRIi32, index);
+}
+
+static void stop(void)
+{
+    esp_err_t ret = i2s_channel_disable(channel);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to disable I2S channel: %s", esp_err_to_name(ret));
+    }
+    clip = NULL;
+
+    portENTER_CRITICAL(&stream_lock);
+    due_head = 0;
+    due_tail = 0;
+    last_buffer = NULL;
+    drained = false;
+    stats.plays++;
+    portEXIT_CRITICAL(&stream_lock);
+}
+
+static void foghorn_task(void *arg)
+{
+    while (true)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        // the next buffer goes out one buffer time after the last one was reported, refill before anything else
+        while (true)
+        {
+            portENTER_CRITICAL(&stream_lock);
+            int16_t *buffer = due_tail != due_head ? due[due_tail % FOGHORN_DMA_BUFFERS] : NULL;
+            portEXIT_CRITICAL(&stream_lock);
+            if (buffer == NULL)
+            {
+                break;
+            }
+            fill(buffer);
+            // the interrupt does not report this buffer again before it was sent, so it is popped only now
+            portENTER_CRITICAL(&stream_lock);
+            due_tail++;
+            portEXIT_CRITICAL(&stream_lock);
+        }
+
+        portENTER_CRITICAL(&stream_lock);
+        bool finished = drained;
+        int32_t request = requested_clip;
+        requested_clip = -1;
+        if (request >= 0 && clip != NULL && !finished)
+        {
+            stats.skipped++;
+        }
+        portEXIT_CRITICAL(&stream_lock);
+
+        if (finished)
+        {
+            stop();
+        }
+        if (request >= 0 && clip == NULL)
+        {
+            start(request);
+        }
+    }
+}
+
+static void beacon_phase(uint8_t phase, bool lit)
+{
+    // the horn sounds with the first light of every CONFIG_FOGHORN_PERIODS-th period of the character
+    if (phase != 0)
+    {
+        return;
+    }
+    if (periods++ % CONFIG_FOGHORN_PERIODS == 0)
+    {
+        foghorn_play(CONFIG_FOGHORN_CLIP);
+    }
+}
+
+static esp_err_t map_clip_set(const esp_partition_t *partition)
+{
+#if CONFIG_IDF_TARGET_LINUX
+    // the emulated flash of the host build cannot be mapped, it gets a copy instead
+    uint8_t *copy = malloc(partition->size);
+    if (copy == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t ret = esp_partition_read(partition, 0, copy, partition->size);
+    if (ret != ESP_OK)
+    {
+        free(copy);
+        return ret;
+    }
+    clip_set = copy;
+    return ESP_OK;
+#else
+    esp_partition_mmap_handle_t handle;
+    const void *mapped;
+    esp_err_t ret = esp_partition_mmap(partition, 0, partition->size, ESP_PARTITION_MMAP_DATA, &mapped, &handle);
+    if (ret == ESP_OK)
+    {
+        clip_set = mapped;
+    }
+    return ret;
+#endif
+}
+
+static bool clip_set_valid(size_t partition_size)
+{
+    const foghorn_set_header_t *header = (const foghorn_set_header_t *)clip_set;
+    if (header->magic != FOGHORN_MAGIC)
+    {
+        ESP_LOGW(TAG, "No clip set in the partition");
+        return false;
+    }
+    if (header->clip_count == 0 || header->clip_count > FOGHORN_MAX_CLIPS || header->sample_rate_hz == 0 ||
+        sizeof(*header) + header->clip_count * sizeof(foghorn_clip_t) > partition_size)
+    {
+        ESP_LOGE(TAG, "Invalid clip set header");
+        return false;
+    }
+
+    const foghorn_clip_t *table = (const foghorn_clip_t *)(header + 1);
+    for (uint16_t i = 0; i < header->clip_count; i++)
+    {
+        const foghorn_clip_t *entry = &table[i];
+        uint64_t needed =
+            entry->format == FOGHORN_FORMAT_IMA_ADPCM ? (entry->samples + 1ull) / 2 : entry->samples * 2ull;
+        if ((entry->format != FOGHORN_FORMAT_PCM16 && entry->format != FOGHORN_FORMAT_IMA_ADPCM) ||
+            entry->step_index > 88 || entry->size < needed || entry->offset > partition_size ||
+            entry->size > partition_size - entry->offset ||
+            (entry->format == FOGHORN_FORMAT_PCM16 && entry->offset % sizeof(int16_t) != 0))
+        {
+            ESP_LOGE(TAG, "Invalid clip %u", i);
+            return false;
+        }
+    }
+
+    clips = table;
+    clip_count = header->clip_count;
+    sample_rate_hz = header->sample_rate_hz;
+    return true;
+}
+
+esp_err_t foghorn_init(void)
+{
+    if (channel != NULL)
+    {
+        return ESP_OK;
+    }
+
+    const esp_partition_t *partition =
+        esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, FOGHORN_PARTITION_LABEL);
+    if (partition == NULL)
+    {
+        ESP_LOGW(TAG, "No foghorn partition");
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_err_t ret = map_clip_set(partition);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to map the clip set: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    if (!clip_set_valid(partition->size))
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    if (task_handle == NULL)
+    {
+        // refills a buffer within one buffer time (15 ms), but nothing of the lights waits for it
+        task_handle = xTaskCreateStaticPinnedToCore(foghorn_task, "foghorn", FOGHORN_TASK_STACK_SIZE, NULL, 8,
+                                                    task_stack, &task_buffer, LIGHT_BLE_CORE);
+    }
+
+    i2s_chan_config_t channel_config = I2S_CHANNEL_DEFAULT_CONFIG(I2S_NUM_AUTO, I2S_ROLE_MASTER);
+    channel_config.dma_desc_num = FOGHORN_DMA_BUFFERS;
+    channel_config.dma_frame_num = FOGHORN_DMA_FRAMES;
+    channel_config.auto_clear_before_cb = true;
+    ret = i2s_new_channel(&channel_config, &channel, NULL);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to create I2S channel: %s", esp_err_to_name(ret));
+        channel = NULL;
+        goto exit;
+    }
+
+    i2s_std_config_t std_config = {
+        .clk_cfg = I2S_STD_CLK_DEFAULT_CONFIG(sample_rate_hz),
+        .slot_cfg = I2S_STD_PHILIPS_SLOT_DEFAULT_CONFIG(I2S_DATA_BIT_WIDTH_16BIT, I2S_SLOT_MODE_MONO),
+        .gpio_cfg =
+            {
+                .mclk = I2S_GPIO_UNUSED,
+                .bclk = CONFIG_FOGHORN_BCLK_PIN,
+                .ws = CONFIG_FOGHORN_WS_PIN,
+                .dout = CONFIG_FOGHORN_DOUT_PIN,
+                .din = I2S_GPIO_UNUSED,
+            },
+    };
+    ret = i2s_channel_init_std_mode(channel, &std_config);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to initialize I2S channel: %s", esp_err_to_name(ret));
+        goto cleanupChannel;
+    }
+
+    i2s_event_callbacks_t callbacks = {.on_sent = foghorn_sent_callback};
+    ret = i2s_channel_register_event_callback(channel, &callbacks, NULL);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to register I2S callbacks: %s", esp_err_to_name(ret));
+        goto cleanupChannel;
+    }
+
+    ret = beacon_add_phase_listener(beacon_phase);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to listen to the beacon: %s", esp_err_to_name(ret));
+        goto cleanupChannel;
+    }
+
+    ESP_LOGI(TAG, "Foghorn with %u clips at %" PRIu32 " Hz, clip %d every %d beacon periods", clip_count,
+             sample_rate_hz, CONFIG_FOGHORN_CLIP, CONFIG_FOGHORN_PERIODS);
+    goto exit;
+
+cleanupChannel:
+    i2s_del_channel(channel);
+    channel = NULL;
+exit:
+    return ret;
+}
+
+esp_err_t foghorn_play(uint32_t index)
+{
+    if (channel == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (index >= clip_count)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&stream_lock);
+    requested_clip = index;
+    portEXIT_CRITICAL(&stream_lock);
+    xTaskNotifyGive(task_handle);
+    return ESP_OK;
+}
+
+foghorn_stats_t foghorn_get_stats(void)
+{
+    portENTER_CRITICAL(&stream_lock);
+    foghorn_stats_t copy = stats;
+    portEXIT_CRITICAL(&stream_lock);
+    return copy;
+}
+
+// printf instead of ESP_LOG, so the output survives release builds with logging compiled out
+static int foghorn_command(int argc, char **argv)
+{
+    if (channel == NULL)
+    {
+        printf("no clip set\n");
+        return 1;
+    }
+
+    if (argc == 3 && strcmp(argv[1], "play") == 0)
+    {
+        esp_err_t ret = foghorn_play(strtoul(argv[2], NULL, 10));
+        if (ret != ESP_OK)
+        {
+            printf("cannot play clip %s: %s\n", argv[2], esp_err_to_name(ret));
+            return 1;
+        }
+        return 0;
+    }
+    if (argc != 1)
+    {
+        printf("usage: foghorn [play <clip>]\n");
+        return 1;
+    }
+
+    for (uint16_t i = 0; i < clip_count; i++)
+    {
+        printf("clip %u: %s, %" PRIu32 " ms, %" PRIu32 " bytes\n", i,
+               clips[i].format == FOGHORN_FORMAT_IMA_ADPCM ? "ima adpcm" : "pcm16",
+               (uint32_t)((uint64_t)clips[i].samples * 1000 / sample_rate_hz), clips[i].size);
+    }
+    foghorn_stats_t current = foghorn_get_stats();
+    printf("plays %" PRIu32 ", skipped %" PRIu32 ", underruns %" PRIu32 "\n", current.plays, current.skipped,
+           current.underruns);
+    return 0;
+}
+
+esp_err_t foghorn_register_console_command(void)
+{
+    const esp_console_cmd_t command = {
+        .command = "foghorn",
+        .help = "List the foghorn clips and playback counters; 'foghorn play <clip>' plays one",
+        .func = foghorn_command,
+    };
+    return esp_console_cmd_register(&command);
+}
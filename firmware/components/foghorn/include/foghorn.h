@@ -0,0 +1,52 @@
+#pragma once
+
+#include "esp_err.h"
+
+#include <stdint.h>
+
+typedef struct
+{
+    uint32_t plays;     ///< clips played to the end
+    uint32_t skipped;   ///< requests while a clip was still playing
+    uint32_t underruns; ///< DMA buffers sent before the decoder refilled them, heard as a gap
+} foghorn_stats_t;
+
+/**
+ * @brief Maps the clip set in the "foghorn" partition and sounds CONFIG_FOGHORN_CLIP with the beacon.
+ *
+ * The clip starts with the first light phase of every CONFIG_FOGHORN_PERIODS-th period of the beacon character.
+ * Needs beacon_init(). Clip sets are built and flashed with components/foghorn/tools/foghorn_clips.py.
+ *
+ * @return
+ *     - ESP_OK: Foghorn ready.
+ *     - ESP_ERR_NOT_FOUND: No partition or no valid clip set in it; the foghorn stays silent.
+ *     - Error codes of esp_partition_mmap() or the I2S driver.
+ */
+esp_err_t foghorn_init(void);
+
+/**
+ * @brief Plays a clip of the set, unless one is playing already.
+ *
+ * Returns right away; the sound starts after the I2S DMA buffers went round once (about 60 ms).
+ *
+ * @return
+ *     - ESP_OK: Clip requested.
+ *     - ESP_ERR_INVALID_ARG: The set has no such clip.
+ *     - ESP_ERR_INVALID_STATE: foghorn_init() did not succeed.
+ */
+esp_err_t foghorn_play(uint32_t index);
+
+/**
+ * @brief Returns the playback counters.
+ */
+foghorn_stats_t foghorn_get_stats(void);
+
+/**
+ * @brief Registers the "foghorn" console command, which lists the clips and the counters; "foghorn play <clip>"
+ * plays one.
+ *
+ * @return
+ *     - ESP_OK: Command registered.
+ *     - Error codes of esp_console_cmd_register().
+ */
+esp_err_t foghorn_register_console_command(void);
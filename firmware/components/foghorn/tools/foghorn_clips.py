@@ -0,0 +1,235 @@
+#!/usr/bin/env python3
+"""Builds clip sets for the foghorn partition and checks the foghorn in a simulation timeline.
+
+"pack" converts 16-bit mono WAV files of one sample rate into a clip set, IMA ADPCM unless --pcm is given;
+"horn" synthesizes a two-tone diaphone blast as a one-clip set. Flash the set with
+
+    parttool.py write_partition --partition-name foghorn --input foghorn.bin
+
+or hand it to the host build with LIGHTHOUSE_PARTITION_IMAGE=foghorn:foghorn.bin. "check" compares the I2S
+output in the timeline with the beacon: every clip has to start within one DMA ring after a light phase and play
+without a gap.
+
+    python foghorn_clips.py horn foghorn.bin
+    LIGHTHOUSE_SIM_VIRTUAL_TIME=1 LIGHTHOUSE_SIM_DURATION_MS=60000 LIGHTHOUSE_SIM_OUTPUT=foghorn.txt \\
+        LIGHTHOUSE_GPIO_SCRIPT=components/sim/tools/beacon_on.gpio \\
+        LIGHTHOUSE_PARTITION_IMAGE=foghorn:foghorn.bin build-linux/Lighthouse.elf
+    python foghorn_clips.py check foghorn.bin foghorn.txt
+"""
+
+import argparse
+import math
+import re
+import struct
+import sys
+import wave
+
+# the layout foghorn.c reads: header, clip table, sample data
+MAGIC = 0x31474f46  # "FOG1"
+HEADER = struct.Struct('<IHHI')
+CLIP = struct.Struct('<IIIBBh')
+FORMAT_PCM16 = 0
+FORMAT_IMA_ADPCM = 1
+MAX_CLIPS = 16
+PARTITION_SIZE = 64 * 1024
+
+# FOGHORN_DMA_FRAMES, the samples of one I2S buffer
+DMA_FRAMES = 240
+
+STEPS = [
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97,
+    107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+    876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871,
+    5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623,
+    27086, 29794, 32767,
+]
+INDEX_STEPS = [-1, -1, -1, -1, 2, 4, 6, 8]
+
+LINE = re.compile(r'^(\d+)\.(\d{3}) (\S+) (.*)$')
+STOP = re.compile(r'stop (\d+) buffers, (\d+) with sound, (\d+) gaps')
+
+
+def ima_step(predictor, index, nibble):
+    """One sample of the decoder in adpcm.c."""
+    step = STEPS[index]
+    diff = step >> 3
+    if nibble & 4:
+        diff += step
+    if nibble & 2:
+        diff += step >> 1
+    if nibble & 1:
+        diff += step >> 2
+    predictor = max(-32768, min(32767, predictor - diff if nibble & 8 else predictor + diff))
+    index = max(0, min(88, index + INDEX_STEPS[nibble & 7]))
+    return predictor, index
+
+
+def ima_encode(samples):
+    """Returns the data and the initial decoder state; the encoder tracks the decoder, so errors do not add up."""
+    predictor, index = samples[0] if samples else 0, 0
+    initial = (predictor, index)
+    nibbles = []
+    for sample in samples:
+        diff = sample - predictor
+        nibble = 8 if diff < 0 else 0
+        diff = abs(diff)
+        step = STEPS[index]
+        for bit in (4, 2, 1):
+            if diff >= step:
+                nibble |= bit
+                diff -= step
+            step >>= 1
+        predictor, index = ima_step(predictor, index, nibble)
+        nibbles.append(nibble)
+    if len(nibbles) % 2:
+        nibbles.append(0)
+    data = bytes(nibbles[i] | nibbles[i + 1] << 4 for i in range(0, len(nibbles), 2))
+    return data, initial
+
+
+def build(clips, rate, pcm):
+    """clips: lists of 16-bit samples."""
+    if not clips or len(clips) > MAX_CLIPS:
+        raise ValueError('a clip set has 1 to %d clips' % MAX_CLIPS)
+    table = []
+    data = b''
+    offset = HEADER.size + CLIP.size * len(clips)
+    for samples in clips:
+        if pcm:
+            encoded = struct.pack('<%dh' % len(samples), *samples)
+            entry = (FORMAT_PCM16, 0, 0)
+        else:
+            encoded, (predictor, index) = ima_encode(samples)
+            entry = (FORMAT_IMA_ADPCM, index, predictor)
+        padding = -(offset + len(data)) % 4
+        data += b'\0' * padding
+        table.append(CLIP.pack(offset + len(data), len(encoded), len(samples), *entry))
+        data += encoded
+    image = HEADER.pack(MAGIC, len(clips), 0, rate) + b''.join(table) + data
+    if len(image) > PARTITION_SIZE:
+        raise ValueError('clip set of %d bytes does not fit the %d bytes of the partition' %
+                         (len(image), PARTITION_SIZE))
+    return image
+
+
+def read_set(path):
+    """Returns the sample rate and the table entries of a clip set."""
+    with open(path, 'rb') as f:
+        image = f.read()
+    magic, count, _, rate = HEADER.unpack_from(image)
+    if magic != MAGIC:
+        raise ValueError('%s is no clip set' % path)
+    return rate, [CLIP.unpack_from(image, HEADER.size + i * CLIP.size) for i in range(count)]
+
+
+def write(path, image, clip_count, rate):
+    with open(path, 'wb') as f:
+        f.write(image)
+    print('%d clips at %d Hz, %d of %d bytes' % (clip_count, rate, len(image), PARTITION_SIZE))
+    return 0
+
+
+def pack(args):
+    clips = []
+    rate = None
+    for path in args.wav:
+        with wave.open(path, 'rb') as f:
+            if f.getnchannels() != 1 or f.getsampwidth() != 2:
+                raise ValueError('%s: only 16-bit mono is supported' % path)
+            if rate is not None and f.getframerate() != rate:
+                raise ValueError('%s: all clips need the sample rate %d Hz' % (path, rate))
+            rate = f.getframerate()
+            frames = f.readframes(f.getnframes())
+        clips.append(list(struct.unpack('<%dh' % (len(frames) // 2), frames)))
+    return write(args.clips, build(clips, rate, args.pcm), len(clips), rate)
+
+
+def horn(args):
+    # a diaphone: a low tone with strong harmonics, a grunt a third lower at the end, swelling in and dying away
+    samples = []
+    length = int(args.rate * args.seconds)
+    attack = int(args.rate * 0.15)
+    release = int(args.rate * 0.4)
+    phase = 0.0
+    for n in range(length):
+        t = n / args.rate
+        frequency = 180.0 if n < length - release else 150.0
+        phase += 2 * math.pi * frequency / args.rate
+        tone = sum(math.sin(k * phase) / k for k in range(1, 6))
+        # never quite silent, so a silent buffer in the middle of the sound is always a gap
+        envelope = 0.05 + 0.95 * min(1.0, n / attack, (length - n) / release)
+        samples.append(int(12000 * envelope * tone * (1 + 0.1 * math.sin(2 * math.pi * 4 * t))))
+    samples = [max(-32768, min(32767, s)) for s in samples]
+    return write(args.clips, build([samples], args.rate, False), 1, args.rate)
+
+
+def check(args):
+    rate, table = read_set(args.clips)
+    # the beacon only ever plays CONFIG_FOGHORN_CLIP
+    samples = table[args.clip][2]
+    buffers = (samples + DMA_FRAMES - 1) // DMA_FRAMES
+    max_delay_ms = args.tolerance_ms
+
+    errors = []
+    lit = False
+    light_ons = []
+    horns = 0
+    for line in args.timeline:
+        match = LINE.match(line.rstrip('\n'))
+        if match is None:
+            continue
+        time_ms = int(match.group(1)) + int(match.group(2)) / 1000
+        source, text = match.group(3), match.group(4)
+
+        if source == 'strip':
+            values = [int(v) for pixel in text.split()[2:] for v in pixel.split(',')]
+            if any(values) and not lit:
+                light_ons.append(time_ms)
+            lit = any(values)
+        elif source == 'i2s' and text == 'sound':
+            horns += 1
+            delay_ms = time_ms - light_ons[-1] if light_ons else None
+            if delay_ms is None or delay_ms > max_delay_ms:
+                errors.append('sound at %.3f ms, %s' %
+                              (time_ms, 'before any light' if delay_ms is None else '%.3f ms after the light' %
+                               delay_ms))
+        elif source == 'i2s' and STOP.match(text):
+            _, sounding, gaps = (int(v) for v in STOP.match(text).groups())
+            if gaps:
+                errors.append('%d silent buffers in the sound stopped at %.3f ms' % (gaps, time_ms))
+            if sounding != buffers:
+                errors.append('%d buffers with sound stopped at %.3f ms, the clip has %d' %
+                              (sounding, time_ms, buffers))
+
+    print('%d foghorn blasts for %d beacon periods, %d buffers each at %d Hz' %
+          (horns, len(light_ons), buffers, rate))
+    if horns == 0:
+        errors.append('the foghorn never sounded')
+    for error in errors:
+        print(error, file=sys.stderr)
+    return 1 if errors else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    commands = parser.add_subparsers(dest='command', required=True)
+    parser_pack = commands.add_parser('pack', help='build a clip set from 16-bit mono WAV files')
+    parser_pack.add_argument('clips')
+    parser_pack.add_argument('wav', nargs='+')
+    parser_pack.add_argument('--pcm', action='store_true', help='store the samples uncompressed')
+    parser_horn = commands.add_parser('horn', help='build a clip set with a synthesized foghorn')
+    parser_horn.add_argument('clips')
+    parser_horn.add_argument('--rate', type=int, default=16000, help='sample rate in Hz')
+    parser_horn.add_argument('--seconds', type=float, default=2.0)
+    parser_check = commands.add_parser('check', help='check the foghorn in a simulation timeline')
+    parser_check.add_argument('clips')
+    parser_check.add_argument('timeline', type=argparse.FileType('r'))
+    parser_check.add_argument('--clip', type=int, default=0, help='CONFIG_FOGHORN_CLIP')
+    parser_check.add_argument('--tolerance-ms', type=float, default=100.0,
+                              help='allowed time from the light phase until the sound')
+    args = parser.parse_args()
+    return {'pack': pack, 'horn': horn, 'check': check}[args.command](args)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "esp_err.h"
+
+#include <stdint.h>
+
+/// Buckets per power of two; the upper bound of a bucket is at most 25 % above its lower bound
+#define LATENCY_SUB_BUCKETS 4
+#define LATENCY_BUCKETS (32 * LATENCY_SUB_BUCKETS)
+
+/**
+ * @brief Paths from a cause to the light output that are measured end to end.
+ */
+typedef enum
+{
+    LATENCY_PATH_TIMER = 0, ///< beacon gptimer alarm -> strip frame sent
+    LATENCY_PATH_TOUCH,     ///< touch edge (touch_triggered_at()) -> light output changed
+    LATENCY_PATH_BLE,       ///< GATT write on the light service -> light output changed
+    LATENCY_PATH_TRACK,     ///< track signal accessory packet received -> light output changed
+    LATENCY_PATH_COUNT,
+} latency_path_t;
+
+/**
+ * @brief Start times (vclock_now_us()) of the paths a light output completes; 0 where a path is not involved.
+ */
+typedef struct
+{
+    int64_t start_us[LATENCY_PATH_COUNT];
+} latency_marks_t;
+
+typedef struct
+{
+    uint32_t count;
+    uint32_t p50_us; ///< upper bound of the bucket, so at most 25 % high
+    uint32_t p99_us;
+    uint32_t max_us;
+} latency_summary_t;
+
+/**
+ * @brief Adds one measurement to the histogram of a path.
+ *
+ * Lock-free; the histograms have a fixed size, nothing is allocated.
+ */
+void latency_record(latency_path_t path, uint32_t latency_us);
+
+/**
+ * @brief Starts a measurement that is completed by a later light output, e.g. when an input arrives.
+ *
+ * If the path already has a pending start, the earlier one is kept: inputs that are coalesced into one
+ * light change are measured from the first of them.
+ */
+void latency_begin(latency_path_t path, int64_t start_us);
+
+/**
+ * @brief Moves all pending starts into `marks` (merged with what is there already) and clears them.
+ */
+void latency_take_pending(latency_marks_t *marks);
+
+/**
+ * @brief Records every path in `marks` as ending at `end_us`.
+ */
+void latency_complete(const latency_marks_t *marks, int64_t end_us);
+
+/**
+ * @brief Merges the starts of `from` into `into`, keeping the earlier start of each path.
+ */
+void latency_merge(latency_marks_t *into, const latency_marks_t *from);
+
+/**
+ * @brief Computes count, percentiles and maximum of a path.
+ */
+latency_summary_t latency_get_summary(latency_path_t path);
+
+/**
+ * @brief Copies the LATENCY_BUCKETS counters of a path; see latency_bucket_floor_us() for the bounds.
+ */
+void latency_get_buckets(latency_path_t path, uint32_t buckets[LATENCY_BUCKETS]);
+
+/**
+ * @brief Lowest latency that falls into a bucket.
+ */
+uint32_t latency_bucket_floor_us(uint32_t bucket);
+
+/**
+ * @brief Clears all histograms, e.g. before a measurement run.
+ */
+void latency_reset(void);
+
+/**
+ * @brief Registers the "latency" console command, which prints or resets the histograms.
+ */
+esp_err_t latency_register_console_command(void);
@@ -0,0 +1,224 @@
+#include "latency.h"
+
+#include "esp_console.h"
+#include "freertos/FreeRTOS.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Log-linear buckets: below 4 us one bucket per microsecond, above that LATENCY_SUB_BUCKETS per power of two.
+ * Four paths of 128 counters each are 2 KB, however long the firmware runs; recording is a handful of
+ * atomic operations and safe on any core.
+ */
+typedef struct
+{
+    uint32_t buckets[LATENCY_BUCKETS];
+    uint32_t max_us;
+} latency_histogram_t;
+
+static latency_histogram_t histograms[LATENCY_PATH_COUNT];
+
+static portMUX_TYPE pending_lock = portMUX_INITIALIZER_UNLOCKED;
+static latency_marks_t pending;
+
+static const char *const path_names[LATENCY_PATH_COUNT] = {
+    [LATENCY_PATH_TIMER] = "timer",
+    [LATENCY_PATH_TOUCH] = "touch",
+    [LATENCY_PATH_BLE] = "ble",
+    [LATENCY_PATH_TRACK] = "track",
+};
+
+static uint32_t bucket_of(uint32_t latency_us)
+{
+    if (latency_us < LATENCY_SUB_BUCKETS)
+    {
+        return latency_us;
+    }
+    uint32_t msb = 31 - __builtin_clz(latency_us);
+    uint32_t sub = (latency_us >> (msb - 2)) & (LATENCY_SUB_BUCKETS - 1);
+    return (msb - 1) * LATENCY_SUB_BUCKETS + sub;
+}
+
+uint32_t latency_bucket_floor_us(uint32_t bucket)
+{
+    if (bucket < LATENCY_SUB_BUCKETS)
+    {
+        return bucket;
+    }
+    uint32_t msb = bucket / LATENCY_SUB_BUCKETS + 1;
+    uint32_t sub = bucket % LATENCY_SUB_BUCKETS;
+    return msb > 31 ? UINT32_MAX : (LATENCY_SUB_BUCKETS + sub) << (msb - 2);
+}
+
+static uint32_t bucket_ceiling_us(uint32_t bucket)
+{
+    uint32_t next = latency_bucket_floor_us(bucket + 1);
+    return next == UINT32_MAX ? UINT32_MAX : next - 1;
+}
+
+void latency_record(latency_path_t path, uint32_t latency_us)
+{
+    if (path >= LATENCY_PATH_COUNT)
+    {
+        return;
+    }
+
+    latency_histogram_t *histogram = &histograms[path];
+    __atomic_fetch_add(&histogram->buckets[bucket_of(latency_us)], 1, __ATOMIC_RELAXED);
+
+    uint32_t current = __atomic_load_n(&histogram->max_us, __ATOMIC_RELAXED);
+    while (latency_us > current && !__atomic_compare_exchange_n(&histogram->max_us, &current, latency_us, true,
+                                                                __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+void latency_merge(latency_marks_t *into, const latency_marks_t *from)
+{
+    for (int i = 0; i < LATENCY_PATH_COUNT; i++)
+    {
+        if (from->start_us[i] != 0 && (into->start_us[i] == 0 || from->start_us[i] < into->start_us[i]))
+        {
+            into->start_us[i] = from->start_us[i];
+        }
+    }
+}
+
+void latency_begin(latency_path_t path, int64_t start_us)
+{
+    if (path >= LATENCY_PATH_COUNT || start_us == 0)
+    {
+        return;
+    }
+
+    portENTER_CRITICAL_SAFE(&pending_lock);
+    if (pending.start_us[path] == 0)
+    {
+        pending.start_us[path] = start_us;
+    }
+    portEXIT_CRITICAL_SAFE(&pending_lock);
+}
+
+void latency_take_pending(latency_marks_t *marks)
+{
+    portENTER_CRITICAL(&pending_lock);
+    latency_merge(marks, &pending);
+    memset(&pending, 0, sizeof(pending));
+    portEXIT_CRITICAL(&pending_lock);
+}
+
+void latency_complete(const latency_marks_t *marks, int64_t end_us)
+{
+    for (int i = 0; i < LATENCY_PATH_COUNT; i++)
+    {
+        if (marks->start_us[i] != 0)
+        {
+            int64_t latency_us = end_us - marks->start_us[i];
+            latency_record(i, latency_us < 0 ? 0 : latency_us > UINT32_MAX ? UINT32_MAX : (uint32_t)latency_us);
+        }
+    }
+}
+
+void latency_get_buckets(latency_path_t path, uint32_t buckets[LATENCY_BUCKETS])
+{
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        buckets[i] = __atomic_load_n(&histograms[path].buckets[i], __ATOMIC_RELAXED);
+    }
+}
+
+latency_summary_t latency_get_summary(latency_path_t path)
+{
+    uint32_t buckets[LATENCY_BUCKETS];
+    latency_get_buckets(path, buckets);
+
+    latency_summary_t summary = {.max_us = __atomic_load_n(&histograms[path].max_us, __ATOMIC_RELAXED)};
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        summary.count += buckets[i];
+    }
+
+    uint64_t p50_rank = ((uint64_t)summary.count * 50 + 99) / 100;
+    uint64_t p99_rank = ((uint64_t)summary.count * 99 + 99) / 100;
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS && summary.count > 0; i++)
+    {
+        if (buckets[i] == 0)
+        {
+            continue;
+        }
+        seen += buckets[i];
+        uint32_t ceiling = bucket_ceiling_us(i) < summary.max_us ? bucket_ceiling_us(i) : summary.max_us;
+        if (summary.p50_us == 0 && seen >= p50_rank)
+        {
+            summary.p50_us = ceiling;
+        }
+        if (seen >= p99_rank)
+        {
+            summary.p99_us = ceiling;
+            break;
+        }
+    }
+    return summary;
+}
+
+void latency_reset(void)
+{
+    for (int path = 0; path < LATENCY_PATH_COUNT; path++)
+    {
+        latency_histogram_t *histogram = &histograms[path];
+        for (int i = 0; i < LATENCY_BUCKETS; i++)
+        {
+            __atomic_store_n(&histogram->buckets[i], 0, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&histogram->max_us, 0, __ATOMIC_RELAXED);
+    }
+}
+
+// printf instead of ESP_LOG, so the output survives release builds with logging compiled out
+static int latency_command(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "reset") == 0)
+    {
+        latency_reset();
+        return 0;
+    }
+    bool verbose = argc > 1 && strcmp(argv[1], "buckets") == 0;
+
+    printf("%-6s %8s %10s %10s %10s\n", "path", "count", "p50 us", "p99 us", "max us");
+    for (int path = 0; path < LATENCY_PATH_COUNT; path++)
+    {
+        latency_summary_t summary = latency_get_summary(path);
+        printf("%-6s %8" PRIu32 " %10" PRIu32 " %10" PRIu32 " %10" PRIu32 "\n", path_names[path], summary.count,
+               summary.p50_us, summary.p99_us, summary.max_us);
+
+        if (verbose)
+        {
+            // one line per used bucket, "<floor us> <count>", to diff two firmware versions on the host
+            uint32_t buckets[LATENCY_BUCKETS];
+            latency_get_buckets(path, buckets);
+            for (int i = 0; i < LATENCY_BUCKETS; i++)
+            {
+                if (buckets[i] > 0)
+                {
+                    printf("  %s %" PRIu32 " %" PRIu32 "\n", path_names[path], latency_bucket_floor_us(i), buckets[i]);
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+esp_err_t latency_register_console_command(void)
+{
+    const esp_console_cmd_t command = {
+        .command = "latency",
+        .help = "Show end-to-end latencies of the light paths; \"latency buckets\" adds the histograms, "
+                "\"latency reset\" clears them",
+        .func = latency_command,
+    };
+    return esp_console_cmd_register(&command);
+}
@@ -1,25 +1,98 @@
 #include "beacon.h"
+#include "compositor.h"
 
 #include "driver/gptimer.h"
+#include "esp_console.h"
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
 #include "led_strip.h"
 #include "light.h"
 #include "persistence.h"
 #include "sdkconfig.h"
-#include "semaphore.h"
+#include "trace.h"
+#include "vclock.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 static const char *TAG = "beacon";
 
+#define BEACON_TASK_STACK_SIZE 4096
+
 static SemaphoreHandle_t timer_semaphore;
+static StaticSemaphore_t timer_semaphore_buffer;
+static StackType_t beacon_task_stack[BEACON_TASK_STACK_SIZE];
+static StaticTask_t beacon_task_buffer;
 gptimer_handle_t gptimer = NULL;
 
-static const uint32_t value = 200;
+#define BEACON_MAX_PHASES 4
+#define BEACON_MAX_PHASE_LISTENERS 2
+#define BEACON_COLOR ((color_t){.red = 0, .green = 255, .blue = 0})
+
+typedef struct
+{
+    uint8_t phase_count;
+    uint16_t phase_ms[BEACON_MAX_PHASES]; ///< alternating light / dark durations, starting with light
+} beacon_character_def_t;
+
+static const DRAM_ATTR beacon_character_def_t characters[BEACON_CHARACTER_COUNT] = {
+    [BEACON_CHARACTER_ISO_4S] = {.phase_count = 2, .phase_ms = {2000, 2000}},
+    [BEACON_CHARACTER_FL_3S] = {.phase_count = 2, .phase_ms = {300, 2700}},
+    [BEACON_CHARACTER_OC_6S] = {.phase_count = 2, .phase_ms = {4500, 1500}},
+    [BEACON_CHARACTER_FL2_9S] = {.phase_count = 4, .phase_ms = {400, 800, 400, 7400}},
+};
+
+static volatile beacon_character_t character = BEACON_CHARACTER_ISO_4S;
+static volatile uint8_t phase = 0;
+static volatile int64_t alarm_at_us; ///< start of the timer latency path of the phase change
+static uint8_t brightness = 200;
+static bool running = false;
+static beacon_phase_listener_t phase_listeners[BEACON_MAX_PHASE_LISTENERS];
+
+/*
+ * The timer interrupt is IRAM-safe (CONFIG_GPTIMER_ISR_IRAM_SAFE, CONFIG_GPTIMER_CTRL_FUNC_IN_IRAM), so it
+ * keeps its time while an NVS commit or a bond write has the flash cache disabled. Everything it touches
+ * lives in IRAM or DRAM; the timing below tells whether that holds.
+ */
+static portMUX_TYPE timing_lock = portMUX_INITIALIZER_UNLOCKED;
+static int64_t edge_due_us; ///< when the next phase change is due
+static beacon_timing_t timing;
 
 static bool IRAM_ATTR beacon_timer_callback(gptimer_handle_t timer, const gptimer_alarm_event_data_t *edata,
                                             void *userCtx)
 {
+    int64_t now_us = vclock_now_us();
+    alarm_at_us = now_us;
+    const beacon_character_def_t *def = &characters[character];
+    phase = (phase + 1) % def->phase_count;
+
+    int64_t late_us = now_us - edge_due_us;
+    portENTER_CRITICAL_ISR(&timing_lock);
+    timing.edges++;
+    if (late_us > BEACON_EDGE_DEADLINE_US)
+    {
+        timing.late_edges++;
+    }
+    if (late_us > timing.max_late_us)
+    {
+        timing.max_late_us = late_us;
+    }
+    portEXIT_CRITICAL_ISR(&timing_lock);
+    edge_due_us += def->phase_ms[phase] * 1000;
+
+    // the counter was reloaded to 0, so the next alarm is simply the duration of the new phase
+    gptimer_alarm_config_t alarm_config = {
+        .alarm_count = def->phase_ms[phase] * 1000ULL,
+        .reload_count = 0,
+        .flags.auto_reload_on_alarm = true,
+    };
+    gptimer_set_alarm_action(timer, &alarm_config);
+    TRACE("beacon phase %u (%u ms)", phase, def->phase_ms[phase]);
+
     BaseType_t high_task_wakeup = pdFALSE;
     xSemaphoreGiveFromISR(timer_semaphore, &high_task_wakeup);
     if (high_task_wakeup)
@@ -29,15 +102,21 @@ static bool IRAM_ATTR beacon_timer_callback(gptimer_handle_t timer, const gptime
     return true;
 }
 
-static void led_refresh(uint32_t brightness)
+static void led_refresh(uint8_t level, const latency_marks_t *marks)
 {
-    LedMatrix_t led_matrix = get_led_matrix();
+    compositor_fill(COMPOSITOR_LAYER_BEACON, color_to_linear(BEACON_COLOR, level));
+    compositor_render(marks);
+}
 
-    for (uint32_t i = 0; i < led_matrix.size; i++)
+static void notify_phase(uint8_t current_phase, bool lit)
+{
+    for (int i = 0; i < BEACON_MAX_PHASE_LISTENERS; i++)
     {
-        led_strip_set_pixel(led_matrix.led_strip, i, 0, brightness, 0);
+        if (phase_listeners[i] != NULL)
+        {
+            phase_listeners[i](current_phase, lit);
+        }
     }
-    led_strip_refresh(led_matrix.led_strip);
 }
 
 static void beacon_timer_event_task(void *arg)
@@ -46,11 +125,13 @@ static void beacon_timer_event_task(void *arg)
     {
         if (xSemaphoreTake(timer_semaphore, portMAX_DELAY))
         {
-
-            static bool level = false;
-            level = !level;
-            led_refresh(level ? value : 0);
-            ESP_LOGD(TAG, "Timer Event, LED now %s", level ? "ON" : "OFF");
+            // even phases are light, odd phases are dark
+            uint8_t current_phase = phase;
+            bool level = (current_phase % 2) == 0;
+            latency_marks_t marks = {.start_us[LATENCY_PATH_TIMER] = alarm_at_us};
+            led_refresh(level ? brightness : 0, &marks);
+            TRACE("beacon led %u", level);
+            notify_phase(current_phase, level);
         }
     }
 }
@@ -76,19 +157,39 @@ esp_err_t beacon_start(void)
         return beacon_stop();
     }
 
+    // every character starts with its first light phase
+    phase = 0;
+    gptimer_alarm_config_t alarm_config = {
+        .alarm_count = characters[character].phase_ms[0] * 1000ULL,
+        .reload_count = 0,
+        .flags.auto_reload_on_alarm = true,
+    };
+    ret = gptimer_set_alarm_action(gptimer, &alarm_config);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to set gptimer alarm action: %s", esp_err_to_name(ret));
+        return beacon_stop();
+    }
+    led_refresh(brightness, NULL);
+
+    edge_due_us = vclock_now_us() + characters[character].phase_ms[0] * 1000;
     ret = gptimer_start(gptimer);
     if (ret != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to start gptimer: %s", esp_err_to_name(ret));
+        return ret;
     }
 
     ESP_LOGI(TAG, "GPTimer started.");
+    running = true;
+    light_state_changed();
+    notify_phase(0, true);
     return ret;
 }
 
 esp_err_t beacon_stop(void)
 {
-    led_refresh(0);
+    led_refresh(0, NULL);
     if (gptimer == NULL)
     {
         ESP_LOGE(TAG, "GPTimer not initialized");
@@ -107,14 +208,151 @@ esp_err_t beacon_stop(void)
         ESP_LOGE(TAG, "Failed to enable gptimer: %s", esp_err_to_name(ret));
     }
 
+    if (running)
+    {
+        running = false;
+        light_state_changed();
+    }
     return ret;
 }
 
+bool beacon_is_running(void)
+{
+    return running;
+}
+
+beacon_character_t beacon_get_character(void)
+{
+    return character;
+}
+
+esp_err_t beacon_set_character(beacon_character_t new_character)
+{
+    if (new_character >= BEACON_CHARACTER_COUNT)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (new_character == character)
+    {
+        return ESP_OK;
+    }
+
+    // takes effect with the next phase change
+    character = new_character;
+    light_state_changed();
+    return ESP_OK;
+}
+
+uint8_t beacon_get_brightness(void)
+{
+    return brightness;
+}
+
+void beacon_set_brightness(uint8_t new_brightness)
+{
+    if (new_brightness == brightness)
+    {
+        return;
+    }
+
+    // takes effect with the next light phase
+    brightness = new_brightness;
+    light_state_changed();
+}
+
+esp_err_t beacon_add_phase_listener(beacon_phase_listener_t listener)
+{
+    for (int i = 0; i < BEACON_MAX_PHASE_LISTENERS; i++)
+    {
+        if (phase_listeners[i] == NULL)
+        {
+            phase_listeners[i] = listener;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+beacon_timing_t beacon_get_timing(void)
+{
+    portENTER_CRITICAL(&timing_lock);
+    beacon_timing_t copy = timing;
+    portEXIT_CRITICAL(&timing_lock);
+    return copy;
+}
+
+void beacon_reset_timing(void)
+{
+    portENTER_CRITICAL(&timing_lock);
+    timing = (beacon_timing_t){0};
+    portEXIT_CRITICAL(&timing_lock);
+}
+
+static void print_timing(void)
+{
+    beacon_timing_t snapshot = beacon_get_timing();
+    printf("edges %" PRIu32 ", late (> %d us) %" PRIu32 ", max late %" PRIu32 " us\n", snapshot.edges,
+           BEACON_EDGE_DEADLINE_US, snapshot.late_edges, snapshot.max_late_us);
+}
+
+// Commits a counter to NVS back to back; a commit per tick, so the idle task still runs
+static int stress(int seconds)
+{
+    if (!running)
+    {
+        printf("beacon is off\n");
+        return 1;
+    }
+
+    beacon_reset_timing();
+    int64_t end_us = vclock_now_us() + (int64_t)seconds * 1000000;
+    int32_t commits = 0;
+    while (vclock_now_us() < end_us)
+    {
+        commits++;
+        persistence_save(VALUE_TYPE_INT32, "BEACON_STRESS", &commits);
+        vTaskDelay(1);
+    }
+
+    printf("%" PRId32 " NVS commits in %d s\n", commits, seconds);
+    print_timing();
+    return beacon_get_timing().late_edges == 0 ? 0 : 1;
+}
+
+// printf instead of ESP_LOG, so the output survives release builds with logging compiled out
+static int beacon_command(int argc, char **argv)
+{
+    if (argc > 2 && strcmp(argv[1], "stress") == 0)
+    {
+        return stress(atoi(argv[2]));
+    }
+    if (argc > 1 && strcmp(argv[1], "reset") == 0)
+    {
+        beacon_reset_timing();
+        return 0;
+    }
+
+    print_timing();
+    return 0;
+}
+
+esp_err_t beacon_register_console_command(void)
+{
+    const esp_console_cmd_t command = {
+        .command = "beacon",
+        .help = "Show the timing of the beacon phase changes; \"beacon reset\" clears it, \"beacon stress "
+                "<seconds>\" commits to NVS meanwhile (wears the flash)",
+        .func = beacon_command,
+    };
+    return esp_console_cmd_register(&command);
+}
+
 esp_err_t beacon_init(void)
 {
     esp_err_t ret = ESP_OK;
 
-    timer_semaphore = xSemaphoreCreateBinary();
+    // character and brightness are left alone: light_restore() applies them from RTC memory or NVS
+    timer_semaphore = xSemaphoreCreateBinaryStatic(&timer_semaphore_buffer);
 
     gptimer_config_t timer_config = {
         .clk_src = GPTIMER_CLK_SRC_DEFAULT,
@@ -137,7 +375,7 @@ esp_err_t beacon_init(void)
     }
 
     gptimer_alarm_config_t alarm_config = {
-        .alarm_count = 2000000,
+        .alarm_count = characters[character].phase_ms[0] * 1000ULL,
         .reload_count = 0,
         .flags.auto_reload_on_alarm = true,
     };
@@ -148,13 +386,8 @@ esp_err_t beacon_init(void)
         goto cleanupEnabledTimer;
     }
 
-    BaseType_t task_created = xTaskCreate(beacon_timer_event_task, "beacon_timer_event_task", 4096, NULL, 10, NULL);
-    if (task_created != pdPASS)
-    {
-        ESP_LOGE(TAG, "Failed to create timer event task");
-        ret = ESP_ERR_NO_MEM;
-        goto cleanupEnabledTimer;
-    }
+    xTaskCreateStaticPinnedToCore(beacon_timer_event_task, "beacon_timer_event_task", BEACON_TASK_STACK_SIZE, NULL,
+                                  10, beacon_task_stack, &beacon_task_buffer, LIGHT_RENDER_CORE);
 
     ESP_LOGI(TAG, "Beacon module initialized.");
     goto exit;
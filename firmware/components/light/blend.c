@@ -0,0 +1,85 @@
+#include "blend.h"
+
+/*
+ * Blend kernels work on whole pixels (SWAR): red/blue and green/alpha are split into two words of two 16 bit
+ * lanes, so one 32 bit multiply scales two channels and the headroom of each lane holds the carries. Only
+ * multiply needs channel-by-channel products. Opacity is 0-256, so 255 maps to 256 and full opacity is exact.
+ */
+#define LANES 0x00ff00ffU
+
+// p * s / 256 in all four channels, s 0-256
+static inline uint32_t scale(uint32_t p, uint32_t s)
+{
+    uint32_t rb = ((p & LANES) * s >> 8) & LANES;
+    uint32_t ga = (((p >> 8) & LANES) * s) & ~LANES;
+    return rb | ga;
+}
+
+// d + (s - d) * a / 256, a 0-256; both terms are truncated, so the sum cannot carry into the next lane
+static inline uint32_t lerp(uint32_t d, uint32_t s, uint32_t a)
+{
+    return scale(s, a) + scale(d, 256 - a);
+}
+
+static inline uint32_t max_lanes(uint32_t a, uint32_t b)
+{
+    // bit 8 of each lane of (0x100 + a - b) is set where a >= b
+    uint32_t ge = (((a | 0x01000100U) - b) >> 8) & 0x00010001U;
+    uint32_t mask = ge * 0xff;
+    return (a & mask) | (b & ~mask & LANES);
+}
+
+static inline uint32_t add_saturated(uint32_t a, uint32_t b)
+{
+    uint32_t rb = (a & LANES) + (b & LANES);
+    uint32_t ga = ((a >> 8) & LANES) + ((b >> 8) & LANES);
+    // a lane that overflowed into bit 8 saturates to 0xff
+    rb |= ((rb >> 8) & 0x00010001U) * 0xff;
+    ga |= ((ga >> 8) & 0x00010001U) * 0xff;
+    return (rb & LANES) | (ga & LANES) << 8;
+}
+
+void blend_add(uint32_t *dst, const uint32_t *src, uint32_t count, uint32_t opacity)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        dst[i] = add_saturated(dst[i], scale(src[i], opacity));
+    }
+}
+
+void blend_max(uint32_t *dst, const uint32_t *src, uint32_t count, uint32_t opacity)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t s = scale(src[i], opacity);
+        uint32_t rb = max_lanes(dst[i] & LANES, s & LANES);
+        uint32_t ga = max_lanes((dst[i] >> 8) & LANES, (s >> 8) & LANES);
+        dst[i] = rb | ga << 8;
+    }
+}
+
+void blend_alpha(uint32_t *dst, const uint32_t *src, uint32_t count, uint32_t opacity)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t alpha = (src[i] >> 24) * opacity >> 8;
+        dst[i] = lerp(dst[i], src[i], alpha + (alpha >> 7));
+    }
+}
+
+void blend_multiply(uint32_t *dst, const uint32_t *src, uint32_t count, uint32_t opacity)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t d = dst[i];
+        uint32_t s = src[i];
+        uint32_t product = 0;
+        for (int shift = 0; shift < 24; shift += 8)
+        {
+            uint32_t channel = ((d >> shift) & 0xff) * ((s >> shift) & 0xff);
+            // x / 255, exact for all products of two bytes
+            product |= ((channel + 1 + (channel >> 8)) >> 8) << shift;
+        }
+        dst[i] = lerp(d, product, opacity);
+    }
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Blend kernels of the compositor, on pixels packed like color_linear_t (0xAABBGGRR). They only depend on
+ * <stdint.h>, so host_test/ builds them without the colour pipeline ("make blend").
+ */
+
+/**
+ * @brief Mixes `count` pixels of `src` onto `dst`, all four channels.
+ *
+ * @param opacity  0-256; 256 leaves `src` as it is.
+ */
+typedef void (*blend_kernel_t)(uint32_t *dst, const uint32_t *src, uint32_t count, uint32_t opacity);
+
+/// dst + src * opacity, saturating at 255
+void blend_add(uint32_t *dst, const uint32_t *src, uint32_t count, uint32_t opacity);
+
+/// the larger of dst and src * opacity
+void blend_max(uint32_t *dst, const uint32_t *src, uint32_t count, uint32_t opacity);
+
+/// src over dst, with the alpha byte of src times opacity
+void blend_alpha(uint32_t *dst, const uint32_t *src, uint32_t count, uint32_t opacity);
+
+/// dst faded towards dst * src / 255 by opacity; the product has alpha 0
+void blend_multiply(uint32_t *dst, const uint32_t *src, uint32_t count, uint32_t opacity);
@@ -0,0 +1,115 @@
+#include "color.h"
+
+#include "color_lut.h"
+#include "sdkconfig.h"
+
+/*
+ * authored colour -> gamma (linear 16 bit) -> brightness (linear 16 bit) -> 8 bit per channel (color_linear_t)
+ * -> [white extraction] -> strip
+ *
+ * Gamma and brightness multiply in the linear domain, so dimming keeps the hue. The pixel format is fixed by
+ * the configuration; only the matching converter and writer are compiled, the loops do not branch on it.
+ */
+
+#if CONFIG_WLED_WITH_WHITE
+
+typedef struct
+{
+    uint8_t red;
+    uint8_t green;
+    uint8_t blue;
+    uint8_t white;
+} pixel_t;
+
+#else
+
+typedef struct
+{
+    uint8_t red;
+    uint8_t green;
+    uint8_t blue;
+} pixel_t;
+
+#endif
+
+static inline uint32_t scale(int channel, uint8_t value, uint32_t level)
+{
+    // 16 x 16 bit, truncated to 8 bit: full scale is 255.99, rounding would overflow
+    return ((uint32_t)color_gamma_lut[channel][value] * level) >> 24;
+}
+
+static inline uint8_t min3(uint8_t a, uint8_t b, uint8_t c)
+{
+    uint8_t m = a < b ? a : b;
+    return m < c ? m : c;
+}
+
+static inline color_linear_t to_linear(color_t color, uint8_t brightness)
+{
+    uint32_t level = color_brightness_lut[brightness];
+    return scale(0, color.red, level) | scale(1, color.green, level) << 8 | scale(2, color.blue, level) << 16;
+}
+
+static inline pixel_t finish(color_linear_t linear)
+{
+    pixel_t pixel = {
+        .red = linear & 0xff,
+        .green = (linear >> 8) & 0xff,
+        .blue = (linear >> 16) & 0xff,
+    };
+
+#if CONFIG_WLED_WITH_WHITE
+    // the part all channels have in common, in the colour of the white LED, moves to the white LED
+    uint8_t white = min3(color_white_share_lut[0][pixel.red], color_white_share_lut[1][pixel.green],
+                         color_white_share_lut[2][pixel.blue]);
+    pixel.red -= color_white_part_lut[0][white];
+    pixel.green -= color_white_part_lut[1][white];
+    pixel.blue -= color_white_part_lut[2][white];
+    pixel.white = white;
+#endif
+
+    return pixel;
+}
+
+static inline esp_err_t write(led_strip_handle_t strip, uint32_t index, pixel_t pixel)
+{
+#if CONFIG_WLED_WITH_WHITE
+    return led_strip_set_pixel_rgbw(strip, index, pixel.red, pixel.green, pixel.blue, pixel.white);
+#else
+    return led_strip_set_pixel(strip, index, pixel.red, pixel.green, pixel.blue);
+#endif
+}
+
+color_linear_t color_to_linear(color_t color, uint8_t brightness)
+{
+    return to_linear(color, brightness);
+}
+
+uint16_t color_brightness_to_linear(uint8_t brightness)
+{
+    return color_brightness_lut[brightness];
+}
+
+esp_err_t color_write_linear(led_strip_handle_t strip, uint32_t index, color_linear_t pixel)
+{
+    return write(strip, index, finish(pixel));
+}
+
+esp_err_t color_write_pixel(led_strip_handle_t strip, uint32_t index, color_t color, uint8_t brightness)
+{
+    return write(strip, index, finish(to_linear(color, brightness)));
+}
+
+esp_err_t color_fill(led_strip_handle_t strip, uint32_t count, color_t color, uint8_t brightness)
+{
+    pixel_t pixel = finish(to_linear(color, brightness));
+    for (uint32_t i = 0; i < count; i++)
+    {
+        esp_err_t ret = write(strip, i, pixel);
+        if (ret != ESP_OK)
+        {
+            return ret;
+        }
+    }
+    return ESP_OK;
+}
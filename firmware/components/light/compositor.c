@@ -0,0 +1,246 @@
+#include "compositor.h"
+
+#include "blend.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "light.h"
+#include "power.h"
+#include "vclock.h"
+
+#include <stdatomic.h>
+#include <string.h>
+
+static const char *TAG = "compositor";
+
+typedef struct
+{
+    compositor_blend_t blend;
+    uint8_t opacity;
+    color_linear_t pixels[COMPOSITOR_PIXELS];
+} compositor_layer_state_t;
+
+typedef struct
+{
+    color_linear_t pixels[COMPOSITOR_PIXELS];
+    int64_t rendered_at;
+    latency_marks_t marks;
+} compositor_frame_t;
+
+#define OUTPUT_TASK_STACK_SIZE 3072
+#define FRAME_INDEX 0x3
+#define FRAME_NEW 0x4 ///< set in `pending` until the output task took the frame
+
+static led_strip_handle_t output;
+static SemaphoreHandle_t lock; ///< layers; only taken by the tasks that draw
+static StaticSemaphore_t lock_buffer;
+static compositor_layer_state_t layers[COMPOSITOR_LAYER_COUNT];
+static latency_marks_t deferred; ///< taken by the next rendered frame; under the layer lock
+static power_lock_t frame_lock;  ///< full CPU clock while a frame is blended or sent, for a steady frame latency
+
+/*
+ * Frames go from the drawing tasks to the output task through three framebuffers without a lock: the drawing
+ * side owns `back`, the output task owns `front`, and the finished frame in between is swapped in and out of
+ * `pending` atomically. With only two buffers the drawing side would have to wait for the output to let go
+ * of one; this way a slow strip only drops intermediate frames, the latest one is always shown.
+ */
+static compositor_frame_t frames[3];
+static uint32_t back = 0;
+static uint32_t front = 1;
+static atomic_uint pending = 2;
+
+static TaskHandle_t output_task_handle;
+static StackType_t output_task_stack[OUTPUT_TASK_STACK_SIZE];
+static StaticTask_t output_task_buffer;
+
+static const blend_kernel_t kernels[COMPOSITOR_BLEND_COUNT] = {
+    [COMPOSITOR_BLEND_ADD] = blend_add,
+    [COMPOSITOR_BLEND_MAX] = blend_max,
+    [COMPOSITOR_BLEND_ALPHA] = blend_alpha,
+    [COMPOSITOR_BLEND_MULTIPLY] = blend_multiply,
+};
+
+static bool is_lit(const compositor_frame_t *frame)
+{
+    for (uint32_t i = 0; i < COMPOSITOR_PIXELS; i++)
+    {
+        if (frame->pixels[i] & 0x00ffffffU)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void output_task(void *arg)
+{
+    bool photon_recorded = false;
+
+    while (true)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (!(atomic_load(&pending) & FRAME_NEW))
+        {
+            continue;
+        }
+        front = atomic_exchange(&pending, front) & FRAME_INDEX;
+
+        const compositor_frame_t *frame = &frames[front];
+        power_lock_acquire(frame_lock);
+        int64_t start = esp_timer_get_time();
+        esp_err_t ret = ESP_OK;
+        for (uint32_t i = 0; i < COMPOSITOR_PIXELS && ret == ESP_OK; i++)
+        {
+            ret = color_write_linear(output, i, frame->pixels[i]);
+        }
+        if (ret == ESP_OK)
+        {
+            ret = led_strip_refresh(output);
+        }
+        if (ret != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to send frame: %s", esp_err_to_name(ret));
+        }
+        else if (!photon_recorded && is_lit(frame))
+        {
+            photon_recorded = true;
+            light_record_photon();
+        }
+        latency_complete(&frame->marks, vclock_now_us());
+        light_record_frame((uint32_t)(start - frame->rendered_at), (uint32_t)(esp_timer_get_time() - start));
+        power_lock_release(frame_lock);
+    }
+}
+
+esp_err_t compositor_init(led_strip_handle_t strip)
+{
+    if (strip == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (lock == NULL)
+    {
+        lock = xSemaphoreCreateMutexStatic(&lock_buffer);
+        esp_err_t ret = power_lock_create(POWER_NEED_CPU_MAX, "wled_frame", &frame_lock);
+        if (ret != ESP_OK)
+        {
+            return ret;
+        }
+    }
+    for (int i = 0; i < COMPOSITOR_LAYER_COUNT; i++)
+    {
+        layers[i] = (compositor_layer_state_t){.blend = COMPOSITOR_BLEND_ADD, .opacity = 0};
+    }
+    // the beacon is the base layer, fully visible from the start
+    layers[COMPOSITOR_LAYER_BEACON].opacity = 255;
+    output = strip;
+
+    if (output_task_handle == NULL)
+    {
+        output_task_handle =
+            xTaskCreateStaticPinnedToCore(output_task, "wled_output", OUTPUT_TASK_STACK_SIZE, NULL, 11,
+                                          output_task_stack, &output_task_buffer, LIGHT_RENDER_CORE);
+    }
+    return ESP_OK;
+}
+
+esp_err_t compositor_set_layer(compositor_layer_t layer, compositor_blend_t blend, uint8_t opacity)
+{
+    if (layer >= COMPOSITOR_LAYER_COUNT || blend >= COMPOSITOR_BLEND_COUNT)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    layers[layer].blend = blend;
+    layers[layer].opacity = opacity;
+    xSemaphoreGive(lock);
+    return ESP_OK;
+}
+
+esp_err_t compositor_draw(compositor_layer_t layer, const color_linear_t *pixels, uint32_t count)
+{
+    if (layer >= COMPOSITOR_LAYER_COUNT || pixels == NULL || count > COMPOSITOR_PIXELS)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    memcpy(layers[layer].pixels, pixels, count * sizeof(*pixels));
+    xSemaphoreGive(lock);
+    return ESP_OK;
+}
+
+esp_err_t compositor_fill(compositor_layer_t layer, color_linear_t pixel)
+{
+    if (layer >= COMPOSITOR_LAYER_COUNT)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for (uint32_t i = 0; i < COMPOSITOR_PIXELS; i++)
+    {
+        layers[layer].pixels[i] = pixel;
+    }
+    xSemaphoreGive(lock);
+    return ESP_OK;
+}
+
+void compositor_defer_marks(const latency_marks_t *marks)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    latency_merge(&deferred, marks);
+    xSemaphoreGive(lock);
+}
+
+esp_err_t compositor_render(const latency_marks_t *marks)
+{
+    if (output_task_handle == NULL)
+    {
+        ESP_LOGE(TAG, "Compositor not initialized");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    power_lock_acquire(frame_lock);
+    xSemaphoreTake(lock, portMAX_DELAY);
+    compositor_frame_t *frame = &frames[back];
+    memset(frame->pixels, 0, sizeof(frame->pixels));
+    for (int i = 0; i < COMPOSITOR_LAYER_COUNT; i++)
+    {
+        const compositor_layer_state_t *layer = &layers[i];
+        if (layer->opacity > 0)
+        {
+            uint32_t opacity = layer->opacity + (layer->opacity >> 7);
+            kernels[layer->blend](frame->pixels, layer->pixels, COMPOSITOR_PIXELS, opacity);
+        }
+    }
+    frame->rendered_at = esp_timer_get_time();
+    latency_marks_t own = deferred;
+    memset(&deferred, 0, sizeof(deferred));
+    if (marks != NULL)
+    {
+        latency_merge(&own, marks);
+    }
+
+    // a frame still pending is dropped by this one, which then completes its paths; the output task only reads
+    // the pending frame, so its marks can be merged until the swap succeeds
+    unsigned int previous = atomic_load(&pending);
+    do
+    {
+        frame->marks = own;
+        if (previous & FRAME_NEW)
+        {
+            latency_merge(&frame->marks, &frames[previous & FRAME_INDEX].marks);
+        }
+    } while (!atomic_compare_exchange_weak(&pending, &previous, back | FRAME_NEW));
+    back = previous & FRAME_INDEX;
+    xSemaphoreGive(lock);
+    power_lock_release(frame_lock);
+
+    xTaskNotifyGive(output_task_handle);
+    return ESP_OK;
+}
@@ -0,0 +1,247 @@
+#include "blend.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Compares each blend kernel with a reference that computes every channel on its own, the way the kernels are
+ * specified, over random pixels and the corner values of a channel at every opacity from 0 to 256. The kernels
+ * have to match bit for bit. A timed loop then reports the time per pixel of kernel and reference.
+ */
+
+#define BLOCK_PIXELS 1024
+#define RANDOM_BLOCKS 4 ///< per opacity
+#define BENCH_PIXELS (64 * 1024 * 1024)
+#define BENCH_OPACITY 200
+
+typedef uint32_t (*reference_t)(uint32_t d, uint32_t s, uint32_t opacity);
+
+typedef struct
+{
+    const char *name;
+    blend_kernel_t kernel;
+    reference_t reference;
+} blend_case_t;
+
+static int checks = 0;
+static int failures = 0;
+
+static uint32_t random_state = 0x2545f491;
+
+static uint32_t next_random(void)
+{
+    // xorshift32, the same sequence on every run
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static uint32_t channel(uint32_t p, int i)
+{
+    return (p >> (8 * i)) & 0xff;
+}
+
+static uint32_t scaled(uint32_t c, uint32_t opacity)
+{
+    return c * opacity / 256;
+}
+
+static uint32_t reference_add(uint32_t d, uint32_t s, uint32_t opacity)
+{
+    uint32_t out = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        uint32_t sum = channel(d, i) + scaled(channel(s, i), opacity);
+        out |= (sum > 255 ? 255 : sum) << (8 * i);
+    }
+    return out;
+}
+
+static uint32_t reference_max(uint32_t d, uint32_t s, uint32_t opacity)
+{
+    uint32_t out = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        uint32_t a = channel(d, i);
+        uint32_t b = scaled(channel(s, i), opacity);
+        out |= (a > b ? a : b) << (8 * i);
+    }
+    return out;
+}
+
+// d * (256 - a) / 256 + s * a / 256, each term truncated
+static uint32_t mix(uint32_t d, uint32_t s, uint32_t a)
+{
+    return scaled(s, a) + scaled(d, 256 - a);
+}
+
+static uint32_t reference_alpha(uint32_t d, uint32_t s, uint32_t opacity)
+{
+    // the alpha byte times opacity, stretched to 0-256 like the layer opacity
+    uint32_t a = scaled(channel(s, 3), opacity);
+    a += a / 128;
+
+    uint32_t out = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        out |= mix(channel(d, i), channel(s, i), a) << (8 * i);
+    }
+    return out;
+}
+
+static uint32_t reference_multiply(uint32_t d, uint32_t s, uint32_t opacity)
+{
+    uint32_t out = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        uint32_t product = i < 3 ? channel(d, i) * channel(s, i) / 255 : 0;
+        out |= mix(channel(d, i), product, opacity) << (8 * i);
+    }
+    return out;
+}
+
+static const blend_case_t cases[] = {
+    {"add", blend_add, reference_add},
+    {"max", blend_max, reference_max},
+    {"alpha", blend_alpha, reference_alpha},
+    {"multiply", blend_multiply, reference_multiply},
+};
+
+static void reference_kernel(reference_t reference, uint32_t *dst, const uint32_t *src, uint32_t count,
+                             uint32_t opacity)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        dst[i] = reference(dst[i], src[i], opacity);
+    }
+}
+
+// reports the first mismatch of a kernel only, one wrong lane usually breaks thousands of pixels
+static void compare(const blend_case_t *c, const uint32_t *dst, const uint32_t *src, uint32_t count,
+                    uint32_t opacity, bool *reported)
+{
+    static uint32_t out[BLOCK_PIXELS];
+    for (uint32_t i = 0; i < count; i++)
+    {
+        out[i] = dst[i];
+    }
+    c->kernel(out, src, count, opacity);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t expected = c->reference(dst[i], src[i], opacity);
+        checks++;
+        if (out[i] != expected)
+        {
+            failures++;
+            if (!*reported)
+            {
+                *reported = true;
+                printf("FAIL: %s opacity %u dst 0x%08x src 0x%08x: 0x%08x, expected 0x%08x\n", c->name,
+                       (unsigned)opacity, (unsigned)dst[i], (unsigned)src[i], (unsigned)out[i],
+                       (unsigned)expected);
+            }
+        }
+    }
+}
+
+static void check_kernel(const blend_case_t *c)
+{
+    static const uint8_t corners[] = {0x00, 0x01, 0x7f, 0x80, 0x81, 0xfe, 0xff};
+    static uint32_t dst[BLOCK_PIXELS];
+    static uint32_t src[BLOCK_PIXELS];
+    int failures_before = failures;
+    bool reported = false;
+
+    for (uint32_t opacity = 0; opacity <= 256; opacity++)
+    {
+        // every pair of corner values, in all channels at once and in one channel with the others random
+        uint32_t count = 0;
+        for (size_t a = 0; a < sizeof(corners); a++)
+        {
+            for (size_t b = 0; b < sizeof(corners); b++)
+            {
+                dst[count] = corners[a] * 0x01010101U;
+                src[count] = corners[b] * 0x01010101U;
+                count++;
+                for (int i = 0; i < 4; i++)
+                {
+                    uint32_t keep = ~(0xffU << (8 * i));
+                    dst[count] = (next_random() & keep) | (uint32_t)corners[a] << (8 * i);
+                    src[count] = (next_random() & keep) | (uint32_t)corners[b] << (8 * i);
+                    count++;
+                }
+            }
+        }
+        compare(c, dst, src, count, opacity, &reported);
+
+        for (int block = 0; block < RANDOM_BLOCKS; block++)
+        {
+            for (uint32_t i = 0; i < BLOCK_PIXELS; i++)
+            {
+                dst[i] = next_random();
+                src[i] = next_random();
+            }
+            compare(c, dst, src, BLOCK_PIXELS, opacity, &reported);
+        }
+    }
+    printf("%-8s %s\n", c->name, failures == failures_before ? "matches the reference" : "differs");
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void time_kernel(const blend_case_t *c)
+{
+    static uint32_t dst[BLOCK_PIXELS];
+    static uint32_t src[BLOCK_PIXELS];
+    for (uint32_t i = 0; i < BLOCK_PIXELS; i++)
+    {
+        dst[i] = next_random();
+        src[i] = next_random();
+    }
+
+    // the kernels do not branch on the pixels, so blending the same block over and over is representative
+    double start = now_s();
+    for (uint32_t done = 0; done < BENCH_PIXELS; done += BLOCK_PIXELS)
+    {
+        c->kernel(dst, src, BLOCK_PIXELS, BENCH_OPACITY);
+    }
+    double kernel_ns = (now_s() - start) * 1e9 / BENCH_PIXELS;
+
+    start = now_s();
+    for (uint32_t done = 0; done < BENCH_PIXELS; done += BLOCK_PIXELS)
+    {
+        reference_kernel(c->reference, dst, src, BLOCK_PIXELS, BENCH_OPACITY);
+    }
+    double reference_ns = (now_s() - start) * 1e9 / BENCH_PIXELS;
+
+    // printing a pixel keeps the compiler from dropping the loops
+    printf("%-8s %8.2f %10.2f   (0x%08x)\n", c->name, kernel_ns, reference_ns, (unsigned)dst[0]);
+}
+
+void app_main(void)
+{
+    size_t count = sizeof(cases) / sizeof(cases[0]);
+    for (size_t i = 0; i < count; i++)
+    {
+        check_kernel(&cases[i]);
+    }
+    printf("%d checks, %d failed\n", checks, failures);
+
+    printf("\nns per pixel at opacity %d, %d pixels\n", BENCH_OPACITY, BENCH_PIXELS);
+    printf("%-8s %8s %10s\n", "kernel", "kernel", "reference");
+    for (size_t i = 0; i < count; i++)
+    {
+        time_kernel(&cases[i]);
+    }
+
+    exit(failures == 0 ? 0 : 1);
+}
@@ -2,6 +2,42 @@
 
 #include "esp_err.h"
 
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Light characters the beacon can show.
+ */
+typedef enum
+{
+    BEACON_CHARACTER_ISO_4S = 0, ///< Isophase, 2 s light / 2 s dark
+    BEACON_CHARACTER_FL_3S,      ///< Flash every 3 s
+    BEACON_CHARACTER_OC_6S,      ///< Occulting, 4.5 s light / 1.5 s dark
+    BEACON_CHARACTER_FL2_9S,     ///< Group of two flashes every 9 s
+    BEACON_CHARACTER_COUNT,
+} beacon_character_t;
+
+typedef struct
+{
+    uint32_t edges;       ///< phase changes of the beacon timer
+    uint32_t late_edges;  ///< phase changes whose interrupt ran later than BEACON_EDGE_DEADLINE_US
+    uint32_t max_late_us; ///< latest phase change interrupt
+} beacon_timing_t;
+
+/// An interrupt this late is far beyond the interrupt latency; it was held back, e.g. by a flash write
+#define BEACON_EDGE_DEADLINE_US 500
+
+/**
+ * @brief Called at every phase of the beacon, when its light output changes.
+ *
+ * Runs right after the frame was rendered, on the beacon task or, for the first phase, on the task that started
+ * the beacon; must return quickly.
+ *
+ * @param phase  Phase of the character, 0 is the first light phase of each period.
+ * @param lit    Whether the phase is a light phase.
+ */
+typedef void (*beacon_phase_listener_t)(uint8_t phase, bool lit);
+
 /**
  * @brief Initializes the beacon module.
  *
@@ -37,3 +73,72 @@ esp_err_t beacon_start(void);
  *     - Error codes in case of failure, indicating the specific issue.
  */
 esp_err_t beacon_stop(void);
+
+/**
+ * @brief Reports whether the beacon is currently flashing.
+ *
+ * @return true if the beacon timer is running, false otherwise.
+ */
+bool beacon_is_running(void);
+
+/**
+ * @brief Returns the light character the beacon is showing.
+ */
+beacon_character_t beacon_get_character(void);
+
+/**
+ * @brief Selects the light character of the beacon.
+ *
+ * A running beacon switches to the new character with its next phase change.
+ *
+ * @return
+ *     - ESP_OK: Character selected.
+ *     - ESP_ERR_INVALID_ARG: Unknown character.
+ */
+esp_err_t beacon_set_character(beacon_character_t character);
+
+/**
+ * @brief Returns the brightness (0-255) of the beacon while lit.
+ */
+uint8_t beacon_get_brightness(void);
+
+/**
+ * @brief Sets the brightness (0-255, perceptually linear) of the beacon while lit.
+ *
+ * A running beacon uses the new brightness from its next light phase on.
+ */
+void beacon_set_brightness(uint8_t brightness);
+
+/**
+ * @brief Registers a listener for the phases of the beacon, e.g. to sound something in sync with it.
+ *
+ * @return
+ *     - ESP_OK: Listener registered.
+ *     - ESP_ERR_NO_MEM: All listener slots are in use.
+ */
+esp_err_t beacon_add_phase_listener(beacon_phase_listener_t listener);
+
+/**
+ * @brief Returns how punctual the phase changes of the beacon timer were since the last reset.
+ *
+ * Each phase change is compared with the time it is due, counted from beacon_start() along the phases of
+ * the character, so a late interrupt shows up even though the hardware timer itself does not drift.
+ */
+beacon_timing_t beacon_get_timing(void);
+
+/**
+ * @brief Clears the phase change timing.
+ */
+void beacon_reset_timing(void);
+
+/**
+ * @brief Registers the "beacon" console command, which shows the phase change timing.
+ *
+ * "beacon stress <seconds>" commits to NVS as fast as it can while the beacon runs - every commit disables
+ * the flash cache - and reports the phase changes it delayed.
+ *
+ * @return
+ *     - ESP_OK: Command registered.
+ *     - Error codes of esp_console_cmd_register().
+ */
+esp_err_t beacon_register_console_command(void);
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "esp_err.h"
+#include "led_strip.h"
+
+#include <stdint.h>
+
+/**
+ * @brief Colour as authored, 8 bit per channel with the usual gamma (like a colour picker shows it).
+ */
+typedef struct
+{
+    uint8_t red;
+    uint8_t green;
+    uint8_t blue;
+} color_t;
+
+/**
+ * @brief Linear 8 bit intensities packed as 0xAABBGGRR, the format effects are mixed in (see compositor.h).
+ *
+ * The alpha byte is only used by compositor layers; the strip ignores it.
+ */
+typedef uint32_t color_linear_t;
+
+#define COLOR_LINEAR(red, green, blue, alpha)                                                                      \
+    ((color_linear_t)(red) | (color_linear_t)(green) << 8 | (color_linear_t)(blue) << 16 |                         \
+     (color_linear_t)(alpha) << 24)
+
+/**
+ * @brief Runs gamma and brightness of the colour pipeline, leaving the alpha byte 0.
+ */
+color_linear_t color_to_linear(color_t color, uint8_t brightness);
+
+/**
+ * @brief Brightness of the colour pipeline (0-255, perceptually linear) as linear intensity (0-65535), for
+ * outputs that are not part of the strip.
+ */
+uint16_t color_brightness_to_linear(uint8_t brightness);
+
+/**
+ * @brief Writes an already linear pixel, running the rest of the pipeline (white extraction on RGBW strips).
+ *
+ * @return
+ *     - ESP_OK: Pixel written.
+ *     - ESP_ERR_INVALID_ARG: Index out of range.
+ */
+esp_err_t color_write_linear(led_strip_handle_t strip, uint32_t index, color_linear_t pixel);
+
+/**
+ * @brief Writes one pixel through the colour pipeline: gamma, brightness and, on RGBW strips
+ * (CONFIG_WLED_WITH_WHITE), white extraction.
+ *
+ * The tables are generated at build time (tools/gen_color_lut.py) and the writer is compiled for the
+ * configured pixel format only. Takes effect with the next led_strip_refresh().
+ *
+ * @param brightness  0-255, perceptually linear; 0 is off.
+ *
+ * @return
+ *     - ESP_OK: Pixel written.
+ *     - ESP_ERR_INVALID_ARG: Index out of range.
+ */
+esp_err_t color_write_pixel(led_strip_handle_t strip, uint32_t index, color_t color, uint8_t brightness);
+
+/**
+ * @brief Writes the same colour to the first `count` pixels; the colour is converted only once.
+ *
+ * @return
+ *     - ESP_OK: Pixels written.
+ *     - ESP_ERR_INVALID_ARG: `count` exceeds the strip.
+ */
+esp_err_t color_fill(led_strip_handle_t strip, uint32_t count, color_t color, uint8_t brightness);
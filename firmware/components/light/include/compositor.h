@@ -0,0 +1,89 @@
+#pragma once
+
+#include "color.h"
+#include "esp_err.h"
+#include "latency.h"
+
+#include <stdint.h>
+
+/**
+ * @brief Number of pixels of the WLED strip, and of every layer.
+ */
+#define COMPOSITOR_PIXELS 1
+
+/**
+ * @brief Effect layers, from bottom to top.
+ */
+typedef enum
+{
+    COMPOSITOR_LAYER_BEACON = 0, ///< the beacon character
+    COMPOSITOR_LAYER_AMBIENT,    ///< glow around the lantern
+    COMPOSITOR_LAYER_STREAM,     ///< live frames streamed by a phone
+    COMPOSITOR_LAYER_ALERT,      ///< flashes that have to be seen over everything else
+    COMPOSITOR_LAYER_COUNT,
+} compositor_layer_t;
+
+/**
+ * @brief How a layer is mixed onto the layers below it, all in linear light.
+ */
+typedef enum
+{
+    COMPOSITOR_BLEND_ADD = 0, ///< saturating sum
+    COMPOSITOR_BLEND_MAX,     ///< brighter channel wins
+    COMPOSITOR_BLEND_ALPHA,   ///< over, with the alpha byte of each pixel
+    COMPOSITOR_BLEND_MULTIPLY,
+    COMPOSITOR_BLEND_COUNT,
+} compositor_blend_t;
+
+/**
+ * @brief Sets up the layers and the output task that sends the frames to the strip; called from wled_init().
+ */
+esp_err_t compositor_init(led_strip_handle_t strip);
+
+/**
+ * @brief Selects blend mode and opacity of a layer. A layer with opacity 0 is skipped.
+ *
+ * @return
+ *     - ESP_OK: Layer configured.
+ *     - ESP_ERR_INVALID_ARG: Unknown layer or blend mode.
+ */
+esp_err_t compositor_set_layer(compositor_layer_t layer, compositor_blend_t blend, uint8_t opacity);
+
+/**
+ * @brief Replaces the first `count` pixels of a layer.
+ *
+ * @return
+ *     - ESP_OK: Pixels copied; visible with the next compositor_render().
+ *     - ESP_ERR_INVALID_ARG: Unknown layer or more than COMPOSITOR_PIXELS pixels.
+ */
+esp_err_t compositor_draw(compositor_layer_t layer, const color_linear_t *pixels, uint32_t count);
+
+/**
+ * @brief Sets all pixels of a layer to one colour.
+ *
+ * @return
+ *     - ESP_OK: Layer filled; visible with the next compositor_render().
+ *     - ESP_ERR_INVALID_ARG: Unknown layer.
+ */
+esp_err_t compositor_fill(compositor_layer_t layer, color_linear_t pixel);
+
+/**
+ * @brief Flattens all layers into a framebuffer and hands it to the output task.
+ *
+ * Every effect calls this after drawing. The output task runs on LIGHT_RENDER_CORE and sends the latest
+ * frame to the strip; a frame replaced before it was sent is dropped. Frames are accounted in the light
+ * pipeline counters.
+ *
+ * @param marks  Latency paths completed once the frame was sent, or NULL. Marks of a dropped frame carry
+ *               over to the frame that replaced it.
+ *
+ * @return
+ *     - ESP_OK: Frame handed over.
+ *     - ESP_ERR_INVALID_STATE: compositor_init() was not called.
+ */
+esp_err_t compositor_render(const latency_marks_t *marks);
+
+/**
+ * @brief Hands latency marks to the next rendered frame, for a change whose frame is rendered further down.
+ */
+void compositor_defer_marks(const latency_marks_t *marks);
@@ -5,6 +5,17 @@
 #include "outdoor.h"
 
 #include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+
+/// Cores the light and the BLE tasks are pinned to, see CONFIG_LIGHT_CORE_LAYOUT
+#if CONFIG_LIGHT_CORES_SPLIT
+#define LIGHT_BLE_CORE CONFIG_BT_NIMBLE_PINNED_TO_CORE
+#define LIGHT_RENDER_CORE (1 - CONFIG_BT_NIMBLE_PINNED_TO_CORE)
+#else
+#define LIGHT_BLE_CORE tskNO_AFFINITY
+#define LIGHT_RENDER_CORE tskNO_AFFINITY
+#endif
 
 typedef struct
 {
@@ -12,6 +23,50 @@ typedef struct
     uint32_t size;
 } LedMatrix_t;
 
+typedef struct
+{
+    bool beacon_enabled;
+    bool outdoor_enabled;
+    uint8_t character;  ///< beacon_character_t
+    uint8_t brightness;    ///< beacon brightness while lit
+    uint8_t outdoor_mode;  ///< outdoor_mode_t
+    uint8_t outdoor_level; ///< outdoor lamp level; the live level while a slider is dragged
+    uint8_t sequence;      ///< incremented on every state change, wraps around
+} light_state_t;
+
+typedef void (*light_state_listener_t)(const light_state_t *state);
+
+typedef struct
+{
+    uint32_t frames;               ///< LED strip refreshes
+    uint32_t max_frame_us;         ///< longest LED strip refresh
+    uint32_t max_frame_latency_us; ///< longest time from compositor_render() until the output started
+    uint32_t state_changes;        ///< light state changes since boot
+    uint32_t commands_posted;      ///< targets posted to the command bus
+    uint32_t commands_coalesced;   ///< posted targets replaced by a newer value before they were applied
+    uint32_t max_apply_us;         ///< longest time the light controller took to apply a batch
+    uint32_t first_photon_us;      ///< esp_timer time of the first lit output after boot, 0 until then
+} light_stats_t;
+
+/// Fields of light_settings_t that are to be applied
+#define LIGHT_SETTING_BEACON_ENABLED (1 << 0)
+#define LIGHT_SETTING_OUTDOOR_ENABLED (1 << 1)
+#define LIGHT_SETTING_CHARACTER (1 << 2)
+#define LIGHT_SETTING_BRIGHTNESS (1 << 3)
+#define LIGHT_SETTING_OUTDOOR_MODE (1 << 4)
+#define LIGHT_SETTING_OUTDOOR_LEVEL (1 << 5)
+#define LIGHT_SETTING_ALL ((1 << 6) - 1)
+
+typedef struct
+{
+    bool beacon_enabled;
+    bool outdoor_enabled;
+    uint8_t character;
+    uint8_t brightness;
+    uint8_t outdoor_mode;  ///< outdoor_mode_t
+    uint8_t outdoor_level; ///< see outdoor_set_level()
+} light_settings_t;
+
 LedMatrix_t get_led_matrix(void);
 
 /**
@@ -25,3 +80,85 @@ LedMatrix_t get_led_matrix(void);
  *     - Error codes in case of failure, indicating the specific issue.
  */
 esp_err_t wled_init(void);
+
+/**
+ * @brief Returns a snapshot of the current light state.
+ */
+light_state_t light_get_state(void);
+
+/**
+ * @brief Registers a listener that is called whenever the light state changes.
+ *
+ * Listeners run in the context of the task that changed the state and must return quickly,
+ * e.g. by deferring work to their own task or event queue.
+ *
+ * @return
+ *     - ESP_OK: Listener registered.
+ *     - ESP_ERR_NO_MEM: All listener slots are in use.
+ */
+esp_err_t light_add_state_listener(light_state_listener_t listener);
+
+/**
+ * @brief Bumps the state sequence counter and informs all listeners.
+ *
+ * Called by the beacon and outdoor modules after they changed their state.
+ */
+void light_state_changed(void);
+
+/**
+ * @brief Validates a set of light settings without applying them.
+ *
+ * @return
+ *     - ESP_OK: All selected settings are valid.
+ *     - ESP_ERR_INVALID_ARG: At least one selected setting is out of range.
+ */
+esp_err_t light_validate(const light_settings_t *settings, uint32_t mask);
+
+/**
+ * @brief Applies the selected light settings and persists them with a single commit.
+ *
+ * Runs the drivers and the NVS commit on the calling task. Inputs post to the light controller with
+ * light_command_post() instead.
+ *
+ * @param settings  New values.
+ * @param mask      LIGHT_SETTING_* bits of the fields to apply.
+ *
+ * @return
+ *     - ESP_OK: All selected settings applied.
+ *     - ESP_ERR_INVALID_ARG: Validation failed, nothing was changed.
+ *     - Error codes of the beacon or outdoor module.
+ */
+esp_err_t light_apply(const light_settings_t *settings, uint32_t mask);
+
+/**
+ * @brief Brings the outputs to the last applied light settings; the first thing to run at boot.
+ *
+ * Initializes the LED strip and the beacon, then applies the settings kept in RTC memory, or the ones in NVS
+ * if the RTC memory did not survive the reset (power cycle). Needs persistence_init(), nothing else; the
+ * light controller and all inputs can start afterwards.
+ *
+ * @return
+ *     - ESP_OK: Lights restored.
+ *     - Error codes of the LED strip, beacon or outdoor module.
+ */
+esp_err_t light_restore(void);
+
+/**
+ * @brief Returns the light pipeline counters.
+ */
+light_stats_t light_get_stats(void);
+
+/**
+ * @brief Accounts one LED strip refresh in the light pipeline counters.
+ *
+ * @param latency_us   Time the frame waited for the output task.
+ * @param duration_us  Time the refresh took, including the RMT transmission.
+ */
+void light_record_frame(uint32_t latency_us, uint32_t duration_us);
+
+/**
+ * @brief Notes that an output is lit; the first call after boot sets light_stats_t.first_photon_us.
+ *
+ * Called by the output paths, cheap after the first time.
+ */
+void light_record_photon(void);
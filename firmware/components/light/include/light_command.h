@@ -0,0 +1,61 @@
+#pragma once
+
+#include "latency.h"
+#include "light.h"
+
+#include "esp_err.h"
+
+#include <stdint.h>
+
+/**
+ * @brief Starts the light controller task that applies posted commands.
+ *
+ * @return
+ *     - ESP_OK: Controller running.
+ */
+esp_err_t light_command_start(void);
+
+/**
+ * @brief Posts light settings to the light controller and returns immediately.
+ *
+ * Each LIGHT_SETTING_* field is a target with a single slot: a value posted before the controller picked
+ * up the previous one replaces it, so only the latest value per target is applied. Fields posted together
+ * are published as one unit, so they are applied together and persisted with a single commit, also while
+ * the controller is busy with an earlier batch. Lock-free; may be called from any task.
+ *
+ * @param settings  New values.
+ * @param mask      LIGHT_SETTING_* bits of the fields to post.
+ *
+ * @return
+ *     - ESP_OK: Settings posted.
+ *     - ESP_ERR_INVALID_ARG: Validation failed, nothing was posted.
+ *     - ESP_ERR_INVALID_STATE: The controller is not running.
+ */
+esp_err_t light_command_post(const light_settings_t *settings, uint32_t mask);
+
+/**
+ * @brief Like light_command_post(), and measures the path from `start_us` until the light output changed.
+ *
+ * @param path      Latency histogram the measurement is accounted in.
+ * @param start_us  vclock_now_us() of the input that caused the command; 0 to not measure.
+ */
+esp_err_t light_command_post_timed(const light_settings_t *settings, uint32_t mask, latency_path_t path,
+                                   int64_t start_us);
+
+/**
+ * @brief Sets the outdoor lamp level right away, for inputs that send a stream of values like a slider.
+ *
+ * Bypasses the command bus: the level goes straight to the lamps' single slot (outdoor_set_level()), so
+ * only the newest value is faded to. Once no new value arrived for a second, the last one is posted as
+ * LIGHT_SETTING_OUTDOOR_LEVEL and persisted, so a drag costs one flash write instead of one per value.
+ *
+ * @return
+ *     - ESP_OK: Level set.
+ *     - ESP_ERR_INVALID_STATE: The controller is not running.
+ */
+esp_err_t light_command_set_live_level(uint8_t level);
+
+/**
+ * @brief Fills the command bus counters of `stats`; used by light_get_stats().
+ */
+void light_command_get_stats(light_stats_t *stats);
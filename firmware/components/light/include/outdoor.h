@@ -2,6 +2,68 @@
 
 #include "esp_err.h"
 
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Ways the outdoor lamps can shine.
+ */
+typedef enum
+{
+    OUTDOOR_MODE_FLICKER = 0, ///< Simulation of a defective light bulb
+    OUTDOOR_MODE_STEADY,      ///< 90 % without flickering
+    OUTDOOR_MODE_DIM,         ///< 30 % without flickering
+    OUTDOOR_MODE_COUNT,
+} outdoor_mode_t;
+
+/**
+ * @brief Configures the LEDC channels and creates the lamp tasks, the lamps stay off.
+ *
+ * Allocates, so it has to be called during boot; outdoor_start() only switches the lamps on.
+ *
+ * @return
+ *     - ESP_OK: Lamps ready.
+ *     - Error codes of the LEDC driver or of power_lock_create().
+ */
+esp_err_t outdoor_init(void);
+
+/**
+ * @brief Switches the outdoor lamps on.
+ *
+ * @return
+ *     - ESP_OK: Lamps running.
+ *     - ESP_ERR_INVALID_STATE: outdoor_init() did not succeed.
+ */
 esp_err_t outdoor_start(void);
 
 esp_err_t outdoor_stop(void);
+
+bool outdoor_is_running(void);
+
+/**
+ * @brief Returns the mode the outdoor lamps use while running.
+ */
+outdoor_mode_t outdoor_get_mode(void);
+
+/**
+ * @brief Sets the mode of the outdoor lamps; running lamps switch immediately.
+ *
+ * @return
+ *     - ESP_OK: Mode set.
+ *     - ESP_ERR_INVALID_ARG: Unknown mode.
+ */
+esp_err_t outdoor_set_mode(outdoor_mode_t mode);
+
+/**
+ * @brief Returns the level the outdoor lamps are scaled to, see outdoor_set_level().
+ */
+uint8_t outdoor_get_level(void);
+
+/**
+ * @brief Sets the level every mode of the outdoor lamps is scaled to; 0-255, perceptually linear.
+ *
+ * Latest value wins: the level is a single slot that the lamps read at every fade frame, so it may be set
+ * at the rate of a slider from any task. The lamps fade to a new level instead of jumping. Not persisted,
+ * see light_command_set_live_level().
+ */
+void outdoor_set_level(uint8_t level);
@@ -1,8 +1,45 @@
 #include "light.h"
+#include "compositor.h"
+#include "light_command.h"
 
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "persistence.h"
 #include "sdkconfig.h"
 
-static LedMatrix_t led_matrix = {.size = 1};
+#include <inttypes.h>
+#include <stdatomic.h>
+
+static const char *TAG = "light";
+
+#define LIGHT_MAX_STATE_LISTENERS 4
+
+// the size is part of the magic, so a snapshot of a firmware with another layout is not taken
+#define SNAPSHOT_MAGIC (0x4c470000U | sizeof(light_settings_t))
+
+/*
+ * The persisted light settings are mirrored in RTC memory, which keeps its content over every reset except a
+ * power cycle. After a crash, a watchdog or an update the lights come back without waiting for NVS; after
+ * a power cycle the magic or the checksum does not match and the settings are read from NVS.
+ */
+typedef struct
+{
+    uint32_t magic;
+    light_settings_t settings;
+    uint32_t checksum;
+} light_snapshot_t;
+
+static RTC_NOINIT_ATTR light_snapshot_t snapshot;
+
+static LedMatrix_t led_matrix = {.size = COMPOSITOR_PIXELS};
+
+static light_state_listener_t state_listeners[LIGHT_MAX_STATE_LISTENERS];
+static atomic_uint state_sequence;
+static atomic_uint frame_count;
+static atomic_uint max_frame_us;
+static atomic_uint max_frame_latency_us;
+static atomic_uint first_photon_us;
 
 LedMatrix_t get_led_matrix(void)
 {
@@ -32,11 +69,308 @@ esp_err_t wled_init(void)
 
     ESP_ERROR_CHECK(led_strip_new_rmt_device(&strip_config, &rmt_config, &led_matrix.led_strip));
 
-    for (uint32_t i = 0; i < led_matrix.size; i++)
+    // all layers start black, so the first frame is dark
+    ESP_ERROR_CHECK(compositor_init(led_matrix.led_strip));
+    return compositor_render(NULL);
+}
+
+light_state_t light_get_state(void)
+{
+    light_state_t state = {
+        .beacon_enabled = beacon_is_running(),
+        .outdoor_enabled = outdoor_is_running(),
+        .character = beacon_get_character(),
+        .brightness = beacon_get_brightness(),
+        .outdoor_mode = outdoor_get_mode(),
+        .outdoor_level = outdoor_get_level(),
+        .sequence = (uint8_t)atomic_load(&state_sequence),
+    };
+    return state;
+}
+
+esp_err_t light_add_state_listener(light_state_listener_t listener)
+{
+    for (int i = 0; i < LIGHT_MAX_STATE_LISTENERS; i++)
     {
-        led_strip_set_pixel(led_matrix.led_strip, i, 0, 0, 0);
+        if (state_listeners[i] == NULL)
+        {
+            state_listeners[i] = listener;
+            return ESP_OK;
+        }
     }
-    led_strip_refresh(led_matrix.led_strip);
+    return ESP_ERR_NO_MEM;
+}
 
+void light_state_changed(void)
+{
+    atomic_fetch_add(&state_sequence, 1);
+
+    light_state_t state = light_get_state();
+    for (int i = 0; i < LIGHT_MAX_STATE_LISTENERS; i++)
+    {
+        if (state_listeners[i] != NULL)
+        {
+            state_listeners[i](&state);
+        }
+    }
+}
+
+// FNV-1a
+static uint32_t snapshot_checksum(const light_settings_t *settings)
+{
+    const uint8_t *bytes = (const uint8_t *)settings;
+    uint32_t hash = 2166136261U;
+    for (size_t i = 0; i < sizeof(*settings); i++)
+    {
+        hash = (hash ^ bytes[i]) * 16777619U;
+    }
+    return hash;
+}
+
+// Only called by the light controller, and before it runs by light_restore()
+static void remember(const light_settings_t *settings, uint32_t mask)
+{
+    light_settings_t *kept = &snapshot.settings;
+    if (mask & LIGHT_SETTING_BEACON_ENABLED)
+    {
+        kept->beacon_enabled = settings->beacon_enabled;
+    }
+    if (mask & LIGHT_SETTING_OUTDOOR_ENABLED)
+    {
+        kept->outdoor_enabled = settings->outdoor_enabled;
+    }
+    if (mask & LIGHT_SETTING_CHARACTER)
+    {
+        kept->character = settings->character;
+    }
+    if (mask & LIGHT_SETTING_BRIGHTNESS)
+    {
+        kept->brightness = settings->brightness;
+    }
+    if (mask & LIGHT_SETTING_OUTDOOR_MODE)
+    {
+        kept->outdoor_mode = settings->outdoor_mode;
+    }
+    if (mask & LIGHT_SETTING_OUTDOOR_LEVEL)
+    {
+        kept->outdoor_level = settings->outdoor_level;
+    }
+    snapshot.magic = SNAPSHOT_MAGIC;
+    snapshot.checksum = snapshot_checksum(kept);
+}
+
+static void load_persisted(light_settings_t *settings)
+{
+    // without a saved value the lights start like before there was one: beacon off, outdoor lamps on
+    *settings = (light_settings_t){
+        .beacon_enabled = false,
+        .outdoor_enabled = true,
+        .character = beacon_get_character(),
+        .brightness = beacon_get_brightness(),
+        .outdoor_mode = outdoor_get_mode(),
+        .outdoor_level = outdoor_get_level(),
+    };
+    // stored as bytes; a bool must not hold anything but 0 or 1
+    uint8_t beacon_enabled = settings->beacon_enabled;
+    uint8_t outdoor_enabled = settings->outdoor_enabled;
+    persistence_load(VALUE_TYPE_INT8, "BEACON_ENABLED", &beacon_enabled);
+    persistence_load(VALUE_TYPE_INT8, "OUTDOOR_ENABLED", &outdoor_enabled);
+    settings->beacon_enabled = beacon_enabled != 0;
+    settings->outdoor_enabled = outdoor_enabled != 0;
+    persistence_load(VALUE_TYPE_INT8, "BEACON_CHAR", &settings->character);
+    persistence_load(VALUE_TYPE_INT8, "BEACON_BRIGHT", &settings->brightness);
+    persistence_load(VALUE_TYPE_INT8, "OUTDOOR_MODE", &settings->outdoor_mode);
+    persistence_load(VALUE_TYPE_INT8, "OUTDOOR_LEVEL", &settings->outdoor_level);
+}
+
+esp_err_t light_validate(const light_settings_t *settings, uint32_t mask)
+{
+    if ((mask & LIGHT_SETTING_CHARACTER) && settings->character >= BEACON_CHARACTER_COUNT)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if ((mask & LIGHT_SETTING_OUTDOOR_MODE) && settings->outdoor_mode >= OUTDOOR_MODE_COUNT)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
     return ESP_OK;
 }
+
+// Drives the outputs to the selected settings
+static esp_err_t apply(const light_settings_t *settings, uint32_t mask)
+{
+    esp_err_t ret = ESP_OK;
+
+    // character, brightness, mode and level first, so a light switched on in the same batch starts with them
+    if (mask & LIGHT_SETTING_CHARACTER)
+    {
+        beacon_set_character(settings->character);
+    }
+    if (mask & LIGHT_SETTING_BRIGHTNESS)
+    {
+        beacon_set_brightness(settings->brightness);
+    }
+    if (mask & LIGHT_SETTING_OUTDOOR_MODE)
+    {
+        outdoor_set_mode(settings->outdoor_mode);
+    }
+    if (mask & LIGHT_SETTING_OUTDOOR_LEVEL)
+    {
+        outdoor_set_level(settings->outdoor_level);
+        // live values only move the lamps; the level becomes part of the state once it is applied, e.g. when a
+        // slider settled, which is compared with the last applied level as the lamps are already there
+        if (settings->outdoor_level != snapshot.settings.outdoor_level)
+        {
+            light_state_changed();
+        }
+    }
+    if ((mask & LIGHT_SETTING_BEACON_ENABLED) && settings->beacon_enabled != beacon_is_running())
+    {
+        esp_err_t err = settings->beacon_enabled ? beacon_start() : beacon_stop();
+        ret = ret == ESP_OK ? err : ret;
+    }
+    if ((mask & LIGHT_SETTING_OUTDOOR_ENABLED) && settings->outdoor_enabled != outdoor_is_running())
+    {
+        esp_err_t err = settings->outdoor_enabled ? outdoor_start() : outdoor_stop();
+        ret = ret == ESP_OK ? err : ret;
+    }
+    return ret;
+}
+
+esp_err_t light_apply(const light_settings_t *settings, uint32_t mask)
+{
+    esp_err_t ret = light_validate(settings, mask);
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+
+    // a light that failed to switch keeps its state, so what is stored is what runs and the next boot does not
+    // retry a failing start
+    light_settings_t applied = *settings;
+    ret = apply(settings, mask);
+    applied.beacon_enabled = beacon_is_running();
+    applied.outdoor_enabled = outdoor_is_running();
+
+    persistence_entry_t entries[6];
+    size_t count = 0;
+    if (mask & LIGHT_SETTING_CHARACTER)
+    {
+        entries[count++] = (persistence_entry_t){VALUE_TYPE_INT8, "BEACON_CHAR", &applied.character};
+    }
+    if (mask & LIGHT_SETTING_BRIGHTNESS)
+    {
+        entries[count++] = (persistence_entry_t){VALUE_TYPE_INT8, "BEACON_BRIGHT", &applied.brightness};
+    }
+    if (mask & LIGHT_SETTING_OUTDOOR_MODE)
+    {
+        entries[count++] = (persistence_entry_t){VALUE_TYPE_INT8, "OUTDOOR_MODE", &applied.outdoor_mode};
+    }
+    if (mask & LIGHT_SETTING_OUTDOOR_LEVEL)
+    {
+        entries[count++] = (persistence_entry_t){VALUE_TYPE_INT8, "OUTDOOR_LEVEL", &applied.outdoor_level};
+    }
+    if (mask & LIGHT_SETTING_BEACON_ENABLED)
+    {
+        entries[count++] = (persistence_entry_t){VALUE_TYPE_INT8, "BEACON_ENABLED", &applied.beacon_enabled};
+    }
+    if (mask & LIGHT_SETTING_OUTDOOR_ENABLED)
+    {
+        entries[count++] = (persistence_entry_t){VALUE_TYPE_INT8, "OUTDOOR_ENABLED", &applied.outdoor_enabled};
+    }
+
+    persistence_save_many(entries, count);
+    remember(&applied, mask);
+    return ret;
+}
+
+esp_err_t light_restore(void)
+{
+    light_settings_t settings;
+    bool from_rtc = snapshot.magic == SNAPSHOT_MAGIC && snapshot.checksum == snapshot_checksum(&snapshot.settings);
+    if (from_rtc)
+    {
+        settings = snapshot.settings;
+    }
+    else
+    {
+        load_persisted(&settings);
+    }
+
+    // a value that is out of range keeps its default
+    uint32_t mask = LIGHT_SETTING_ALL;
+    if (light_validate(&settings, LIGHT_SETTING_CHARACTER) != ESP_OK)
+    {
+        mask &= ~LIGHT_SETTING_CHARACTER;
+        settings.character = beacon_get_character();
+    }
+    if (light_validate(&settings, LIGHT_SETTING_OUTDOOR_MODE) != ESP_OK)
+    {
+        mask &= ~LIGHT_SETTING_OUTDOOR_MODE;
+        settings.outdoor_mode = outdoor_get_mode();
+    }
+
+    esp_err_t ret = wled_init();
+    if (ret == ESP_OK)
+    {
+        ret = beacon_init();
+    }
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to initialize the beacon: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    // also when the lamps start off: starting them later must not allocate after the boot
+    ret = outdoor_init();
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to initialize the outdoor lamps: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    ret = apply(&settings, mask);
+    settings.beacon_enabled = beacon_is_running();
+    settings.outdoor_enabled = outdoor_is_running();
+    remember(&settings, LIGHT_SETTING_ALL);
+    ESP_LOGI(TAG, "Light state restored from %s after %" PRId64 " us", from_rtc ? "RTC memory" : "NVS",
+             esp_timer_get_time());
+    return ret;
+}
+
+light_stats_t light_get_stats(void)
+{
+    light_stats_t stats = {
+        .frames = atomic_load(&frame_count),
+        .max_frame_us = atomic_load(&max_frame_us),
+        .max_frame_latency_us = atomic_load(&max_frame_latency_us),
+        .first_photon_us = atomic_load(&first_photon_us),
+        .state_changes = atomic_load(&state_sequence),
+    };
+    light_command_get_stats(&stats);
+    return stats;
+}
+
+static void record_max(atomic_uint *max, uint32_t value)
+{
+    unsigned int current = atomic_load(max);
+    while (value > current && !atomic_compare_exchange_weak(max, &current, value))
+    {
+    }
+}
+
+void light_record_frame(uint32_t latency_us, uint32_t duration_us)
+{
+    atomic_fetch_add(&frame_count, 1);
+    record_max(&max_frame_us, duration_us);
+    record_max(&max_frame_latency_us, latency_us);
+}
+
+void light_record_photon(void)
+{
+    if (atomic_load_explicit(&first_photon_us, memory_order_relaxed) == 0)
+    {
+        unsigned int expected = 0;
+        atomic_compare_exchange_strong(&first_photon_us, &expected, (uint32_t)esp_timer_get_time());
+    }
+}
@@ -0,0 +1,235 @@
+#include "light_command.h"
+#include "beacon.h"
+#include "compositor.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "trace.h"
+#include "vclock.h"
+
+#include <inttypes.h>
+#include <stdatomic.h>
+
+static const char *TAG = "light_command";
+
+#define LIGHT_TARGET_COUNT 6 // one per LIGHT_SETTING_* bit
+#define LIGHT_TARGET_ALL ((1 << LIGHT_TARGET_COUNT) - 1)
+
+/*
+ * The slots of all targets and the pending mask share one word, so a producer publishes its whole batch with
+ * a single compare-and-swap and the controller takes values and mask with another: a batch is never split
+ * across two applies. A value that is overwritten before the controller ran is simply never applied, so the
+ * bus never blocks and never runs out of space. The pending mask uses the LIGHT_SETTING_* bits.
+ */
+typedef struct
+{
+    uint8_t shift;
+    uint8_t width;
+} slot_field_t;
+
+static const slot_field_t slot_fields[LIGHT_TARGET_COUNT] = {
+    {.shift = 6, .width = 1},  // beacon_enabled
+    {.shift = 7, .width = 1},  // outdoor_enabled
+    {.shift = 8, .width = 2},  // character
+    {.shift = 10, .width = 8}, // brightness
+    {.shift = 18, .width = 2}, // outdoor_mode
+    {.shift = 20, .width = 8}, // outdoor_level
+};
+
+// the outdoor_level slot stands for the live level at the time it is applied, see settle_timer_callback()
+#define LIVE_LEVEL_FLAG (1u << 28)
+
+_Static_assert(BEACON_CHARACTER_COUNT <= 4 && OUTDOOR_MODE_COUNT <= 4, "character and mode slots are 2 bits wide");
+
+static atomic_uint bus;
+
+#define CONTROLLER_TASK_STACK_SIZE 4096
+
+static TaskHandle_t controller_task_handle = NULL;
+static StackType_t controller_task_stack[CONTROLLER_TASK_STACK_SIZE];
+static StaticTask_t controller_task_buffer;
+
+#define LIVE_LEVEL_SETTLE_US (1000 * 1000)
+
+static vclock_timer_handle_t settle_timer;
+
+static atomic_uint commands_posted;
+static atomic_uint commands_coalesced;
+static atomic_uint max_apply_us;
+
+static unsigned int slot_value(unsigned int word, int target)
+{
+    return (word >> slot_fields[target].shift) & ((1u << slot_fields[target].width) - 1);
+}
+
+static void light_controller_task(void *arg)
+{
+    while (true)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        unsigned int word = atomic_load(&bus);
+        while (!atomic_compare_exchange_weak(&bus, &word, word & ~(LIGHT_TARGET_ALL | LIVE_LEVEL_FLAG)))
+        {
+        }
+        uint32_t mask = word & LIGHT_TARGET_ALL;
+        if (mask == 0)
+        {
+            continue;
+        }
+
+        light_settings_t settings = {
+            .beacon_enabled = slot_value(word, 0),
+            .outdoor_enabled = slot_value(word, 1),
+            .character = slot_value(word, 2),
+            .brightness = slot_value(word, 3),
+            .outdoor_mode = slot_value(word, 4),
+            .outdoor_level = (word & LIVE_LEVEL_FLAG) ? outdoor_get_level() : slot_value(word, 5),
+        };
+        latency_marks_t marks = {0};
+        latency_take_pending(&marks);
+
+        // switching the beacon is only visible with the frame it renders, everything else once it is applied
+        bool beacon_switches = (mask & LIGHT_SETTING_BEACON_ENABLED) && settings.beacon_enabled != beacon_is_running();
+        if (beacon_switches)
+        {
+            compositor_defer_marks(&marks);
+        }
+
+        int64_t start = esp_timer_get_time();
+        esp_err_t ret = light_apply(&settings, mask);
+        uint32_t duration = esp_timer_get_time() - start;
+        if (!beacon_switches)
+        {
+            latency_complete(&marks, vclock_now_us());
+        }
+
+        unsigned int current = atomic_load(&max_apply_us);
+        while (duration > current && !atomic_compare_exchange_weak(&max_apply_us, &current, duration))
+        {
+        }
+
+        TRACE("light apply mask=0x%x %u us", mask, duration);
+        if (ret != ESP_OK)
+        {
+            ESP_LOGW(TAG, "Failed to apply light settings 0x%" PRIx32 ": %s", mask, esp_err_to_name(ret));
+        }
+    }
+}
+
+static esp_err_t post(const light_settings_t *settings, uint32_t mask, latency_path_t path, int64_t start_us,
+                      unsigned int flags)
+{
+    mask &= LIGHT_TARGET_ALL;
+
+    if (controller_task_handle == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t ret = light_validate(settings, mask);
+    if (ret != ESP_OK || mask == 0)
+    {
+        return ret;
+    }
+
+    const unsigned int values[LIGHT_TARGET_COUNT] = {settings->beacon_enabled, settings->outdoor_enabled,
+                                                     settings->character, settings->brightness,
+                                                     settings->outdoor_mode, settings->outdoor_level};
+    unsigned int batch = mask | flags;
+    unsigned int batch_fields = mask;
+    if (mask & LIGHT_SETTING_OUTDOOR_LEVEL)
+    {
+        // a level posted later replaces a pending live one
+        batch_fields |= LIVE_LEVEL_FLAG;
+    }
+    for (int i = 0; i < LIGHT_TARGET_COUNT; i++)
+    {
+        if (mask & (1 << i))
+        {
+            unsigned int field_mask = (1u << slot_fields[i].width) - 1;
+            batch |= (values[i] & field_mask) << slot_fields[i].shift;
+            batch_fields |= field_mask << slot_fields[i].shift;
+        }
+    }
+
+    // before the pending bits, so the controller that picks up the values also picks up the start
+    latency_begin(path, start_us);
+    unsigned int word = atomic_load(&bus);
+    while (!atomic_compare_exchange_weak(&bus, &word, (word & ~batch_fields) | batch))
+    {
+    }
+    uint32_t overwritten = word & mask;
+    atomic_fetch_add(&commands_posted, __builtin_popcount(mask));
+    atomic_fetch_add(&commands_coalesced, __builtin_popcount(overwritten));
+
+    xTaskNotifyGive(controller_task_handle);
+    return ESP_OK;
+}
+
+// Posts the level a live channel settled on, so it is applied and persisted like any other command. The level
+// is read when it is applied: a live value that arrived in between must not be undone by the older one.
+static void settle_timer_callback(void *arg)
+{
+    light_settings_t settings = {.outdoor_level = outdoor_get_level()};
+    post(&settings, LIGHT_SETTING_OUTDOOR_LEVEL, LATENCY_PATH_COUNT, 0, LIVE_LEVEL_FLAG);
+}
+
+esp_err_t light_command_start(void)
+{
+    if (controller_task_handle != NULL)
+    {
+        return ESP_OK;
+    }
+
+    const esp_timer_create_args_t settle_timer_args = {
+        .callback = settle_timer_callback,
+        .name = "light_settle",
+    };
+    esp_err_t ret = vclock_timer_create(&settle_timer_args, &settle_timer);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to create settle timer: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    // applies what the BLE host posts, so it stays next to it
+    controller_task_handle =
+        xTaskCreateStaticPinnedToCore(light_controller_task, "light_ctrl", CONTROLLER_TASK_STACK_SIZE, NULL, 10,
+                                      controller_task_stack, &controller_task_buffer, LIGHT_BLE_CORE);
+    return ESP_OK;
+}
+
+esp_err_t light_command_post(const light_settings_t *settings, uint32_t mask)
+{
+    return light_command_post_timed(settings, mask, LATENCY_PATH_COUNT, 0);
+}
+
+esp_err_t light_command_post_timed(const light_settings_t *settings, uint32_t mask, latency_path_t path,
+                                   int64_t start_us)
+{
+    return post(settings, mask, path, start_us, 0);
+}
+
+esp_err_t light_command_set_live_level(uint8_t level)
+{
+    if (controller_task_handle == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    outdoor_set_level(level);
+
+    // every value restarts the timer, so a slider drag ends in a single commit of the value it stopped at;
+    // a value that arrives while that commit is applied restarts it again and is committed in turn
+    vclock_timer_stop(settle_timer);
+    return vclock_timer_start_once(settle_timer, LIVE_LEVEL_SETTLE_US);
+}
+
+void light_command_get_stats(light_stats_t *stats)
+{
+    stats->commands_posted = atomic_load(&commands_posted);
+    stats->commands_coalesced = atomic_load(&commands_coalesced);
+    stats->max_apply_us = atomic_load(&max_apply_us);
+}
@@ -1,9 +1,15 @@
 #include "outdoor.h"
+#include "color.h"
 #include "driver/ledc.h"
 #include "esp_log.h"
 #include "esp_random.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "light.h"
+#include "power.h"
+#include "vclock.h"
+
+#include <stdatomic.h>
 
 static const char *TAG = "outdoor";
 
@@ -11,78 +17,294 @@ static const char *TAG = "outdoor";
 #define MAX_DUTY 1023
 
 #define NORMAL_DUTY (MAX_DUTY * 0.9) // 90% brightness
+#define DIM_DUTY (MAX_DUTY * 0.3)    // 30% brightness
 
-#define FLICKER_CHANCE 2 // 2% chance of flickering per cycle
-#define FLICKER_COUNT 8  // Number of brightness changes during a flicker
+#define FLICKER_CHANCE 2     // 2% chance of flickering per cycle
+#define FLICKER_COUNT 8      // Number of brightness changes during a flicker
+#define FLICKER_CYCLE_MS 100 // Length of a cycle
 
-TaskHandle_t outdoor_task_handle = NULL;
+#define FADE_FRAME_MS 10       // the lamps pick up a new level once per frame
+#define FADE_FULL_RANGE_MS 250 // a fade from off to full; shorter distances take proportionally less
+#define FADE_STEP (MAX_DUTY * FADE_FRAME_MS / FADE_FULL_RANGE_MS)
 
-void outdoor_task(void *pvParameters)
+#define OUTDOOR_LAMP_COUNT 2
+
+typedef struct
 {
+    int gpio_num;
+    ledc_channel_t channel; ///< every lamp needs its own channel, they share the timer
+} outdoor_lamp_t;
 
-    int led_pin = *(int *)pvParameters;
+static const outdoor_lamp_t lamps[OUTDOOR_LAMP_COUNT] = {
+    {.gpio_num = CONFIG_LED_PIN_LEFT, .channel = LEDC_CHANNEL_0},
+    {.gpio_num = CONFIG_LED_PIN_RIGHT, .channel = LEDC_CHANNEL_1},
+};
 
-    ledc_timer_config_t ledc_timer = {.speed_mode = LEDC_LOW_SPEED_MODE,
-                                      .timer_num = LEDC_TIMER_0,
-                                      .duty_resolution = LEDC_RESOLUTION,
-                                      .freq_hz = 5000,
-                                      .clk_cfg = LEDC_AUTO_CLK};
-    ESP_ERROR_CHECK(ledc_timer_config(&ledc_timer));
+#define OUTDOOR_TASK_STACK_SIZE 2048
+
+static const char *task_names[OUTDOOR_LAMP_COUNT] = {"outdoor_task_left", "outdoor_task_right"};
+
+// the lamp tasks live forever and idle while the lamps are off, so their memory can be static
+static TaskHandle_t outdoor_task_handles[OUTDOOR_LAMP_COUNT] = {NULL, NULL};
+static StackType_t outdoor_task_stacks[OUTDOOR_LAMP_COUNT][OUTDOOR_TASK_STACK_SIZE];
+static StaticTask_t outdoor_task_buffers[OUTDOOR_LAMP_COUNT];
+
+static volatile bool running = false;
+static volatile outdoor_mode_t mode = OUTDOOR_MODE_FLICKER;
+static atomic_uint level = 255;
+static power_lock_t pwm_lock; ///< LEDC runs from the APB clock, a frequency change or light sleep would show
+
+static void set_duty(ledc_channel_t channel, uint32_t duty)
+{
+    ledc_set_duty(LEDC_LOW_SPEED_MODE, channel, duty);
+    ledc_update_duty(LEDC_LOW_SPEED_MODE, channel);
+    if (duty > 0)
+    {
+        light_record_photon();
+    }
+}
+
+// Duty of a mode at the current level
+static uint32_t level_duty(uint32_t mode_duty)
+{
+    return mode_duty * color_brightness_to_linear(atomic_load(&level)) / 65535;
+}
+
+// Waits for the given time; returns true if the lamp was woken early because its state changed
+static bool wait(uint32_t ms)
+{
+    return vclock_notify_take(pdTRUE, pdMS_TO_TICKS(ms)) != 0;
+}
 
-    ledc_channel_config_t ledc_channel = {.speed_mode = LEDC_LOW_SPEED_MODE,
-                                          .channel = LEDC_CHANNEL_0,
-                                          .timer_sel = LEDC_TIMER_0,
-                                          .intr_type = LEDC_INTR_DISABLE,
-                                          .gpio_num = led_pin,
-                                          .duty = 0,
-                                          .hpoint = 0};
-    ESP_ERROR_CHECK(ledc_channel_config(&ledc_channel));
+// Cycles until the next flicker: the chances are drawn up front, so the lamp sleeps through the quiet cycles
+static uint32_t cycles_until_flicker(void)
+{
+    uint32_t cycles = 1;
+    while (esp_random() % 100 >= FLICKER_CHANCE)
+    {
+        cycles++;
+    }
+    return cycles;
+}
+
+// Moves the lamp towards `target` one frame at a time; returns true if woken early because its state changed
+static bool fade_to(ledc_channel_t channel, uint32_t *duty, uint32_t target)
+{
+    while (*duty != target)
+    {
+        if (*duty < target)
+        {
+            *duty = target - *duty > FADE_STEP ? *duty + FADE_STEP : target;
+        }
+        else
+        {
+            *duty = *duty - target > FADE_STEP ? *duty - FADE_STEP : target;
+        }
+        set_duty(channel, *duty);
+
+        if (*duty != target && wait(FADE_FRAME_MS))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void wake_lamps(void)
+{
+    for (int i = 0; i < OUTDOOR_LAMP_COUNT; i++)
+    {
+        if (outdoor_task_handles[i] != NULL)
+        {
+            xTaskNotifyGive(outdoor_task_handles[i]);
+        }
+    }
+}
+
+void outdoor_task(void *pvParameters)
+{
+    const outdoor_lamp_t *lamp = pvParameters;
+    uint32_t duty = 0;
 
     while (1)
     {
-        ledc_set_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0, NORMAL_DUTY);
-        ledc_update_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0);
+        if (!running)
+        {
+            ledc_stop(LEDC_LOW_SPEED_MODE, lamp->channel, 0);
+            duty = 0;
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        // a fade that was woken early is restarted with the newest mode and level
+        switch (mode)
+        {
+        case OUTDOOR_MODE_STEADY:
+            // nothing to do until the state changes
+            if (!fade_to(lamp->channel, &duty, level_duty(NORMAL_DUTY)))
+            {
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            }
+            break;
 
-        uint32_t random_val = esp_random() % 100;
+        case OUTDOOR_MODE_DIM:
+            if (!fade_to(lamp->channel, &duty, level_duty(DIM_DUTY)))
+            {
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            }
+            break;
 
-        if (random_val < FLICKER_CHANCE)
+        case OUTDOOR_MODE_FLICKER:
+        default:
         {
+            uint32_t normal_duty = level_duty(NORMAL_DUTY);
+            if (fade_to(lamp->channel, &duty, normal_duty) || wait(cycles_until_flicker() * FLICKER_CYCLE_MS))
+            {
+                break;
+            }
+
             for (int i = 0; i < FLICKER_COUNT; i++)
             {
-                uint32_t flicker_duty = (NORMAL_DUTY * 0.3) + (esp_random() % (uint32_t)(NORMAL_DUTY * 0.4));
-                ledc_set_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0, flicker_duty);
-                ledc_update_duty(LEDC_LOW_SPEED_MODE, LEDC_CHANNEL_0);
+                duty = (normal_duty * 0.3) + (esp_random() % ((uint32_t)(normal_duty * 0.4) + 1));
+                set_duty(lamp->channel, duty);
 
-                vTaskDelay(pdMS_TO_TICKS(20 + (esp_random() % 50)));
+                if (wait(20 + (esp_random() % 50)))
+                {
+                    break;
+                }
             }
+
+            // a flickering bulb catches itself at once
+            duty = normal_duty;
+            set_duty(lamp->channel, duty);
+            break;
+        }
+        }
+    }
+}
+
+esp_err_t outdoor_init(void)
+{
+    ledc_timer_config_t ledc_timer = {.speed_mode = LEDC_LOW_SPEED_MODE,
+                                      .timer_num = LEDC_TIMER_0,
+                                      .duty_resolution = LEDC_RESOLUTION,
+                                      .freq_hz = 5000,
+                                      .clk_cfg = LEDC_AUTO_CLK};
+    esp_err_t ret = ledc_timer_config(&ledc_timer);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to configure LEDC timer: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    ret = power_lock_create(POWER_NEED_APB_MAX, "outdoor", &pwm_lock);
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+
+    for (int i = 0; i < OUTDOOR_LAMP_COUNT; i++)
+    {
+        ledc_channel_config_t ledc_channel = {.speed_mode = LEDC_LOW_SPEED_MODE,
+                                              .channel = lamps[i].channel,
+                                              .timer_sel = LEDC_TIMER_0,
+                                              .intr_type = LEDC_INTR_DISABLE,
+                                              .gpio_num = lamps[i].gpio_num,
+                                              .duty = 0,
+                                              .hpoint = 0};
+        ret = ledc_channel_config(&ledc_channel);
+        if (ret != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to configure LEDC channel %d: %s", lamps[i].channel, esp_err_to_name(ret));
+            return ret;
         }
+    }
 
-        vTaskDelay(pdMS_TO_TICKS(100));
+    // last, so the lamps exist only when everything they use is set up
+    for (int i = 0; i < OUTDOOR_LAMP_COUNT; i++)
+    {
+        outdoor_task_handles[i] =
+            xTaskCreateStaticPinnedToCore(outdoor_task, task_names[i], OUTDOOR_TASK_STACK_SIZE, (void *)&lamps[i], 5,
+                                          outdoor_task_stacks[i], &outdoor_task_buffers[i], LIGHT_RENDER_CORE);
     }
+
+    // mode and level are left alone: light_restore() and the commands set them, possibly before the first start
+    return ESP_OK;
 }
 
 esp_err_t outdoor_start(void)
 {
-    ESP_LOGI(TAG, "Simulation of a defective light bulb started.");
+    if (outdoor_is_running())
+    {
+        return ESP_OK;
+    }
 
-    static const int led_left_pin = CONFIG_LED_PIN_LEFT;
-    xTaskCreate(outdoor_task, "outdoor_task_left", 2048, (void *)&led_left_pin, 5, &outdoor_task_handle);
+    if (outdoor_task_handles[0] == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
 
-    static const int led_right_pin = CONFIG_LED_PIN_RIGHT;
-    xTaskCreate(outdoor_task, "outdoor_task_right", 2048, (void *)&led_right_pin, 5, &outdoor_task_handle);
+    power_lock_acquire(pwm_lock);
+    running = true;
+    wake_lamps();
 
+    ESP_LOGI(TAG, "Outdoor lamps started (mode %d).", mode);
+    light_state_changed();
     return ESP_OK;
 }
 
 esp_err_t outdoor_stop(void)
 {
-    if (outdoor_task_handle == NULL)
+    if (!outdoor_is_running())
     {
         return ESP_FAIL;
     }
 
-    vTaskDelete(outdoor_task_handle);
-    outdoor_task_handle = NULL;
+    // the lamp tasks switch their channel off themselves, so a running flicker cannot turn it on again
+    running = false;
+    wake_lamps();
+    power_lock_release(pwm_lock);
 
+    light_state_changed();
     return ESP_OK;
 }
+
+bool outdoor_is_running(void)
+{
+    return running;
+}
+
+outdoor_mode_t outdoor_get_mode(void)
+{
+    return mode;
+}
+
+esp_err_t outdoor_set_mode(outdoor_mode_t new_mode)
+{
+    if (new_mode >= OUTDOOR_MODE_COUNT)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (new_mode == mode)
+    {
+        return ESP_OK;
+    }
+
+    mode = new_mode;
+    wake_lamps();
+    light_state_changed();
+    return ESP_OK;
+}
+
+uint8_t outdoor_get_level(void)
+{
+    return atomic_load(&level);
+}
+
+void outdoor_set_level(uint8_t new_level)
+{
+    if (atomic_exchange(&level, new_level) != new_level)
+    {
+        wake_lamps();
+    }
+}
@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+"""Generates the lookup tables of the colour pipeline (color.c) at build time.
+
+    gen_color_lut.py --gamma 2.8 [--white-kelvin 4500] -o color_lut.h
+
+- gamma: authored 8 bit value -> linear 16 bit intensity, one table per channel
+- brightness: 8 bit brightness -> linear 16 bit scale along the CIE 1931 lightness curve, so equal steps look equal
+- white (only with --white-kelvin): splits the common part of a linear RGB colour off to the white LED, measured in
+  the colour of that LED, so warm or cool white LEDs do not shift the hue
+"""
+
+import argparse
+import math
+
+CHANNELS = ('red', 'green', 'blue')
+
+
+def gamma_table(gamma):
+    return [round((v / 255) ** gamma * 65535) for v in range(256)]
+
+
+def brightness_table():
+    table = []
+    for v in range(256):
+        lightness = v / 255 * 100
+        if lightness <= 8:
+            luminance = lightness / 903.3
+        else:
+            luminance = ((lightness + 16) / 116) ** 3
+        table.append(round(luminance * 65535))
+    return table
+
+
+def kelvin_to_rgb(kelvin):
+    """Colour of a black body, normalised to its brightest channel (Tanner Helland's fit)."""
+    t = kelvin / 100
+    if t <= 66:
+        red = 255
+        green = 99.4708025861 * math.log(t) - 161.1195681661
+        blue = 0 if t <= 19 else 138.5177312231 * math.log(t - 10) - 305.0447927307
+    else:
+        red = 329.698727446 * (t - 60) ** -0.1332047592
+        green = 288.1221695283 * (t - 60) ** -0.0755148492
+        blue = 255
+    rgb = [min(max(c, 0), 255) / 255 for c in (red, green, blue)]
+    # the fit is in sRGB, the pipeline works on linear intensities
+    rgb = [c ** 2.2 for c in rgb]
+    return [c / max(rgb) for c in rgb]
+
+
+def format_table(name, ctype, rows, comment):
+    lines = ['// %s' % comment]
+    if isinstance(rows[0], list):
+        lines.append('static const %s %s[%d][256] = {' % (ctype, name, len(rows)))
+        for channel, row in zip(CHANNELS, rows):
+            lines.append('    // %s' % channel)
+            lines.append('    {')
+            lines.extend(format_values(row, 8))
+            lines.append('    },')
+    else:
+        lines.append('static const %s %s[256] = {' % (ctype, name))
+        lines.extend(format_values(rows, 4))
+    lines.append('};')
+    return '\n'.join(lines)
+
+
+def format_values(values, indent):
+    per_line = 16 if max(values) < 256 else 12
+    return [' ' * indent + ', '.join('%d' % v for v in values[i:i + per_line]) + ','
+            for i in range(0, len(values), per_line)]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--gamma', type=float, nargs='+', default=[2.8],
+                        help='one exponent for all channels or one per channel (red green blue)')
+    parser.add_argument('--white-kelvin', type=int, help='colour temperature of the white LEDs, enables RGBW')
+    parser.add_argument('-o', '--output', required=True)
+    args = parser.parse_args()
+
+    gammas = args.gamma * 3 if len(args.gamma) == 1 else args.gamma
+    if len(gammas) != 3:
+        parser.error('--gamma takes one or three values')
+
+    parts = [
+        '#pragma once',
+        '',
+        '// Generated by gen_color_lut.py --gamma %s%s, do not edit' %
+        (' '.join('%g' % g for g in args.gamma),
+         ' --white-kelvin %d' % args.white_kelvin if args.white_kelvin else ''),
+        '',
+        '#include <stdint.h>',
+        '',
+        format_table('color_gamma_lut', 'uint16_t', [gamma_table(g) for g in gammas],
+                     'authored value -> linear intensity (0-65535)'),
+        '',
+        format_table('color_brightness_lut', 'uint16_t', brightness_table(),
+                     'brightness -> linear scale (0-65535)'),
+    ]
+
+    if args.white_kelvin:
+        white = kelvin_to_rgb(args.white_kelvin)
+        # floor() keeps the white part of every channel below the channel itself, so the subtraction cannot wrap
+        share = [[min(255, math.floor(v / w)) if w > 0 else 255 for v in range(256)] for w in white]
+        part = [[round(v * w) for v in range(256)] for w in white]
+        parts += [
+            '',
+            '// white LED colour: %s' % ', '.join('%s %.3f' % (c, w) for c, w in zip(CHANNELS, white)),
+            format_table('color_white_share_lut', 'uint8_t', share,
+                         'linear channel value -> white level that channel could carry'),
+            '',
+            format_table('color_white_part_lut', 'uint8_t', part,
+                         'white level -> part of the channel it replaces'),
+        ]
+
+    with open(args.output, 'w') as f:
+        f.write('\n'.join(parts) + '\n')
+
+
+if __name__ == '__main__':
+    main()
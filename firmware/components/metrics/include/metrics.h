@@ -0,0 +1,70 @@
+#pragma once
+
+#include "esp_err.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define METRICS_MAX_TASKS 24
+#define METRICS_TASK_NAME_LEN 12
+
+typedef struct
+{
+    char name[METRICS_TASK_NAME_LEN];
+    uint16_t stack_free;  ///< stack high-water mark in bytes
+    uint8_t cpu_percent;  ///< share of one core since the previous sample
+    uint8_t core;         ///< pinned core, 0xFF if the task is not pinned
+} metrics_task_t;
+
+typedef struct
+{
+    uint32_t uptime_s;
+    uint32_t heap_free;
+    uint32_t heap_min_free;
+    uint32_t heap_largest_block;
+    uint32_t heap_allocs_after_boot; ///< only counted with CONFIG_HEAP_GUARD
+    uint32_t light_frames;
+    uint32_t light_max_frame_us;
+    uint32_t light_state_changes;
+    uint8_t task_count;
+    metrics_task_t tasks[METRICS_MAX_TASKS];
+} metrics_snapshot_t;
+
+/// Upper bound of metrics_pack() output
+#define METRICS_PACKED_MAX_SIZE (2 + 8 * 4 + METRICS_MAX_TASKS * (METRICS_TASK_NAME_LEN + 4))
+
+/**
+ * @brief Prepares the metrics module; must be called before the first sample.
+ */
+void metrics_init(void);
+
+/**
+ * @brief Marks the end of the boot phase.
+ *
+ * With CONFIG_HEAP_GUARD every heap allocation from now on is counted, traced and - with
+ * CONFIG_HEAP_GUARD_ABORT - aborts, so the allocation shows up with its backtrace.
+ */
+void metrics_boot_complete(void);
+
+/**
+ * @brief Samples task, heap and light pipeline statistics.
+ *
+ * Uses only static buffers, so the cost is bounded by METRICS_MAX_TASKS and independent of the log level.
+ * CPU shares are computed against the previous call.
+ */
+void metrics_sample(metrics_snapshot_t *snapshot);
+
+/**
+ * @brief Serializes a snapshot into the little-endian wire format of the metrics characteristic.
+ *
+ * Layout: [version][task count][uptime][heap free][heap min free][largest block][frames][max frame us]
+ * [state changes][heap allocations after boot] followed by [name (12)][stack free (u16)][cpu %][core] per task.
+ *
+ * @return Number of bytes written, at most METRICS_PACKED_MAX_SIZE.
+ */
+size_t metrics_pack(const metrics_snapshot_t *snapshot, uint8_t *out);
+
+/**
+ * @brief Registers the `metrics` console command.
+ */
+esp_err_t metrics_register_console_command(void);
@@ -0,0 +1,221 @@
+#include "metrics.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_attr.h"
+#include "esp_console.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "light.h"
+#include "sdkconfig.h"
+#include "trace.h"
+
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_heap_caps.h"
+#endif
+
+#define METRICS_FORMAT_VERSION 0x02
+
+static TaskStatus_t task_status[METRICS_MAX_TASKS];
+
+// run time counters of the previous sample, to turn totals into shares
+static UBaseType_t previous_task_number[METRICS_MAX_TASKS];
+static configRUN_TIME_COUNTER_TYPE previous_task_runtime[METRICS_MAX_TASKS];
+static UBaseType_t previous_count;
+static configRUN_TIME_COUNTER_TYPE previous_total_runtime;
+
+static SemaphoreHandle_t sample_mutex;
+static StaticSemaphore_t sample_mutex_buffer;
+
+static bool boot_complete = false;
+static uint32_t heap_allocs_after_boot;
+
+#if CONFIG_HEAP_GUARD
+// Called by the heap allocator for every allocation, also from IRAM code
+void IRAM_ATTR esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps)
+{
+    if (!boot_complete)
+    {
+        return;
+    }
+
+    __atomic_fetch_add(&heap_allocs_after_boot, 1, __ATOMIC_RELAXED);
+    TRACE("heap alloc after boot: %u bytes, caps 0x%x", size, caps);
+#if CONFIG_HEAP_GUARD_ABORT
+    abort();
+#endif
+}
+
+void IRAM_ATTR esp_heap_trace_free_hook(void *ptr)
+{
+}
+#endif
+
+static configRUN_TIME_COUNTER_TYPE previous_runtime_of(UBaseType_t task_number)
+{
+    for (UBaseType_t i = 0; i < previous_count; i++)
+    {
+        if (previous_task_number[i] == task_number)
+        {
+            return previous_task_runtime[i];
+        }
+    }
+    return 0;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+void metrics_init(void)
+{
+    sample_mutex = xSemaphoreCreateMutexStatic(&sample_mutex_buffer);
+}
+
+void metrics_boot_complete(void)
+{
+    boot_complete = true;
+}
+
+void metrics_sample(metrics_snapshot_t *snapshot)
+{
+    memset(snapshot, 0, sizeof(*snapshot));
+
+    snapshot->uptime_s = (uint32_t)(esp_timer_get_time() / 1000000);
+
+#if !CONFIG_IDF_TARGET_LINUX
+    // the host build runs on the process heap, which tells nothing about the device
+    multi_heap_info_t heap_info;
+    heap_caps_get_info(&heap_info, MALLOC_CAP_8BIT);
+    snapshot->heap_free = heap_info.total_free_bytes;
+    snapshot->heap_min_free = heap_info.minimum_free_bytes;
+    snapshot->heap_largest_block = heap_info.largest_free_block;
+#endif
+    snapshot->heap_allocs_after_boot = __atomic_load_n(&heap_allocs_after_boot, __ATOMIC_RELAXED);
+
+    light_stats_t light_stats = light_get_stats();
+    snapshot->light_frames = light_stats.frames;
+    snapshot->light_max_frame_us = light_stats.max_frame_us;
+    snapshot->light_state_changes = light_stats.state_changes;
+
+    // the BLE host task and the console may sample at the same time
+    xSemaphoreTake(sample_mutex, portMAX_DELAY);
+
+    configRUN_TIME_COUNTER_TYPE total_runtime = 0;
+    UBaseType_t count = uxTaskGetSystemState(task_status, METRICS_MAX_TASKS, &total_runtime);
+    configRUN_TIME_COUNTER_TYPE elapsed = total_runtime - previous_total_runtime;
+
+    for (UBaseType_t i = 0; i < count; i++)
+    {
+        const TaskStatus_t *status = &task_status[i];
+        metrics_task_t *task = &snapshot->tasks[i];
+
+        strlcpy(task->name, status->pcTaskName, sizeof(task->name));
+        task->stack_free = status->usStackHighWaterMark > UINT16_MAX ? UINT16_MAX : status->usStackHighWaterMark;
+#if CONFIG_FREERTOS_VTASKLIST_INCLUDE_COREID
+        task->core = status->xCoreID == tskNO_AFFINITY ? 0xFF : status->xCoreID;
+#else
+        task->core = 0xFF;
+#endif
+
+        configRUN_TIME_COUNTER_TYPE delta = status->ulRunTimeCounter - previous_runtime_of(status->xTaskNumber);
+        uint64_t percent = elapsed > 0 ? (uint64_t)delta * 100 / elapsed : 0;
+        task->cpu_percent = percent > 100 ? 100 : percent;
+    }
+    snapshot->task_count = count;
+
+    for (UBaseType_t i = 0; i < count; i++)
+    {
+        previous_task_number[i] = task_status[i].xTaskNumber;
+        previous_task_runtime[i] = task_status[i].ulRunTimeCounter;
+    }
+    previous_count = count;
+    previous_total_runtime = total_runtime;
+
+    xSemaphoreGive(sample_mutex);
+}
+
+size_t metrics_pack(const metrics_snapshot_t *snapshot, uint8_t *out)
+{
+    size_t len = 0;
+    out[len++] = METRICS_FORMAT_VERSION;
+    out[len++] = snapshot->task_count;
+
+    const uint32_t values[] = {snapshot->uptime_s,           snapshot->heap_free,    snapshot->heap_min_free,
+                               snapshot->heap_largest_block, snapshot->light_frames, snapshot->light_max_frame_us,
+                               snapshot->light_state_changes, snapshot->heap_allocs_after_boot};
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+    {
+        put_le32(&out[len], values[i]);
+        len += 4;
+    }
+
+    for (uint8_t i = 0; i < snapshot->task_count; i++)
+    {
+        const metrics_task_t *task = &snapshot->tasks[i];
+        memcpy(&out[len], task->name, METRICS_TASK_NAME_LEN);
+        len += METRICS_TASK_NAME_LEN;
+        out[len++] = task->stack_free;
+        out[len++] = task->stack_free >> 8;
+        out[len++] = task->cpu_percent;
+        out[len++] = task->core;
+    }
+    return len;
+}
+
+// printf instead of ESP_LOG, so the output survives release builds with logging compiled out
+static int metrics_command(int argc, char **argv)
+{
+    static metrics_snapshot_t snapshot;
+    metrics_sample(&snapshot);
+
+    printf("uptime %" PRIu32 " s\n", snapshot.uptime_s);
+    printf("heap free %" PRIu32 ", min free %" PRIu32 ", largest block %" PRIu32 " (fragmentation %" PRIu32 "%%)\n",
+           snapshot.heap_free, snapshot.heap_min_free, snapshot.heap_largest_block,
+           snapshot.heap_free > 0 ? 100 - snapshot.heap_largest_block * 100 / snapshot.heap_free : 0);
+#if CONFIG_HEAP_GUARD
+    printf("heap allocations after boot %" PRIu32 "\n", snapshot.heap_allocs_after_boot);
+#endif
+    printf("light frames %" PRIu32 ", max frame %" PRIu32 " us, state changes %" PRIu32 "\n",
+           snapshot.light_frames, snapshot.light_max_frame_us, snapshot.light_state_changes);
+
+    light_stats_t light_stats = light_get_stats();
+    printf("light commands %" PRIu32 ", coalesced %" PRIu32 ", max apply %" PRIu32 " us\n",
+           light_stats.commands_posted, light_stats.commands_coalesced, light_stats.max_apply_us);
+    printf("light max frame latency %" PRIu32 " us\n", light_stats.max_frame_latency_us);
+    printf("light first photon %" PRIu32 " us after boot\n", light_stats.first_photon_us);
+
+    printf("%-12s %10s %5s %4s\n", "task", "stack free", "cpu%", "core");
+    for (uint8_t i = 0; i < snapshot.task_count; i++)
+    {
+        const metrics_task_t *task = &snapshot.tasks[i];
+        if (task->core == 0xFF)
+        {
+            printf("%-12.12s %10u %5u %4s\n", task->name, task->stack_free, task->cpu_percent, "-");
+        }
+        else
+        {
+            printf("%-12.12s %10u %5u %4u\n", task->name, task->stack_free, task->cpu_percent, task->core);
+        }
+    }
+    return 0;
+}
+
+esp_err_t metrics_register_console_command(void)
+{
+    const esp_console_cmd_t command = {
+        .command = "metrics",
+        .help = "Show task stacks and CPU shares, heap and light pipeline counters",
+        .func = metrics_command,
+    };
+    return esp_console_cmd_register(&command);
+}
@@ -0,0 +1,377 @@
+#include "ota_stream.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Feeds raw and heatshrink compressed images through ota_stream_feed() into a memory writer, the stand-in for
+ * the OTA partition, and compares what arrives with the original. The compressed images come from a greedy
+ * encoder below that writes the bit stream of `heatshrink -e -w 10 -l 5`; a hand-assembled stream pins the
+ * format itself.
+ */
+
+#define IMAGE_SIZE (48 * 1024)
+#define CHUNK_PAYLOAD 244 ///< MTU 247 minus the ATT header, the largest chunk a phone writes
+#define COMPRESSED_MAX (IMAGE_SIZE + IMAGE_SIZE / 8 + 1)
+
+typedef struct
+{
+    uint8_t data[IMAGE_SIZE];
+    size_t len;
+    size_t capacity; ///< writes beyond fail, like a full partition
+    uint32_t writes;
+} memory_writer_t;
+
+typedef struct
+{
+    const uint8_t *data;
+    size_t len;
+    size_t payload;
+    uint16_t first_seq;
+} chunker_t;
+
+typedef struct
+{
+    uint8_t *out;
+    size_t len;
+    uint32_t acc;
+    uint8_t bits;
+} bit_writer_t;
+
+static uint8_t image[IMAGE_SIZE];
+static uint8_t compressed[COMPRESSED_MAX];
+static size_t compressed_len;
+static memory_writer_t writer;
+static ota_stream_t stream;
+static int checks = 0;
+static int failures = 0;
+
+static void expect(bool ok, const char *what)
+{
+    checks++;
+    if (!ok)
+    {
+        failures++;
+        printf("FAIL: %s\n", what);
+    }
+}
+
+static esp_err_t memory_write(void *ctx, const uint8_t *data, size_t len)
+{
+    memory_writer_t *w = ctx;
+    if (w->len + len > w->capacity)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(&w->data[w->len], data, len);
+    w->len += len;
+    w->writes++;
+    return ESP_OK;
+}
+
+static void start(bool is_compressed, size_t capacity)
+{
+    memset(&writer, 0, sizeof(writer));
+    writer.capacity = capacity;
+    ota_stream_init(&stream, is_compressed, memory_write, &writer);
+}
+
+// bit by bit, as independent from the nibble table of the stream as possible
+static uint32_t crc32_reference(const uint8_t *data, size_t len)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < len; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (crc & 1 ? 0xEDB88320 : 0);
+        }
+    }
+    return ~crc;
+}
+
+static uint32_t next_random(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+// noise, runs and repeats from inside and just beyond the window, so every kind of symbol occurs
+static void make_image(void)
+{
+    static const char text[] = "Leuchtturm Warnemuende, Kennung Blz.(2) 12s ";
+    uint32_t seed = 1;
+    size_t pos = 0;
+    while (pos < IMAGE_SIZE)
+    {
+        uint32_t r = next_random(&seed);
+        size_t n = 1 + (r >> 8) % 200;
+        if (n > IMAGE_SIZE - pos)
+        {
+            n = IMAGE_SIZE - pos;
+        }
+        size_t distance = 1 + (r >> 16) % 1100;
+        for (size_t i = 0; i < n; i++, pos++)
+        {
+            switch (r % 4)
+            {
+            case 0:
+                image[pos] = next_random(&seed);
+                break;
+            case 1:
+                image[pos] = r >> 24;
+                break;
+            case 2:
+                image[pos] = pos >= distance ? image[pos - distance] : text[pos % (sizeof(text) - 1)];
+                break;
+            default:
+                image[pos] = text[pos % (sizeof(text) - 1)];
+                break;
+            }
+        }
+    }
+}
+
+static void put_bits(bit_writer_t *w, uint32_t value, uint8_t count)
+{
+    while (count-- > 0)
+    {
+        w->acc = (w->acc << 1) | ((value >> count) & 1);
+        if (++w->bits == 8)
+        {
+            w->out[w->len++] = w->acc;
+            w->acc = 0;
+            w->bits = 0;
+        }
+    }
+}
+
+static size_t compress(const uint8_t *in, size_t len, uint8_t *out)
+{
+    const size_t window = 1 << OTA_STREAM_WINDOW_BITS;
+    const size_t max_count = 1 << OTA_STREAM_LOOKAHEAD_BITS;
+    bit_writer_t w = {.out = out};
+
+    size_t pos = 0;
+    while (pos < len)
+    {
+        size_t best_count = 0;
+        size_t best_offset = 0;
+        for (size_t offset = 1; offset <= window && offset <= pos; offset++)
+        {
+            size_t count = 0;
+            while (count < max_count && pos + count < len && in[pos + count] == in[pos + count - offset])
+            {
+                count++;
+            }
+            if (count > best_count)
+            {
+                best_count = count;
+                best_offset = offset;
+            }
+        }
+
+        // a back-reference takes 16 bits, two literals 18
+        if (best_count >= 2)
+        {
+            put_bits(&w, 0, 1);
+            put_bits(&w, best_offset - 1, OTA_STREAM_WINDOW_BITS);
+            put_bits(&w, best_count - 1, OTA_STREAM_LOOKAHEAD_BITS);
+            pos += best_count;
+        }
+        else
+        {
+            put_bits(&w, 1, 1);
+            put_bits(&w, in[pos], 8);
+            pos++;
+        }
+    }
+    if (w.bits > 0)
+    {
+        put_bits(&w, 0, 8 - w.bits);
+    }
+    return w.len;
+}
+
+static size_t chunk_count(const chunker_t *c)
+{
+    return (c->len + c->payload - 1) / c->payload;
+}
+
+static size_t make_chunk(const chunker_t *c, size_t index, uint8_t *chunk)
+{
+    size_t offset = index * c->payload;
+    size_t len = c->len - offset < c->payload ? c->len - offset : c->payload;
+    uint16_t seq = c->first_seq + index;
+    chunk[0] = seq;
+    chunk[1] = seq >> 8;
+    memcpy(&chunk[OTA_STREAM_CHUNK_HEADER_SIZE], &c->data[offset], len);
+    return OTA_STREAM_CHUNK_HEADER_SIZE + len;
+}
+
+static esp_err_t feed(const chunker_t *c, size_t index)
+{
+    uint8_t chunk[OTA_STREAM_CHUNK_HEADER_SIZE + CHUNK_PAYLOAD];
+    return ota_stream_feed(&stream, chunk, make_chunk(c, index, chunk));
+}
+
+static esp_err_t feed_range(const chunker_t *c, size_t first, size_t end)
+{
+    for (size_t i = first; i < end; i++)
+    {
+        esp_err_t ret = feed(c, i);
+        if (ret != ESP_OK)
+        {
+            return ret;
+        }
+    }
+    return ESP_OK;
+}
+
+static void expect_image(const char *name, size_t bytes_in)
+{
+    char what[96];
+    snprintf(what, sizeof(what), "%s: image size", name);
+    expect(writer.len == IMAGE_SIZE && stream.bytes_out == IMAGE_SIZE, what);
+    snprintf(what, sizeof(what), "%s: image content", name);
+    expect(writer.len == IMAGE_SIZE && memcmp(writer.data, image, IMAGE_SIZE) == 0, what);
+    snprintf(what, sizeof(what), "%s: CRC-32", name);
+    expect(stream.crc == crc32_reference(image, IMAGE_SIZE), what);
+    snprintf(what, sizeof(what), "%s: payload bytes", name);
+    expect(stream.bytes_in == bytes_in, what);
+}
+
+// "abc" as literals, then 8 bytes from 3 back, which overlap the bytes they produce
+static void check_known_stream(void)
+{
+    static const uint8_t bits[] = {0xb0, 0xd8, 0xac, 0x60, 0x08, 0xe0};
+    chunker_t c = {.data = bits, .len = sizeof(bits), .payload = 1};
+
+    start(true, IMAGE_SIZE);
+    esp_err_t ret = feed_range(&c, 0, chunk_count(&c));
+    if (ret == ESP_OK)
+    {
+        ret = ota_stream_flush(&stream);
+    }
+    expect(ret == ESP_OK, "known stream: accepted");
+    expect(writer.len == 11 && memcmp(writer.data, "abcabcabcab", 11) == 0, "known stream: decoded");
+}
+
+static void check_round_trip(bool is_compressed, size_t payload)
+{
+    chunker_t c = {
+        .data = is_compressed ? compressed : image,
+        .len = is_compressed ? compressed_len : IMAGE_SIZE,
+        .payload = payload,
+    };
+
+    start(is_compressed, IMAGE_SIZE);
+    esp_err_t ret = feed_range(&c, 0, chunk_count(&c));
+    if (ret == ESP_OK)
+    {
+        ret = ota_stream_flush(&stream);
+    }
+
+    char name[48];
+    snprintf(name, sizeof(name), "%s, %zu byte chunks", is_compressed ? "compressed" : "raw", payload);
+    expect(ret == ESP_OK, name);
+    expect_image(name, c.len);
+    printf("%-28s %6zu chunks, %5u writes\n", name, chunk_count(&c), (unsigned)writer.writes);
+}
+
+// a chunk the phone sent again, because it missed the acknowledgement, is ignored
+static void check_duplicate(void)
+{
+    chunker_t c = {.data = compressed, .len = compressed_len, .payload = CHUNK_PAYLOAD};
+
+    start(true, IMAGE_SIZE);
+    expect(feed_range(&c, 0, 10) == ESP_OK, "duplicate: first chunks");
+    size_t bytes_in = stream.bytes_in;
+    size_t bytes_out = stream.bytes_out + stream.out_len;
+    expect(feed(&c, 9) == ESP_OK, "duplicate: last chunk again is accepted");
+    expect(feed(&c, 0) == ESP_OK, "duplicate: first chunk again is accepted");
+    expect(stream.next_seq == 10 && stream.bytes_in == bytes_in, "duplicate: not consumed");
+    expect(stream.bytes_out + stream.out_len == bytes_out, "duplicate: nothing decoded");
+
+    esp_err_t ret = feed_range(&c, 10, chunk_count(&c));
+    expect(ret == ESP_OK && ota_stream_flush(&stream) == ESP_OK, "duplicate: remaining chunks");
+    expect_image("duplicate", compressed_len);
+}
+
+// a lost chunk stops the stream until it arrives, nothing after it may be decoded out of order
+static void check_gap(void)
+{
+    chunker_t c = {.data = compressed, .len = compressed_len, .payload = CHUNK_PAYLOAD};
+
+    start(true, IMAGE_SIZE);
+    expect(feed_range(&c, 0, 5) == ESP_OK, "gap: first chunks");
+    size_t bytes_out = stream.bytes_out + stream.out_len;
+    expect(feed(&c, 6) == ESP_ERR_INVALID_STATE, "gap: chunk after the missing one is rejected");
+    uint16_t ahead = 5 + 0x7fff;
+    const uint8_t far_ahead[] = {ahead, ahead >> 8, 0x00};
+    expect(ota_stream_feed(&stream, far_ahead, sizeof(far_ahead)) == ESP_ERR_INVALID_STATE,
+           "gap: chunk far ahead is rejected");
+    expect(stream.next_seq == 5 && stream.bytes_out + stream.out_len == bytes_out, "gap: nothing decoded");
+
+    esp_err_t ret = feed_range(&c, 5, chunk_count(&c));
+    expect(ret == ESP_OK && ota_stream_flush(&stream) == ESP_OK, "gap: missing chunk and the rest");
+    expect_image("gap", compressed_len);
+}
+
+// raw images of several MB take more than 65536 chunks of a small MTU
+static void check_sequence_wrap(void)
+{
+    chunker_t c = {.data = image, .len = IMAGE_SIZE, .payload = CHUNK_PAYLOAD, .first_seq = 0xfff0};
+
+    start(false, IMAGE_SIZE);
+    stream.next_seq = c.first_seq;
+    expect(feed_range(&c, 0, 0x20) == ESP_OK, "sequence wrap: chunks across 0xffff");
+    expect(feed(&c, 0x0e) == ESP_OK && stream.next_seq == 0x0010, "sequence wrap: duplicate of 0xfffe ignored");
+
+    esp_err_t ret = feed_range(&c, 0x20, chunk_count(&c));
+    expect(ret == ESP_OK && ota_stream_flush(&stream) == ESP_OK, "sequence wrap: remaining chunks");
+    expect_image("sequence wrap", IMAGE_SIZE);
+}
+
+static void check_errors(void)
+{
+    static const uint8_t header_only[] = {0x00};
+    start(true, IMAGE_SIZE);
+    expect(ota_stream_feed(&stream, header_only, sizeof(header_only)) == ESP_ERR_INVALID_SIZE,
+           "short chunk: rejected");
+    expect(stream.next_seq == 0, "short chunk: not consumed");
+
+    // the writer fails once the partition is full; the failing chunk is not consumed
+    chunker_t c = {.data = image, .len = IMAGE_SIZE, .payload = CHUNK_PAYLOAD};
+    start(false, 3 * CHUNK_PAYLOAD);
+    expect(feed_range(&c, 0, 3) == ESP_OK, "writer error: chunks that fit");
+    expect(feed(&c, 3) == ESP_ERR_INVALID_SIZE, "writer error: reported");
+    expect(stream.next_seq == 3 && stream.bytes_out == 3 * CHUNK_PAYLOAD, "writer error: chunk not consumed");
+}
+
+void app_main(void)
+{
+    make_image();
+    compressed_len = compress(image, IMAGE_SIZE, compressed);
+    printf("image %d bytes, compressed %zu bytes\n", IMAGE_SIZE, compressed_len);
+
+    check_known_stream();
+    check_round_trip(false, CHUNK_PAYLOAD);
+    check_round_trip(false, 1);
+    check_round_trip(true, CHUNK_PAYLOAD);
+    check_round_trip(true, 20);
+    // every symbol split across chunks, the accumulator has to carry the bits over
+    check_round_trip(true, 1);
+    check_duplicate();
+    check_gap();
+    check_sequence_wrap();
+    check_errors();
+
+    printf("%d checks, %d failed\n", checks, failures);
+    exit(failures == 0 ? 0 : 1);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "esp_err.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum
+{
+    OTA_STATE_IDLE = 0,
+    OTA_STATE_RECEIVING,
+    OTA_STATE_DONE,
+    OTA_STATE_FAILED,
+} ota_state_t;
+
+typedef struct
+{
+    ota_state_t state;
+    esp_err_t last_error;
+    uint16_t next_seq;
+    uint32_t bytes_received; ///< payload bytes as transferred (compressed size for compressed images)
+    uint32_t bytes_written;  ///< image bytes written to flash
+    uint32_t duration_ms;
+    uint32_t throughput_kbps; ///< payload throughput in KB/s
+} ota_status_t;
+
+/**
+ * @brief Starts a new update into the next OTA partition.
+ *
+ * @param image_size  Size of the (decompressed) application image in bytes.
+ * @param compressed  true if the chunks carry a heatshrink compressed image.
+ *
+ * @return
+ *     - ESP_OK: Update started.
+ *     - ESP_ERR_INVALID_STATE: An update is already running.
+ *     - ESP_ERR_INVALID_SIZE: Image does not fit into the OTA partition.
+ *     - Error codes of esp_ota_begin().
+ */
+esp_err_t ota_begin(size_t image_size, bool compressed);
+
+/**
+ * @brief Writes one chunk of the running update (see ota_stream_feed()).
+ */
+esp_err_t ota_write_chunk(const uint8_t *chunk, size_t len);
+
+/**
+ * @brief Completes the running update and selects the new image for the next boot.
+ *
+ * @param crc32  CRC-32 of the decompressed image as computed by the sender.
+ *
+ * @return
+ *     - ESP_OK: Image verified and set as boot partition.
+ *     - ESP_ERR_INVALID_CRC: Size or checksum mismatch.
+ *     - Error codes of esp_ota_end() or esp_ota_set_boot_partition().
+ */
+esp_err_t ota_finish(uint32_t crc32);
+
+/**
+ * @brief Cancels the running update, if any.
+ */
+void ota_abort(void);
+
+void ota_get_status(ota_status_t *status);
+
+/**
+ * @brief Confirms or rejects the running image after an update.
+ *
+ * Has no effect unless the running image is still pending verification. An unhealthy image is marked
+ * invalid and the device reboots into the previous one.
+ */
+esp_err_t ota_confirm_image(bool healthy);
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "esp_err.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Chunked, optionally compressed image stream.
+ *
+ * The stream has no dependency on the flash or the BLE stack: every decoded byte is handed to a writer
+ * callback, so the protocol and the decompressor can be exercised on a host against any stand-in writer
+ * ("make ota_stream" runs host_test/ against a memory writer).
+ *
+ * Compressed images use the heatshrink format (LZSS) with the parameters below, i.e. they have to be
+ * created with `heatshrink -e -w 10 -l 5`.
+ */
+#define OTA_STREAM_WINDOW_BITS 10
+#define OTA_STREAM_LOOKAHEAD_BITS 5
+#define OTA_STREAM_OUT_BUFFER_SIZE 256
+
+/// Every chunk starts with a little-endian 16-bit sequence number
+#define OTA_STREAM_CHUNK_HEADER_SIZE 2
+
+typedef esp_err_t (*ota_stream_write_fn)(void *ctx, const uint8_t *data, size_t len);
+
+typedef struct
+{
+    ota_stream_write_fn write;
+    void *ctx;
+    bool compressed;
+
+    uint16_t next_seq;
+    size_t bytes_in;  ///< payload bytes received, excluding chunk headers
+    size_t bytes_out; ///< bytes handed to the writer
+    uint32_t crc;     ///< CRC-32 of all bytes handed to the writer
+
+    // decompressor state
+    uint32_t bit_acc;
+    uint8_t bit_count;
+    uint16_t window_head;
+    uint8_t window[1 << OTA_STREAM_WINDOW_BITS];
+
+    size_t out_len;
+    uint8_t out[OTA_STREAM_OUT_BUFFER_SIZE];
+} ota_stream_t;
+
+/**
+ * @brief Resets a stream for a new image.
+ *
+ * @param stream      Stream to initialize.
+ * @param compressed  true if the chunks carry a heatshrink compressed image.
+ * @param write       Destination for the decoded image bytes.
+ * @param ctx         Passed unchanged to `write`.
+ */
+void ota_stream_init(ota_stream_t *stream, bool compressed, ota_stream_write_fn write, void *ctx);
+
+/**
+ * @brief Feeds one chunk (sequence header plus payload) into the stream.
+ *
+ * A chunk with an already consumed sequence number is treated as a retransmission and ignored.
+ *
+ * @return
+ *     - ESP_OK: Chunk consumed (or ignored as a duplicate).
+ *     - ESP_ERR_INVALID_SIZE: Chunk is shorter than its header.
+ *     - ESP_ERR_INVALID_STATE: A chunk is missing before this one.
+ *     - Error codes of the writer callback.
+ */
+esp_err_t ota_stream_feed(ota_stream_t *stream, const uint8_t *chunk, size_t len);
+
+/**
+ * @brief Hands all buffered output to the writer.
+ *
+ * Must be called once after the last chunk.
+ */
+esp_err_t ota_stream_flush(ota_stream_t *stream);
@@ -0,0 +1,181 @@
+#include "ota.h"
+
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_timer.h"
+#include "ota_stream.h"
+
+static const char *TAG = "ota";
+
+static ota_stream_t stream;
+static esp_ota_handle_t ota_handle;
+static const esp_partition_t *update_partition;
+static size_t expected_size;
+static int64_t start_time_us;
+static ota_status_t status;
+
+static esp_err_t flash_writer(void *ctx, const uint8_t *data, size_t len)
+{
+    if (stream.bytes_out + len > expected_size)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return esp_ota_write(ota_handle, data, len);
+}
+
+static void update_status(void)
+{
+    uint32_t elapsed_ms = (uint32_t)((esp_timer_get_time() - start_time_us) / 1000);
+
+    status.next_seq = stream.next_seq;
+    status.bytes_received = stream.bytes_in;
+    status.bytes_written = stream.bytes_out;
+    status.duration_ms = elapsed_ms;
+    status.throughput_kbps = elapsed_ms > 0 ? (uint32_t)((uint64_t)stream.bytes_in * 1000 / 1024 / elapsed_ms) : 0;
+}
+
+static esp_err_t fail(esp_err_t err)
+{
+    ESP_LOGE(TAG, "Update failed: %s", esp_err_to_name(err));
+    esp_ota_abort(ota_handle);
+    update_status();
+    status.state = OTA_STATE_FAILED;
+    status.last_error = err;
+    return err;
+}
+
+esp_err_t ota_begin(size_t image_size, bool compressed)
+{
+    if (status.state == OTA_STATE_RECEIVING)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    update_partition = esp_ota_get_next_update_partition(NULL);
+    if (update_partition == NULL)
+    {
+        ESP_LOGE(TAG, "No OTA partition available");
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (image_size == 0 || image_size > update_partition->size)
+    {
+        ESP_LOGE(TAG, "Image size %u does not fit into %s", image_size, update_partition->label);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // sequential writes erase sector by sector instead of the whole partition up front
+    esp_err_t ret = esp_ota_begin(update_partition, OTA_WITH_SEQUENTIAL_WRITES, &ota_handle);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to begin update: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    ota_stream_init(&stream, compressed, flash_writer, NULL);
+    expected_size = image_size;
+    start_time_us = esp_timer_get_time();
+
+    status = (ota_status_t){.state = OTA_STATE_RECEIVING, .last_error = ESP_OK};
+
+    ESP_LOGI(TAG, "Writing %u bytes (%s) to partition %s", image_size, compressed ? "compressed" : "raw",
+             update_partition->label);
+    return ESP_OK;
+}
+
+esp_err_t ota_write_chunk(const uint8_t *chunk, size_t len)
+{
+    if (status.state != OTA_STATE_RECEIVING)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_err_t ret = ota_stream_feed(&stream, chunk, len);
+    if (ret != ESP_OK)
+    {
+        return fail(ret);
+    }
+
+    update_status();
+    return ESP_OK;
+}
+
+esp_err_t ota_finish(uint32_t crc32)
+{
+    if (status.state != OTA_STATE_RECEIVING)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_err_t ret = ota_stream_flush(&stream);
+    if (ret != ESP_OK)
+    {
+        return fail(ret);
+    }
+
+    update_status();
+    if (stream.bytes_out != expected_size || stream.crc != crc32)
+    {
+        ESP_LOGE(TAG, "Image mismatch: %u/%u bytes, crc %08lx/%08lx", stream.bytes_out, expected_size, stream.crc,
+                 crc32);
+        return fail(ESP_ERR_INVALID_CRC);
+    }
+
+    ret = esp_ota_end(ota_handle);
+    if (ret != ESP_OK)
+    {
+        status.state = OTA_STATE_FAILED;
+        status.last_error = ret;
+        ESP_LOGE(TAG, "Image validation failed: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    ret = esp_ota_set_boot_partition(update_partition);
+    if (ret != ESP_OK)
+    {
+        status.state = OTA_STATE_FAILED;
+        status.last_error = ret;
+        ESP_LOGE(TAG, "Failed to set boot partition: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    status.state = OTA_STATE_DONE;
+    ESP_LOGI(TAG, "Update complete: %lu bytes received, %lu bytes written in %lu ms (%lu KB/s)", status.bytes_received,
+             status.bytes_written, status.duration_ms, status.throughput_kbps);
+    return ESP_OK;
+}
+
+void ota_abort(void)
+{
+    if (status.state != OTA_STATE_RECEIVING)
+    {
+        return;
+    }
+
+    ESP_LOGW(TAG, "Update aborted");
+    fail(ESP_ERR_INVALID_STATE);
+}
+
+void ota_get_status(ota_status_t *out)
+{
+    *out = status;
+}
+
+esp_err_t ota_confirm_image(bool healthy)
+{
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    esp_ota_img_states_t state;
+
+    if (esp_ota_get_state_partition(running, &state) != ESP_OK || state != ESP_OTA_IMG_PENDING_VERIFY)
+    {
+        return ESP_OK;
+    }
+
+    if (healthy)
+    {
+        ESP_LOGI(TAG, "Health check passed, image %s confirmed", running->label);
+        return esp_ota_mark_app_valid_cancel_rollback();
+    }
+
+    ESP_LOGE(TAG, "Health check failed, rolling back");
+    return esp_ota_mark_app_invalid_rollback_and_reboot();
+}
@@ -0,0 +1,37 @@
+#include "ota.h"
+
+#include <string.h>
+
+/*
+ * The host build has no app partitions and boots no other image, so updates are refused. The stream
+ * decoder in ota_stream.c is built as on the device.
+ */
+
+esp_err_t ota_begin(size_t image_size, bool compressed)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t ota_write_chunk(const uint8_t *chunk, size_t len)
+{
+    return ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t ota_finish(uint32_t crc32)
+{
+    return ESP_ERR_INVALID_STATE;
+}
+
+void ota_abort(void)
+{
+}
+
+void ota_get_status(ota_status_t *status)
+{
+    memset(status, 0, sizeof(*status));
+}
+
+esp_err_t ota_confirm_image(bool healthy)
+{
+    return ESP_OK;
+}
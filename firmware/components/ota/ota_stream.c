@@ -0,0 +1,141 @@
+#include "ota_stream.h"
+
+#include <string.h>
+
+#define WINDOW_MASK ((1u << OTA_STREAM_WINDOW_BITS) - 1)
+
+// Symbol sizes of the heatshrink bit stream (MSB first)
+#define LITERAL_BITS (1 + 8)
+#define BACKREF_BITS (1 + OTA_STREAM_WINDOW_BITS + OTA_STREAM_LOOKAHEAD_BITS)
+
+static const uint32_t crc32_nibble_table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+};
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t len)
+{
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++)
+    {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ crc32_nibble_table[crc & 0x0F];
+        crc = (crc >> 4) ^ crc32_nibble_table[crc & 0x0F];
+    }
+    return ~crc;
+}
+
+static esp_err_t emit(ota_stream_t *stream, const uint8_t *data, size_t len)
+{
+    esp_err_t ret = stream->write(stream->ctx, data, len);
+    if (ret == ESP_OK)
+    {
+        stream->crc = crc32_update(stream->crc, data, len);
+        stream->bytes_out += len;
+    }
+    return ret;
+}
+
+static esp_err_t put_byte(ota_stream_t *stream, uint8_t c)
+{
+    stream->window[stream->window_head++ & WINDOW_MASK] = c;
+    stream->out[stream->out_len++] = c;
+    if (stream->out_len == sizeof(stream->out))
+    {
+        stream->out_len = 0;
+        return emit(stream, stream->out, sizeof(stream->out));
+    }
+    return ESP_OK;
+}
+
+static uint32_t take_bits(ota_stream_t *stream, uint8_t count)
+{
+    stream->bit_count -= count;
+    return (stream->bit_acc >> stream->bit_count) & ((1u << count) - 1);
+}
+
+static esp_err_t decompress(ota_stream_t *stream, const uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        stream->bit_acc = (stream->bit_acc << 8) | data[i];
+        stream->bit_count += 8;
+
+        // decode every symbol that is completely available in the accumulator
+        while (stream->bit_count > 0)
+        {
+            bool literal = (stream->bit_acc >> (stream->bit_count - 1)) & 1;
+            if (stream->bit_count < (literal ? LITERAL_BITS : BACKREF_BITS))
+            {
+                break;
+            }
+            take_bits(stream, 1);
+
+            esp_err_t ret = ESP_OK;
+            if (literal)
+            {
+                ret = put_byte(stream, (uint8_t)take_bits(stream, 8));
+            }
+            else
+            {
+                uint32_t offset = take_bits(stream, OTA_STREAM_WINDOW_BITS) + 1;
+                uint32_t count = take_bits(stream, OTA_STREAM_LOOKAHEAD_BITS) + 1;
+                for (uint32_t n = 0; n < count && ret == ESP_OK; n++)
+                {
+                    ret = put_byte(stream, stream->window[(stream->window_head - offset) & WINDOW_MASK]);
+                }
+            }
+            if (ret != ESP_OK)
+            {
+                return ret;
+            }
+        }
+    }
+    return ESP_OK;
+}
+
+void ota_stream_init(ota_stream_t *stream, bool compressed, ota_stream_write_fn write, void *ctx)
+{
+    memset(stream, 0, sizeof(*stream));
+    stream->write = write;
+    stream->ctx = ctx;
+    stream->compressed = compressed;
+}
+
+esp_err_t ota_stream_feed(ota_stream_t *stream, const uint8_t *chunk, size_t len)
+{
+    if (len < OTA_STREAM_CHUNK_HEADER_SIZE)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    uint16_t seq = chunk[0] | (chunk[1] << 8);
+    if (seq != stream->next_seq)
+    {
+        // a duplicate lies within the last half of the sequence space, anything else is a gap
+        return (uint16_t)(stream->next_seq - seq) <= 0x8000 ? ESP_OK : ESP_ERR_INVALID_STATE;
+    }
+
+    const uint8_t *payload = chunk + OTA_STREAM_CHUNK_HEADER_SIZE;
+    size_t payload_len = len - OTA_STREAM_CHUNK_HEADER_SIZE;
+
+    esp_err_t ret = stream->compressed ? decompress(stream, payload, payload_len) : emit(stream, payload, payload_len);
+    if (ret == ESP_OK)
+    {
+        stream->next_seq++;
+        stream->bytes_in += payload_len;
+    }
+    return ret;
+}
+
+esp_err_t ota_stream_flush(ota_stream_t *stream)
+{
+    if (stream->out_len == 0)
+    {
+        return ESP_OK;
+    }
+
+    size_t len = stream->out_len;
+    stream->out_len = 0;
+    return emit(stream, stream->out, len);
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stddef.h>
+
 typedef enum
 {
     VALUE_TYPE_STRING,
@@ -7,7 +9,16 @@ typedef enum
     VALUE_TYPE_INT32,
 } persistence_value_type_t;
 
+typedef struct
+{
+    persistence_value_type_t value_type;
+    const char *key;
+    const void *value;
+} persistence_entry_t;
+
 void persistence_init(const char *namespace_name);
+void persistence_log_entries(void);
 void persistence_save(persistence_value_type_t value_type, const char *key, const void *value);
+void persistence_save_many(const persistence_entry_t *entries, size_t count);
 void *persistence_load(persistence_value_type_t value_type, const char *key, void *out);
 void persistence_deinit();
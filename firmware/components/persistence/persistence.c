@@ -9,6 +9,7 @@ static const char *TAG = "persistence";
 
 static nvs_handle_t persistence_handle;
 static SemaphoreHandle_t persistence_mutex;
+static StaticSemaphore_t persistence_mutex_buffer;
 
 #include "esp_log.h"
 #include "nvs.h"
@@ -73,16 +74,15 @@ void display_nvs_value(const char *namespace_name, const char *key, nvs_type_t t
         break;
     }
     case NVS_TYPE_STR: {
-        size_t length = 0;
-        nvs_get_str(handle, key, NULL, &length);
-        if (length > 0)
+        char value[64];
+        size_t length = sizeof(value);
+        if (nvs_get_str(handle, key, value, &length) == ESP_OK)
         {
-            char *value = malloc(length);
-            if (nvs_get_str(handle, key, value, &length) == ESP_OK)
-            {
-                ESP_LOGI(TAG, "  -> Value (STR): %s", value);
-            }
-            free(value);
+            ESP_LOGI(TAG, "  -> Value (STR): %s", value);
+        }
+        else if (nvs_get_str(handle, key, NULL, &length) == ESP_OK)
+        {
+            ESP_LOGI(TAG, "  -> Value (STR): %zu bytes", length);
         }
         break;
     }
@@ -91,15 +91,14 @@ void display_nvs_value(const char *namespace_name, const char *key, nvs_type_t t
         nvs_get_blob(handle, key, NULL, &length);
         if (length > 0)
         {
-            ESP_LOGI(TAG, "  -> Value (BLOB): %d bytes", length);
+            ESP_LOGI(TAG, "  -> Value (BLOB): %zu bytes", length);
 
-            // Optional: Erste Bytes als Hex anzeigen
-            uint8_t *blob = malloc(length);
-            if (nvs_get_blob(handle, key, blob, &length) == ESP_OK)
+            // Optional: Erste Bytes als Hex anzeigen (nur kleine Blobs, ohne Heap)
+            uint8_t blob[32];
+            if (length <= sizeof(blob) && nvs_get_blob(handle, key, blob, &length) == ESP_OK)
             {
-                ESP_LOG_BUFFER_HEX_LEVEL(TAG, blob, MIN(length, 32), ESP_LOG_INFO);
+                ESP_LOG_BUFFER_HEX_LEVEL(TAG, blob, length, ESP_LOG_INFO);
             }
-            free(blob);
         }
         break;
     }
@@ -163,53 +162,69 @@ void persistence_init(const char *namespace_name)
     }
     ESP_ERROR_CHECK(ret);
 
+    ESP_ERROR_CHECK(nvs_open(namespace_name, NVS_READWRITE, &persistence_handle));
+
+    persistence_mutex = xSemaphoreCreateMutexStatic(&persistence_mutex_buffer);
+}
+
+// walks all of NVS, so it is kept out of persistence_init() and the way of the light restore at boot
+void persistence_log_entries(void)
+{
     list_all_nvs_entries();
     check_nvs_stats();
+}
 
-    ESP_ERROR_CHECK(nvs_open(namespace_name, NVS_READWRITE, &persistence_handle));
-
-    persistence_mutex = xSemaphoreCreateMutex();
-    if (persistence_mutex == NULL)
+static esp_err_t set_value(persistence_value_type_t value_type, const char *key, const void *value)
+{
+    switch (value_type)
     {
-        ESP_LOGE(TAG, "Failed to create mutex");
+    case VALUE_TYPE_STRING:
+        return nvs_set_str(persistence_handle, key, (char *)value);
+
+    case VALUE_TYPE_INT8:
+        return nvs_set_i8(persistence_handle, key, *(int8_t *)value);
+
+    case VALUE_TYPE_INT32:
+        return nvs_set_i32(persistence_handle, key, *(int32_t *)value);
+
+    default:
+        ESP_LOGE(TAG, "Unsupported value type");
+        return ESP_ERR_INVALID_ARG;
     }
 }
 
 void persistence_save(persistence_value_type_t value_type, const char *key, const void *value)
+{
+    persistence_entry_t entry = {.value_type = value_type, .key = key, .value = value};
+    persistence_save_many(&entry, 1);
+}
+
+void persistence_save_many(const persistence_entry_t *entries, size_t count)
 {
     if (persistence_mutex != NULL)
     {
         if (xSemaphoreTake(persistence_mutex, portMAX_DELAY) == pdTRUE)
         {
-            esp_err_t err = ESP_ERR_INVALID_ARG;
+            bool dirty = false;
 
-            switch (value_type)
+            for (size_t i = 0; i < count; i++)
             {
-            case VALUE_TYPE_STRING:
-                err = nvs_set_str(persistence_handle, key, (char *)value);
-                break;
-
-            case VALUE_TYPE_INT8:
-                err = nvs_set_i8(persistence_handle, key, *(int8_t *)value);
-                break;
-
-            case VALUE_TYPE_INT32:
-                err = nvs_set_i32(persistence_handle, key, *(int32_t *)value);
-                break;
-
-            default:
-                ESP_LOGE(TAG, "Unsupported value type");
-                break;
+                esp_err_t err = set_value(entries[i].value_type, entries[i].key, entries[i].value);
+                if (err == ESP_OK)
+                {
+                    dirty = true;
+                }
+                else
+                {
+                    ESP_LOGE(TAG, "Error saving key %s: %s", entries[i].key, esp_err_to_name(err));
+                }
             }
 
-            if (err == ESP_OK)
+            // a single commit for the whole batch
+            if (dirty)
             {
                 ESP_ERROR_CHECK(nvs_commit(persistence_handle));
             }
-            else
-            {
-                ESP_LOGE(TAG, "Error saving key %s: %s", key, esp_err_to_name(err));
-            }
 
             xSemaphoreGive(persistence_mutex);
         }
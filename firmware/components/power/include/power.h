@@ -0,0 +1,63 @@
+#pragma once
+
+#include "esp_err.h"
+
+/**
+ * @brief What a component needs from the chip while it holds a lock.
+ */
+typedef enum
+{
+    POWER_NEED_CPU_MAX = 0, ///< CPU at the profile's highest frequency, e.g. for a throughput-bound transfer
+    POWER_NEED_APB_MAX,     ///< peripheral clock unchanged, e.g. for PWM clocked from APB
+    POWER_NEED_AWAKE,       ///< no light sleep, e.g. to see the next edge of an input
+} power_need_t;
+
+/// Lock on the chip's power state; NULL where power management is disabled
+typedef struct power_lock *power_lock_t;
+
+/**
+ * @brief Applies the CPU frequency bounds and light sleep setting of CONFIG_POWER_PROFILE.
+ *
+ * Call once at boot. Locks created and taken before are kept.
+ *
+ * @return
+ *     - ESP_OK: Profile applied, or power management is disabled.
+ *     - Error codes of esp_pm_configure().
+ */
+esp_err_t power_init(void);
+
+/**
+ * @brief Creates a lock for one component.
+ *
+ * Without CONFIG_PM_ENABLE the lock is NULL and acquiring it does nothing, so components do not need to
+ * check whether power management is available.
+ *
+ * @param need  What the component needs while it holds the lock.
+ * @param name  Shown by the "power" console command; must outlive the lock.
+ *
+ * @return
+ *     - ESP_OK: Lock created.
+ *     - Error codes of esp_pm_lock_create().
+ */
+esp_err_t power_lock_create(power_need_t need, const char *name, power_lock_t *lock);
+
+/**
+ * @brief Takes the lock; the chip keeps what the lock needs until every acquire was released.
+ *
+ * Counted, so nested sections of one component can each take it.
+ */
+void power_lock_acquire(power_lock_t lock);
+
+/**
+ * @brief Releases one acquire of the lock.
+ */
+void power_lock_release(power_lock_t lock);
+
+/**
+ * @brief Registers the "power" console command, which shows the profile and the locks.
+ *
+ * @return
+ *     - ESP_OK: Command registered.
+ *     - Error codes of esp_console_cmd_register().
+ */
+esp_err_t power_register_console_command(void);
@@ -0,0 +1,128 @@
+#include "power.h"
+
+#include "esp_console.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#if CONFIG_PM_ENABLE
+#include "esp_pm.h"
+#endif
+
+#include <stdio.h>
+
+static const char *TAG = "power";
+
+#if CONFIG_POWER_PROFILE_PERFORMANCE
+#define POWER_PROFILE_NAME "performance"
+#define POWER_MIN_FREQ_MHZ CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ
+#define POWER_LIGHT_SLEEP false
+#elif CONFIG_POWER_PROFILE_ECO
+#define POWER_PROFILE_NAME "eco"
+#define POWER_MIN_FREQ_MHZ CONFIG_XTAL_FREQ
+#define POWER_LIGHT_SLEEP true
+#else
+#define POWER_PROFILE_NAME "balanced"
+#define POWER_MIN_FREQ_MHZ CONFIG_XTAL_FREQ
+#define POWER_LIGHT_SLEEP false
+#endif
+
+#if CONFIG_PM_ENABLE
+static const esp_pm_lock_type_t lock_types[] = {
+    [POWER_NEED_CPU_MAX] = ESP_PM_CPU_FREQ_MAX,
+    [POWER_NEED_APB_MAX] = ESP_PM_APB_FREQ_MAX,
+    [POWER_NEED_AWAKE] = ESP_PM_NO_LIGHT_SLEEP,
+};
+#endif
+
+esp_err_t power_init(void)
+{
+#if CONFIG_PM_ENABLE
+    const esp_pm_config_t config = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = POWER_MIN_FREQ_MHZ,
+        .light_sleep_enable = POWER_LIGHT_SLEEP,
+    };
+    esp_err_t ret = esp_pm_configure(&config);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to apply the %s profile: %s", POWER_PROFILE_NAME, esp_err_to_name(ret));
+        return ret;
+    }
+
+    ESP_LOGI(TAG, "Profile %s: %d-%d MHz, light sleep %s", POWER_PROFILE_NAME, config.min_freq_mhz,
+             config.max_freq_mhz, config.light_sleep_enable ? "on" : "off");
+#endif
+    return ESP_OK;
+}
+
+esp_err_t power_lock_create(power_need_t need, const char *name, power_lock_t *lock)
+{
+    *lock = NULL;
+#if CONFIG_PM_ENABLE
+    if (need >= sizeof(lock_types) / sizeof(lock_types[0]))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_pm_lock_handle_t handle;
+    esp_err_t ret = esp_pm_lock_create(lock_types[need], 0, name, &handle);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to create lock %s: %s", name, esp_err_to_name(ret));
+        return ret;
+    }
+    *lock = (power_lock_t)handle;
+#endif
+    return ESP_OK;
+}
+
+void power_lock_acquire(power_lock_t lock)
+{
+#if CONFIG_PM_ENABLE
+    if (lock != NULL)
+    {
+        esp_pm_lock_acquire((esp_pm_lock_handle_t)lock);
+    }
+#endif
+}
+
+void power_lock_release(power_lock_t lock)
+{
+#if CONFIG_PM_ENABLE
+    if (lock != NULL)
+    {
+        esp_pm_lock_release((esp_pm_lock_handle_t)lock);
+    }
+#endif
+}
+
+// printf instead of ESP_LOG, so the output survives release builds with logging compiled out
+static int power_command(int argc, char **argv)
+{
+#if CONFIG_PM_ENABLE
+    esp_pm_config_t config;
+    if (esp_pm_get_configuration(&config) != ESP_OK)
+    {
+        printf("power management not configured\n");
+        return 1;
+    }
+
+    printf("profile %s, %d-%d MHz, light sleep %s\n", POWER_PROFILE_NAME, config.min_freq_mhz, config.max_freq_mhz,
+           config.light_sleep_enable ? "on" : "off");
+    // the component locks and the ones the drivers take themselves; times need CONFIG_PM_PROFILING
+    esp_pm_dump_locks(stdout);
+#else
+    printf("power management disabled\n");
+#endif
+    return 0;
+}
+
+esp_err_t power_register_console_command(void)
+{
+    const esp_console_cmd_t command = {
+        .command = "power",
+        .help = "Show the power profile and the power management locks",
+        .func = power_command,
+    };
+    return esp_console_cmd_register(&command);
+}
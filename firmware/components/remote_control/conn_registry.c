@@ -0,0 +1,261 @@
+#include "include/conn_registry.h"
+
+#include <stdatomic.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+static const char *TAG = "conn_registry";
+
+/*
+ * Every slot is guarded by a sequence lock. The NimBLE host task is the only writer, so the
+ * writer side needs no lock at all; readers (e.g. uart_tx_task) retry until they observe an even
+ * and unchanged sequence number. Counters are bumped from other tasks and therefore live outside
+ * the sequence-protected data as plain atomics.
+ */
+typedef struct
+{
+    atomic_uint seq;
+    ble_connection_t data;
+    atomic_uint notify_sent;
+    atomic_uint notify_failed;
+    atomic_uint writes_received;
+} conn_slot_t;
+
+static conn_slot_t slots[CONFIG_BT_NIMBLE_MAX_CONNECTIONS];
+static const uint16_t *chr_val_handles[CONN_CHR_COUNT];
+
+static void slot_write_begin(conn_slot_t *slot)
+{
+    atomic_fetch_add_explicit(&slot->seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void slot_write_end(conn_slot_t *slot)
+{
+    atomic_fetch_add_explicit(&slot->seq, 1, memory_order_release);
+}
+
+static void slot_read(conn_slot_t *slot, ble_connection_t *out)
+{
+    for (;;)
+    {
+        unsigned int begin = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (begin & 1)
+        {
+            continue;
+        }
+        memcpy(out, &slot->data, sizeof(*out));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&slot->seq, memory_order_relaxed) == begin)
+        {
+            break;
+        }
+    }
+    out->notify_sent = atomic_load_explicit(&slot->notify_sent, memory_order_relaxed);
+    out->notify_failed = atomic_load_explicit(&slot->notify_failed, memory_order_relaxed);
+    out->writes_received = atomic_load_explicit(&slot->writes_received, memory_order_relaxed);
+}
+
+// Only used by the host task, which is the sole writer and can therefore read without retrying
+static conn_slot_t *find_slot(uint16_t conn_handle)
+{
+    for (int i = 0; i < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; i++)
+    {
+        if (slots[i].data.is_connected && slots[i].data.conn_handle == conn_handle)
+        {
+            return &slots[i];
+        }
+    }
+    return NULL;
+}
+
+// Used from arbitrary tasks, so the handle has to be read through the sequence lock
+static conn_slot_t *find_slot_concurrent(uint16_t conn_handle)
+{
+    ble_connection_t conn;
+    for (int i = 0; i < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; i++)
+    {
+        slot_read(&slots[i], &conn);
+        if (conn.is_connected && conn.conn_handle == conn_handle)
+        {
+            return &slots[i];
+        }
+    }
+    return NULL;
+}
+
+void conn_registry_init(void)
+{
+    for (int i = 0; i < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; i++)
+    {
+        atomic_init(&slots[i].seq, 0);
+        memset(&slots[i].data, 0, sizeof(slots[i].data));
+        slots[i].data.conn_handle = BLE_HS_CONN_HANDLE_NONE;
+        atomic_init(&slots[i].notify_sent, 0);
+        atomic_init(&slots[i].notify_failed, 0);
+        atomic_init(&slots[i].writes_received, 0);
+    }
+}
+
+void conn_registry_bind_chr(conn_chr_t chr, const uint16_t *val_handle)
+{
+    if (chr < CONN_CHR_COUNT)
+    {
+        chr_val_handles[chr] = val_handle;
+    }
+}
+
+bool conn_registry_add(uint16_t conn_handle)
+{
+    for (int i = 0; i < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; i++)
+    {
+        conn_slot_t *slot = &slots[i];
+        if (!slot->data.is_connected)
+        {
+            atomic_store_explicit(&slot->notify_sent, 0, memory_order_relaxed);
+            atomic_store_explicit(&slot->notify_failed, 0, memory_order_relaxed);
+            atomic_store_explicit(&slot->writes_received, 0, memory_order_relaxed);
+
+            slot_write_begin(slot);
+            memset(&slot->data, 0, sizeof(slot->data));
+            slot->data.conn_handle = conn_handle;
+            slot->data.is_connected = true;
+            slot->data.mtu = BLE_ATT_MTU_DFLT;
+            slot_write_end(slot);
+
+            ESP_LOGI(TAG, "Connection %d stored in slot %d", conn_handle, i);
+            return true;
+        }
+    }
+    ESP_LOGW(TAG, "No free connection slot available!");
+    return false;
+}
+
+void conn_registry_remove(uint16_t conn_handle)
+{
+    conn_slot_t *slot = find_slot(conn_handle);
+    if (slot == NULL)
+    {
+        return;
+    }
+
+    ble_connection_t *conn = &slot->data;
+    ESP_LOGI(TAG, "Connection %d removed (notify sent=%u failed=%u, writes=%u)", conn_handle,
+             atomic_load(&slot->notify_sent), atomic_load(&slot->notify_failed), atomic_load(&slot->writes_received));
+
+    slot_write_begin(slot);
+    conn->is_connected = false;
+    conn->conn_handle = BLE_HS_CONN_HANDLE_NONE;
+    conn->subscriptions = 0;
+    slot_write_end(slot);
+}
+
+void conn_registry_set_mtu(uint16_t conn_handle, uint16_t mtu)
+{
+    conn_slot_t *slot = find_slot(conn_handle);
+    if (slot == NULL)
+    {
+        return;
+    }
+
+    slot_write_begin(slot);
+    slot->data.mtu = mtu;
+    slot_write_end(slot);
+}
+
+void conn_registry_set_security(uint16_t conn_handle, const struct ble_gap_sec_state *sec_state)
+{
+    conn_slot_t *slot = find_slot(conn_handle);
+    if (slot == NULL)
+    {
+        return;
+    }
+
+    slot_write_begin(slot);
+    slot->data.encrypted = sec_state->encrypted;
+    slot->data.authenticated = sec_state->authenticated;
+    slot->data.bonded = sec_state->bonded;
+    slot_write_end(slot);
+}
+
+void conn_registry_set_subscription(uint16_t conn_handle, uint16_t attr_handle, bool notify)
+{
+    conn_slot_t *slot = find_slot(conn_handle);
+    if (slot == NULL)
+    {
+        return;
+    }
+
+    for (int chr = 0; chr < CONN_CHR_COUNT; chr++)
+    {
+        if (chr_val_handles[chr] != NULL && *chr_val_handles[chr] == attr_handle)
+        {
+            uint32_t subscriptions = slot->data.subscriptions;
+            if (notify)
+            {
+                subscriptions |= (1u << chr);
+            }
+            else
+            {
+                subscriptions &= ~(1u << chr);
+            }
+
+            slot_write_begin(slot);
+            slot->data.subscriptions = subscriptions;
+            slot_write_end(slot);
+            return;
+        }
+    }
+}
+
+void conn_registry_count_notify(uint16_t conn_handle, bool success)
+{
+    conn_slot_t *slot = find_slot_concurrent(conn_handle);
+    if (slot != NULL)
+    {
+        atomic_fetch_add_explicit(success ? &slot->notify_sent : &slot->notify_failed, 1, memory_order_relaxed);
+    }
+}
+
+void conn_registry_count_write(uint16_t conn_handle)
+{
+    conn_slot_t *slot = find_slot_concurrent(conn_handle);
+    if (slot != NULL)
+    {
+        atomic_fetch_add_explicit(&slot->writes_received, 1, memory_order_relaxed);
+    }
+}
+
+size_t conn_registry_snapshot(ble_connection_t *out, conn_chr_t chr)
+{
+    size_t count = 0;
+    for (int i = 0; i < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; i++)
+    {
+        slot_read(&slots[i], &out[count]);
+        if (!out[count].is_connected)
+        {
+            continue;
+        }
+        if (chr < CONN_CHR_COUNT && (out[count].subscriptions & (1u << chr)) == 0)
+        {
+            continue;
+        }
+        count++;
+    }
+    return count;
+}
+
+bool is_any_device_connected(void)
+{
+    ble_connection_t conn;
+    for (int i = 0; i < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; i++)
+    {
+        slot_read(&slots[i], &conn);
+        if (conn.is_connected)
+        {
+            return true;
+        }
+    }
+    return false;
+}
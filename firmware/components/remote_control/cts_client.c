@@ -0,0 +1,153 @@
+#include "include/cts_client.h"
+#include "esp_log.h"
+#include "host/ble_hs.h"
+#include "schedule.h"
+#include "sdkconfig.h"
+#include "trace.h"
+
+static const char *TAG = "cts_client";
+
+#define CTS_SERVICE_UUID 0x1805
+#define CTS_CURRENT_TIME_UUID 0x2A2B    // [year u16][month][day][hours][minutes][seconds][weekday][1/256 s][reason]
+#define CTS_LOCAL_TIME_INFO_UUID 0x2A0F // [time zone s8, 15 min][DST offset u8, 15 min]
+
+#define CTS_CURRENT_TIME_SIZE 10
+#define CTS_TIME_ZONE_UNKNOWN -128
+#define CTS_DST_UNKNOWN 255
+
+/*
+ * service discovery -> read Local Time Information (optional) -> read Current Time -> schedule_set_time().
+ * Only one sync runs at a time, all callbacks run on the host task.
+ */
+static struct
+{
+    bool busy;
+    uint16_t start_handle;
+    uint16_t end_handle;
+    int32_t utc_offset_s;
+} sync;
+
+// Days since 1970-01-01 of a civil date, after H. Hinnant
+static int64_t days_from_civil(int64_t year, unsigned month, unsigned day)
+{
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    unsigned year_of_era = (unsigned)(year - era * 400);
+    unsigned day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    unsigned day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + (int64_t)day_of_era - 719468;
+}
+
+static int on_current_time(uint16_t conn_handle, const struct ble_gatt_error *error, struct ble_gatt_attr *attr,
+                           void *arg)
+{
+    if (error->status != 0)
+    {
+        // BLE_HS_EDONE after the value, or the peer has no current time
+        sync.busy = false;
+        return 0;
+    }
+
+    uint8_t value[CTS_CURRENT_TIME_SIZE];
+    if (OS_MBUF_PKTLEN(attr->om) < sizeof(value) || os_mbuf_copydata(attr->om, 0, sizeof(value), value) != 0)
+    {
+        return 0;
+    }
+
+    unsigned year = value[0] | value[1] << 8;
+    unsigned month = value[2];
+    unsigned day = value[3];
+    // year, month and day 0 mean "not known"
+    if (year < 1582 || month < 1 || month > 12 || day < 1 || day > 31 || value[4] > 23 || value[5] > 59 ||
+        value[6] > 59)
+    {
+        ESP_LOGW(TAG, "Peer sent no valid time");
+        return 0;
+    }
+
+    int64_t local_s = days_from_civil(year, month, day) * 86400 + value[4] * 3600 + value[5] * 60 + value[6];
+    int64_t utc_us = (local_s - sync.utc_offset_s) * 1000000 + value[8] * 1000000 / 256;
+    TRACE("cts date %u-%u-%u", year, month, day);
+    TRACE("cts time %u:%u:%u", value[4], value[5], value[6]);
+    schedule_set_time(utc_us, sync.utc_offset_s);
+    return 0;
+}
+
+static void read_current_time(uint16_t conn_handle)
+{
+    int rc = ble_gattc_read_by_uuid(conn_handle, sync.start_handle, sync.end_handle,
+                                    BLE_UUID16_DECLARE(CTS_CURRENT_TIME_UUID), on_current_time, NULL);
+    if (rc != 0)
+    {
+        ESP_LOGW(TAG, "Failed to read current time, error code: %d", rc);
+        sync.busy = false;
+    }
+}
+
+static int on_local_time_info(uint16_t conn_handle, const struct ble_gatt_error *error, struct ble_gatt_attr *attr,
+                              void *arg)
+{
+    if (error->status != 0)
+    {
+        // done, or the optional characteristic is missing: the configured offset stays
+        read_current_time(conn_handle);
+        return 0;
+    }
+
+    uint8_t value[2];
+    if (os_mbuf_copydata(attr->om, 0, sizeof(value), value) == 0 && (int8_t)value[0] != CTS_TIME_ZONE_UNKNOWN)
+    {
+        sync.utc_offset_s = (int8_t)value[0] * 15 * 60;
+        if (value[1] != CTS_DST_UNKNOWN)
+        {
+            sync.utc_offset_s += value[1] * 15 * 60;
+        }
+    }
+    return 0;
+}
+
+static int on_service(uint16_t conn_handle, const struct ble_gatt_error *error, const struct ble_gatt_svc *service,
+                      void *arg)
+{
+    if (error->status == 0)
+    {
+        sync.start_handle = service->start_handle;
+        sync.end_handle = service->end_handle;
+        return 0;
+    }
+
+    if (error->status != BLE_HS_EDONE || sync.start_handle == 0)
+    {
+        ESP_LOGI(TAG, "No current time service on the peer (status %d)", error->status);
+        sync.busy = false;
+        return 0;
+    }
+
+    int rc = ble_gattc_read_by_uuid(conn_handle, sync.start_handle, sync.end_handle,
+                                    BLE_UUID16_DECLARE(CTS_LOCAL_TIME_INFO_UUID), on_local_time_info, NULL);
+    if (rc != 0)
+    {
+        read_current_time(conn_handle);
+    }
+    return 0;
+}
+
+void cts_client_sync(uint16_t conn_handle)
+{
+    if (sync.busy)
+    {
+        return;
+    }
+
+    sync.busy = true;
+    sync.start_handle = 0;
+    sync.end_handle = 0;
+    sync.utc_offset_s = CONFIG_SCHEDULE_UTC_OFFSET * 60;
+
+    int rc = ble_gattc_disc_svc_by_uuid(conn_handle, BLE_UUID16_DECLARE(CTS_SERVICE_UUID), on_service, NULL);
+    if (rc != 0)
+    {
+        ESP_LOGW(TAG, "Failed to discover current time service, error code: %d", rc);
+        sync.busy = false;
+    }
+}
@@ -1,58 +1,74 @@
 #include "include/device_service.h"
-#include "esp_app_desc.h"
+#include "sdkconfig.h"
 #include <stdio.h>
 #include <string.h>
 
-int gatt_svr_chr_device_name_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt,
-                                    void *arg)
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_app_desc.h"
+#endif
+
+const char *device_info_name(void)
 {
-    char firmware_revision_str[33];
+#if CONFIG_IDF_TARGET_LINUX
+    // the host build has no app description
+    return "Lighthouse";
+#else
     const esp_app_desc_t *app_desc = esp_app_get_description();
+    return app_desc->project_name[0] != '\0' ? app_desc->project_name : "undefined";
+#endif
+}
 
-    if (app_desc->project_name[0] != '\0')
-    {
-        snprintf(firmware_revision_str, sizeof(firmware_revision_str), "%s", app_desc->project_name);
-    }
-    else
-    {
-        snprintf(firmware_revision_str, sizeof(firmware_revision_str), "undefined");
-    }
+const char *device_info_firmware_revision(void)
+{
+#if CONFIG_IDF_TARGET_LINUX
+    return "host";
+#else
+    const esp_app_desc_t *app_desc = esp_app_get_description();
+    return app_desc->version[0] != '\0' ? app_desc->version : "undefined";
+#endif
+}
 
-    os_mbuf_append(ctxt->om, firmware_revision_str, strlen(firmware_revision_str));
-    return 0;
+const char *device_info_hardware_revision(void)
+{
+    return "rev1";
 }
 
-int gatt_svr_chr_device_firmware_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt,
-                                        void *arg)
+const char *device_info_manufacturer(void)
 {
-    char firmware_revision_str[33];
-    const esp_app_desc_t *app_desc = esp_app_get_description();
+    return "mars3142";
+}
 
-    if (app_desc->version[0] != '\0')
-    {
-        snprintf(firmware_revision_str, sizeof(firmware_revision_str), "%s", app_desc->version);
-    }
-    else
+static int append_string(struct ble_gatt_access_ctxt *ctxt, const char *str)
+{
+    if (ctxt->op != BLE_GATT_ACCESS_OP_READ_CHR)
     {
-        snprintf(firmware_revision_str, sizeof(firmware_revision_str), "undefined");
+        return BLE_ATT_ERR_UNLIKELY;
     }
 
-    os_mbuf_append(ctxt->om, firmware_revision_str, strlen(firmware_revision_str));
-    return 0;
+    // the strings originate from esp_app_desc_t, whose fields hold at most 32 characters
+    return os_mbuf_append(ctxt->om, str, strnlen(str, 32)) == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+}
+
+int gatt_svr_chr_device_name_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt,
+                                    void *arg)
+{
+    return append_string(ctxt, device_info_name());
+}
+
+int gatt_svr_chr_device_firmware_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt,
+                                        void *arg)
+{
+    return append_string(ctxt, device_info_firmware_revision());
 }
 
 int gatt_svr_chr_device_hardware_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt,
                                         void *arg)
 {
-    char *hardware_revision = "rev1";
-    os_mbuf_append(ctxt->om, hardware_revision, strlen(hardware_revision));
-    return 0;
+    return append_string(ctxt, device_info_hardware_revision());
 }
 
 int gatt_svr_chr_device_manufacturer_access(uint16_t conn_handle, uint16_t attr_handle,
                                             struct ble_gatt_access_ctxt *ctxt, void *arg)
 {
-    char *manufacturer = "mars3142";
-    os_mbuf_append(ctxt->om, manufacturer, strlen(manufacturer));
-    return 0;
+    return append_string(ctxt, device_info_manufacturer());
 }
@@ -0,0 +1,30 @@
+#include "include/diagnostics_service.h"
+#include "esp_timer.h"
+#include "metrics.h"
+
+// Long reads arrive as several requests; they are served from one sample taken within this window
+#define METRICS_SAMPLE_REUSE_US (500 * 1000)
+
+int gatt_svr_chr_diag_metrics_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt,
+                                     void *arg)
+{
+    if (ctxt->op != BLE_GATT_ACCESS_OP_READ_CHR)
+    {
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+
+    // only the host task reads characteristics, so the buffers can be shared between reads
+    static metrics_snapshot_t snapshot;
+    static uint8_t packed[METRICS_PACKED_MAX_SIZE];
+    static size_t packed_len = 0;
+    static int64_t sampled_at = 0;
+
+    int64_t now = esp_timer_get_time();
+    if (packed_len == 0 || now - sampled_at > METRICS_SAMPLE_REUSE_US)
+    {
+        metrics_sample(&snapshot);
+        packed_len = metrics_pack(&snapshot, packed);
+        sampled_at = now;
+    }
+    return os_mbuf_append(ctxt->om, packed, packed_len) == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+}
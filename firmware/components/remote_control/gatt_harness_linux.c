@@ -0,0 +1,317 @@
+#include "include/gatt_harness.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "include/char_desc.h"
+#include "include/conn_registry.h"
+#include "include/device_service.h"
+#include "include/diagnostics_service.h"
+#include "include/light_service.h"
+#include "include/ota_service.h"
+#include "include/state_service.h"
+#include "include/uart_service.h"
+#include "sim.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+/*
+ * Every access callback of the GATT table in remote_control.c gets the requests a phone can send: reads, also
+ * into a full response with an empty mbuf pool, and well-formed, empty, short and long writes up to the 512
+ * bytes of the longest attribute value. Each request runs HARNESS_ROUNDS times from a bonded connection that is
+ * subscribed to every notification, so the notify paths run as well; the stand-in in the sim component writes
+ * the notifications to the simulation timeline. Per request the table shows the mean and worst time spent in
+ * the callback, the heap the rounds left behind (glibc only), the mbuf blocks the callback took per round and
+ * the ATT result, which has to match the expected one.
+ */
+
+#define HARNESS_ROUNDS 200
+#define HARNESS_CONN_HANDLE 1
+
+typedef struct
+{
+    const char *callback;
+    ble_gatt_access_fn *access;
+    const char *request;
+    uint8_t op;
+    const uint8_t *value; ///< value of a write, NULL for reads
+    uint16_t len;
+    bool no_mbufs; ///< the read response is full and the pool empty while the callback runs
+    int expected;  ///< ATT result
+} harness_request_t;
+
+#define READ(chr) BLE_GATT_ACCESS_OP_READ_##chr, NULL, 0
+#define WRITE(value) BLE_GATT_ACCESS_OP_WRITE_CHR, value, sizeof(value)
+#define WRITE_EMPTY BLE_GATT_ACCESS_OP_WRITE_CHR, byte_one, 0
+
+static const uint8_t byte_one[] = {0x01};
+static const uint8_t byte_level[] = {0x80};
+static const uint8_t byte_invalid_flag[] = {0x02};
+static const uint8_t two_bytes[] = {0x01, 0x01};
+static const uint8_t max_value[BLE_ATT_ATTR_MAX_LEN];
+static const uint8_t uart_text[] = "Leuchtfeuer Warnemuende";
+
+// beacon on and brightness 128
+static const uint8_t batch[] = {0x01, 0x01, 0x01, 0x04, 0x01, 0x80};
+static const uint8_t batch_truncated[] = {0x01, 0x01};
+static const uint8_t batch_unknown_type[] = {0x7f, 0x01, 0x00};
+// one byte more than the 8 entries a batch may carry
+static const uint8_t batch_too_long[8 * 3 + 1];
+
+static const uint8_t ota_abort[] = {0x03};
+static const uint8_t ota_begin[] = {0x01, 0x00, 0x10, 0x00, 0x00, 0x00};
+static const uint8_t ota_begin_short[] = {0x01, 0x00, 0x10};
+static const uint8_t ota_begin_long[] = {0x01, 0x00, 0x10, 0x00, 0x00, 0x00, 0x00};
+static const uint8_t ota_unknown_op[] = {0x7f};
+static const uint8_t ota_chunk[] = {0x00, 0x00, 0xe9};
+
+static const harness_request_t requests[] = {
+    {"device_manufacturer", gatt_svr_chr_device_manufacturer_access, "read", READ(CHR), false, 0},
+    {"device_manufacturer", gatt_svr_chr_device_manufacturer_access, "read, no mbufs", READ(CHR), true,
+     BLE_ATT_ERR_INSUFFICIENT_RES},
+    {"device_hardware", gatt_svr_chr_device_hardware_access, "read", READ(CHR), false, 0},
+    {"device_hardware", gatt_svr_chr_device_hardware_access, "read, no mbufs", READ(CHR), true,
+     BLE_ATT_ERR_INSUFFICIENT_RES},
+    {"device_firmware", gatt_svr_chr_device_firmware_access, "read", READ(CHR), false, 0},
+    {"device_firmware", gatt_svr_chr_device_firmware_access, "read, no mbufs", READ(CHR), true,
+     BLE_ATT_ERR_INSUFFICIENT_RES},
+    {"device_name", gatt_svr_chr_device_name_access, "read", READ(CHR), false, 0},
+    {"device_name", gatt_svr_chr_device_name_access, "read, no mbufs", READ(CHR), true,
+     BLE_ATT_ERR_INSUFFICIENT_RES},
+
+    {"light_beacon", gatt_svr_chr_light_beacon_access, "read", READ(CHR), false, 0},
+    {"light_beacon", gatt_svr_chr_light_beacon_access, "read, no mbufs", READ(CHR), true,
+     BLE_ATT_ERR_INSUFFICIENT_RES},
+    {"light_beacon", gatt_svr_chr_light_beacon_access, "write", WRITE(byte_one), false, 0},
+    {"light_beacon", gatt_svr_chr_light_beacon_access, "write, invalid value", WRITE(byte_invalid_flag), false,
+     BLE_ATT_ERR_VALUE_NOT_ALLOWED},
+    {"light_beacon", gatt_svr_chr_light_beacon_access, "write, empty", WRITE_EMPTY, false,
+     BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN},
+    {"light_beacon", gatt_svr_chr_light_beacon_access, "write, long", WRITE(two_bytes), false,
+     BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN},
+    {"light_beacon", gatt_svr_chr_light_beacon_access, "write, 512 bytes", WRITE(max_value), false,
+     BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN},
+
+    {"light_led", gatt_svr_chr_light_led_access, "read", READ(CHR), false, 0},
+    {"light_led", gatt_svr_chr_light_led_access, "read, no mbufs", READ(CHR), true, BLE_ATT_ERR_INSUFFICIENT_RES},
+    {"light_led", gatt_svr_chr_light_led_access, "write", WRITE(byte_level), false, 0},
+    {"light_led", gatt_svr_chr_light_led_access, "write, empty", WRITE_EMPTY, false,
+     BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN},
+    {"light_led", gatt_svr_chr_light_led_access, "write, long", WRITE(two_bytes), false,
+     BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN},
+    {"light_led", gatt_svr_chr_light_led_access, "write, 512 bytes", WRITE(max_value), false,
+     BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN},
+
+    {"light_command", gatt_svr_chr_light_command_access, "read", READ(CHR), false, 0},
+    {"light_command", gatt_svr_chr_light_command_access, "read, no mbufs", READ(CHR), true,
+     BLE_ATT_ERR_INSUFFICIENT_RES},
+    {"light_command", gatt_svr_chr_light_command_access, "write", WRITE(batch), false, 0},
+    {"light_command", gatt_svr_chr_light_command_access, "write, short entry", WRITE(batch_truncated), false,
+     BLE_ATT_ERR_VALUE_NOT_ALLOWED},
+    {"light_command", gatt_svr_chr_light_command_access, "write, unknown type", WRITE(batch_unknown_type), false,
+     BLE_ATT_ERR_VALUE_NOT_ALLOWED},
+    {"light_command", gatt_svr_chr_light_command_access, "write, empty", WRITE_EMPTY, false,
+     BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN},
+    {"light_command", gatt_svr_chr_light_command_access, "write, long", WRITE(batch_too_long), false,
+     BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN},
+    {"light_command", gatt_svr_chr_light_command_access, "write, 512 bytes", WRITE(max_value), false,
+     BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN},
+
+    {"state", gatt_svr_chr_state_access, "read", READ(CHR), false, 0},
+    {"state", gatt_svr_chr_state_access, "read, no mbufs", READ(CHR), true, BLE_ATT_ERR_INSUFFICIENT_RES},
+
+    {"uart", gatt_svr_chr_uart_access, "write", WRITE(uart_text), false, 0},
+    {"uart", gatt_svr_chr_uart_access, "write, empty", WRITE_EMPTY, false, 0},
+    {"uart", gatt_svr_chr_uart_access, "write, 512 bytes", WRITE(max_value), false, 0},
+
+    {"ota_control", gatt_svr_chr_ota_control_access, "read", READ(CHR), false, 0},
+    {"ota_control", gatt_svr_chr_ota_control_access, "read, no mbufs", READ(CHR), true,
+     BLE_ATT_ERR_INSUFFICIENT_RES},
+    {"ota_control", gatt_svr_chr_ota_control_access, "write, abort", WRITE(ota_abort), false, 0},
+    // the host build refuses every update, which is a failed update rather than a malformed command
+    {"ota_control", gatt_svr_chr_ota_control_access, "write, begin", WRITE(ota_begin), false, BLE_ATT_ERR_UNLIKELY},
+    {"ota_control", gatt_svr_chr_ota_control_access, "write, short begin", WRITE(ota_begin_short), false,
+     BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN},
+    {"ota_control", gatt_svr_chr_ota_control_access, "write, long begin", WRITE(ota_begin_long), false,
+     BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN},
+    {"ota_control", gatt_svr_chr_ota_control_access, "write, unknown op", WRITE(ota_unknown_op), false,
+     BLE_ATT_ERR_REQ_NOT_SUPPORTED},
+    {"ota_control", gatt_svr_chr_ota_control_access, "write, empty", WRITE_EMPTY, false,
+     BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN},
+    {"ota_control", gatt_svr_chr_ota_control_access, "write, 512 bytes", WRITE(max_value), false,
+     BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN},
+
+    // without a running update every chunk is refused
+    {"ota_data", gatt_svr_chr_ota_data_access, "write", WRITE(ota_chunk), false, BLE_ATT_ERR_WRITE_NOT_PERMITTED},
+    {"ota_data", gatt_svr_chr_ota_data_access, "write, empty", WRITE_EMPTY, false,
+     BLE_ATT_ERR_WRITE_NOT_PERMITTED},
+    {"ota_data", gatt_svr_chr_ota_data_access, "write, 512 bytes", WRITE(max_value), false,
+     BLE_ATT_ERR_WRITE_NOT_PERMITTED},
+
+    {"diag_metrics", gatt_svr_chr_diag_metrics_access, "read", READ(CHR), false, 0},
+    {"diag_metrics", gatt_svr_chr_diag_metrics_access, "read, no mbufs", READ(CHR), true,
+     BLE_ATT_ERR_INSUFFICIENT_RES},
+
+    {"beacon_user_desc", gatt_svr_desc_beacon_user_desc_access, "read", READ(DSC), false, 0},
+    {"beacon_user_desc", gatt_svr_desc_beacon_user_desc_access, "read, no mbufs", READ(DSC), true,
+     BLE_ATT_ERR_INSUFFICIENT_RES},
+    {"led_user_desc", gatt_svr_desc_led_user_desc_access, "read", READ(DSC), false, 0},
+    {"led_user_desc", gatt_svr_desc_led_user_desc_access, "read, no mbufs", READ(DSC), true,
+     BLE_ATT_ERR_INSUFFICIENT_RES},
+    {"presentation_bool", gatt_svr_desc_presentation_bool_access, "read", READ(DSC), false, 0},
+    {"presentation_bool", gatt_svr_desc_presentation_bool_access, "read, no mbufs", READ(DSC), true,
+     BLE_ATT_ERR_INSUFFICIENT_RES},
+    {"valid_range_bool", gatt_svr_desc_valid_range_bool_access, "read", READ(DSC), false, 0},
+    {"valid_range_bool", gatt_svr_desc_valid_range_bool_access, "read, no mbufs", READ(DSC), true,
+     BLE_ATT_ERR_INSUFFICIENT_RES},
+    {"presentation_uint8", gatt_svr_desc_presentation_uint8_access, "read", READ(DSC), false, 0},
+    {"presentation_uint8", gatt_svr_desc_presentation_uint8_access, "read, no mbufs", READ(DSC), true,
+     BLE_ATT_ERR_INSUFFICIENT_RES},
+    {"valid_range_uint8", gatt_svr_desc_valid_range_uint8_access, "read", READ(DSC), false, 0},
+    {"valid_range_uint8", gatt_svr_desc_valid_range_uint8_access, "read, no mbufs", READ(DSC), true,
+     BLE_ATT_ERR_INSUFFICIENT_RES},
+};
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static long heap_in_use(void)
+{
+#ifdef __GLIBC__
+    return (long)mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+}
+
+// what NimBLE hands to the callback: the written value, or a read response that already holds the opcode
+static struct os_mbuf *request_mbuf(const harness_request_t *request)
+{
+    static const uint8_t read_rsp_opcode = 0x0b;
+    static const uint8_t padding[OS_MBUF_BLOCK_SIZE];
+
+    if (request->value != NULL)
+    {
+        return ble_hs_mbuf_from_flat(request->value, request->len);
+    }
+
+    struct os_mbuf *om = ble_hs_mbuf_from_flat(&read_rsp_opcode, sizeof(read_rsp_opcode));
+    if (om != NULL && request->no_mbufs)
+    {
+        // without room left in the response, the callback needs another block from the empty pool
+        os_mbuf_append(om, padding, sizeof(padding) - om->om_len);
+    }
+    return om;
+}
+
+static void connect_phone(void)
+{
+    conn_registry_init();
+    conn_registry_bind_chr(CONN_CHR_UART_TX, &tx_chr_val_handle);
+    conn_registry_bind_chr(CONN_CHR_OTA_CONTROL, &ota_control_val_handle);
+    conn_registry_bind_chr(CONN_CHR_STATE, &state_chr_val_handle);
+    conn_registry_bind_chr(CONN_CHR_LIGHT_COMMAND, &light_command_val_handle);
+    ota_service_init();
+
+    // the stack assigns the value handles when the GATT table is registered
+    tx_chr_val_handle = 0x0020;
+    ota_control_val_handle = 0x0021;
+    state_chr_val_handle = 0x0022;
+    light_command_val_handle = 0x0023;
+
+    struct ble_gap_sec_state sec_state = {.encrypted = 1, .authenticated = 1, .bonded = 1, .key_size = 16};
+    conn_registry_add(HARNESS_CONN_HANDLE);
+    conn_registry_set_security(HARNESS_CONN_HANDLE, &sec_state);
+    conn_registry_set_mtu(HARNESS_CONN_HANDLE, 247);
+    conn_registry_set_subscription(HARNESS_CONN_HANDLE, tx_chr_val_handle, true);
+    conn_registry_set_subscription(HARNESS_CONN_HANDLE, ota_control_val_handle, true);
+    conn_registry_set_subscription(HARNESS_CONN_HANDLE, state_chr_val_handle, true);
+    conn_registry_set_subscription(HARNESS_CONN_HANDLE, light_command_val_handle, true);
+}
+
+static bool run_request(const harness_request_t *request)
+{
+    int64_t total_ns = 0;
+    int64_t max_ns = 0;
+    uint32_t blocks = 0;
+    int result = 0;
+    int unexpected = 0;
+
+    uint32_t taken_before;
+    uint32_t in_use_before;
+    sim_mbuf_get_stats(&taken_before, &in_use_before);
+    long heap_before = heap_in_use();
+
+    for (int round = 0; round < HARNESS_ROUNDS; round++)
+    {
+        struct ble_gatt_access_ctxt ctxt = {.op = request->op, .om = request_mbuf(request)};
+        if (ctxt.om == NULL)
+        {
+            printf("%-20s %-20s no mbuf for the request\n", request->callback, request->request);
+            return false;
+        }
+
+        uint32_t taken_start;
+        uint32_t taken_end;
+        uint32_t in_use;
+        sim_mbuf_fail_allocations(request->no_mbufs);
+        sim_mbuf_get_stats(&taken_start, &in_use);
+        int64_t start = now_ns();
+        result = request->access(HARNESS_CONN_HANDLE, 0, &ctxt, NULL);
+        int64_t elapsed = now_ns() - start;
+        sim_mbuf_get_stats(&taken_end, &in_use);
+        sim_mbuf_fail_allocations(false);
+        os_mbuf_free_chain(ctxt.om);
+
+        total_ns += elapsed;
+        max_ns = elapsed > max_ns ? elapsed : max_ns;
+        blocks += taken_end - taken_start;
+        unexpected += result != request->expected;
+    }
+
+    long heap_delta = heap_in_use() - heap_before;
+    uint32_t taken;
+    uint32_t in_use;
+    sim_mbuf_get_stats(&taken, &in_use);
+    bool leaked = in_use != in_use_before;
+    bool ok = unexpected == 0 && !leaked;
+
+    // printf instead of ESP_LOG, so the table is not interleaved with log prefixes
+    printf("%-20s %-20s %8lld %8lld %+7ld %6.2f   0x%02x  0x%02x  %s%s\n", request->callback, request->request,
+           (long long)(total_ns / HARNESS_ROUNDS), (long long)max_ns, heap_delta, (double)blocks / HARNESS_ROUNDS,
+           result, request->expected, ok ? "ok" : "FAIL", leaked ? " (mbufs leaked)" : "");
+    return ok;
+}
+
+esp_err_t gatt_harness_run(void)
+{
+    connect_phone();
+
+    // like the NimBLE host task, above the light controller, which applies the posted commands between requests
+    UBaseType_t priority = uxTaskPriorityGet(NULL);
+    vTaskPrioritySet(NULL, configMAX_PRIORITIES - 4);
+
+    printf("%d rounds per request\n", HARNESS_ROUNDS);
+    printf("%-20s %-20s %8s %8s %7s %6s %6s %6s\n", "callback", "request", "mean ns", "max ns", "heap", "mbufs",
+           "result", "expect");
+
+    int failed = 0;
+    size_t count = sizeof(requests) / sizeof(requests[0]);
+    for (size_t i = 0; i < count; i++)
+    {
+        failed += !run_request(&requests[i]);
+        vTaskDelay(pdMS_TO_TICKS(20));
+    }
+    printf("%zu requests, %d failed\n", count, failed);
+
+    vTaskPrioritySet(NULL, priority);
+    return failed == 0 ? ESP_OK : ESP_FAIL;
+}
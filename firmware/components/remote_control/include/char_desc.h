@@ -7,3 +7,7 @@ int gatt_svr_desc_presentation_bool_access(uint16_t con_handle, uint16_t attr_ha
                                            void *arg);
 int gatt_svr_desc_valid_range_bool_access(uint16_t con_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt,
                                           void *arg);
+int gatt_svr_desc_presentation_uint8_access(uint16_t con_handle, uint16_t attr_handle,
+                                            struct ble_gatt_access_ctxt *ctxt, void *arg);
+int gatt_svr_desc_valid_range_uint8_access(uint16_t con_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt,
+                                           void *arg);
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "host/ble_hs.h"
+#include "sdkconfig.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Characteristics a peer can subscribe to (bit index in ble_connection_t::subscriptions)
+typedef enum
+{
+    CONN_CHR_UART_TX = 0,
+    CONN_CHR_OTA_CONTROL,
+    CONN_CHR_STATE,
+    CONN_CHR_LIGHT_COMMAND,
+    CONN_CHR_COUNT,
+} conn_chr_t;
+
+typedef struct
+{
+    uint16_t conn_handle;
+    bool is_connected;
+    uint16_t mtu;
+    bool encrypted;
+    bool authenticated;
+    bool bonded;
+    uint32_t subscriptions; // bitmask of conn_chr_t
+    uint32_t notify_sent;
+    uint32_t notify_failed;
+    uint32_t writes_received;
+} ble_connection_t;
+
+/**
+ * @brief Resets all connection slots.
+ *
+ * Must be called before the NimBLE host task is started.
+ */
+void conn_registry_init(void);
+
+/**
+ * @brief Binds a subscribable characteristic to its value handle.
+ *
+ * The handle is resolved lazily, so the pointer passed as `.val_handle` in the GATT table can be used
+ * before the stack has assigned it.
+ */
+void conn_registry_bind_chr(conn_chr_t chr, const uint16_t *val_handle);
+
+/*
+ * Writers - only to be called from the NimBLE host task (GAP event handler).
+ */
+bool conn_registry_add(uint16_t conn_handle);
+void conn_registry_remove(uint16_t conn_handle);
+void conn_registry_set_mtu(uint16_t conn_handle, uint16_t mtu);
+void conn_registry_set_security(uint16_t conn_handle, const struct ble_gap_sec_state *sec_state);
+void conn_registry_set_subscription(uint16_t conn_handle, uint16_t attr_handle, bool notify);
+
+/*
+ * Counters - safe to call from any task.
+ */
+void conn_registry_count_notify(uint16_t conn_handle, bool success);
+void conn_registry_count_write(uint16_t conn_handle);
+
+/**
+ * @brief Copies a consistent view of all active connections without taking a lock.
+ *
+ * @param out   Destination array, at least CONFIG_BT_NIMBLE_MAX_CONNECTIONS entries.
+ * @param chr   Only return peers subscribed to this characteristic, or CONN_CHR_COUNT for all peers.
+ * @return Number of entries written to `out`.
+ */
+size_t conn_registry_snapshot(ble_connection_t *out, conn_chr_t chr);
+
+bool is_any_device_connected(void);
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @brief Reads the time from the peer's Current Time Service (0x1805), if it has one, and sets the calendar.
+ *
+ * Called once the link is encrypted; phones only expose the service to bonded peers. The GATT procedures run
+ * in the background on the host task, a peer without the service is simply left alone.
+ */
+void cts_client_sync(uint16_t conn_handle);
@@ -3,6 +3,12 @@
 #include "host/ble_hs.h"
 #include <stdio.h>
 
+// Device Information strings, shared with the state snapshot characteristic
+const char *device_info_name(void);
+const char *device_info_firmware_revision(void);
+const char *device_info_hardware_revision(void);
+const char *device_info_manufacturer(void);
+
 // 0x2A00 - Device Name
 int gatt_svr_chr_device_name_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt,
                                     void *arg);
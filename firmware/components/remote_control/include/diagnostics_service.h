@@ -0,0 +1,8 @@
+#pragma once
+
+#include "host/ble_hs.h"
+#include <stdint.h>
+
+// 0xA0D1 - Runtime Metrics
+int gatt_svr_chr_diag_metrics_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt,
+                                     void *arg);
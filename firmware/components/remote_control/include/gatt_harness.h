@@ -0,0 +1,15 @@
+#pragma once
+
+#include "esp_err.h"
+
+/**
+ * @brief Drives every GATT access callback with synthetic requests and prints latency, heap delta and ATT
+ * result per request. Host build only, see LIGHTHOUSE_GATT_HARNESS in sim.h.
+ *
+ * Must be called once the light controller runs.
+ *
+ * @return
+ *     - ESP_OK: Every request got its expected result and no mbuf was leaked.
+ *     - ESP_FAIL: At least one request did not.
+ */
+esp_err_t gatt_harness_run(void);
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * L2CAP connection-oriented channel next to the GATT server, for bulk uploads and frame streams: a message of up
+ * to L2CAP_SERVICE_SDU_SIZE bytes is one SDU, sent as a few link layer packets without an ATT header on each, and
+ * the credits of the channel pace the sender, who otherwise guesses how fast to write without response.
+ */
+#define L2CAP_SERVICE_PSM 0x0080    ///< first LE dynamic PSM
+#define L2CAP_SERVICE_SDU_SIZE 1024 ///< largest SDU the channel receives
+
+/**
+ * @brief Registers the channel server on L2CAP_SERVICE_PSM.
+ *
+ * Must be called after nimble_port_init() and before the NimBLE host task is started.
+ */
+void l2cap_service_init(void);
@@ -11,6 +11,12 @@ int gatt_svr_chr_light_led_access(uint16_t conn_handle, uint16_t attr_handle, st
 int gatt_svr_chr_light_beacon_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt,
                                      void *arg);
 
+// 0xBA7C - Command Batch (TLV)
+extern uint16_t light_command_val_handle;
+
+int gatt_svr_chr_light_command_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt,
+                                      void *arg);
+
 /// Outdoor Light Descriptors
 int gatt_svr_desc_led_user_desc_access(uint16_t con_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt,
                                        void *arg);
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "esp_err.h"
+#include "host/ble_hs.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// [state][last error (i32)][next seq (u16)][bytes received (u32)][bytes written (u32)][KB/s (u16)]
+#define OTA_STATUS_SIZE 17
+
+// 0xA0F0 - OTA Service
+extern uint16_t ota_control_val_handle;
+
+// 0xA0F1 - OTA Control (begin/end/abort, status on read and notify)
+int gatt_svr_chr_ota_control_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt,
+                                    void *arg);
+
+// 0xA0F2 - OTA Data (image chunks, write without response)
+int gatt_svr_chr_ota_data_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt,
+                                 void *arg);
+
+/*
+ * Transport independent part, shared with the L2CAP channel (l2cap_service.c), so only one peer updates at a time
+ * whichever way it sends the image. Host task only.
+ */
+
+/**
+ * @brief Runs an OTA control command, the value of a write to 0xA0F1.
+ *
+ * @return
+ *     - ESP_OK: Command done.
+ *     - ESP_ERR_INVALID_ARG: Wrong length for the command.
+ *     - ESP_ERR_NOT_ALLOWED: Another peer owns the update.
+ *     - ESP_ERR_NOT_SUPPORTED: Unknown command.
+ *     - Error codes of ota_begin() or ota_finish().
+ */
+esp_err_t ota_service_control(uint16_t conn_handle, const uint8_t *cmd, size_t len);
+
+/**
+ * @brief Writes one image chunk, the value of a write to 0xA0F2. A failed chunk ends the update.
+ *
+ * @return
+ *     - ESP_OK: Chunk written.
+ *     - ESP_ERR_NOT_ALLOWED: The peer does not own the update.
+ *     - Error codes of ota_write_chunk().
+ */
+esp_err_t ota_service_write(uint16_t conn_handle, const uint8_t *chunk, size_t len);
+
+/**
+ * @brief Packs the update status as read from 0xA0F1 into `out`, OTA_STATUS_SIZE bytes.
+ */
+size_t ota_service_pack_status(uint8_t *out);
+
+void ota_service_init(void);
+void ota_service_on_disconnect(uint16_t conn_handle);
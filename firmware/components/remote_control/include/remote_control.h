@@ -1,15 +1,17 @@
 #pragma once
 
-#include "host/ble_hs.h"
+#include "esp_err.h"
 #include "sdkconfig.h"
 
-typedef struct
-{
-    uint16_t conn_handle;
-    bool is_connected;
-} ble_connection_t;
+esp_err_t remote_control_init(void);
 
-extern ble_connection_t g_connections[CONFIG_BT_NIMBLE_MAX_CONNECTIONS];
-
-void remote_control_init(void);
-bool is_any_device_connected(void);
+/**
+ * @brief Opens a pairing window: advertises fast and flags pairing in the advertising data for a while.
+ *
+ * Safe to call from any task; the window ends on timeout or when a peer connects.
+ *
+ * @return
+ *     - ESP_OK: Pairing window requested.
+ *     - ESP_ERR_INVALID_STATE: The BLE stack is not running.
+ */
+esp_err_t remote_control_start_pairing(void);
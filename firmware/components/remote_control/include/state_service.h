@@ -0,0 +1,17 @@
+#pragma once
+
+#include "host/ble_hs.h"
+#include <stdint.h>
+
+// 0x57A7 - Device State Snapshot
+extern uint16_t state_chr_val_handle;
+
+int gatt_svr_chr_state_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt,
+                              void *arg);
+
+/**
+ * @brief Starts notifying subscribers about light state changes.
+ *
+ * Must be called before the NimBLE host task is started.
+ */
+void state_service_init(void);
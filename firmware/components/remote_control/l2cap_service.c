@@ -0,0 +1,355 @@
+#include "include/l2cap_service.h"
+#include "color.h"
+#include "compositor.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "host/ble_hs.h"
+#include "include/ota_service.h"
+#include "power.h"
+#include "sdkconfig.h"
+#include "trace.h"
+#include <string.h>
+
+static const char *TAG = "l2cap_service";
+
+#if CONFIG_BT_NIMBLE_L2CAP_COC_MAX_NUM < 1
+#error "The L2CAP channel needs CONFIG_BT_NIMBLE_L2CAP_COC_MAX_NUM of at least 1"
+#endif
+
+// Messages, one per SDU: [opcode][payload]
+#define L2CAP_OP_OTA_CONTROL 0x01 // [command as written to 0xA0F1], answered with [0x01][result (i32)][OTA status]
+#define L2CAP_OP_OTA_DATA 0x02    // [chunk as written to 0xA0F2], answered like a control command only if it failed
+#define L2CAP_OP_FRAME 0x10       // [red][green][blue] per pixel, up to COMPOSITOR_PIXELS
+#define L2CAP_OP_FRAME_END 0x11   // the lights below the stream show again
+#define L2CAP_OP_STATS 0x20       // answered with [0x20][bytes (u32)][SDUs (u32)][ms (u32)][KB/s (u16)]
+
+#define L2CAP_STATS_SIZE 15
+
+/*
+ * The channel is served on the host task like the GATT characteristics, so it shares the OTA ownership with them
+ * without a lock. Received SDUs come from a static pool of two blocks, each big enough for a whole SDU, so the
+ * stack never allocates for the channel: one block is handed to the stack for the next SDU, which grants the
+ * peer the credits for it, before the other one is handled. A flash write while handling an SDU therefore does
+ * not stop the link; the peer runs out of credits only if the next SDU is complete before the write is.
+ */
+#define L2CAP_SDU_BUFFERS 2
+#define L2CAP_SDU_BLOCK_SIZE (L2CAP_SERVICE_SDU_SIZE + sizeof(struct os_mbuf) + sizeof(struct os_mbuf_pkthdr))
+
+static os_membuf_t sdu_memory[OS_MEMPOOL_SIZE(L2CAP_SDU_BUFFERS, L2CAP_SDU_BLOCK_SIZE)];
+static struct os_mempool sdu_mempool;
+static struct os_mbuf_pool sdu_pool;
+
+static struct ble_l2cap_chan *channel; ///< one channel at a time
+static uint16_t channel_conn_handle = BLE_HS_CONN_HANDLE_NONE;
+static bool rearm_pending = false; ///< the stack has no buffer for the next SDU, the peer no credits
+static bool streaming = false;
+static power_lock_t channel_lock; ///< CPU at full speed while the channel is open
+
+static struct
+{
+    uint32_t bytes;
+    uint32_t sdus;
+    int64_t first_us;
+    int64_t last_us;
+} stats;
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static uint32_t duration_ms(void)
+{
+    return stats.sdus > 1 ? (uint32_t)((stats.last_us - stats.first_us) / 1000) : 0;
+}
+
+static uint32_t throughput_kbps(void)
+{
+    uint32_t elapsed_ms = duration_ms();
+    return elapsed_ms > 0 ? (uint32_t)((uint64_t)stats.bytes * 1000 / 1024 / elapsed_ms) : 0;
+}
+
+// Hands the stack a block for the next SDU, which returns the credits for it to the peer
+static int arm(struct ble_l2cap_chan *chan)
+{
+    struct os_mbuf *sdu = os_mbuf_get_pkthdr(&sdu_pool, 0);
+    if (sdu == NULL)
+    {
+        return BLE_HS_ENOMEM;
+    }
+
+    int rc = ble_l2cap_recv_ready(chan, sdu);
+    if (rc != 0)
+    {
+        os_mbuf_free_chain(sdu);
+    }
+    return rc;
+}
+
+static void send(struct ble_l2cap_chan *chan, const uint8_t *data, uint16_t len)
+{
+    struct os_mbuf *om = ble_hs_mbuf_from_flat(data, len);
+    if (om == NULL)
+    {
+        return;
+    }
+
+    // a stalled SDU is queued and goes out with the next credits; anything else is not sent
+    int rc = ble_l2cap_send(chan, om);
+    if (rc != 0 && rc != BLE_HS_ESTALLED)
+    {
+        ESP_LOGW(TAG, "Failed to send reply: %d", rc);
+        os_mbuf_free_chain(om);
+    }
+}
+
+static void reply_ota_status(struct ble_l2cap_chan *chan, esp_err_t result)
+{
+    uint8_t reply[1 + 4 + OTA_STATUS_SIZE];
+    reply[0] = L2CAP_OP_OTA_CONTROL;
+    put_le32(&reply[1], (uint32_t)result);
+    send(chan, reply, 5 + ota_service_pack_status(&reply[5]));
+}
+
+static void reply_stats(struct ble_l2cap_chan *chan)
+{
+    uint32_t kbps = throughput_kbps();
+
+    uint8_t reply[L2CAP_STATS_SIZE];
+    reply[0] = L2CAP_OP_STATS;
+    put_le32(&reply[1], stats.bytes);
+    put_le32(&reply[5], stats.sdus);
+    put_le32(&reply[9], duration_ms());
+    reply[13] = kbps > UINT16_MAX ? 0xff : kbps;
+    reply[14] = kbps > UINT16_MAX ? 0xff : kbps >> 8;
+    send(chan, reply, sizeof(reply));
+}
+
+static void draw_frame(const uint8_t *data, uint16_t len)
+{
+    if (len % 3 != 0 || len / 3 > COMPOSITOR_PIXELS)
+    {
+        ESP_LOGW(TAG, "Frame of %u bytes does not fit %d pixels", len, COMPOSITOR_PIXELS);
+        return;
+    }
+
+    // opaque, so the stream covers the beacon and the ambient glow; alerts still show over it
+    color_linear_t pixels[COMPOSITOR_PIXELS];
+    uint32_t count = len / 3;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        color_t color = {.red = data[3 * i], .green = data[3 * i + 1], .blue = data[3 * i + 2]};
+        pixels[i] = color_to_linear(color, 255) | COLOR_LINEAR(0, 0, 0, 255);
+    }
+    compositor_draw(COMPOSITOR_LAYER_STREAM, pixels, count);
+    if (!streaming)
+    {
+        compositor_set_layer(COMPOSITOR_LAYER_STREAM, COMPOSITOR_BLEND_ALPHA, 255);
+        streaming = true;
+    }
+    compositor_render(NULL);
+}
+
+static void end_stream(void)
+{
+    if (!streaming)
+    {
+        return;
+    }
+    compositor_set_layer(COMPOSITOR_LAYER_STREAM, COMPOSITOR_BLEND_ALPHA, 0);
+    streaming = false;
+    compositor_render(NULL);
+}
+
+static void handle(struct ble_l2cap_chan *chan, const uint8_t *data, uint16_t len)
+{
+    if (len == 0)
+    {
+        return;
+    }
+
+    esp_err_t ret;
+    switch (data[0])
+    {
+    case L2CAP_OP_OTA_CONTROL:
+        ret = ota_service_control(channel_conn_handle, &data[1], len - 1);
+        reply_ota_status(chan, ret);
+        break;
+
+    case L2CAP_OP_OTA_DATA:
+        ret = ota_service_write(channel_conn_handle, &data[1], len - 1);
+        if (ret != ESP_OK)
+        {
+            // like on GATT the chunks are not acknowledged, the sender only hears of a failure
+            reply_ota_status(chan, ret);
+        }
+        break;
+
+    case L2CAP_OP_FRAME:
+        draw_frame(&data[1], len - 1);
+        break;
+
+    case L2CAP_OP_FRAME_END:
+        end_stream();
+        break;
+
+    case L2CAP_OP_STATS:
+        reply_stats(chan);
+        break;
+
+    default:
+        ESP_LOGW(TAG, "Unknown opcode 0x%02x", data[0]);
+        break;
+    }
+}
+
+static void receive(struct ble_l2cap_chan *chan, struct os_mbuf *sdu)
+{
+    rearm_pending = arm(chan) != 0;
+
+    uint16_t len = OS_MBUF_PKTLEN(sdu);
+    int64_t now_us = esp_timer_get_time();
+    stats.first_us = stats.sdus == 0 ? now_us : stats.first_us;
+    stats.last_us = now_us;
+    stats.sdus++;
+    stats.bytes += len;
+    TRACE("l2cap rx conn=%u len=%u", channel_conn_handle, len);
+
+    // the SDU fits one block of the pool, so it is contiguous already and the pullup does not copy it
+    sdu = os_mbuf_pullup(sdu, len);
+    if (sdu == NULL)
+    {
+        ESP_LOGE(TAG, "SDU of %u bytes does not fit a block", len);
+    }
+    else
+    {
+        handle(chan, sdu->om_data, len);
+        os_mbuf_free_chain(sdu);
+    }
+
+    if (rearm_pending)
+    {
+        int rc = arm(chan);
+        rearm_pending = rc != 0;
+        if (rearm_pending)
+        {
+            ESP_LOGE(TAG, "Failed to receive the next SDU: %d", rc);
+        }
+    }
+}
+
+static int accept(uint16_t conn_handle, struct ble_l2cap_chan *chan)
+{
+    // like the GATT characteristics, the channel is only open to encrypted links
+    struct ble_gap_conn_desc desc;
+    if (ble_gap_conn_find(conn_handle, &desc) != 0 || !desc.sec_state.encrypted)
+    {
+        return BLE_HS_EAUTHEN;
+    }
+    if (channel != NULL)
+    {
+        return BLE_HS_ENOMEM;
+    }
+
+    int rc = arm(chan);
+    if (rc != 0)
+    {
+        return rc;
+    }
+    channel = chan;
+    channel_conn_handle = conn_handle;
+    rearm_pending = false;
+    memset(&stats, 0, sizeof(stats));
+    return 0;
+}
+
+static void log_throughput(void)
+{
+    struct ble_gap_conn_desc desc;
+    if (ble_gap_conn_find(channel_conn_handle, &desc) != 0)
+    {
+        ESP_LOGI(TAG, "Throughput %lu KB/s (%lu SDUs, %lu bytes in %lu ms)", throughput_kbps(), stats.sdus,
+                 stats.bytes, duration_ms());
+        return;
+    }
+
+    // the same figures as the GATT upload logs (ota_service.c), to compare the two paths on one link
+    ESP_LOGI(TAG, "Throughput %lu KB/s (itvl=%d x1.25ms, latency=%d, %lu SDUs, %lu bytes in %lu ms)",
+             throughput_kbps(), desc.conn_itvl, desc.conn_latency, stats.sdus, stats.bytes, duration_ms());
+}
+
+static int l2cap_event(struct ble_l2cap_event *event, void *arg)
+{
+    switch (event->type)
+    {
+    case BLE_L2CAP_EVENT_COC_ACCEPT:
+        return accept(event->accept.conn_handle, event->accept.chan);
+
+    case BLE_L2CAP_EVENT_COC_CONNECTED:
+        if (event->connect.status != 0)
+        {
+            ESP_LOGW(TAG, "Channel failed; status=%d", event->connect.status);
+            channel = NULL;
+            channel_conn_handle = BLE_HS_CONN_HANDLE_NONE;
+            return 0;
+        }
+
+        struct ble_l2cap_chan_info info;
+        if (ble_l2cap_get_chan_info(event->connect.chan, &info) == 0)
+        {
+            ESP_LOGI(TAG, "Channel open; conn=%d, sdu=%d/%d, mps=%d/%d (ours/peer's)", event->connect.conn_handle,
+                     info.our_coc_mtu, info.peer_coc_mtu, info.our_l2cap_mtu, info.peer_l2cap_mtu);
+        }
+        power_lock_acquire(channel_lock);
+        return 0;
+
+    case BLE_L2CAP_EVENT_COC_DISCONNECTED:
+        if (event->disconnect.chan != channel)
+        {
+            return 0;
+        }
+        log_throughput();
+        end_stream();
+        power_lock_release(channel_lock);
+        channel = NULL;
+        channel_conn_handle = BLE_HS_CONN_HANDLE_NONE;
+        return 0;
+
+    case BLE_L2CAP_EVENT_COC_DATA_RECEIVED:
+        receive(event->receive.chan, event->receive.sdu_rx);
+        return 0;
+
+    default:
+        return 0;
+    }
+}
+
+void l2cap_service_init(void)
+{
+    // frames are blended and uploads decompressed and written at the rate of the link
+    esp_err_t ret = power_lock_create(POWER_NEED_CPU_MAX, "l2cap", &channel_lock);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to create the channel power lock, the link runs at any clock: %s", esp_err_to_name(ret));
+    }
+
+    int rc = os_mempool_init(&sdu_mempool, L2CAP_SDU_BUFFERS, L2CAP_SDU_BLOCK_SIZE, sdu_memory, "l2cap_sdu");
+    if (rc == 0)
+    {
+        rc = os_mbuf_pool_init(&sdu_pool, &sdu_mempool, L2CAP_SDU_BLOCK_SIZE, L2CAP_SDU_BUFFERS);
+    }
+    if (rc == 0)
+    {
+        rc = ble_l2cap_create_server(L2CAP_SERVICE_PSM, L2CAP_SERVICE_SDU_SIZE, l2cap_event, NULL);
+    }
+    if (rc != 0)
+    {
+        ESP_LOGE(TAG, "Failed to create L2CAP server (err: %d)", rc);
+        return;
+    }
+
+    ESP_LOGI(TAG, "L2CAP channel on PSM 0x%04x, SDUs up to %d bytes", L2CAP_SERVICE_PSM, L2CAP_SERVICE_SDU_SIZE);
+}
@@ -1,24 +1,62 @@
 #include "include/light_service.h"
-#include "beacon.h"
-#include "persistence.h"
+#include "esp_timer.h"
+#include "include/conn_registry.h"
+#include "light.h"
+#include "light_command.h"
+#include "trace.h"
+#include <string.h>
 
-static uint8_t g_beacon_enabled = 0;
-static int8_t g_led_value = 0;
+/*
+ * Command batch (0xBA7C): a sequence of [type][length][value] entries. The whole batch is
+ * validated first and only posted to the light controller if every entry is valid; the controller
+ * applies it and persists the settings with a single commit. The result - [entry count][status per
+ * entry] - can be read back and is notified to the writer.
+ */
+#define LIGHT_TLV_BEACON_ENABLED 0x01  // [0|1]
+#define LIGHT_TLV_OUTDOOR_ENABLED 0x02 // [0|1]
+#define LIGHT_TLV_CHARACTER 0x03       // [beacon_character_t]
+#define LIGHT_TLV_BRIGHTNESS 0x04      // [0..255]
+#define LIGHT_TLV_OUTDOOR_LEVEL 0x05   // [0..255]
+
+#define LIGHT_TLV_STATUS_OK 0x00
+#define LIGHT_TLV_STATUS_UNKNOWN_TYPE 0x01
+#define LIGHT_TLV_STATUS_INVALID_LENGTH 0x02
+#define LIGHT_TLV_STATUS_INVALID_VALUE 0x03
+#define LIGHT_TLV_STATUS_DUPLICATE 0x04
+#define LIGHT_TLV_STATUS_NOT_APPLIED 0x05 // valid, but the batch was rejected because of another entry
+#define LIGHT_TLV_STATUS_FAILED 0x06      // valid, but the batch could not be posted
+
+#define LIGHT_TLV_MAX_ENTRIES 8
+
+uint16_t light_command_val_handle;
+
+static uint8_t command_result[LIGHT_TLV_MAX_ENTRIES];
+static uint8_t command_result_count = 0;
 
 /// Characteristic Callbacks
+
+// Outdoor level (0xF037): [0..255], written without response at the rate of a slider
 int gatt_svr_chr_light_led_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt,
                                   void *arg)
 {
     if (ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR)
     {
-        char *data = "To be implemented later";
-        os_mbuf_append(ctxt->om, data, strlen(data));
-        return 0;
+        uint8_t level = outdoor_get_level();
+        return os_mbuf_append(ctxt->om, &level, sizeof(level)) == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
     }
     if (ctxt->op == BLE_GATT_ACCESS_OP_WRITE_CHR)
     {
-        int8_t led_value = 0;
-        persistence_load(VALUE_TYPE_INT8, "LED_VALUE", &led_value);
+        if (OS_MBUF_PKTLEN(ctxt->om) != 1)
+        {
+            return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+        }
+        uint8_t level;
+        os_mbuf_copydata(ctxt->om, 0, 1, &level);
+
+        // no queue and no flash write per value: the lamps fade to the newest one, the settled one is persisted
+        esp_err_t ret = light_command_set_live_level(level);
+        TRACE("led write %u", level);
+        return ret == ESP_OK ? 0 : BLE_ATT_ERR_UNLIKELY;
     }
     return BLE_ATT_ERR_UNLIKELY;
 }
@@ -29,14 +67,13 @@ int gatt_svr_chr_light_beacon_access(uint16_t conn_handle, uint16_t attr_handle,
 
     if (ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR)
     {
-        return os_mbuf_append(ctxt->om, &g_beacon_enabled, sizeof(g_beacon_enabled)) == 0
-                   ? 0
-                   : BLE_ATT_ERR_INSUFFICIENT_RES;
+        uint8_t beacon_enabled = beacon_is_running();
+        return os_mbuf_append(ctxt->om, &beacon_enabled, sizeof(beacon_enabled)) == 0 ? 0
+                                                                                      : BLE_ATT_ERR_INSUFFICIENT_RES;
     }
     if (ctxt->op == BLE_GATT_ACCESS_OP_WRITE_CHR)
     {
-        int8_t beacon_enabled = 0;
-        persistence_load(VALUE_TYPE_INT8, "BEACON_ENABLED", &beacon_enabled);
+        int64_t start = esp_timer_get_time();
 
         // it has to be 1 Byte (0 or 1)
         if (OS_MBUF_PKTLEN(ctxt->om) != 1)
@@ -47,28 +84,194 @@ int gatt_svr_chr_light_beacon_access(uint16_t conn_handle, uint16_t attr_handle,
         os_mbuf_copydata(ctxt->om, 0, 1, &val);
         if (val > 1)
         {
-            return BLE_ATT_ERR_UNLIKELY; // or BLE_ATT_ERR_INVALID_ATTR_VALUE
+            return BLE_ATT_ERR_VALUE_NOT_ALLOWED;
+        }
+
+        // the drivers and the NVS commit run on the light controller, not on the host task
+        light_settings_t settings = {.beacon_enabled = val};
+        esp_err_t ret = light_command_post_timed(&settings, LIGHT_SETTING_BEACON_ENABLED, LATENCY_PATH_BLE, start);
+
+        TRACE("beacon write %u us", (uint32_t)(esp_timer_get_time() - start));
+        return ret == ESP_OK ? 0 : BLE_ATT_ERR_UNLIKELY;
+    }
+    return BLE_ATT_ERR_UNLIKELY;
+}
+
+static size_t pack_command_result(uint8_t *out)
+{
+    out[0] = command_result_count;
+    memcpy(&out[1], command_result, command_result_count);
+    return 1 + command_result_count;
+}
+
+static void notify_command_result(uint16_t conn_handle)
+{
+    ble_connection_t subscribers[CONFIG_BT_NIMBLE_MAX_CONNECTIONS];
+    size_t count = conn_registry_snapshot(subscribers, CONN_CHR_LIGHT_COMMAND);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (subscribers[i].conn_handle == conn_handle)
+        {
+            uint8_t result[1 + LIGHT_TLV_MAX_ENTRIES];
+            struct os_mbuf *om = ble_hs_mbuf_from_flat(result, pack_command_result(result));
+            if (om)
+            {
+                int rc = ble_gatts_notify_custom(conn_handle, light_command_val_handle, om);
+                conn_registry_count_notify(conn_handle, rc == 0);
+            }
+        }
+    }
+}
+
+// Parses and validates a complete TLV batch; returns true if every entry is valid
+static bool parse_command_batch(const uint8_t *data, uint16_t len, light_settings_t *settings, uint32_t *mask)
+{
+    bool valid = true;
+    uint16_t pos = 0;
+
+    command_result_count = 0;
+    *mask = 0;
+
+    while (pos < len && command_result_count < LIGHT_TLV_MAX_ENTRIES)
+    {
+        uint8_t *status = &command_result[command_result_count++];
+
+        if (len - pos < 2 || len - pos - 2 < data[pos + 1])
+        {
+            *status = LIGHT_TLV_STATUS_INVALID_LENGTH;
+            return false;
         }
 
-        if (val == g_beacon_enabled) // value is already set
+        uint8_t type = data[pos];
+        uint8_t value_len = data[pos + 1];
+        const uint8_t *value = &data[pos + 2];
+        pos += 2 + value_len;
+
+        uint32_t field;
+        switch (type)
         {
-            return 0;
+        case LIGHT_TLV_BEACON_ENABLED:
+            field = LIGHT_SETTING_BEACON_ENABLED;
+            break;
+        case LIGHT_TLV_OUTDOOR_ENABLED:
+            field = LIGHT_SETTING_OUTDOOR_ENABLED;
+            break;
+        case LIGHT_TLV_CHARACTER:
+            field = LIGHT_SETTING_CHARACTER;
+            break;
+        case LIGHT_TLV_BRIGHTNESS:
+            field = LIGHT_SETTING_BRIGHTNESS;
+            break;
+        case LIGHT_TLV_OUTDOOR_LEVEL:
+            field = LIGHT_SETTING_OUTDOOR_LEVEL;
+            break;
+        default:
+            *status = LIGHT_TLV_STATUS_UNKNOWN_TYPE;
+            valid = false;
+            continue;
         }
 
-        g_beacon_enabled = val;
+        if (value_len != 1)
+        {
+            *status = LIGHT_TLV_STATUS_INVALID_LENGTH;
+            valid = false;
+            continue;
+        }
+        if (*mask & field)
+        {
+            *status = LIGHT_TLV_STATUS_DUPLICATE;
+            valid = false;
+            continue;
+        }
 
-        if (g_beacon_enabled)
+        switch (field)
         {
-            beacon_start();
+        case LIGHT_SETTING_BEACON_ENABLED:
+            settings->beacon_enabled = value[0];
+            break;
+        case LIGHT_SETTING_OUTDOOR_ENABLED:
+            settings->outdoor_enabled = value[0];
+            break;
+        case LIGHT_SETTING_CHARACTER:
+            settings->character = value[0];
+            break;
+        case LIGHT_SETTING_BRIGHTNESS:
+            settings->brightness = value[0];
+            break;
+        case LIGHT_SETTING_OUTDOOR_LEVEL:
+            settings->outdoor_level = value[0];
+            break;
+        }
+
+        bool is_flag = field == LIGHT_SETTING_BEACON_ENABLED || field == LIGHT_SETTING_OUTDOOR_ENABLED;
+        if ((is_flag && value[0] > 1) || light_validate(settings, field) != ESP_OK)
+        {
+            *status = LIGHT_TLV_STATUS_INVALID_VALUE;
+            valid = false;
         }
         else
         {
-            beacon_stop();
+            *status = LIGHT_TLV_STATUS_OK;
         }
-        persistence_save(VALUE_TYPE_INT8, "BEACON_ENABLED", &g_beacon_enabled);
-        return 0;
+        *mask |= field;
     }
-    return BLE_ATT_ERR_UNLIKELY;
+
+    if (pos < len)
+    {
+        // more entries than a batch may carry
+        return false;
+    }
+    return valid;
+}
+
+int gatt_svr_chr_light_command_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt,
+                                      void *arg)
+{
+    if (ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR)
+    {
+        uint8_t result[1 + LIGHT_TLV_MAX_ENTRIES];
+        return os_mbuf_append(ctxt->om, result, pack_command_result(result)) == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+    if (ctxt->op != BLE_GATT_ACCESS_OP_WRITE_CHR)
+    {
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+
+    int64_t start = esp_timer_get_time();
+
+    uint8_t data[LIGHT_TLV_MAX_ENTRIES * 3];
+    uint16_t len = OS_MBUF_PKTLEN(ctxt->om);
+    if (len == 0 || len > sizeof(data) || ble_hs_mbuf_to_flat(ctxt->om, data, sizeof(data), &len) != 0)
+    {
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    }
+
+    light_settings_t settings = {0};
+    uint32_t mask;
+    bool valid = parse_command_batch(data, len, &settings, &mask);
+
+    if (valid && light_command_post_timed(&settings, mask, LATENCY_PATH_BLE, start) != ESP_OK)
+    {
+        valid = false;
+        memset(command_result, LIGHT_TLV_STATUS_FAILED, command_result_count);
+    }
+    else if (!valid)
+    {
+        // nothing of a rejected batch is applied
+        for (uint8_t i = 0; i < command_result_count; i++)
+        {
+            if (command_result[i] == LIGHT_TLV_STATUS_OK)
+            {
+                command_result[i] = LIGHT_TLV_STATUS_NOT_APPLIED;
+            }
+        }
+    }
+
+    notify_command_result(conn_handle);
+
+    TRACE("command batch write %u us", (uint32_t)(esp_timer_get_time() - start));
+    return valid ? 0 : BLE_ATT_ERR_VALUE_NOT_ALLOWED;
 }
 
 // Characteristic User Descriptions
@@ -0,0 +1,267 @@
+#include "include/ota_service.h"
+#include "esp_log.h"
+#include "include/conn_registry.h"
+#include "ota.h"
+#include "power.h"
+#include <inttypes.h>
+#include <string.h>
+
+static const char *TAG = "ota_service";
+
+// Control opcodes (first byte of a write to 0xA0F1)
+#define OTA_OP_BEGIN 0x01 // [u32 image size][u8 flags]
+#define OTA_OP_END 0x02   // [u32 crc32 of the decompressed image]
+#define OTA_OP_ABORT 0x03
+
+#define OTA_FLAG_COMPRESSED 0x01
+
+uint16_t ota_control_val_handle;
+
+static uint16_t owner_conn_handle = BLE_HS_CONN_HANDLE_NONE;
+static uint8_t chunk_buffer[BLE_ATT_ATTR_MAX_LEN];
+static power_lock_t transfer_lock; ///< CPU at full speed while a peer owns the update
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+// Every change of the updating peer goes through here, so the transfer lock is held exactly while one owns it
+static void set_owner(uint16_t conn_handle)
+{
+    if (owner_conn_handle == BLE_HS_CONN_HANDLE_NONE && conn_handle != BLE_HS_CONN_HANDLE_NONE)
+    {
+        power_lock_acquire(transfer_lock);
+    }
+    else if (owner_conn_handle != BLE_HS_CONN_HANDLE_NONE && conn_handle == BLE_HS_CONN_HANDLE_NONE)
+    {
+        power_lock_release(transfer_lock);
+    }
+    owner_conn_handle = conn_handle;
+}
+
+size_t ota_service_pack_status(uint8_t *out)
+{
+    ota_status_t status;
+    ota_get_status(&status);
+
+    uint16_t kbps = status.throughput_kbps > UINT16_MAX ? UINT16_MAX : status.throughput_kbps;
+
+    out[0] = status.state;
+    put_le32(&out[1], (uint32_t)status.last_error);
+    out[5] = status.next_seq;
+    out[6] = status.next_seq >> 8;
+    put_le32(&out[7], status.bytes_received);
+    put_le32(&out[11], status.bytes_written);
+    out[15] = kbps;
+    out[16] = kbps >> 8;
+    return OTA_STATUS_SIZE;
+}
+
+static void notify_status(uint16_t conn_handle)
+{
+    ble_connection_t subscribers[CONFIG_BT_NIMBLE_MAX_CONNECTIONS];
+    size_t count = conn_registry_snapshot(subscribers, CONN_CHR_OTA_CONTROL);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (subscribers[i].conn_handle != conn_handle)
+        {
+            continue;
+        }
+
+        uint8_t status[OTA_STATUS_SIZE];
+        struct os_mbuf *om = ble_hs_mbuf_from_flat(status, ota_service_pack_status(status));
+        if (om)
+        {
+            int rc = ble_gatts_notify_custom(conn_handle, ota_control_val_handle, om);
+            conn_registry_count_notify(conn_handle, rc == 0);
+        }
+    }
+}
+
+static void log_throughput(uint16_t conn_handle)
+{
+    ota_status_t status;
+    ota_get_status(&status);
+
+    struct ble_gap_conn_desc desc;
+    if (ble_gap_conn_find(conn_handle, &desc) != 0)
+    {
+        return;
+    }
+
+    ESP_LOGI(TAG,
+             "Throughput %" PRIu32 " KB/s (itvl=%d x1.25ms, latency=%d, mtu=%d, %" PRIu32 " bytes in %" PRIu32 " ms)",
+             status.throughput_kbps, desc.conn_itvl, desc.conn_latency, ble_att_mtu(conn_handle),
+             status.bytes_received, status.duration_ms);
+}
+
+// Checks a control command without running it, so its errors are told apart from those of the update itself
+static esp_err_t check_control(uint16_t conn_handle, const uint8_t *cmd, size_t len)
+{
+    if (len == 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (owner_conn_handle != BLE_HS_CONN_HANDLE_NONE && owner_conn_handle != conn_handle)
+    {
+        // another peer is already updating
+        return ESP_ERR_NOT_ALLOWED;
+    }
+
+    switch (cmd[0])
+    {
+    case OTA_OP_BEGIN:
+        return len == 6 ? ESP_OK : ESP_ERR_INVALID_ARG;
+    case OTA_OP_END:
+        return len == 5 ? ESP_OK : ESP_ERR_INVALID_ARG;
+    case OTA_OP_ABORT:
+        return ESP_OK;
+    default:
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+}
+
+esp_err_t ota_service_control(uint16_t conn_handle, const uint8_t *cmd, size_t len)
+{
+    esp_err_t ret = check_control(conn_handle, cmd, len);
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+
+    switch (cmd[0])
+    {
+    case OTA_OP_BEGIN:
+        ret = ota_begin(get_le32(&cmd[1]), cmd[5] & OTA_FLAG_COMPRESSED);
+        if (ret == ESP_OK)
+        {
+            set_owner(conn_handle);
+        }
+        return ret;
+
+    case OTA_OP_END:
+        ret = ota_finish(get_le32(&cmd[1]));
+        log_throughput(conn_handle);
+        set_owner(BLE_HS_CONN_HANDLE_NONE);
+        return ret;
+
+    case OTA_OP_ABORT:
+        ota_abort();
+        set_owner(BLE_HS_CONN_HANDLE_NONE);
+        return ESP_OK;
+
+    default:
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+}
+
+esp_err_t ota_service_write(uint16_t conn_handle, const uint8_t *chunk, size_t len)
+{
+    if (conn_handle != owner_conn_handle)
+    {
+        return ESP_ERR_NOT_ALLOWED;
+    }
+
+    esp_err_t ret = ota_write_chunk(chunk, len);
+    if (ret != ESP_OK)
+    {
+        set_owner(BLE_HS_CONN_HANDLE_NONE);
+    }
+    return ret;
+}
+
+int gatt_svr_chr_ota_control_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt,
+                                    void *arg)
+{
+    if (ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR)
+    {
+        uint8_t status[OTA_STATUS_SIZE];
+        return os_mbuf_append(ctxt->om, status, ota_service_pack_status(status)) == 0 ? 0
+                                                                                       : BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+    if (ctxt->op != BLE_GATT_ACCESS_OP_WRITE_CHR)
+    {
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+
+    uint8_t cmd[6];
+    uint16_t len = OS_MBUF_PKTLEN(ctxt->om);
+    if (len == 0 || len > sizeof(cmd) || ble_hs_mbuf_to_flat(ctxt->om, cmd, sizeof(cmd), &len) != 0)
+    {
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    }
+
+    // a malformed command is answered with its ATT error; an update that fails is reported through the status,
+    // as ota_begin() and ota_finish() return the same codes for their own reasons
+    switch (check_control(conn_handle, cmd, len))
+    {
+    case ESP_OK:
+        break;
+    case ESP_ERR_INVALID_ARG:
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    case ESP_ERR_NOT_ALLOWED:
+        return BLE_ATT_ERR_WRITE_NOT_PERMITTED;
+    default:
+        return BLE_ATT_ERR_REQ_NOT_SUPPORTED;
+    }
+
+    esp_err_t ret = ota_service_control(conn_handle, cmd, len);
+    notify_status(conn_handle);
+    return ret == ESP_OK ? 0 : BLE_ATT_ERR_UNLIKELY;
+}
+
+int gatt_svr_chr_ota_data_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt,
+                                 void *arg)
+{
+    if (ctxt->op != BLE_GATT_ACCESS_OP_WRITE_CHR)
+    {
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+    if (conn_handle != owner_conn_handle)
+    {
+        return BLE_ATT_ERR_WRITE_NOT_PERMITTED;
+    }
+
+    uint16_t len;
+    if (ble_hs_mbuf_to_flat(ctxt->om, chunk_buffer, sizeof(chunk_buffer), &len) != 0)
+    {
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    }
+
+    if (ota_service_write(conn_handle, chunk_buffer, len) != ESP_OK)
+    {
+        // data is written without response, so the sender learns about the failure through the status
+        notify_status(conn_handle);
+        return BLE_ATT_ERR_UNLIKELY;
+    }
+    return 0;
+}
+
+void ota_service_init(void)
+{
+    // decompression and flash writes keep up with the link only at full clock
+    esp_err_t ret = power_lock_create(POWER_NEED_CPU_MAX, "ota", &transfer_lock);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to create the transfer power lock, uploads run at any clock: %s", esp_err_to_name(ret));
+    }
+}
+
+void ota_service_on_disconnect(uint16_t conn_handle)
+{
+    if (conn_handle == owner_conn_handle)
+    {
+        ota_abort();
+        set_owner(BLE_HS_CONN_HANDLE_NONE);
+    }
+}
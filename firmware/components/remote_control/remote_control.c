@@ -13,14 +13,22 @@
 #include "host/ble_sm.h"
 #include "host/ble_uuid.h"
 #include "include/char_desc.h"
+#include "include/conn_registry.h"
+#include "include/cts_client.h"
 #include "include/device_service.h"
+#include "include/diagnostics_service.h"
+#include "include/l2cap_service.h"
 #include "include/light_service.h"
+#include "include/ota_service.h"
+#include "include/state_service.h"
 #include "include/uart_service.h"
+#include "light.h"
 #include "nimble/nimble_port.h"
 #include "nimble/nimble_port_freertos.h"
 #include "sdkconfig.h"
 #include "services/gap/ble_svc_gap.h"
 #include "services/gatt/ble_svc_gatt.h"
+#include "trace.h"
 
 void ble_store_config_init(void);
 
@@ -29,31 +37,29 @@ static const char *TAG = "remote_control";
 static const ble_uuid16_t gatt_svr_svc_device_uuid = BLE_UUID16_INIT(0x180A);
 static const ble_uuid16_t gatt_svr_svc_light_uuid = BLE_UUID16_INIT(0xA000);
 static const ble_uuid16_t gatt_svr_svc_settings_uuid = BLE_UUID16_INIT(0xA999);
+static const ble_uuid16_t gatt_svr_svc_ota_uuid = BLE_UUID16_INIT(0xA0F0);
+static const ble_uuid16_t gatt_svr_svc_diagnostics_uuid = BLE_UUID16_INIT(0xA0D0);
 
 uint8_t ble_addr_type;
 
-ble_connection_t g_connections[CONFIG_BT_NIMBLE_MAX_CONNECTIONS];
+/// Layout version of the status record in the manufacturer data
+#define ADV_STATUS_VERSION 0x01
 
-static void init_connection_pool()
-{
-    for (int i = 0; i < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; i++)
-    {
-        g_connections[i].conn_handle = BLE_HS_CONN_HANDLE_NONE;
-        g_connections[i].is_connected = false;
-    }
-}
+#define ADV_STATUS_FLAG_BEACON (1 << 0)
+#define ADV_STATUS_FLAG_OUTDOOR (1 << 1)
+#define ADV_STATUS_FLAG_PAIRING (1 << 2)
 
-bool is_any_device_connected(void)
-{
-    for (int i = 0; i < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; i++)
-    {
-        if (g_connections[i].is_connected)
-        {
-            return true;
-        }
-    }
-    return false;
-}
+#define PAIRING_WINDOW_MS (60 * 1000)
+
+#define UART_TX_TASK_STACK_SIZE 2048
+
+static StackType_t uart_tx_task_stack[UART_TX_TASK_STACK_SIZE];
+static StaticTask_t uart_tx_task_buffer;
+
+static struct ble_npl_event adv_update_event;
+static struct ble_npl_event pairing_event;
+static bool adv_connectable = false; ///< mode of the running advertisement, see ble_app_advertise()
+static bool pairing_window_open = false;
 
 static void ble_app_advertise(void);
 
@@ -92,13 +98,13 @@ static struct ble_gatt_dsc_def led_char_desc[] = {
         // Presentation Format Descriptor
         .uuid = BLE_UUID16_DECLARE(0x2904),
         .att_flags = BLE_ATT_F_READ,
-        .access_cb = gatt_svr_desc_presentation_bool_access,
+        .access_cb = gatt_svr_desc_presentation_uint8_access,
     },
     {
         // Valid Range Descriptor
         .uuid = BLE_UUID16_DECLARE(0x2906),
         .att_flags = BLE_ATT_F_READ,
-        .access_cb = gatt_svr_desc_valid_range_bool_access,
+        .access_cb = gatt_svr_desc_valid_range_uint8_access,
     },
     {0},
 };
@@ -155,11 +161,26 @@ static const struct ble_gatt_svc_def gatt_svcs[] = {
                 {
                     // LED Characteristic
                     .uuid = BLE_UUID16_DECLARE(0xF037),
-                    .flags =
-                        BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_READ_ENC | BLE_GATT_CHR_F_WRITE_ENC,
+                    .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_NO_RSP |
+                             BLE_GATT_CHR_F_READ_ENC | BLE_GATT_CHR_F_WRITE_ENC,
                     .access_cb = gatt_svr_chr_light_led_access,
                     .descriptors = led_char_desc,
                 },
+                {
+                    // Command Batch Characteristic
+                    .uuid = BLE_UUID16_DECLARE(0xBA7C),
+                    .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_NOTIFY |
+                             BLE_GATT_CHR_F_READ_ENC | BLE_GATT_CHR_F_WRITE_ENC,
+                    .access_cb = gatt_svr_chr_light_command_access,
+                    .val_handle = &light_command_val_handle,
+                },
+                {
+                    // State Snapshot Characteristic
+                    .uuid = BLE_UUID16_DECLARE(0x57A7),
+                    .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY | BLE_GATT_CHR_F_READ_ENC,
+                    .access_cb = gatt_svr_chr_state_access,
+                    .val_handle = &state_chr_val_handle,
+                },
                 {0},
             },
     },
@@ -185,6 +206,44 @@ static const struct ble_gatt_svc_def gatt_svcs[] = {
                 {0},
             },
     },
+    {
+        // OTA Service
+        .type = BLE_GATT_SVC_TYPE_PRIMARY,
+        .uuid = &gatt_svr_svc_ota_uuid.u,
+        .characteristics =
+            (struct ble_gatt_chr_def[]){
+                {
+                    // OTA Control Characteristic
+                    .uuid = BLE_UUID16_DECLARE(0xA0F1),
+                    .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_NOTIFY |
+                             BLE_GATT_CHR_F_READ_ENC | BLE_GATT_CHR_F_WRITE_ENC,
+                    .access_cb = gatt_svr_chr_ota_control_access,
+                    .val_handle = &ota_control_val_handle,
+                },
+                {
+                    // OTA Data Characteristic
+                    .uuid = BLE_UUID16_DECLARE(0xA0F2),
+                    .flags = BLE_GATT_CHR_F_WRITE_NO_RSP | BLE_GATT_CHR_F_WRITE_ENC,
+                    .access_cb = gatt_svr_chr_ota_data_access,
+                },
+                {0},
+            },
+    },
+    {
+        // Diagnostics Service
+        .type = BLE_GATT_SVC_TYPE_PRIMARY,
+        .uuid = &gatt_svr_svc_diagnostics_uuid.u,
+        .characteristics =
+            (struct ble_gatt_chr_def[]){
+                {
+                    // Runtime Metrics Characteristic
+                    .uuid = BLE_UUID16_DECLARE(0xA0D1),
+                    .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_READ_ENC,
+                    .access_cb = gatt_svr_chr_diag_metrics_access,
+                },
+                {0},
+            },
+    },
     // Settings Service (empty for now)
     {
         .type = BLE_GATT_SVC_TYPE_PRIMARY,
@@ -228,6 +287,8 @@ static int ble_gap_event(struct ble_gap_event *event, void *arg)
     esp_err_t rc;
     struct ble_gap_conn_desc desc;
 
+    TRACE("gap event %u", event->type);
+
     switch (event->type)
     {
     case BLE_GAP_EVENT_CONNECT:
@@ -238,22 +299,11 @@ static int ble_gap_event(struct ble_gap_event *event, void *arg)
         /* Connection succeeded */
         if (event->connect.status == 0)
         {
-            bool found_slot = false;
-            for (int i = 0; i < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; i++)
-            {
-                if (!g_connections[i].is_connected)
-                {
-                    g_connections[i].conn_handle = event->connect.conn_handle;
-                    g_connections[i].is_connected = true;
-                    found_slot = true;
-                    ESP_LOGI(TAG, "Connection stored in slot %d", i);
-                    break;
-                }
-            }
-            if (!found_slot)
-            {
-                ESP_LOGW(TAG, "No free connection slot available!");
-            }
+            conn_registry_add(event->connect.conn_handle);
+            pairing_window_open = false;
+
+            /* The controller stopped advertising for the connection; scanners keep reading the status */
+            ble_app_advertise();
 
             /* Check connection handle */
             rc = ble_gap_conn_find(event->connect.conn_handle, &desc);
@@ -284,17 +334,9 @@ static int ble_gap_event(struct ble_gap_event *event, void *arg)
 
     case BLE_GAP_EVENT_DISCONNECT:
         ESP_LOGI(TAG, "Disconnected; reason=%d", event->disconnect.reason);
-        for (int i = 0; i < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; i++)
-        {
-            if (g_connections[i].conn_handle == event->disconnect.conn.conn_handle)
-            {
-                g_connections[i].is_connected = false;
-                g_connections[i].conn_handle = BLE_HS_CONN_HANDLE_NONE;
-                ESP_LOGI(TAG, "Connection from slot %d removed", i);
-                ble_app_advertise(); // Restart advertising to allow new connections
-                break;
-            }
-        }
+        conn_registry_remove(event->disconnect.conn.conn_handle);
+        ota_service_on_disconnect(event->disconnect.conn.conn_handle);
+        ble_app_advertise(); // Restart advertising to allow new connections
         break;
 
     case BLE_GAP_EVENT_PASSKEY_ACTION:
@@ -343,9 +385,30 @@ static int ble_gap_event(struct ble_gap_event *event, void *arg)
         else
         {
             ESP_LOGI(TAG, "Encryption successfully established");
+
+            rc = ble_gap_conn_find(event->enc_change.conn_handle, &desc);
+            if (rc == 0)
+            {
+                conn_registry_set_security(event->enc_change.conn_handle, &desc.sec_state);
+            }
+
+            // a bonded phone is the clock of the calendar
+            cts_client_sync(event->enc_change.conn_handle);
         }
         break;
 
+    case BLE_GAP_EVENT_SUBSCRIBE:
+        TRACE("subscribe conn=%u attr=%u notify=%u", event->subscribe.conn_handle, event->subscribe.attr_handle,
+              event->subscribe.cur_notify);
+        conn_registry_set_subscription(event->subscribe.conn_handle, event->subscribe.attr_handle,
+                                       event->subscribe.cur_notify);
+        break;
+
+    case BLE_GAP_EVENT_MTU:
+        TRACE("mtu conn=%u mtu=%u", event->mtu.conn_handle, event->mtu.value);
+        conn_registry_set_mtu(event->mtu.conn_handle, event->mtu.value);
+        break;
+
     case BLE_GAP_EVENT_REPEAT_PAIRING:
         ESP_LOGI(TAG, "Repeat pairing requested");
 
@@ -363,6 +426,8 @@ static int ble_gap_event(struct ble_gap_event *event, void *arg)
 
     case BLE_GAP_EVENT_ADV_COMPLETE:
         ESP_LOGI(TAG, "Advertising complete");
+        // either the pairing window timed out or a peer connected
+        pairing_window_open = false;
         ble_app_advertise();
         break;
 
@@ -372,15 +437,19 @@ static int ble_gap_event(struct ble_gap_event *event, void *arg)
     return 0;
 }
 
-// Define the BLE connection
-static void ble_app_advertise(void)
+// Build the advertising payload, including the live light status in the manufacturer data
+static int ble_app_set_adv_fields(void)
 {
-    int ret;
-
-    // GAP - advertising definition
     struct ble_hs_adv_fields fields;
     memset(&fields, 0, sizeof(fields));
-    uint8_t mfg_data[] = {0xDE, 0xC0, 0x05, 0x10, 0x20, 0x25};
+
+    light_state_t state = light_get_state();
+    uint8_t flags = (state.beacon_enabled ? ADV_STATUS_FLAG_BEACON : 0) |
+                    (state.outdoor_enabled ? ADV_STATUS_FLAG_OUTDOOR : 0) |
+                    (pairing_window_open ? ADV_STATUS_FLAG_PAIRING : 0);
+
+    // [company id (2)][version][flags][character][brightness][sequence]
+    uint8_t mfg_data[] = {0xDE, 0xC0, ADV_STATUS_VERSION, flags, state.character, state.brightness, state.sequence};
     static const ble_uuid16_t services[] = {gatt_svr_svc_device_uuid, gatt_svr_svc_light_uuid,
                                             gatt_svr_svc_settings_uuid};
 
@@ -391,24 +460,101 @@ static void ble_app_advertise(void)
     fields.mfg_data = mfg_data;
     fields.mfg_data_len = sizeof(mfg_data);
 
-    ret = ble_gap_adv_set_fields(&fields);
+    return ble_gap_adv_set_fields(&fields);
+}
+
+// Runs on the host task; the advertising data is replaced without restarting advertising
+static void adv_update_event_handler(struct ble_npl_event *ev)
+{
+    if (!ble_hs_synced())
+    {
+        return;
+    }
+
+    int ret = ble_app_set_adv_fields();
+    if (ret != 0)
+    {
+        ESP_LOGE(TAG, "Failed to update advertising data (err: %d)", ret);
+    }
+}
+
+// May be called from any task, so the update is deferred to the host task
+static void light_state_listener(const light_state_t *state)
+{
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &adv_update_event);
+}
+
+// Runs on the host task; restarts advertising with the pairing parameters
+static void pairing_event_handler(struct ble_npl_event *ev)
+{
+    if (!ble_hs_synced())
+    {
+        return;
+    }
+
+    ESP_LOGI(TAG, "Pairing window opened for %d s", PAIRING_WINDOW_MS / 1000);
+    pairing_window_open = true;
+    if (ble_gap_adv_active())
+    {
+        ble_gap_adv_stop();
+    }
+    ble_app_advertise();
+}
+
+esp_err_t remote_control_start_pairing(void)
+{
+    if (!ble_hs_synced())
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &pairing_event);
+    return ESP_OK;
+}
+
+// Define the BLE connection
+static void ble_app_advertise(void)
+{
+    int ret;
+
+    ret = ble_app_set_adv_fields();
     if (ret != 0)
     {
         ESP_LOGE(TAG, "Failed to set advertising data (err: %d)", ret);
         return;
     }
 
+    // with every connection slot taken the status is still broadcast, only no further phone can connect
+    ble_connection_t connections[CONFIG_BT_NIMBLE_MAX_CONNECTIONS];
+    bool connectable = conn_registry_snapshot(connections, CONN_CHR_COUNT) < CONFIG_BT_NIMBLE_MAX_CONNECTIONS;
+    if (ble_gap_adv_active())
+    {
+        if (connectable == adv_connectable)
+        {
+            return;
+        }
+        ble_gap_adv_stop();
+    }
+
     // GAP - device connectivity definition
     struct ble_gap_adv_params adv_params;
     memset(&adv_params, 0, sizeof(adv_params));
-    adv_params.conn_mode = BLE_GAP_CONN_MODE_UND; // connectable or non-connectable
+    adv_params.conn_mode = connectable ? BLE_GAP_CONN_MODE_UND : BLE_GAP_CONN_MODE_NON;
     adv_params.disc_mode = BLE_GAP_DISC_MODE_GEN; // discoverable or non-discoverable
-    ret = ble_gap_adv_start(ble_addr_type, NULL, BLE_HS_FOREVER, &adv_params, ble_gap_event, NULL);
+    int32_t duration_ms = BLE_HS_FOREVER;
+    if (pairing_window_open)
+    {
+        adv_params.itvl_min = BLE_GAP_ADV_FAST_INTERVAL1_MIN;
+        adv_params.itvl_max = BLE_GAP_ADV_FAST_INTERVAL1_MAX;
+        duration_ms = PAIRING_WINDOW_MS;
+    }
+    ret = ble_gap_adv_start(ble_addr_type, NULL, duration_ms, &adv_params, ble_gap_event, NULL);
     if (ret != 0)
     {
         ESP_LOGE(TAG, "Advertising failed to start (err %d)", ret);
         return;
     }
+    adv_connectable = connectable;
 
     // --- Configure Scan Response Data (SCAN_RSP) ---
     struct ble_hs_adv_fields scan_rsp_fields;
@@ -517,7 +663,7 @@ static void nimble_host_config_init(void)
     ble_store_config_init();
 }
 
-void remote_control_init(void)
+esp_err_t remote_control_init(void)
 {
     esp_err_t ret;
 
@@ -525,28 +671,42 @@ void remote_control_init(void)
     if (ret != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to initialize nimble stack (err: %s)", esp_err_to_name(ret));
-        return;
+        return ret;
     }
 
-    init_connection_pool();
+    conn_registry_init();
+    conn_registry_bind_chr(CONN_CHR_UART_TX, &tx_chr_val_handle);
+    conn_registry_bind_chr(CONN_CHR_OTA_CONTROL, &ota_control_val_handle);
+    conn_registry_bind_chr(CONN_CHR_STATE, &state_chr_val_handle);
+    conn_registry_bind_chr(CONN_CHR_LIGHT_COMMAND, &light_command_val_handle);
 
     ret = gap_init();
     if (ret != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to initialize GAP service (err: %s)", esp_err_to_name(ret));
-        return;
+        return ret;
     }
 
     ret = gatt_svc_init();
     if (ret != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to initialize GATT server (err: %s)", esp_err_to_name(ret));
-        return;
+        return ret;
     }
 
     nimble_host_config_init();
 
+    ble_npl_event_init(&adv_update_event, adv_update_event_handler, NULL);
+    ble_npl_event_init(&pairing_event, pairing_event_handler, NULL);
+    light_add_state_listener(light_state_listener);
+    state_service_init();
+    ota_service_init();
+    l2cap_service_init();
+
     nimble_port_freertos_init(host_task); // Start BLE host task
 
-    xTaskCreate(uart_tx_task, "uart_tx", 2048, NULL, 1, NULL);
+    xTaskCreateStaticPinnedToCore(uart_tx_task, "uart_tx", UART_TX_TASK_STACK_SIZE, NULL, 1, uart_tx_task_stack,
+                                  &uart_tx_task_buffer, LIGHT_BLE_CORE);
+
+    return ESP_OK;
 }
@@ -0,0 +1,40 @@
+#include "include/remote_control.h"
+
+#include "include/gatt_harness.h"
+#include "light.h"
+#include "sim.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * NimBLE does not run on the host. Instead of notifying connected centrals, the light state is written to
+ * the simulation timeline, which is what a test would otherwise read from the state characteristic. The GATT
+ * services are built against the stand-ins of the sim component and driven by the harness in gatt_harness_linux.c.
+ */
+
+static void state_listener(const light_state_t *state)
+{
+    sim_emit("ble", "state beacon=%d outdoor=%d character=%u brightness=%u mode=%u level=%u seq=%u",
+             state->beacon_enabled, state->outdoor_enabled, state->character, state->brightness, state->outdoor_mode,
+             state->outdoor_level, state->sequence);
+}
+
+esp_err_t remote_control_init(void)
+{
+    const char *harness = getenv("LIGHTHOUSE_GATT_HARNESS");
+    if (harness != NULL && strcmp(harness, "1") == 0)
+    {
+        // the light controller runs by now, so the callbacks reach it as on the device
+        exit(gatt_harness_run() == ESP_OK ? 0 : 1);
+    }
+
+    sim_emit("ble", "advertising (not available on the host)");
+    return light_add_state_listener(state_listener);
+}
+
+esp_err_t remote_control_start_pairing(void)
+{
+    sim_emit("ble", "pairing window opened");
+    return ESP_OK;
+}
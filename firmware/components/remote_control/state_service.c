@@ -0,0 +1,164 @@
+#include "include/state_service.h"
+#include "esp_log.h"
+#include "include/conn_registry.h"
+#include "include/device_service.h"
+#include "light.h"
+#include "nimble/nimble_port.h"
+#include <string.h>
+
+static const char *TAG = "state_service";
+
+/*
+ * Packed state record:
+ *   [version][field bitmap (u16)][fields present in the bitmap, in bit order]
+ *
+ * A read always returns every field. Notifications only carry the fields that changed since the
+ * previous notification, so a client keeps its copy current by merging the deltas.
+ */
+#define STATE_FORMAT_VERSION 0x01
+
+#define STATE_FIELD_LIGHT (1 << 0)       // [flags: bit0 beacon, bit1 outdoor]
+#define STATE_FIELD_CHARACTER (1 << 1)   // [beacon character]
+#define STATE_FIELD_BRIGHTNESS (1 << 2)  // [beacon brightness]
+#define STATE_FIELD_SEQUENCE (1 << 3)    // [light state sequence counter]
+#define STATE_FIELD_DEVICE_INFO (1 << 4) // [len][name][len][firmware][len][hardware][len][manufacturer]
+#define STATE_FIELD_OUTDOOR (1 << 5)     // [outdoor mode][outdoor level]
+
+#define STATE_FIELDS_ALL 0x003F
+
+#define STATE_LIGHT_FLAG_BEACON (1 << 0)
+#define STATE_LIGHT_FLAG_OUTDOOR (1 << 1)
+
+#define STATE_MAX_SIZE (3 + 4 + 4 * (1 + 32) + 2)
+
+uint16_t state_chr_val_handle;
+
+static struct ble_npl_event state_changed_event;
+static light_state_t last_notified_state;
+
+static size_t put_string(uint8_t *out, const char *str)
+{
+    size_t len = strnlen(str, 32);
+    out[0] = len;
+    memcpy(&out[1], str, len);
+    return 1 + len;
+}
+
+static size_t pack_state(uint8_t *out, const light_state_t *state, uint16_t fields)
+{
+    size_t len = 0;
+    out[len++] = STATE_FORMAT_VERSION;
+    out[len++] = fields;
+    out[len++] = fields >> 8;
+
+    if (fields & STATE_FIELD_LIGHT)
+    {
+        out[len++] = (state->beacon_enabled ? STATE_LIGHT_FLAG_BEACON : 0) |
+                     (state->outdoor_enabled ? STATE_LIGHT_FLAG_OUTDOOR : 0);
+    }
+    if (fields & STATE_FIELD_CHARACTER)
+    {
+        out[len++] = state->character;
+    }
+    if (fields & STATE_FIELD_BRIGHTNESS)
+    {
+        out[len++] = state->brightness;
+    }
+    if (fields & STATE_FIELD_SEQUENCE)
+    {
+        out[len++] = state->sequence;
+    }
+    if (fields & STATE_FIELD_DEVICE_INFO)
+    {
+        len += put_string(&out[len], device_info_name());
+        len += put_string(&out[len], device_info_firmware_revision());
+        len += put_string(&out[len], device_info_hardware_revision());
+        len += put_string(&out[len], device_info_manufacturer());
+    }
+    if (fields & STATE_FIELD_OUTDOOR)
+    {
+        out[len++] = state->outdoor_mode;
+        out[len++] = state->outdoor_level;
+    }
+    return len;
+}
+
+static uint16_t changed_fields(const light_state_t *old_state, const light_state_t *new_state)
+{
+    uint16_t fields = STATE_FIELD_SEQUENCE;
+    if (old_state->beacon_enabled != new_state->beacon_enabled ||
+        old_state->outdoor_enabled != new_state->outdoor_enabled)
+    {
+        fields |= STATE_FIELD_LIGHT;
+    }
+    if (old_state->character != new_state->character)
+    {
+        fields |= STATE_FIELD_CHARACTER;
+    }
+    if (old_state->brightness != new_state->brightness)
+    {
+        fields |= STATE_FIELD_BRIGHTNESS;
+    }
+    if (old_state->outdoor_mode != new_state->outdoor_mode || old_state->outdoor_level != new_state->outdoor_level)
+    {
+        fields |= STATE_FIELD_OUTDOOR;
+    }
+    return fields;
+}
+
+// Runs on the host task
+static void state_changed_event_handler(struct ble_npl_event *ev)
+{
+    light_state_t state = light_get_state();
+    uint16_t fields = changed_fields(&last_notified_state, &state);
+    last_notified_state = state;
+
+    ble_connection_t subscribers[CONFIG_BT_NIMBLE_MAX_CONNECTIONS];
+    size_t count = conn_registry_snapshot(subscribers, CONN_CHR_STATE);
+    if (count == 0)
+    {
+        return;
+    }
+
+    uint8_t payload[STATE_MAX_SIZE];
+    size_t len = pack_state(payload, &state, fields);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        struct os_mbuf *om = ble_hs_mbuf_from_flat(payload, len);
+        if (om == NULL)
+        {
+            ESP_LOGW(TAG, "No mbuf for state notification");
+            break;
+        }
+
+        int rc = ble_gatts_notify_custom(subscribers[i].conn_handle, state_chr_val_handle, om);
+        conn_registry_count_notify(subscribers[i].conn_handle, rc == 0);
+    }
+}
+
+// May be called from any task, so the notification is deferred to the host task
+static void light_state_listener(const light_state_t *state)
+{
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &state_changed_event);
+}
+
+int gatt_svr_chr_state_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt,
+                              void *arg)
+{
+    if (ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR)
+    {
+        uint8_t payload[STATE_MAX_SIZE];
+        light_state_t state = light_get_state();
+        size_t len = pack_state(payload, &state, STATE_FIELDS_ALL);
+        return os_mbuf_append(ctxt->om, payload, len) == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+    return BLE_ATT_ERR_UNLIKELY;
+}
+
+void state_service_init(void)
+{
+    last_notified_state = light_get_state();
+    ble_npl_event_init(&state_changed_event, state_changed_event_handler, NULL);
+    light_add_state_listener(light_state_listener);
+}
@@ -1,7 +1,11 @@
 #include "include/uart_service.h"
 #include "esp_log.h"
-#include "include/remote_control.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "include/conn_registry.h"
 #include "sdkconfig.h"
+#include "trace.h"
+#include <string.h>
 
 static const char *TAG = "uart_service";
 
@@ -19,6 +23,9 @@ const ble_uuid128_t gatt_svr_chr_uart_tx_uuid =
 
 uint16_t tx_chr_val_handle;
 
+// only the host task writes characteristics, so one buffer is enough
+static char rx_buffer[BLE_ATT_ATTR_MAX_LEN + 1];
+
 // Callback function for GATT events (read/write on characteristics)
 int gatt_svr_chr_uart_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg)
 {
@@ -28,20 +35,18 @@ int gatt_svr_chr_uart_access(uint16_t conn_handle, uint16_t attr_handle, struct
         // Check if the RX characteristic is being written to
         // if (ble_uuid_cmp((const ble_uuid_t *)&ctxt->chr->uuid, (const ble_uuid_t *)&gatt_svr_chr_uart_rx_uuid) == 0)
         {
+            conn_registry_count_write(conn_handle);
+
             // Get data from the buffer
-            uint16_t data_len = OS_MBUF_PKTLEN(ctxt->om);
-            char *data = (char *)malloc(data_len + 1);
-            if (data)
+            uint16_t data_len;
+            int rc = ble_hs_mbuf_to_flat(ctxt->om, rx_buffer, sizeof(rx_buffer) - 1, &data_len);
+            if (rc == 0)
             {
-                int rc = ble_hs_mbuf_to_flat(ctxt->om, data, data_len, NULL);
-                if (rc == 0)
-                {
-                    data[data_len] = '\0';
-                    ESP_LOGI(TAG, "Received data: %s", data);
-                }
-                free(data);
+                rx_buffer[data_len] = '\0';
+                TRACE("uart rx conn=%u len=%u", conn_handle, data_len);
+                ESP_LOGD(TAG, "Received data: %s", rx_buffer);
             }
-            return 0;
+            return rc == 0 ? 0 : BLE_ATT_ERR_UNLIKELY;
         }
         break;
     default:
@@ -53,26 +58,21 @@ int gatt_svr_chr_uart_access(uint16_t conn_handle, uint16_t attr_handle, struct
 // Function to send data via the TX characteristic
 void send_ble_data(const char *data)
 {
-    ESP_LOGI(TAG, "Preparing to send data: %s", data);
-
     struct os_mbuf *om;
+    ble_connection_t subscribers[CONFIG_BT_NIMBLE_MAX_CONNECTIONS];
+    size_t count = conn_registry_snapshot(subscribers, CONN_CHR_UART_TX);
 
-    for (int i = 0; i < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; i++)
+    for (size_t i = 0; i < count; i++)
     {
-        if (g_connections[i].is_connected)
+        om = ble_hs_mbuf_from_flat(data, strlen(data));
+        if (om)
         {
-            om = ble_hs_mbuf_from_flat(data, strlen(data));
-            if (om)
+            int rc = ble_gatts_notify_custom(subscribers[i].conn_handle, tx_chr_val_handle, om);
+            conn_registry_count_notify(subscribers[i].conn_handle, rc == 0);
+            TRACE("uart tx conn=%u len=%u rc=%d", subscribers[i].conn_handle, strlen(data), rc);
+            if (rc != 0 && rc != BLE_HS_ENOTCONN) // Ignore "not connected" errors if a device just disconnected
             {
-                int rc = ble_gatts_notify_custom(g_connections[i].conn_handle, tx_chr_val_handle, om);
-                if (rc == 0)
-                {
-                    ESP_LOGI(TAG, "Sent data to conn_handle %d: %s", g_connections[i].conn_handle, data);
-                }
-                else if (rc != BLE_HS_ENOTCONN) // Ignore "not connected" errors if a device just disconnected
-                {
-                    ESP_LOGE(TAG, "Error sending data to conn_handle %d: %d", g_connections[i].conn_handle, rc);
-                }
+                ESP_LOGE(TAG, "Error sending data to conn_handle %d: %d", subscribers[i].conn_handle, rc);
             }
         }
     }
@@ -87,7 +87,6 @@ void uart_tx_task(void *param)
         vTaskDelay(pdMS_TO_TICKS(2000));
         if (is_any_device_connected())
         {
-            ESP_LOGI(TAG, "Sending data over BLE UART TX");
             sprintf(buffer, "Hello World #%d", count++);
             send_ble_data(buffer);
         }
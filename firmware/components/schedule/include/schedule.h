@@ -0,0 +1,55 @@
+#pragma once
+
+#include "esp_err.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Calendar events, each recurring once a day.
+ */
+typedef enum
+{
+    SCHEDULE_EVENT_DUSK = 0, ///< sunset at CONFIG_SCHEDULE_LATITUDE/LONGITUDE: beacon on
+    SCHEDULE_EVENT_DAWN,     ///< sunrise: beacon off
+    SCHEDULE_EVENT_NIGHT,    ///< CONFIG_SCHEDULE_NIGHT_START: outdoor lamps dimmed to CONFIG_SCHEDULE_NIGHT_LEVEL
+    SCHEDULE_EVENT_MORNING,  ///< CONFIG_SCHEDULE_NIGHT_END: outdoor lamps back to their level before the night
+    SCHEDULE_EVENT_COUNT,
+} schedule_event_t;
+
+/**
+ * @brief Creates the scheduler timer. Nothing is scheduled until the time is known, see schedule_set_time().
+ *
+ * @return
+ *     - ESP_OK: Scheduler ready.
+ *     - Error codes of esp_timer.
+ */
+esp_err_t schedule_init(void);
+
+/**
+ * @brief Sets the time of day, e.g. from a phone's Current Time Service, and reschedules all events.
+ *
+ * Safe to call from any task. The first time after boot also brings the lights to the state the calendar
+ * has them in at that time; later calls only move the events, so a manual change sticks until the next one.
+ *
+ * @param utc_us        Microseconds since the epoch, UTC.
+ * @param utc_offset_s  Local time minus UTC, including daylight saving time.
+ *
+ * @return
+ *     - ESP_OK: Time set.
+ *     - ESP_ERR_INVALID_STATE: schedule_init() was not called.
+ */
+esp_err_t schedule_set_time(int64_t utc_us, int32_t utc_offset_s);
+
+/**
+ * @brief Returns the current time, if it was set since boot.
+ *
+ * @return true and the time in `utc_us` / `utc_offset_s`, or false if the time is unknown.
+ */
+bool schedule_get_time(int64_t *utc_us, int32_t *utc_offset_s);
+
+/**
+ * @brief Registers the "schedule" console command, which shows the clock and the pending events and can
+ * set the time by hand.
+ */
+esp_err_t schedule_register_console_command(void);
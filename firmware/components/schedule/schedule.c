@@ -0,0 +1,329 @@
+#include "schedule.h"
+#include "sun.h"
+
+#include "esp_console.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "light.h"
+#include "light_command.h"
+#include "sdkconfig.h"
+#include "vclock.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "schedule";
+
+#define US_PER_S 1000000
+#define S_PER_DAY 86400
+
+typedef struct
+{
+    int64_t at_us; ///< UTC
+    schedule_event_t event;
+} schedule_entry_t;
+
+static const char *const event_names[SCHEDULE_EVENT_COUNT] = {
+    [SCHEDULE_EVENT_DUSK] = "dusk",
+    [SCHEDULE_EVENT_DAWN] = "dawn",
+    [SCHEDULE_EVENT_NIGHT] = "night",
+    [SCHEDULE_EVENT_MORNING] = "morning",
+};
+
+/*
+ * The next occurrence of every event waits in a queue sorted by time, and a single one-shot timer is armed
+ * for the head. Between two events nothing runs, so with automatic light sleep the chip sleeps through the
+ * hours until the next switch - esp_timer wakes it up. The queue belongs to the timer callback; a new time
+ * only flags a rebuild and fires the timer. Wall time is the vclock plus the offset taken when the time was
+ * set, so the host simulation runs the calendar on virtual time.
+ */
+static vclock_timer_handle_t timer;
+static SemaphoreHandle_t lock;
+static StaticSemaphore_t lock_buffer;
+
+static bool synced = false;
+static bool rebuild = false;
+static bool catch_up = false;
+static int64_t clock_offset_us; ///< UTC minus vclock_now_us()
+static int32_t utc_offset_s;
+
+static schedule_entry_t queue[SCHEDULE_EVENT_COUNT];
+static uint32_t queue_length;
+
+// only used by the timer callback
+static bool dimmed = false;
+static uint8_t day_level;
+
+static int64_t floor_div(int64_t a, int64_t b)
+{
+    return a / b - (a % b < 0);
+}
+
+static int64_t local_day_of(int64_t utc_us)
+{
+    return floor_div(floor_div(utc_us, US_PER_S) + utc_offset_s, S_PER_DAY);
+}
+
+// Time of an event on a local calendar day
+static int64_t occurrence_us(schedule_event_t event, int64_t local_day)
+{
+    int64_t sunrise_s;
+    int64_t sunset_s;
+
+    switch (event)
+    {
+    case SCHEDULE_EVENT_DUSK:
+    case SCHEDULE_EVENT_DAWN:
+        sun_times(local_day, CONFIG_SCHEDULE_LATITUDE / 1000.0, CONFIG_SCHEDULE_LONGITUDE / 1000.0, &sunrise_s,
+                  &sunset_s);
+        return (event == SCHEDULE_EVENT_DUSK ? sunset_s : sunrise_s) * US_PER_S;
+    case SCHEDULE_EVENT_NIGHT:
+        return (local_day * S_PER_DAY + CONFIG_SCHEDULE_NIGHT_START * 60 - utc_offset_s) * US_PER_S;
+    case SCHEDULE_EVENT_MORNING:
+    default:
+        return (local_day * S_PER_DAY + CONFIG_SCHEDULE_NIGHT_END * 60 - utc_offset_s) * US_PER_S;
+    }
+}
+
+static int64_t next_occurrence_us(schedule_event_t event, int64_t after_us)
+{
+    int64_t day = local_day_of(after_us) - 1;
+    int64_t at_us;
+    while ((at_us = occurrence_us(event, day)) <= after_us)
+    {
+        day++;
+    }
+    return at_us;
+}
+
+static int64_t last_occurrence_us(schedule_event_t event, int64_t at_or_before_us)
+{
+    int64_t day = local_day_of(at_or_before_us) + 1;
+    int64_t at_us;
+    while ((at_us = occurrence_us(event, day)) > at_or_before_us)
+    {
+        day--;
+    }
+    return at_us;
+}
+
+static void enqueue(schedule_event_t event, int64_t at_us)
+{
+    uint32_t i = queue_length++;
+    while (i > 0 && queue[i - 1].at_us > at_us)
+    {
+        queue[i] = queue[i - 1];
+        i--;
+    }
+    queue[i] = (schedule_entry_t){.at_us = at_us, .event = event};
+}
+
+static void run(schedule_event_t event)
+{
+    ESP_LOGI(TAG, "%s", event_names[event]);
+
+    switch (event)
+    {
+    case SCHEDULE_EVENT_DUSK:
+    case SCHEDULE_EVENT_DAWN:
+    {
+        light_settings_t settings = {.beacon_enabled = event == SCHEDULE_EVENT_DUSK};
+        light_command_post(&settings, LIGHT_SETTING_BEACON_ENABLED);
+        break;
+    }
+    case SCHEDULE_EVENT_NIGHT:
+        // not persisted, so after a reboot at night the lamps still know their day level
+        if (!dimmed)
+        {
+            day_level = outdoor_get_level();
+            dimmed = true;
+        }
+        outdoor_set_level(CONFIG_SCHEDULE_NIGHT_LEVEL);
+        break;
+    case SCHEDULE_EVENT_MORNING:
+    default:
+        if (dimmed)
+        {
+            outdoor_set_level(day_level);
+            dimmed = false;
+        }
+        break;
+    }
+}
+
+static void arm(int64_t now_us)
+{
+    vclock_timer_stop(timer);
+    if (queue_length > 0)
+    {
+        vclock_timer_start_once(timer, queue[0].at_us > now_us ? queue[0].at_us - now_us : 0);
+    }
+}
+
+static void schedule_timer_callback(void *arg)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    int64_t now_us = vclock_now_us() + clock_offset_us;
+
+    if (rebuild)
+    {
+        rebuild = false;
+        queue_length = 0;
+        for (int event = 0; event < SCHEDULE_EVENT_COUNT; event++)
+        {
+            enqueue(event, next_occurrence_us(event, now_us));
+        }
+    }
+    if (catch_up)
+    {
+        // the clock was set for the first time: the lights get the state of the latest events that passed
+        catch_up = false;
+        int64_t dusk_us = last_occurrence_us(SCHEDULE_EVENT_DUSK, now_us);
+        run(dusk_us > last_occurrence_us(SCHEDULE_EVENT_DAWN, now_us) ? SCHEDULE_EVENT_DUSK : SCHEDULE_EVENT_DAWN);
+        if (last_occurrence_us(SCHEDULE_EVENT_NIGHT, now_us) > last_occurrence_us(SCHEDULE_EVENT_MORNING, now_us))
+        {
+            run(SCHEDULE_EVENT_NIGHT);
+        }
+    }
+
+    while (queue_length > 0 && queue[0].at_us <= now_us)
+    {
+        schedule_entry_t due = queue[0];
+        queue_length--;
+        memmove(&queue[0], &queue[1], queue_length * sizeof(queue[0]));
+
+        run(due.event);
+        enqueue(due.event, next_occurrence_us(due.event, due.at_us));
+    }
+
+    arm(now_us);
+    xSemaphoreGive(lock);
+}
+
+esp_err_t schedule_init(void)
+{
+    if (timer != NULL)
+    {
+        return ESP_OK;
+    }
+
+    lock = xSemaphoreCreateMutexStatic(&lock_buffer);
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = schedule_timer_callback,
+        .name = "schedule",
+    };
+    esp_err_t ret = vclock_timer_create(&timer_args, &timer);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to create timer: %s", esp_err_to_name(ret));
+    }
+    return ret;
+}
+
+esp_err_t schedule_set_time(int64_t utc_us, int32_t new_utc_offset_s)
+{
+    if (timer == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    clock_offset_us = utc_us - vclock_now_us();
+    utc_offset_s = new_utc_offset_s;
+    catch_up = !synced;
+    synced = true;
+    rebuild = true;
+    vclock_timer_stop(timer);
+    esp_err_t ret = vclock_timer_start_once(timer, 0);
+    xSemaphoreGive(lock);
+
+    ESP_LOGI(TAG, "Time set to %" PRId64 " s UTC%+" PRId32 " min", utc_us / US_PER_S, new_utc_offset_s / 60);
+    return ret;
+}
+
+bool schedule_get_time(int64_t *utc_us, int32_t *offset_s)
+{
+    if (lock == NULL)
+    {
+        return false;
+    }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    bool valid = synced;
+    *utc_us = vclock_now_us() + clock_offset_us;
+    *offset_s = utc_offset_s;
+    xSemaphoreGive(lock);
+    return valid;
+}
+
+// "YYYY-MM-DD HH:MM" in local time, days to civil date after H. Hinnant
+static void format_local(char *out, size_t size, int64_t utc_us, int32_t offset_s)
+{
+    int64_t local_s = floor_div(utc_us, US_PER_S) + offset_s;
+    int64_t days = floor_div(local_s, S_PER_DAY);
+    int64_t seconds = local_s - days * S_PER_DAY;
+
+    days += 719468;
+    int64_t era = floor_div(days, 146097);
+    int64_t day_of_era = days - era * 146097;
+    int64_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    int64_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    int64_t mp = (5 * day_of_year + 2) / 153;
+    int64_t day = day_of_year - (153 * mp + 2) / 5 + 1;
+    int64_t month = mp < 10 ? mp + 3 : mp - 9;
+    int64_t year = year_of_era + era * 400 + (month <= 2);
+
+    snprintf(out, size, "%04" PRId64 "-%02" PRId64 "-%02" PRId64 " %02" PRId64 ":%02" PRId64, year, month, day,
+             seconds / 3600, seconds % 3600 / 60);
+}
+
+// printf instead of ESP_LOG, so the output survives release builds with logging compiled out
+static int schedule_command(int argc, char **argv)
+{
+    if (argc > 2 && strcmp(argv[1], "set") == 0)
+    {
+        int64_t utc_s = strtoll(argv[2], NULL, 10);
+        int32_t offset_min = argc > 3 ? strtol(argv[3], NULL, 10) : CONFIG_SCHEDULE_UTC_OFFSET;
+        return schedule_set_time(utc_s * US_PER_S, offset_min * 60) == ESP_OK ? 0 : 1;
+    }
+
+    int64_t now_us;
+    int32_t offset_s;
+    if (!schedule_get_time(&now_us, &offset_s))
+    {
+        printf("time not set\n");
+        return 0;
+    }
+
+    char text[24];
+    format_local(text, sizeof(text), now_us, offset_s);
+    printf("now      %s (UTC%+" PRId32 " min)\n", text, offset_s / 60);
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    schedule_entry_t pending[SCHEDULE_EVENT_COUNT];
+    uint32_t count = queue_length;
+    memcpy(pending, queue, sizeof(pending));
+    xSemaphoreGive(lock);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        format_local(text, sizeof(text), pending[i].at_us, offset_s);
+        printf("%-8s %s\n", event_names[pending[i].event], text);
+    }
+    return 0;
+}
+
+esp_err_t schedule_register_console_command(void)
+{
+    const esp_console_cmd_t command = {
+        .command = "schedule",
+        .help = "Show the clock and the next calendar events; \"schedule set <unix seconds> [<UTC offset min>]\" "
+                "sets the time",
+        .func = schedule_command,
+    };
+    return esp_console_cmd_register(&command);
+}
@@ -0,0 +1,35 @@
+#include "sun.h"
+
+#include <math.h>
+
+#define J2000_UNIX_S 946728000LL // 2000-01-01 12:00 UTC
+#define J2000_UNIX_DAY 10957     // days from 1970-01-01 to 2000-01-01
+#define OBLIQUITY 23.4397
+#define HORIZON -0.833 // refraction and the radius of the sun
+
+static double radians(double degrees)
+{
+    return degrees * (M_PI / 180.0);
+}
+
+void sun_times(int64_t day, double latitude, double longitude, int64_t *sunrise_s, int64_t *sunset_s)
+{
+    // mean solar noon, in days since J2000
+    double noon = (double)(day - J2000_UNIX_DAY) - longitude / 360.0;
+
+    double anomaly = fmod(357.5291 + 0.98560028 * noon, 360.0);
+    double m = radians(anomaly);
+    double center = 1.9148 * sin(m) + 0.0200 * sin(2 * m) + 0.0003 * sin(3 * m);
+    double ecliptic = radians(fmod(anomaly + center + 180.0 + 102.9372, 360.0));
+    double transit = noon + 0.0053 * sin(m) - 0.0069 * sin(2 * ecliptic);
+
+    double declination = asin(sin(ecliptic) * sin(radians(OBLIQUITY)));
+    double cos_hour_angle = (sin(radians(HORIZON)) - sin(radians(latitude)) * sin(declination)) /
+                            (cos(radians(latitude)) * cos(declination));
+    // polar day or night: the sun stays above or below the horizon, rise and set collapse to noon
+    cos_hour_angle = fmax(-1.0, fmin(1.0, cos_hour_angle));
+    double half_day = acos(cos_hour_angle) / (2 * M_PI);
+
+    *sunrise_s = J2000_UNIX_S + llround((transit - half_day) * 86400.0);
+    *sunset_s = J2000_UNIX_S + llround((transit + half_day) * 86400.0);
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @brief Sunrise and sunset (upper limb at the horizon, with refraction) of a day, in seconds since the epoch.
+ *
+ * Uses the sunrise equation with the usual low-precision solar terms, good to about a minute at mid latitudes.
+ * Where the sun does not rise or set that day, both are the solar noon.
+ *
+ * @param day        Days since 1970-01-01.
+ * @param latitude   Degrees, north positive.
+ * @param longitude  Degrees, east positive.
+ */
+void sun_times(int64_t day, double latitude, double longitude, int64_t *sunrise_s, int64_t *sunset_s);
@@ -0,0 +1,194 @@
+#include "driver/gpio.h"
+#include "sim.h"
+#include "sim_internal.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "vclock.h"
+
+static const char *TAG = "sim_gpio";
+
+#define GPIO_SCRIPT_TASK_STACK_SIZE 4096
+
+typedef struct
+{
+    gpio_mode_t mode;
+    gpio_int_type_t intr_type;
+    int level;
+    gpio_isr_t handler;
+    void *arg;
+} sim_gpio_t;
+
+static sim_gpio_t pins[GPIO_PIN_COUNT];
+static bool isr_service_installed = false;
+static FILE *script;
+
+static bool is_valid(gpio_num_t gpio_num)
+{
+    return gpio_num >= 0 && gpio_num < GPIO_PIN_COUNT;
+}
+
+esp_err_t gpio_config(const gpio_config_t *config)
+{
+    for (int i = 0; i < GPIO_PIN_COUNT; i++)
+    {
+        if (config->pin_bit_mask & (1ULL << i))
+        {
+            pins[i].mode = config->mode;
+            pins[i].intr_type = config->intr_type;
+            // an unconnected input reads its pull
+            pins[i].level = config->pull_up_en == GPIO_PULLUP_ENABLE ? 1 : 0;
+        }
+    }
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num)
+{
+    return is_valid(gpio_num) ? pins[gpio_num].level : 0;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+    if (!is_valid(gpio_num))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (pins[gpio_num].level != (level != 0))
+    {
+        pins[gpio_num].level = level != 0;
+        sim_emit("gpio", "%d out %d", gpio_num, pins[gpio_num].level);
+    }
+    return ESP_OK;
+}
+
+esp_err_t gpio_install_isr_service(int intr_alloc_flags)
+{
+    if (isr_service_installed)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    isr_service_installed = true;
+    return ESP_OK;
+}
+
+void gpio_uninstall_isr_service(void)
+{
+    isr_service_installed = false;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler, void *args)
+{
+    if (!isr_service_installed)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!is_valid(gpio_num))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pins[gpio_num].arg = args;
+    pins[gpio_num].handler = isr_handler;
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t gpio_num)
+{
+    if (!is_valid(gpio_num))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pins[gpio_num].handler = NULL;
+    return ESP_OK;
+}
+
+static bool triggers(gpio_int_type_t intr_type, int level)
+{
+    switch (intr_type)
+    {
+    case GPIO_INTR_POSEDGE:
+    case GPIO_INTR_HIGH_LEVEL:
+        return level == 1;
+    case GPIO_INTR_NEGEDGE:
+    case GPIO_INTR_LOW_LEVEL:
+        return level == 0;
+    case GPIO_INTR_ANYEDGE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void drive_input(gpio_num_t gpio_num, int level)
+{
+    sim_gpio_t *pin = &pins[gpio_num];
+    if (pin->level == level)
+    {
+        return;
+    }
+
+    pin->level = level;
+    sim_emit("gpio", "%d in %d", gpio_num, level);
+
+    // the script task runs at the highest priority, so the handler is not preempted by tasks - like an ISR
+    if (isr_service_installed && pin->handler != NULL && triggers(pin->intr_type, level))
+    {
+        pin->handler(pin->arg);
+    }
+}
+
+// Plays "<time ms> <gpio> <level>" lines; times are absolute and have to be ascending
+static void script_task(void *arg)
+{
+    char line[128];
+    unsigned line_number = 0;
+
+    while (fgets(line, sizeof(line), script) != NULL)
+    {
+        line_number++;
+
+        unsigned long time_ms;
+        int gpio_num;
+        int level;
+        char first;
+        if (sscanf(line, " %c", &first) != 1 || first == '#')
+        {
+            continue;
+        }
+        if (sscanf(line, "%lu %d %d", &time_ms, &gpio_num, &level) != 3 || !is_valid(gpio_num))
+        {
+            ESP_LOGW(TAG, "Ignoring GPIO script line %u: %s", line_number, line);
+            continue;
+        }
+
+        // nothing notifies this task, the wait only ends at the deadline
+        int64_t at_us = (int64_t)time_ms * 1000;
+        while (sim_time_us() < at_us)
+        {
+            vclock_notify_take_until(pdTRUE, at_us);
+        }
+        drive_input(gpio_num, level != 0);
+    }
+
+    fclose(script);
+    script = NULL;
+    sim_emit("gpio", "script done");
+    vTaskDelete(NULL);
+}
+
+esp_err_t sim_gpio_play(const char *path)
+{
+    script = fopen(path, "r");
+    if (script == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to open GPIO script %s", path);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    xTaskCreate(script_task, "sim_gpio_script", GPIO_SCRIPT_TASK_STACK_SIZE, NULL, configMAX_PRIORITIES - 1, NULL);
+    return ESP_OK;
+}
@@ -0,0 +1,292 @@
+#include "driver/gptimer.h"
+#include "sim.h"
+
+#include <stdlib.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "vclock.h"
+
+#define GPTIMER_TASK_STACK_SIZE 4096
+
+typedef enum
+{
+    GPTIMER_STATE_INIT = 0,
+    GPTIMER_STATE_ENABLE,
+    GPTIMER_STATE_RUN,
+} gptimer_state_t;
+
+struct gptimer_t
+{
+    portMUX_TYPE lock;
+    TaskHandle_t task;
+    uint32_t resolution_hz;
+    gptimer_state_t state;
+    uint64_t base_count;  ///< count at base_time_us
+    int64_t base_time_us; ///< only meaningful while running
+    bool alarm_armed;
+    gptimer_alarm_config_t alarm;
+    gptimer_alarm_cb_t on_alarm;
+    void *user_data;
+};
+
+static uint64_t count_at(const struct gptimer_t *timer, int64_t now)
+{
+    if (timer->state != GPTIMER_STATE_RUN)
+    {
+        return timer->base_count;
+    }
+    return timer->base_count + (uint64_t)(now - timer->base_time_us) * timer->resolution_hz / 1000000;
+}
+
+static int64_t alarm_time_us(const struct gptimer_t *timer)
+{
+    return timer->base_time_us +
+           (int64_t)((timer->alarm.alarm_count - timer->base_count) * 1000000 / timer->resolution_hz);
+}
+
+// Plays the interrupt: waits for the next alarm and calls the callback outside of the lock
+static void gptimer_task(void *arg)
+{
+    struct gptimer_t *timer = arg;
+
+    while (true)
+    {
+        int64_t wait_until_us = 0;
+        bool fire = false;
+        gptimer_alarm_event_data_t edata;
+
+        portENTER_CRITICAL(&timer->lock);
+        if (timer->state == GPTIMER_STATE_RUN && timer->alarm_armed)
+        {
+            int64_t now = sim_time_us();
+            uint64_t count = count_at(timer, now);
+
+            if (count >= timer->alarm.alarm_count)
+            {
+                edata = (gptimer_alarm_event_data_t){.count_value = count, .alarm_value = timer->alarm.alarm_count};
+                if (timer->alarm.flags.auto_reload_on_alarm)
+                {
+                    // reload at the time the alarm was due, so the period does not drift with the task latency
+                    int64_t due = timer->alarm.alarm_count > timer->base_count ? alarm_time_us(timer) : now;
+                    timer->base_count = timer->alarm.reload_count;
+                    timer->base_time_us = due;
+                }
+                else
+                {
+                    timer->alarm_armed = false;
+                }
+                fire = true;
+            }
+            else
+            {
+                wait_until_us = alarm_time_us(timer);
+            }
+        }
+        portEXIT_CRITICAL(&timer->lock);
+
+        if (fire)
+        {
+            if (timer->on_alarm != NULL)
+            {
+                timer->on_alarm(timer, &edata, timer->user_data);
+            }
+            continue;
+        }
+        if (wait_until_us != 0)
+        {
+            vclock_notify_take_until(pdTRUE, wait_until_us);
+        }
+        else
+        {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        }
+    }
+}
+
+static void reschedule(struct gptimer_t *timer)
+{
+    xTaskNotifyGive(timer->task);
+}
+
+esp_err_t gptimer_new_timer(const gptimer_config_t *config, gptimer_handle_t *ret_timer)
+{
+    if (config == NULL || ret_timer == NULL || config->resolution_hz == 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (config->direction != GPTIMER_COUNT_UP)
+    {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    struct gptimer_t *timer = calloc(1, sizeof(*timer));
+    if (timer == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    portMUX_INITIALIZE(&timer->lock);
+    timer->resolution_hz = config->resolution_hz;
+
+    if (xTaskCreate(gptimer_task, "sim_gptimer", GPTIMER_TASK_STACK_SIZE, timer, configMAX_PRIORITIES - 1,
+                    &timer->task) != pdPASS)
+    {
+        free(timer);
+        return ESP_ERR_NO_MEM;
+    }
+
+    *ret_timer = timer;
+    return ESP_OK;
+}
+
+esp_err_t gptimer_del_timer(gptimer_handle_t timer)
+{
+    if (timer == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (timer->state != GPTIMER_STATE_INIT)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    vTaskDelete(timer->task);
+    free(timer);
+    return ESP_OK;
+}
+
+esp_err_t gptimer_set_raw_count(gptimer_handle_t timer, uint64_t value)
+{
+    if (timer == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL_SAFE(&timer->lock);
+    timer->base_count = value;
+    timer->base_time_us = sim_time_us();
+    portEXIT_CRITICAL_SAFE(&timer->lock);
+
+    reschedule(timer);
+    return ESP_OK;
+}
+
+esp_err_t gptimer_get_raw_count(gptimer_handle_t timer, uint64_t *value)
+{
+    if (timer == NULL || value == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL_SAFE(&timer->lock);
+    *value = count_at(timer, sim_time_us());
+    portEXIT_CRITICAL_SAFE(&timer->lock);
+    return ESP_OK;
+}
+
+esp_err_t gptimer_register_event_callbacks(gptimer_handle_t timer, const gptimer_event_callbacks_t *cbs,
+                                           void *user_data)
+{
+    if (timer == NULL || cbs == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (timer->state != GPTIMER_STATE_INIT)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    timer->on_alarm = cbs->on_alarm;
+    timer->user_data = user_data;
+    return ESP_OK;
+}
+
+// Also called from the alarm callback, like the real driver allows it from the ISR
+esp_err_t gptimer_set_alarm_action(gptimer_handle_t timer, const gptimer_alarm_config_t *config)
+{
+    if (timer == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL_SAFE(&timer->lock);
+    timer->alarm_armed = config != NULL;
+    if (config != NULL)
+    {
+        timer->alarm = *config;
+    }
+    portEXIT_CRITICAL_SAFE(&timer->lock);
+
+    reschedule(timer);
+    return ESP_OK;
+}
+
+esp_err_t gptimer_enable(gptimer_handle_t timer)
+{
+    if (timer == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (timer->state != GPTIMER_STATE_INIT)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    timer->state = GPTIMER_STATE_ENABLE;
+    return ESP_OK;
+}
+
+esp_err_t gptimer_disable(gptimer_handle_t timer)
+{
+    if (timer == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (timer->state != GPTIMER_STATE_ENABLE)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    timer->state = GPTIMER_STATE_INIT;
+    return ESP_OK;
+}
+
+esp_err_t gptimer_start(gptimer_handle_t timer)
+{
+    if (timer == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&timer->lock);
+    esp_err_t ret = timer->state == GPTIMER_STATE_ENABLE ? ESP_OK : ESP_ERR_INVALID_STATE;
+    if (ret == ESP_OK)
+    {
+        timer->base_time_us = sim_time_us();
+        timer->state = GPTIMER_STATE_RUN;
+    }
+    portEXIT_CRITICAL(&timer->lock);
+
+    reschedule(timer);
+    return ret;
+}
+
+esp_err_t gptimer_stop(gptimer_handle_t timer)
+{
+    if (timer == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&timer->lock);
+    esp_err_t ret = timer->state == GPTIMER_STATE_RUN ? ESP_OK : ESP_ERR_INVALID_STATE;
+    if (ret == ESP_OK)
+    {
+        timer->base_count = count_at(timer, sim_time_us());
+        timer->state = GPTIMER_STATE_ENABLE;
+    }
+    portEXIT_CRITICAL(&timer->lock);
+
+    reschedule(timer);
+    return ret;
+}
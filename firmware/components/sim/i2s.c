@@ -0,0 +1,274 @@
+#include "driver/i2s_std.h"
+#include "sim.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "vclock.h"
+
+#define I2S_TASK_STACK_SIZE 4096
+
+struct i2s_channel_t
+{
+    portMUX_TYPE lock;
+    TaskHandle_t task;
+    i2s_chan_config_t config;
+    uint32_t sample_rate_hz;
+    size_t buffer_size;
+    uint8_t **buffers;
+    bool initialized;
+    bool enabled;
+    i2s_isr_callback_t on_sent;
+    void *user_data;
+
+    // sink statistics of the current enable
+    uint32_t sent;
+    uint32_t sounding;
+    uint32_t silent_run; ///< silent buffers since the last one with sound
+    uint32_t gaps;       ///< silent buffers between buffers with sound
+};
+
+static bool is_silent(const uint8_t *buffer, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        if (buffer[i] != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// What the DAC hears: a silent buffer between two with sound is a buffer the driver did not get in time
+static void sink(struct i2s_channel_t *channel, const uint8_t *buffer)
+{
+    channel->sent++;
+    if (is_silent(buffer, channel->buffer_size))
+    {
+        channel->silent_run++;
+        return;
+    }
+    if (channel->sounding == 0)
+    {
+        sim_emit("i2s", "sound");
+    }
+    else
+    {
+        channel->gaps += channel->silent_run;
+    }
+    channel->silent_run = 0;
+    channel->sounding++;
+}
+
+// Plays the DMA: sends the buffers round-robin at the sample rate and reports each one as sent
+static void i2s_task(void *arg)
+{
+    struct i2s_channel_t *channel = arg;
+    uint32_t index = 0;
+    int64_t period_us = 0;
+    int64_t next_us = 0;
+
+    while (true)
+    {
+        portENTER_CRITICAL(&channel->lock);
+        bool enabled = channel->enabled;
+        portEXIT_CRITICAL(&channel->lock);
+        if (!enabled)
+        {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            index = 0;
+            period_us = (int64_t)channel->config.dma_frame_num * 1000000 / channel->sample_rate_hz;
+            next_us = sim_time_us();
+            continue;
+        }
+
+        uint8_t *buffer = channel->buffers[index];
+        sink(channel, buffer);
+        next_us += period_us;
+        while (sim_time_us() < next_us)
+        {
+            vclock_notify_take_until(pdTRUE, next_us);
+        }
+
+        portENTER_CRITICAL(&channel->lock);
+        enabled = channel->enabled;
+        portEXIT_CRITICAL(&channel->lock);
+        if (!enabled)
+        {
+            continue;
+        }
+
+        if (channel->config.auto_clear_before_cb)
+        {
+            memset(buffer, 0, channel->buffer_size);
+        }
+        if (channel->on_sent != NULL)
+        {
+            i2s_event_data_t event = {.dma_buf = buffer, .size = channel->buffer_size};
+            channel->on_sent(channel, &event, channel->user_data);
+        }
+        if (channel->config.auto_clear_after_cb)
+        {
+            memset(buffer, 0, channel->buffer_size);
+        }
+        index = (index + 1) % channel->config.dma_desc_num;
+    }
+}
+
+esp_err_t i2s_new_channel(const i2s_chan_config_t *chan_cfg, i2s_chan_handle_t *ret_tx_handle,
+                          i2s_chan_handle_t *ret_rx_handle)
+{
+    if (chan_cfg == NULL || ret_tx_handle == NULL || chan_cfg->dma_desc_num < 2 || chan_cfg->dma_frame_num == 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (ret_rx_handle != NULL || chan_cfg->role != I2S_ROLE_MASTER)
+    {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    struct i2s_channel_t *channel = calloc(1, sizeof(*channel));
+    if (channel == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    portMUX_INITIALIZE(&channel->lock);
+    channel->config = *chan_cfg;
+
+    *ret_tx_handle = channel;
+    return ESP_OK;
+}
+
+esp_err_t i2s_del_channel(i2s_chan_handle_t handle)
+{
+    if (handle == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (handle->enabled)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (handle->task != NULL)
+    {
+        vTaskDelete(handle->task);
+    }
+    if (handle->buffers != NULL)
+    {
+        for (uint32_t i = 0; i < handle->config.dma_desc_num; i++)
+        {
+            free(handle->buffers[i]);
+        }
+        free(handle->buffers);
+    }
+    free(handle);
+    return ESP_OK;
+}
+
+esp_err_t i2s_channel_init_std_mode(i2s_chan_handle_t handle, const i2s_std_config_t *std_cfg)
+{
+    if (handle == NULL || std_cfg == NULL || std_cfg->clk_cfg.sample_rate_hz == 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (handle->initialized)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // like the driver: a mono frame is one slot, a stereo frame two
+    handle->sample_rate_hz = std_cfg->clk_cfg.sample_rate_hz;
+    handle->buffer_size =
+        handle->config.dma_frame_num * std_cfg->slot_cfg.slot_mode * (std_cfg->slot_cfg.data_bit_width / 8);
+    handle->buffers = calloc(handle->config.dma_desc_num, sizeof(*handle->buffers));
+    if (handle->buffers == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    for (uint32_t i = 0; i < handle->config.dma_desc_num; i++)
+    {
+        handle->buffers[i] = calloc(1, handle->buffer_size);
+        if (handle->buffers[i] == NULL)
+        {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    if (xTaskCreate(i2s_task, "sim_i2s", I2S_TASK_STACK_SIZE, handle, configMAX_PRIORITIES - 1, &handle->task) !=
+        pdPASS)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    handle->initialized = true;
+    return ESP_OK;
+}
+
+esp_err_t i2s_channel_register_event_callback(i2s_chan_handle_t handle, const i2s_event_callbacks_t *callback,
+                                              void *user_data)
+{
+    if (handle == NULL || callback == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (handle->enabled)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    handle->on_sent = callback->on_sent;
+    handle->user_data = user_data;
+    return ESP_OK;
+}
+
+esp_err_t i2s_channel_enable(i2s_chan_handle_t handle)
+{
+    if (handle == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&handle->lock);
+    esp_err_t ret = handle->initialized && !handle->enabled ? ESP_OK : ESP_ERR_INVALID_STATE;
+    if (ret == ESP_OK)
+    {
+        handle->enabled = true;
+        handle->sent = 0;
+        handle->sounding = 0;
+        handle->silent_run = 0;
+        handle->gaps = 0;
+    }
+    portEXIT_CRITICAL(&handle->lock);
+
+    if (ret == ESP_OK)
+    {
+        sim_emit("i2s", "start %u Hz", (unsigned)handle->sample_rate_hz);
+        xTaskNotifyGive(handle->task);
+    }
+    return ret;
+}
+
+esp_err_t i2s_channel_disable(i2s_chan_handle_t handle)
+{
+    if (handle == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&handle->lock);
+    esp_err_t ret = handle->enabled ? ESP_OK : ESP_ERR_INVALID_STATE;
+    handle->enabled = false;
+    portEXIT_CRITICAL(&handle->lock);
+
+    if (ret == ESP_OK)
+    {
+        sim_emit("i2s", "stop %u buffers, %u with sound, %u gaps", (unsigned)handle->sent,
+                 (unsigned)handle->sounding, (unsigned)handle->gaps);
+        xTaskNotifyGive(handle->task);
+    }
+    return ret;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+/*
+ * Host stand-in for the subset of the ESP-IDF GPIO driver the firmware uses. Outputs only remember their
+ * level; inputs follow the GPIO script (see sim_init()) and call their ISR handler on configured edges.
+ */
+
+#include "esp_err.h"
+
+#include <stdint.h>
+
+#define GPIO_PIN_COUNT 64
+
+typedef int gpio_num_t;
+
+typedef enum
+{
+    GPIO_INTR_DISABLE = 0,
+    GPIO_INTR_POSEDGE,
+    GPIO_INTR_NEGEDGE,
+    GPIO_INTR_ANYEDGE,
+    GPIO_INTR_LOW_LEVEL,
+    GPIO_INTR_HIGH_LEVEL,
+} gpio_int_type_t;
+
+typedef enum
+{
+    GPIO_MODE_DISABLE = 0,
+    GPIO_MODE_INPUT,
+    GPIO_MODE_OUTPUT,
+    GPIO_MODE_OUTPUT_OD,
+    GPIO_MODE_INPUT_OUTPUT_OD,
+    GPIO_MODE_INPUT_OUTPUT,
+} gpio_mode_t;
+
+typedef enum
+{
+    GPIO_PULLUP_DISABLE = 0,
+    GPIO_PULLUP_ENABLE,
+} gpio_pullup_t;
+
+typedef enum
+{
+    GPIO_PULLDOWN_DISABLE = 0,
+    GPIO_PULLDOWN_ENABLE,
+} gpio_pulldown_t;
+
+typedef struct
+{
+    uint64_t pin_bit_mask;
+    gpio_mode_t mode;
+    gpio_pullup_t pull_up_en;
+    gpio_pulldown_t pull_down_en;
+    gpio_int_type_t intr_type;
+} gpio_config_t;
+
+typedef void (*gpio_isr_t)(void *arg);
+
+esp_err_t gpio_config(const gpio_config_t *config);
+
+int gpio_get_level(gpio_num_t gpio_num);
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level);
+
+esp_err_t gpio_install_isr_service(int intr_alloc_flags);
+
+void gpio_uninstall_isr_service(void);
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler, void *args);
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t gpio_num);
@@ -0,0 +1,168 @@
+#pragma once
+
+/*
+ * Host stand-in for the ESP-IDF I2S driver in standard (Philips) mode, transmit only. The DMA buffers are sent
+ * on the simulation time at the sample rate; the sink writes when sound starts and, when the channel is
+ * disabled, how many buffers it sent and how many of them were silent in the middle of the sound (underruns).
+ */
+
+#include "driver/gpio.h"
+#include "esp_err.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define I2S_GPIO_UNUSED (-1)
+
+typedef struct i2s_channel_t *i2s_chan_handle_t;
+
+typedef enum
+{
+    I2S_NUM_0 = 0,
+    I2S_NUM_AUTO,
+} i2s_port_t;
+
+typedef enum
+{
+    I2S_ROLE_MASTER = 0,
+    I2S_ROLE_SLAVE,
+} i2s_role_t;
+
+typedef enum
+{
+    I2S_DATA_BIT_WIDTH_8BIT = 8,
+    I2S_DATA_BIT_WIDTH_16BIT = 16,
+    I2S_DATA_BIT_WIDTH_24BIT = 24,
+    I2S_DATA_BIT_WIDTH_32BIT = 32,
+} i2s_data_bit_width_t;
+
+typedef enum
+{
+    I2S_SLOT_BIT_WIDTH_AUTO = 0,
+} i2s_slot_bit_width_t;
+
+typedef enum
+{
+    I2S_SLOT_MODE_MONO = 1,
+    I2S_SLOT_MODE_STEREO = 2,
+} i2s_slot_mode_t;
+
+typedef enum
+{
+    I2S_STD_SLOT_LEFT = 1,
+    I2S_STD_SLOT_RIGHT = 2,
+    I2S_STD_SLOT_BOTH = 3,
+} i2s_std_slot_mask_t;
+
+typedef enum
+{
+    I2S_CLK_SRC_DEFAULT = 0,
+} i2s_clock_src_t;
+
+typedef enum
+{
+    I2S_MCLK_MULTIPLE_256 = 256,
+} i2s_mclk_multiple_t;
+
+typedef struct
+{
+    i2s_port_t id;
+    i2s_role_t role;
+    uint32_t dma_desc_num;
+    uint32_t dma_frame_num;
+    union {
+        bool auto_clear;
+        bool auto_clear_after_cb;
+    };
+    bool auto_clear_before_cb;
+    bool allow_pd;
+    int intr_priority;
+} i2s_chan_config_t;
+
+#define I2S_CHANNEL_DEFAULT_CONFIG(i2s_num, i2s_role)                                                                 \
+    {                                                                                                                  \
+        .id = i2s_num, .role = i2s_role, .dma_desc_num = 6, .dma_frame_num = 240, .auto_clear_after_cb = false,      \
+        .auto_clear_before_cb = false, .intr_priority = 0,                                                             \
+    }
+
+typedef struct
+{
+    uint32_t sample_rate_hz;
+    i2s_clock_src_t clk_src;
+    i2s_mclk_multiple_t mclk_multiple;
+} i2s_std_clk_config_t;
+
+#define I2S_STD_CLK_DEFAULT_CONFIG(rate)                                                                               \
+    {                                                                                                                  \
+        .sample_rate_hz = rate, .clk_src = I2S_CLK_SRC_DEFAULT, .mclk_multiple = I2S_MCLK_MULTIPLE_256,              \
+    }
+
+typedef struct
+{
+    i2s_data_bit_width_t data_bit_width;
+    i2s_slot_bit_width_t slot_bit_width;
+    i2s_slot_mode_t slot_mode;
+    i2s_std_slot_mask_t slot_mask;
+} i2s_std_slot_config_t;
+
+#define I2S_STD_PHILIPS_SLOT_DEFAULT_CONFIG(bits_per_sample, mono_or_stereo)                                           \
+    {                                                                                                                  \
+        .data_bit_width = bits_per_sample, .slot_bit_width = I2S_SLOT_BIT_WIDTH_AUTO, .slot_mode = mono_or_stereo,   \
+        .slot_mask = I2S_STD_SLOT_BOTH,                                                                                \
+    }
+
+typedef struct
+{
+    gpio_num_t mclk;
+    gpio_num_t bclk;
+    gpio_num_t ws;
+    gpio_num_t dout;
+    gpio_num_t din;
+    struct
+    {
+        uint32_t mclk_inv : 1;
+        uint32_t bclk_inv : 1;
+        uint32_t ws_inv : 1;
+    } invert_flags;
+} i2s_std_gpio_config_t;
+
+typedef struct
+{
+    i2s_std_clk_config_t clk_cfg;
+    i2s_std_slot_config_t slot_cfg;
+    i2s_std_gpio_config_t gpio_cfg;
+} i2s_std_config_t;
+
+typedef struct
+{
+    void *dma_buf; ///< DMA buffer that was just sent
+    size_t size;
+} i2s_event_data_t;
+
+typedef bool (*i2s_isr_callback_t)(i2s_chan_handle_t handle, i2s_event_data_t *event, void *user_ctx);
+
+typedef struct
+{
+    i2s_isr_callback_t on_recv;
+    i2s_isr_callback_t on_recv_q_ovf;
+    i2s_isr_callback_t on_sent;
+    i2s_isr_callback_t on_send_q_ovf;
+} i2s_event_callbacks_t;
+
+/**
+ * @brief Creates a transmit channel; receiving is not supported, `ret_rx_handle` has to be NULL.
+ */
+esp_err_t i2s_new_channel(const i2s_chan_config_t *chan_cfg, i2s_chan_handle_t *ret_tx_handle,
+                          i2s_chan_handle_t *ret_rx_handle);
+
+esp_err_t i2s_del_channel(i2s_chan_handle_t handle);
+
+esp_err_t i2s_channel_init_std_mode(i2s_chan_handle_t handle, const i2s_std_config_t *std_cfg);
+
+esp_err_t i2s_channel_register_event_callback(i2s_chan_handle_t handle, const i2s_event_callbacks_t *callback,
+                                              void *user_data);
+
+esp_err_t i2s_channel_enable(i2s_chan_handle_t handle);
+
+esp_err_t i2s_channel_disable(i2s_chan_handle_t handle);
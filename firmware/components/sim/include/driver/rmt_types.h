@@ -0,0 +1,25 @@
+#pragma once
+
+/*
+ * Host stand-in for the RMT types shared by the LED strip and the RMT receiver stand-ins.
+ */
+
+#include <stdint.h>
+
+typedef struct rmt_channel_t *rmt_channel_handle_t;
+
+typedef enum
+{
+    RMT_CLK_SRC_DEFAULT = 0,
+} rmt_clock_source_t;
+
+typedef union {
+    struct
+    {
+        uint16_t duration0 : 15;
+        uint16_t level0 : 1;
+        uint16_t duration1 : 15;
+        uint16_t level1 : 1;
+    };
+    uint32_t val;
+} rmt_symbol_word_t;
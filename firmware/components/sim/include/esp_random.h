@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Pseudo random numbers of the simulation, seeded by LIGHTHOUSE_SIM_SEED so runs can be repeated.
+ */
+uint32_t esp_random(void);
+
+void esp_fill_random(void *buf, size_t len);
@@ -0,0 +1,16 @@
+#pragma once
+
+/*
+ * Host stand-in for the ATT definitions of NimBLE that the GATT services use.
+ */
+
+#define BLE_ATT_MTU_DFLT 23
+#define BLE_ATT_ATTR_MAX_LEN 512
+
+#define BLE_ATT_ERR_READ_NOT_PERMITTED 0x02
+#define BLE_ATT_ERR_WRITE_NOT_PERMITTED 0x03
+#define BLE_ATT_ERR_REQ_NOT_SUPPORTED 0x06
+#define BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN 0x0d
+#define BLE_ATT_ERR_UNLIKELY 0x0e
+#define BLE_ATT_ERR_INSUFFICIENT_RES 0x11
+#define BLE_ATT_ERR_VALUE_NOT_ALLOWED 0x13
@@ -0,0 +1,31 @@
+#pragma once
+
+/*
+ * Host stand-in for the GATT server API of NimBLE, see os/os_mbuf.h. Notifications are written to the
+ * simulation timeline.
+ */
+
+#include "host/ble_att.h"
+#include "host/ble_uuid.h"
+#include "os/os_mbuf.h"
+
+#include <stdint.h>
+
+#define BLE_GATT_ACCESS_OP_READ_CHR 0
+#define BLE_GATT_ACCESS_OP_WRITE_CHR 1
+#define BLE_GATT_ACCESS_OP_READ_DSC 2
+#define BLE_GATT_ACCESS_OP_WRITE_DSC 3
+
+struct ble_gatt_access_ctxt
+{
+    uint8_t op;
+    struct os_mbuf *om; ///< value of a write, or the response a read appends to
+};
+
+typedef int ble_gatt_access_fn(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt,
+                               void *arg);
+
+/**
+ * @brief Consumes `om` in any case, like NimBLE.
+ */
+int ble_gatts_notify_custom(uint16_t conn_handle, uint16_t attr_handle, struct os_mbuf *om);
@@ -0,0 +1,52 @@
+#pragma once
+
+/*
+ * Host stand-in for the NimBLE host, see os/os_mbuf.h. There is no link on the host: the GATT harness of
+ * the remote_control component calls the access callbacks directly.
+ */
+
+#include "host/ble_att.h"
+#include "host/ble_gatt.h"
+#include "host/ble_uuid.h"
+#include "os/os_mbuf.h"
+#include "sdkconfig.h"
+
+#include <stdint.h>
+
+// the Bluetooth options only exist for targets with a radio; the defaults of the device build
+#ifndef CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+#define CONFIG_BT_NIMBLE_MAX_CONNECTIONS 3
+#endif
+
+#define BLE_HS_CONN_HANDLE_NONE 0xffff
+
+#define BLE_HS_EMSGSIZE 4
+#define BLE_HS_ENOMEM 6
+#define BLE_HS_ENOTCONN 7
+
+struct ble_gap_sec_state
+{
+    unsigned encrypted : 1;
+    unsigned authenticated : 1;
+    unsigned bonded : 1;
+    unsigned key_size : 5;
+};
+
+struct ble_gap_conn_desc
+{
+    struct ble_gap_sec_state sec_state;
+    uint16_t conn_handle;
+    uint16_t conn_itvl;
+    uint16_t conn_latency;
+    uint16_t supervision_timeout;
+};
+
+/**
+ * @brief Always BLE_HS_ENOTCONN, there are no links on the host.
+ */
+int ble_gap_conn_find(uint16_t handle, struct ble_gap_conn_desc *out_desc);
+
+uint16_t ble_att_mtu(uint16_t conn_handle);
+
+struct os_mbuf *ble_hs_mbuf_from_flat(const void *buf, uint16_t len);
+int ble_hs_mbuf_to_flat(const struct os_mbuf *om, void *flat, uint16_t max_len, uint16_t *out_copy_len);
@@ -0,0 +1,8 @@
+#pragma once
+
+/*
+ * Host stand-in for the security manager of NimBLE. Pairing only happens on the device; the services only
+ * need the security state of a link, which is in host/ble_hs.h.
+ */
+
+#include "host/ble_hs.h"
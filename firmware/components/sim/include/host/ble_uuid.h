@@ -0,0 +1,30 @@
+#pragma once
+
+/*
+ * Host stand-in for the UUID types of NimBLE, see os/os_mbuf.h.
+ */
+
+#include <stdint.h>
+
+#define BLE_UUID_TYPE_16 16
+#define BLE_UUID_TYPE_128 128
+
+typedef struct
+{
+    uint8_t type;
+} ble_uuid_t;
+
+typedef struct
+{
+    ble_uuid_t u;
+    uint16_t value;
+} ble_uuid16_t;
+
+typedef struct
+{
+    ble_uuid_t u;
+    uint8_t value[16];
+} ble_uuid128_t;
+
+#define BLE_UUID16_INIT(uuid16) {.u = {.type = BLE_UUID_TYPE_16}, .value = (uuid16)}
+#define BLE_UUID128_INIT(uuid128...) {.u = {.type = BLE_UUID_TYPE_128}, .value = {uuid128}}
@@ -0,0 +1,25 @@
+#pragma once
+
+/*
+ * Host stand-in for the event queue of the NimBLE port, see os/os_mbuf.h. There is no host task, so an event
+ * runs right away on the task that puts it.
+ */
+
+struct ble_npl_event;
+
+typedef void ble_npl_event_fn(struct ble_npl_event *ev);
+
+struct ble_npl_event
+{
+    ble_npl_event_fn *fn;
+    void *arg;
+};
+
+struct ble_npl_eventq
+{
+    int unused;
+};
+
+void ble_npl_event_init(struct ble_npl_event *ev, ble_npl_event_fn *fn, void *arg);
+void ble_npl_eventq_put(struct ble_npl_eventq *evq, struct ble_npl_event *ev);
+struct ble_npl_eventq *nimble_port_get_dflt_eventq(void);
@@ -0,0 +1,30 @@
+#pragma once
+
+/*
+ * Host stand-in for the mbufs of NimBLE. Blocks come from a small static pool like the msys pool on the
+ * device, and values longer than one block are chains, so the callbacks see long writes as NimBLE hands them
+ * over. Only the fields and functions the firmware uses exist.
+ */
+
+#include <stdint.h>
+
+#define OS_ENOMEM 1
+
+/// Data bytes of one block, smaller than on the device so that long values are chained
+#define OS_MBUF_BLOCK_SIZE 128
+
+struct os_mbuf
+{
+    uint8_t *om_data;
+    uint16_t om_len;
+    uint16_t om_pkt_len; ///< length of the whole chain, only kept in the first mbuf
+    struct os_mbuf *om_next;
+    uint8_t om_databuf[OS_MBUF_BLOCK_SIZE];
+};
+
+#define OS_MBUF_PKTLEN(om) ((om)->om_pkt_len)
+
+struct os_mbuf *os_msys_get_pkthdr(uint16_t dsize, uint16_t user_hdr_len);
+int os_mbuf_append(struct os_mbuf *om, const void *data, uint16_t len);
+int os_mbuf_copydata(const struct os_mbuf *om, int off, int len, void *dst);
+int os_mbuf_free_chain(struct os_mbuf *om);
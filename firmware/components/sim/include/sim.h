@@ -0,0 +1,64 @@
+#pragma once
+
+#include "esp_err.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Sets up the host simulation; call first thing in app_main.
+ *
+ * Configured through environment variables:
+ *     - LIGHTHOUSE_SIM_OUTPUT: file the timeline is written to (default: stdout).
+ *     - LIGHTHOUSE_SIM_DURATION_MS: exit after this time (default: run forever).
+ *     - LIGHTHOUSE_SIM_VIRTUAL_TIME: "1" runs on virtual time, which skips ahead whenever all tasks wait; the
+ *       timeline then only depends on the seed and the GPIO script (default: real time).
+ *     - LIGHTHOUSE_SIM_SEED: seed of esp_random(), so flicker patterns can be replayed (default: 1).
+ *     - LIGHTHOUSE_GPIO_SCRIPT: input levels to play back, one "<time ms> <gpio> <level>" per line.
+ *     - LIGHTHOUSE_TRACK_TRACE: track signal the RMT receiver plays back, one "<time us> <level>" per edge
+ *       (default: a silent track).
+ *     - LIGHTHOUSE_PARTITION_IMAGE: "<label>:<file>", written to the start of a data partition at boot, e.g. the
+ *       clip set of the foghorn.
+ *     - LIGHTHOUSE_FLASH_FILE: flash image backing NVS; kept across runs (default: a temporary file).
+ *     - LIGHTHOUSE_SIM_UTC: UTC in seconds since the epoch the simulation starts at; the calendar gets the time
+ *       as if a phone had set it right after boot, in the CONFIG_SCHEDULE_UTC_OFFSET zone (default: no time).
+ *     - LIGHTHOUSE_GATT_HARNESS: "1" drives every GATT access callback with synthetic requests once the
+ *       services are up, prints latency, heap delta and ATT result per request and exits, with status 1 if a
+ *       result differs from the expected one (see remote_control/gatt_harness_linux.c).
+ *
+ * @return
+ *     - ESP_OK: Simulation running.
+ *     - ESP_ERR_NOT_FOUND: The output, the GPIO script or a partition image could not be opened.
+ */
+esp_err_t sim_init(void);
+
+/**
+ * @brief Current time of the simulation in microseconds (vclock_now_us()), the time base of all stand-ins.
+ */
+int64_t sim_time_us(void);
+
+/**
+ * @brief Wall clock of the simulation, see LIGHTHOUSE_SIM_UTC.
+ *
+ * @return true and the current UTC time in microseconds, or false if no start time was given.
+ */
+bool sim_wall_clock_us(int64_t *utc_us);
+
+/**
+ * @brief Appends one line "<time ms> <source> <text>" to the timeline.
+ *
+ * The timeline is what the stand-ins observed (pixels, duty cycles, inputs) and can be compared
+ * against an expected output.
+ */
+void sim_emit(const char *source, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Lets every mbuf allocation of the NimBLE stand-in fail, as if the pool were empty, so the callbacks
+ * take their out-of-memory paths.
+ */
+void sim_mbuf_fail_allocations(bool fail);
+
+/**
+ * @brief Mbuf blocks of the NimBLE stand-in taken since start, and currently in use.
+ */
+void sim_mbuf_get_stats(uint32_t *taken, uint32_t *in_use);
@@ -0,0 +1,112 @@
+#include "led_strip.h"
+#include "sim.h"
+#include "sim_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LED_STRIP_FRAME_TEXT_MAX 160
+
+struct led_strip_t
+{
+    int gpio_num;
+    uint32_t max_leds;
+    uint32_t num_components;
+    uint8_t pixels[]; ///< red, green, blue, white per LED, independent of the wire order
+};
+
+esp_err_t led_strip_new_rmt_device(const led_strip_config_t *led_config, const led_strip_rmt_config_t *rmt_config,
+                                   led_strip_handle_t *ret_strip)
+{
+    if (led_config == NULL || ret_strip == NULL || led_config->max_leds == 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    struct led_strip_t *strip = calloc(1, sizeof(*strip) + led_config->max_leds * 4);
+    if (strip == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    strip->gpio_num = led_config->strip_gpio_num;
+    strip->max_leds = led_config->max_leds;
+    strip->num_components = led_config->color_component_format.format.num_components == 4 ? 4 : 3;
+
+    *ret_strip = strip;
+    return ESP_OK;
+}
+
+esp_err_t led_strip_set_pixel_rgbw(led_strip_handle_t strip, uint32_t index, uint32_t red, uint32_t green,
+                                   uint32_t blue, uint32_t white)
+{
+    if (strip == NULL || index >= strip->max_leds)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint8_t *pixel = &strip->pixels[index * 4];
+    pixel[0] = red;
+    pixel[1] = green;
+    pixel[2] = blue;
+    pixel[3] = white;
+    return ESP_OK;
+}
+
+esp_err_t led_strip_set_pixel(led_strip_handle_t strip, uint32_t index, uint32_t red, uint32_t green, uint32_t blue)
+{
+    return led_strip_set_pixel_rgbw(strip, index, red, green, blue, 0);
+}
+
+// One frame per refresh: "gpio <n> <r>,<g>,<b>[,<w>] ...", plus coloured blocks on a terminal
+esp_err_t led_strip_refresh(led_strip_handle_t strip)
+{
+    if (strip == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    char text[LED_STRIP_FRAME_TEXT_MAX];
+    bool terminal = sim_output_is_terminal();
+    int len = snprintf(text, sizeof(text), "gpio %d", strip->gpio_num);
+
+    for (uint32_t i = 0; i < strip->max_leds && len > 0 && len < (int)sizeof(text); i++)
+    {
+        const uint8_t *p = &strip->pixels[i * 4];
+        if (terminal)
+        {
+            // the white channel is added to all colours, which is roughly what it looks like
+            uint32_t r = p[0] + p[3], g = p[1] + p[3], b = p[2] + p[3];
+            len += snprintf(&text[len], sizeof(text) - len, " \x1b[48;2;%u;%u;%um  \x1b[0m", r > 255 ? 255 : r,
+                            g > 255 ? 255 : g, b > 255 ? 255 : b);
+        }
+        else if (strip->num_components == 4)
+        {
+            len += snprintf(&text[len], sizeof(text) - len, " %u,%u,%u,%u", p[0], p[1], p[2], p[3]);
+        }
+        else
+        {
+            len += snprintf(&text[len], sizeof(text) - len, " %u,%u,%u", p[0], p[1], p[2]);
+        }
+    }
+
+    sim_emit("strip", "%s", text);
+    return ESP_OK;
+}
+
+esp_err_t led_strip_clear(led_strip_handle_t strip)
+{
+    if (strip == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(strip->pixels, 0, strip->max_leds * 4);
+    return led_strip_refresh(strip);
+}
+
+esp_err_t led_strip_del(led_strip_handle_t strip)
+{
+    free(strip);
+    return ESP_OK;
+}
@@ -0,0 +1,103 @@
+#include "driver/ledc.h"
+#include "sim.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+typedef struct
+{
+    bool configured;
+    int gpio_num;
+    ledc_timer_t timer;
+    uint32_t duty;        ///< set, but not latched yet
+    uint32_t output_duty; ///< what the pin shows
+} sim_ledc_channel_t;
+
+static uint32_t timer_max_duty[LEDC_TIMER_MAX];
+static sim_ledc_channel_t channels[LEDC_CHANNEL_MAX];
+
+static bool is_valid(ledc_mode_t speed_mode, ledc_channel_t channel)
+{
+    return speed_mode < LEDC_SPEED_MODE_MAX && channel < LEDC_CHANNEL_MAX && channels[channel].configured;
+}
+
+static void output(sim_ledc_channel_t *ch, uint32_t duty)
+{
+    if (duty == ch->output_duty)
+    {
+        return;
+    }
+
+    ch->output_duty = duty;
+    sim_emit("ledc", "gpio %d duty %" PRIu32 "/%" PRIu32, ch->gpio_num, duty, timer_max_duty[ch->timer]);
+}
+
+esp_err_t ledc_timer_config(const ledc_timer_config_t *timer_conf)
+{
+    if (timer_conf == NULL || timer_conf->timer_num >= LEDC_TIMER_MAX || timer_conf->duty_resolution == 0 ||
+        timer_conf->duty_resolution >= LEDC_TIMER_BIT_MAX)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    timer_max_duty[timer_conf->timer_num] = (1U << timer_conf->duty_resolution) - 1;
+    return ESP_OK;
+}
+
+esp_err_t ledc_channel_config(const ledc_channel_config_t *ledc_conf)
+{
+    if (ledc_conf == NULL || ledc_conf->channel >= LEDC_CHANNEL_MAX || ledc_conf->timer_sel >= LEDC_TIMER_MAX)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    sim_ledc_channel_t *ch = &channels[ledc_conf->channel];
+    *ch = (sim_ledc_channel_t){
+        .configured = true,
+        .gpio_num = ledc_conf->gpio_num,
+        .timer = ledc_conf->timer_sel,
+        .duty = ledc_conf->duty,
+        .output_duty = ledc_conf->duty,
+    };
+    sim_emit("ledc", "gpio %d duty %" PRIu32 "/%" PRIu32, ch->gpio_num, ch->output_duty, timer_max_duty[ch->timer]);
+    return ESP_OK;
+}
+
+esp_err_t ledc_set_duty(ledc_mode_t speed_mode, ledc_channel_t channel, uint32_t duty)
+{
+    if (!is_valid(speed_mode, channel))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    channels[channel].duty = duty;
+    return ESP_OK;
+}
+
+esp_err_t ledc_update_duty(ledc_mode_t speed_mode, ledc_channel_t channel)
+{
+    if (!is_valid(speed_mode, channel))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    output(&channels[channel], channels[channel].duty);
+    return ESP_OK;
+}
+
+uint32_t ledc_get_duty(ledc_mode_t speed_mode, ledc_channel_t channel)
+{
+    return is_valid(speed_mode, channel) ? channels[channel].output_duty : 0;
+}
+
+esp_err_t ledc_stop(ledc_mode_t speed_mode, ledc_channel_t channel, uint32_t idle_level)
+{
+    if (!is_valid(speed_mode, channel))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    sim_ledc_channel_t *ch = &channels[channel];
+    output(ch, idle_level ? timer_max_duty[ch->timer] : 0);
+    return ESP_OK;
+}
@@ -0,0 +1,186 @@
+#include "host/ble_hs.h"
+#include "nimble/nimble_port.h"
+#include "sim.h"
+
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+
+// enough for a few 512 byte values at once, the longest an attribute can be
+#define MBUF_BLOCKS 32
+
+static struct os_mbuf blocks[MBUF_BLOCKS];
+static bool block_used[MBUF_BLOCKS];
+static portMUX_TYPE pool_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool fail_allocations = false;
+static uint32_t blocks_taken = 0;
+static uint32_t blocks_in_use = 0;
+static struct ble_npl_eventq default_eventq;
+
+void sim_mbuf_fail_allocations(bool fail)
+{
+    fail_allocations = fail;
+}
+
+void sim_mbuf_get_stats(uint32_t *taken, uint32_t *in_use)
+{
+    portENTER_CRITICAL(&pool_lock);
+    *taken = blocks_taken;
+    *in_use = blocks_in_use;
+    portEXIT_CRITICAL(&pool_lock);
+}
+
+static struct os_mbuf *get_block(void)
+{
+    struct os_mbuf *om = NULL;
+    portENTER_CRITICAL(&pool_lock);
+    for (int i = 0; i < MBUF_BLOCKS && !fail_allocations; i++)
+    {
+        if (!block_used[i])
+        {
+            block_used[i] = true;
+            blocks_taken++;
+            blocks_in_use++;
+            om = &blocks[i];
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&pool_lock);
+
+    if (om != NULL)
+    {
+        om->om_data = om->om_databuf;
+        om->om_len = 0;
+        om->om_pkt_len = 0;
+        om->om_next = NULL;
+    }
+    return om;
+}
+
+struct os_mbuf *os_msys_get_pkthdr(uint16_t dsize, uint16_t user_hdr_len)
+{
+    return get_block();
+}
+
+int os_mbuf_free_chain(struct os_mbuf *om)
+{
+    while (om != NULL)
+    {
+        struct os_mbuf *next = om->om_next;
+        portENTER_CRITICAL(&pool_lock);
+        block_used[om - blocks] = false;
+        blocks_in_use--;
+        portEXIT_CRITICAL(&pool_lock);
+        om = next;
+    }
+    return 0;
+}
+
+int os_mbuf_append(struct os_mbuf *om, const void *data, uint16_t len)
+{
+    struct os_mbuf *last = om;
+    while (last->om_next != NULL)
+    {
+        last = last->om_next;
+    }
+
+    const uint8_t *src = data;
+    while (len > 0)
+    {
+        uint16_t room = sizeof(last->om_databuf) - (last->om_data - last->om_databuf) - last->om_len;
+        if (room == 0)
+        {
+            // like NimBLE, what was appended before the pool ran out stays in the chain
+            struct os_mbuf *next = get_block();
+            if (next == NULL)
+            {
+                return OS_ENOMEM;
+            }
+            last->om_next = next;
+            last = next;
+            continue;
+        }
+
+        uint16_t n = len < room ? len : room;
+        memcpy(&last->om_data[last->om_len], src, n);
+        last->om_len += n;
+        om->om_pkt_len += n;
+        src += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int os_mbuf_copydata(const struct os_mbuf *om, int off, int len, void *dst)
+{
+    uint8_t *out = dst;
+    for (; om != NULL && len > 0; om = om->om_next)
+    {
+        if (off >= om->om_len)
+        {
+            off -= om->om_len;
+            continue;
+        }
+        int n = om->om_len - off < len ? om->om_len - off : len;
+        memcpy(out, &om->om_data[off], n);
+        out += n;
+        len -= n;
+        off = 0;
+    }
+    return len > 0 ? -1 : 0;
+}
+
+struct os_mbuf *ble_hs_mbuf_from_flat(const void *buf, uint16_t len)
+{
+    struct os_mbuf *om = get_block();
+    if (om != NULL && os_mbuf_append(om, buf, len) != 0)
+    {
+        os_mbuf_free_chain(om);
+        om = NULL;
+    }
+    return om;
+}
+
+int ble_hs_mbuf_to_flat(const struct os_mbuf *om, void *flat, uint16_t max_len, uint16_t *out_copy_len)
+{
+    uint16_t len = OS_MBUF_PKTLEN(om) < max_len ? OS_MBUF_PKTLEN(om) : max_len;
+    os_mbuf_copydata(om, 0, len, flat);
+    if (out_copy_len != NULL)
+    {
+        *out_copy_len = len;
+    }
+    return len < OS_MBUF_PKTLEN(om) ? BLE_HS_EMSGSIZE : 0;
+}
+
+int ble_gatts_notify_custom(uint16_t conn_handle, uint16_t attr_handle, struct os_mbuf *om)
+{
+    sim_emit("ble", "notify conn=%u attr=%u len=%u", conn_handle, attr_handle, om != NULL ? OS_MBUF_PKTLEN(om) : 0);
+    os_mbuf_free_chain(om);
+    return 0;
+}
+
+int ble_gap_conn_find(uint16_t handle, struct ble_gap_conn_desc *out_desc)
+{
+    return BLE_HS_ENOTCONN;
+}
+
+uint16_t ble_att_mtu(uint16_t conn_handle)
+{
+    return BLE_ATT_MTU_DFLT;
+}
+
+void ble_npl_event_init(struct ble_npl_event *ev, ble_npl_event_fn *fn, void *arg)
+{
+    ev->fn = fn;
+    ev->arg = arg;
+}
+
+void ble_npl_eventq_put(struct ble_npl_eventq *evq, struct ble_npl_event *ev)
+{
+    ev->fn(ev);
+}
+
+struct ble_npl_eventq *nimble_port_get_dflt_eventq(void)
+{
+    return &default_eventq;
+}
@@ -0,0 +1,346 @@
+#include "driver/rmt_rx.h"
+#include "sim.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "vclock.h"
+
+static const char *TAG = "sim_rmt";
+
+#define RMT_RX_TASK_STACK_SIZE 4096
+#define RMT_RX_DURATION_MAX 0x7fff
+
+struct rmt_channel_t
+{
+    portMUX_TYPE lock;
+    TaskHandle_t task;
+    FILE *trace;
+    uint32_t resolution_hz;
+    size_t chunk_symbols; ///< half of the channel memory, like the ping-pong receive delivers it
+    bool enabled;
+    bool armed;
+    rmt_receive_config_t config;
+    rmt_symbol_word_t *buffer;
+    size_t buffer_symbols;
+    size_t buffer_offset;
+    rmt_rx_done_callback_t on_recv_done;
+    void *user_data;
+};
+
+static void wait_until(int64_t at_us)
+{
+    while (sim_time_us() < at_us)
+    {
+        vclock_notify_take_until(pdTRUE, at_us);
+    }
+}
+
+static bool read_edge(struct rmt_channel_t *channel, int64_t *time_us, int *level)
+{
+    char line[64];
+    long long time;
+    char first;
+
+    while (fgets(line, sizeof(line), channel->trace) != NULL)
+    {
+        if (sscanf(line, " %c", &first) != 1 || first == '#')
+        {
+            continue;
+        }
+        if (sscanf(line, "%lld %d", &time, level) == 2)
+        {
+            *time_us = time;
+            return true;
+        }
+        ESP_LOGW(TAG, "Ignoring trace line: %s", line);
+    }
+    return false;
+}
+
+// Copies the symbols into the receive buffer, wrapping around like the driver, and calls the callback
+static void deliver(struct rmt_channel_t *channel, const rmt_symbol_word_t *symbols, size_t count, bool is_last)
+{
+    portENTER_CRITICAL(&channel->lock);
+    bool armed = channel->armed && channel->enabled;
+    channel->armed = channel->armed && !is_last;
+    portEXIT_CRITICAL(&channel->lock);
+    if (!armed || count > channel->buffer_symbols)
+    {
+        return;
+    }
+
+    if (channel->buffer_offset + count > channel->buffer_symbols)
+    {
+        channel->buffer_offset = 0;
+    }
+    rmt_symbol_word_t *received = &channel->buffer[channel->buffer_offset];
+    memcpy(received, symbols, count * sizeof(*symbols));
+    channel->buffer_offset += count;
+
+    rmt_rx_done_event_data_t edata = {.received_symbols = received, .num_symbols = count};
+    edata.flags.is_last = is_last;
+    if (channel->on_recv_done != NULL)
+    {
+        channel->on_recv_done(channel, &edata, channel->user_data);
+    }
+}
+
+static bool is_armed(struct rmt_channel_t *channel)
+{
+    portENTER_CRITICAL(&channel->lock);
+    bool armed = channel->armed && channel->enabled;
+    portEXIT_CRITICAL(&channel->lock);
+    return armed;
+}
+
+static void wait_armed(struct rmt_channel_t *channel)
+{
+    while (!is_armed(channel))
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+}
+
+/*
+ * Plays the trace: every level between two edges becomes half a symbol. A full chunk is delivered at the time
+ * of its last edge; a level that lasts longer than signal_range_max_ns ends the receive like the idle
+ * detection of the hardware, and edges until the next rmt_receive() are lost. There is no glitch filter.
+ */
+static void rmt_rx_task(void *arg)
+{
+    struct rmt_channel_t *channel = arg;
+    rmt_symbol_word_t chunk[channel->chunk_symbols + 1];
+    size_t count = 0;
+    bool second_half = false;
+    int64_t last_us;
+    int last_level;
+    int64_t edge_us;
+    int level;
+
+    wait_armed(channel);
+    if (!read_edge(channel, &last_us, &last_level))
+    {
+        goto done;
+    }
+
+    while (true)
+    {
+        bool more = read_edge(channel, &edge_us, &level);
+        int64_t idle_until_us = last_us + channel->config.signal_range_max_ns / 1000;
+        if (!more || edge_us > idle_until_us)
+        {
+            // the receive ends with a zero duration after the last level
+            wait_until(idle_until_us);
+            if (second_half)
+            {
+                chunk[count].duration1 = 0;
+                chunk[count].level1 = last_level;
+            }
+            else
+            {
+                chunk[count] = (rmt_symbol_word_t){.level0 = last_level};
+            }
+            count++;
+            deliver(channel, chunk, count, true);
+            count = 0;
+            second_half = false;
+            if (!more)
+            {
+                break;
+            }
+
+            wait_armed(channel);
+            int64_t armed_us = sim_time_us();
+            while (more && edge_us < armed_us)
+            {
+                more = read_edge(channel, &edge_us, &level);
+            }
+            if (!more)
+            {
+                break;
+            }
+            last_us = edge_us;
+            last_level = level;
+            continue;
+        }
+
+        uint64_t ticks = (uint64_t)(edge_us - last_us) * channel->resolution_hz / 1000000;
+        uint16_t duration = ticks > RMT_RX_DURATION_MAX ? RMT_RX_DURATION_MAX : ticks;
+        if (second_half)
+        {
+            chunk[count].duration1 = duration;
+            chunk[count].level1 = last_level;
+            count++;
+        }
+        else
+        {
+            chunk[count] = (rmt_symbol_word_t){.duration0 = duration, .level0 = last_level};
+        }
+        second_half = !second_half;
+        last_us = edge_us;
+        last_level = level;
+
+        if (count == channel->chunk_symbols)
+        {
+            wait_until(edge_us);
+            deliver(channel, chunk, count, false);
+            count = 0;
+        }
+    }
+
+done:
+    fclose(channel->trace);
+    channel->trace = NULL;
+    channel->task = NULL;
+    sim_emit("rmt", "trace done");
+    vTaskDelete(NULL);
+}
+
+esp_err_t rmt_new_rx_channel(const rmt_rx_channel_config_t *config, rmt_channel_handle_t *ret_chan)
+{
+    if (config == NULL || ret_chan == NULL || config->resolution_hz == 0 || config->mem_block_symbols < 2)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    struct rmt_channel_t *channel = calloc(1, sizeof(*channel));
+    if (channel == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    portMUX_INITIALIZE(&channel->lock);
+    channel->resolution_hz = config->resolution_hz;
+    channel->chunk_symbols = config->mem_block_symbols / 2;
+
+    const char *path = getenv("LIGHTHOUSE_TRACK_TRACE");
+    if (path != NULL)
+    {
+        channel->trace = fopen(path, "r");
+        if (channel->trace == NULL)
+        {
+            ESP_LOGE(TAG, "Failed to open track trace %s", path);
+        }
+    }
+
+    *ret_chan = channel;
+    return ESP_OK;
+}
+
+esp_err_t rmt_del_channel(rmt_channel_handle_t channel)
+{
+    if (channel == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (channel->enabled)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (channel->task != NULL)
+    {
+        vTaskDelete(channel->task);
+    }
+    if (channel->trace != NULL)
+    {
+        fclose(channel->trace);
+    }
+    free(channel);
+    return ESP_OK;
+}
+
+esp_err_t rmt_rx_register_event_callbacks(rmt_channel_handle_t rx_channel, const rmt_rx_event_callbacks_t *cbs,
+                                          void *user_data)
+{
+    if (rx_channel == NULL || cbs == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (rx_channel->enabled)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    rx_channel->on_recv_done = cbs->on_recv_done;
+    rx_channel->user_data = user_data;
+    return ESP_OK;
+}
+
+esp_err_t rmt_enable(rmt_channel_handle_t channel)
+{
+    if (channel == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (channel->enabled)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    channel->enabled = true;
+    // the trace is played once, from the first enable on
+    if (channel->trace != NULL && channel->task == NULL &&
+        xTaskCreate(rmt_rx_task, "sim_rmt_rx", RMT_RX_TASK_STACK_SIZE, channel, configMAX_PRIORITIES - 1,
+                    &channel->task) != pdPASS)
+    {
+        channel->enabled = false;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+esp_err_t rmt_disable(rmt_channel_handle_t channel)
+{
+    if (channel == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!channel->enabled)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    portENTER_CRITICAL(&channel->lock);
+    channel->enabled = false;
+    channel->armed = false;
+    portEXIT_CRITICAL(&channel->lock);
+    return ESP_OK;
+}
+
+// Also called from the receive callback, like the real driver allows it with CONFIG_RMT_RECV_FUNC_IN_IRAM
+esp_err_t rmt_receive(rmt_channel_handle_t rx_channel, void *buffer, size_t buffer_size,
+                      const rmt_receive_config_t *config)
+{
+    if (rx_channel == NULL || buffer == NULL || config == NULL || buffer_size < sizeof(rmt_symbol_word_t))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!config->flags.en_partial_rx)
+    {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    portENTER_CRITICAL_SAFE(&rx_channel->lock);
+    esp_err_t ret = rx_channel->enabled && !rx_channel->armed ? ESP_OK : ESP_ERR_INVALID_STATE;
+    if (ret == ESP_OK)
+    {
+        rx_channel->config = *config;
+        rx_channel->buffer = buffer;
+        rx_channel->buffer_symbols = buffer_size / sizeof(rmt_symbol_word_t);
+        rx_channel->buffer_offset = 0;
+        rx_channel->armed = true;
+    }
+    portEXIT_CRITICAL_SAFE(&rx_channel->lock);
+
+    if (ret == ESP_OK && rx_channel->task != NULL)
+    {
+        xTaskNotifyGive(rx_channel->task);
+    }
+    return ret;
+}
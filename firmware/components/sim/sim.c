@@ -0,0 +1,235 @@
+#include "sim.h"
+#include "sim_internal.h"
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_private/partition_linux.h"
+#include "esp_random.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "vclock.h"
+
+static const char *TAG = "sim";
+
+#define SIM_TEXT_MAX 192
+
+static FILE *output;
+static portMUX_TYPE random_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t random_state = 1;
+static uint32_t duration_ms;
+static const char *flash_file;
+static bool wall_clock_set = false;
+static int64_t wall_clock_start_us;
+
+int64_t sim_time_us(void)
+{
+    return vclock_now_us();
+}
+
+bool sim_wall_clock_us(int64_t *utc_us)
+{
+    *utc_us = wall_clock_start_us + sim_time_us();
+    return wall_clock_set;
+}
+
+bool sim_output_is_terminal(void)
+{
+    return isatty(fileno(output != NULL ? output : stdout));
+}
+
+void sim_emit(const char *source, const char *fmt, ...)
+{
+    char text[SIM_TEXT_MAX];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+
+    int64_t now = sim_time_us();
+    fprintf(output != NULL ? output : stdout, "%" PRId64 ".%03" PRId64 " %s %s\n", now / 1000, now % 1000, source,
+            text);
+}
+
+// xorshift32, good enough for flicker and reproducible from the seed
+uint32_t esp_random(void)
+{
+    portENTER_CRITICAL(&random_lock);
+    uint32_t x = random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    random_state = x;
+    portEXIT_CRITICAL(&random_lock);
+    return x;
+}
+
+void esp_fill_random(void *buf, size_t len)
+{
+    uint8_t *bytes = buf;
+    for (size_t i = 0; i < len; i += sizeof(uint32_t))
+    {
+        uint32_t value = esp_random();
+        memcpy(&bytes[i], &value, len - i < sizeof(value) ? len - i : sizeof(value));
+    }
+}
+
+// The emulated flash lives in a temporary file; keep it for the next run
+static void save_flash(void)
+{
+    const char *current = esp_partition_get_file_mmap_ctrl_act()->flash_file_name;
+    if (current[0] == '\0' || strcmp(current, flash_file) == 0)
+    {
+        return;
+    }
+
+    FILE *in = fopen(current, "rb");
+    FILE *out = fopen(flash_file, "wb");
+    if (in != NULL && out != NULL)
+    {
+        char buffer[4096];
+        size_t len;
+        while ((len = fread(buffer, 1, sizeof(buffer), in)) > 0)
+        {
+            fwrite(buffer, 1, len, out);
+        }
+    }
+    else
+    {
+        ESP_LOGE(TAG, "Failed to save flash image to %s", flash_file);
+    }
+    if (in != NULL)
+    {
+        fclose(in);
+        unlink(current);
+    }
+    if (out != NULL)
+    {
+        fclose(out);
+    }
+}
+
+// "<label>:<file>", e.g. the clip set of the foghorn; the partition is erased first
+static esp_err_t write_partition_image(const char *spec)
+{
+    const char *separator = strchr(spec, ':');
+    if (separator == NULL)
+    {
+        ESP_LOGE(TAG, "Partition image %s is not <label>:<file>", spec);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    char label[sizeof(((esp_partition_t *)NULL)->label)];
+    snprintf(label, sizeof(label), "%.*s", (int)(separator - spec), spec);
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_ANY, ESP_PARTITION_SUBTYPE_ANY,
+                                                                label);
+    FILE *in = fopen(separator + 1, "rb");
+    if (partition == NULL || in == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to write %s to partition %s", separator + 1, label);
+        if (in != NULL)
+        {
+            fclose(in);
+        }
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    esp_err_t ret = esp_partition_erase_range(partition, 0, partition->size);
+    char buffer[4096];
+    size_t offset = 0;
+    size_t len;
+    while (ret == ESP_OK && (len = fread(buffer, 1, sizeof(buffer), in)) > 0)
+    {
+        ret = offset + len <= partition->size ? esp_partition_write(partition, offset, buffer, len)
+                                              : ESP_ERR_INVALID_SIZE;
+        offset += len;
+    }
+    fclose(in);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to write %s to partition %s: %s", separator + 1, label, esp_err_to_name(ret));
+    }
+    return ret;
+}
+
+static void stop_task(void *arg)
+{
+    vclock_delay(pdMS_TO_TICKS(duration_ms));
+    sim_emit("sim", "end");
+    fflush(output);
+    exit(0);
+}
+
+esp_err_t sim_init(void)
+{
+    const char *path = getenv("LIGHTHOUSE_SIM_OUTPUT");
+    output = path != NULL ? fopen(path, "w") : stdout;
+    if (output == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to open timeline output %s", path);
+        output = stdout;
+        return ESP_ERR_NOT_FOUND;
+    }
+    setvbuf(output, NULL, path != NULL ? _IOFBF : _IOLBF, 0);
+
+    const char *seed = getenv("LIGHTHOUSE_SIM_SEED");
+    if (seed != NULL && strtoul(seed, NULL, 0) != 0)
+    {
+        random_state = strtoul(seed, NULL, 0);
+    }
+
+    // has to happen before the first partition access, i.e. before persistence_init()
+    flash_file = getenv("LIGHTHOUSE_FLASH_FILE");
+    if (flash_file != NULL)
+    {
+        esp_partition_file_mmap_ctrl_t *ctrl = esp_partition_get_file_mmap_ctrl_input();
+        if (access(flash_file, F_OK) == 0)
+        {
+            snprintf(ctrl->flash_file_name, sizeof(ctrl->flash_file_name), "%s", flash_file);
+        }
+        ctrl->remove_dump = false;
+        atexit(save_flash);
+    }
+
+    const char *virtual_time = getenv("LIGHTHOUSE_SIM_VIRTUAL_TIME");
+    bool use_virtual_time = virtual_time != NULL && strcmp(virtual_time, "1") == 0;
+    if (use_virtual_time)
+    {
+        vclock_use_virtual_time();
+    }
+
+    sim_emit("sim", "start seed %" PRIu32 "%s", random_state, use_virtual_time ? " virtual time" : "");
+
+    const char *utc = getenv("LIGHTHOUSE_SIM_UTC");
+    if (utc != NULL)
+    {
+        wall_clock_set = true;
+        wall_clock_start_us = strtoll(utc, NULL, 0) * 1000000;
+    }
+
+    const char *duration = getenv("LIGHTHOUSE_SIM_DURATION_MS");
+    if (duration != NULL)
+    {
+        duration_ms = strtoul(duration, NULL, 0);
+        xTaskCreate(stop_task, "sim_stop", 4096, NULL, configMAX_PRIORITIES - 1, NULL);
+    }
+
+    const char *image = getenv("LIGHTHOUSE_PARTITION_IMAGE");
+    if (image != NULL && write_partition_image(image) != ESP_OK)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    const char *script = getenv("LIGHTHOUSE_GPIO_SCRIPT");
+    if (script != NULL)
+    {
+        return sim_gpio_play(script);
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "esp_err.h"
+
+#include <stdbool.h>
+
+/**
+ * @brief Starts playing back the input levels of a GPIO script.
+ */
+esp_err_t sim_gpio_play(const char *path);
+
+/**
+ * @brief Returns true if the timeline goes to a terminal, which then gets coloured pixels.
+ */
+bool sim_output_is_terminal(void);
@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+"""Checks a simulation timeline against the light characters of the beacon.
+
+Every completed light or dark phase of the beacon has to last exactly as long as its character says; the
+outdoor lamps are summarised per GPIO. Exits with 1 on the first mismatching phase, so it can gate a build.
+
+    LIGHTHOUSE_SIM_VIRTUAL_TIME=1 LIGHTHOUSE_SIM_DURATION_MS=86400000 LIGHTHOUSE_SIM_OUTPUT=timeline.txt \\
+        build-linux/Lighthouse.elf
+    python timeline_check.py timeline.txt
+"""
+
+import argparse
+import re
+import sys
+
+# beacon.c: alternating light / dark durations in ms, starting with light
+CHARACTERS = {
+    0: (2000, 2000),
+    1: (300, 2700),
+    2: (4500, 1500),
+    3: (400, 800, 400, 7400),
+}
+
+LINE = re.compile(r'^(\d+)\.(\d{3}) (\S+) (.*)$')
+STATE = re.compile(r'state beacon=(\d) outdoor=(\d) character=(\d+)')
+LEDC = re.compile(r'gpio (\d+) duty (\d+)/(\d+)')
+
+
+class Beacon:
+    def __init__(self, tolerance_ms):
+        self.tolerance_ms = tolerance_ms
+        self.enabled = False
+        self.character = 0
+        self.lit = None
+        self.run_start = None
+        self.run_character = None
+        self.phase = None
+        self.phases = 0
+        self.errors = []
+
+    def state(self, enabled, character):
+        if not enabled:
+            # stopping cuts the current phase short
+            self.phase = None
+        self.enabled = enabled
+        self.character = character
+
+    def frame(self, time_ms, lit):
+        if lit == self.lit:
+            return
+        if self.phase is not None:
+            expected = CHARACTERS[self.run_character][self.phase]
+            duration = time_ms - self.run_start
+            self.phases += 1
+            if abs(duration - expected) > self.tolerance_ms:
+                self.errors.append('%.3f: %s phase %d of character %d lasted %.3f ms instead of %d ms' %
+                                   (time_ms, 'light' if self.lit else 'dark', self.phase, self.run_character,
+                                    duration, expected))
+            # like the timer callback: a new character takes over with the next phase
+            self.phase = (self.phase + 1) % len(CHARACTERS[self.character])
+        elif lit and self.enabled:
+            self.phase = 0
+        self.lit = lit
+        self.run_start = time_ms
+        self.run_character = self.character
+
+
+class Lamp:
+    def __init__(self, time_ms):
+        self.changes = 0
+        self.duty = 0.0
+        self.since = time_ms
+        self.weighted = 0.0
+
+    def set(self, time_ms, duty):
+        self.weighted += self.duty * (time_ms - self.since)
+        self.duty = duty
+        self.since = time_ms
+        self.changes += 1
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('timeline', type=argparse.FileType('r'))
+    parser.add_argument('--tolerance-ms', type=float, default=1.0,
+                        help='allowed deviation of a phase; raise it for timelines recorded in real time')
+    args = parser.parse_args()
+
+    beacon = Beacon(args.tolerance_ms)
+    lamps = {}
+    end_ms = 0.0
+
+    for line in args.timeline:
+        match = LINE.match(line.rstrip('\n'))
+        if match is None:
+            continue
+        time_ms = int(match.group(1)) + int(match.group(2)) / 1000
+        source, text = match.group(3), match.group(4)
+        end_ms = time_ms
+
+        if source == 'ble' and STATE.match(text):
+            enabled, _, character = STATE.match(text).groups()
+            beacon.state(enabled == '1', int(character))
+        elif source == 'strip':
+            values = [int(v) for pixel in text.split()[2:] for v in pixel.split(',')]
+            beacon.frame(time_ms, any(values))
+        elif source == 'ledc' and LEDC.match(text):
+            gpio, duty, max_duty = (int(v) for v in LEDC.match(text).groups())
+            lamps.setdefault(gpio, Lamp(time_ms)).set(time_ms, duty / max_duty)
+
+    hours = end_ms / 3600000
+    print('%.2f h simulated, %d beacon phases checked' % (hours, beacon.phases))
+    for gpio, lamp in sorted(lamps.items()):
+        weighted = lamp.weighted + lamp.duty * (end_ms - lamp.since)
+        print('lamp gpio %d: %d duty changes (%.1f per hour), mean duty %.1f %%' %
+              (gpio, lamp.changes, lamp.changes / hours if hours > 0 else 0,
+               100 * weighted / end_ms if end_ms > 0 else 0))
+
+    for error in beacon.errors[:20]:
+        print(error, file=sys.stderr)
+    if beacon.errors:
+        print('%d of %d beacon phases off' % (len(beacon.errors), beacon.phases), file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -1,3 +1,68 @@
 #pragma once
 
-void init_touch(void);
+#include "esp_err.h"
+
+#include <stdint.h>
+
+/**
+ * @brief Gestures recognised on the touch input.
+ */
+typedef enum
+{
+    TOUCH_GESTURE_TAP = 0,     ///< Short press, fires on the release
+    TOUCH_GESTURE_DOUBLE_TAP,  ///< Second press within the double-tap window after a tap, fires on that press
+    TOUCH_GESTURE_LONG_PRESS,  ///< Held for the long-press time, fires while still held
+    TOUCH_GESTURE_HOLD_REPEAT, ///< Repeats while held after a long press
+    TOUCH_GESTURE_COUNT,
+} touch_gesture_t;
+
+/**
+ * @brief Action bound to a gesture.
+ *
+ * Actions run on the esp_timer task and should return quickly.
+ */
+typedef void (*touch_action_t)(touch_gesture_t gesture, void *ctx);
+
+typedef struct
+{
+    uint32_t gestures;        ///< gestures dispatched to a bound action
+    uint32_t rejected_edges;  ///< edges dropped by the debounce
+    uint32_t last_latency_us; ///< from the triggering edge (or long-press time) to the action
+    uint32_t max_latency_us;
+    uint32_t max_action_us;   ///< longest time an action took to return
+} touch_stats_t;
+
+/**
+ * @brief Initializes the touch input and starts recognising gestures.
+ *
+ * @return
+ *     - ESP_OK: Touch input ready.
+ *     - Error codes of the GPIO or esp_timer driver.
+ */
+esp_err_t touch_init(void);
+
+/**
+ * @brief Binds an action to a gesture, replacing any previous binding.
+ *
+ * @param action  Action to run, or NULL to unbind the gesture.
+ *
+ * @return
+ *     - ESP_OK: Action bound.
+ *     - ESP_ERR_INVALID_ARG: Unknown gesture.
+ */
+esp_err_t touch_bind(touch_gesture_t gesture, touch_action_t action, void *ctx);
+
+/**
+ * @brief Returns the time (vclock_now_us()) of the edge that triggered the gesture being dispatched.
+ *
+ * For a long press and hold-repeat, which no edge triggers, it is the time the gesture became due.
+ *
+ * Only meaningful inside an action; it starts the LATENCY_PATH_TOUCH of what the action posts, so the time the
+ * gesture engine took to recognise the gesture counts towards the latency.
+ */
+int64_t touch_triggered_at(void);
+
+/**
+ * @brief Returns the gesture engine counters.
+ */
+touch_stats_t touch_get_stats(void);
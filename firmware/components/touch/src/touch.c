@@ -1,90 +1,357 @@
+#include "touch.h"
+
 #include "driver/gpio.h"
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
-#include "freertos/queue.h"
-#include "freertos/task.h"
-#include "freertos/timers.h"
+#include "power.h"
+#include "sdkconfig.h"
+#include "trace.h"
+#include "vclock.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+static const char *TAG = "touch";
+
+#define TOUCH_GPIO_PIN CONFIG_TOUCH_PIN
+#define TOUCH_ACTIVE_LEVEL 0 // the input is pulled up, a touch pulls it low
+
+#define TOUCH_DEBOUNCE_US (30 * 1000)     // edges within this time after an accepted edge are bounces
+#define TOUCH_DOUBLE_TAP_US (300 * 1000)  // a second press within this time after a release is a double-tap
+#define TOUCH_LONG_PRESS_US (800 * 1000)  // held this long is a long press
+#define TOUCH_HOLD_REPEAT_US (400 * 1000) // interval of the hold-repeat while still held
+#define TOUCH_LATENCY_BUDGET_US (20 * 1000)
+
+#define TOUCH_EDGE_QUEUE_SIZE 8
+
+typedef struct
+{
+    int64_t time;
+    bool pressed;
+} touch_edge_t;
+
+typedef enum
+{
+    TOUCH_STATE_IDLE = 0,
+    TOUCH_STATE_PRESSED,         // waiting for release or the long press
+    TOUCH_STATE_HELD,            // long press fired, repeating until release
+    TOUCH_STATE_WAIT_SECOND_TAP, // released, waiting whether a second press follows
+    TOUCH_STATE_SECOND_PRESSED,  // double-tap fired, waiting for release
+} touch_state_t;
+
+typedef struct
+{
+    touch_action_t action;
+    void *ctx;
+} touch_binding_t;
+
+/*
+ * Edges are debounced by timestamp in the ISR: the first edge is accepted immediately and further edges are
+ * ignored for TOUCH_DEBOUNCE_US. The ISR only queues the accepted edge and kicks the timer, whose callback
+ * runs the gesture state machine on the esp_timer task - there is no task of our own in between. All times
+ * come from the vclock, so the host simulation can run gestures on virtual time.
+ */
+static portMUX_TYPE edge_lock = portMUX_INITIALIZER_UNLOCKED;
+static touch_edge_t edge_queue[TOUCH_EDGE_QUEUE_SIZE];
+static uint32_t edge_head;
+static uint32_t edge_tail;
+static touch_edge_t last_edge;
+
+static vclock_timer_handle_t gesture_timer;
+static touch_binding_t bindings[TOUCH_GESTURE_COUNT];
+static touch_stats_t stats;
+
+// only used by the timer callback
+static touch_state_t state = TOUCH_STATE_IDLE;
+static int64_t deadline;
+static int64_t dispatched_triggered_at;
+static power_lock_t gesture_lock;
+static bool gesture_lock_held = false;
+
+// Takes the lock itself, so it can be called from the ISR and from the timer callback
+static bool accept_edge(int64_t now, bool pressed)
+{
+    bool accepted = false;
+
+    portENTER_CRITICAL_SAFE(&edge_lock);
+    if (pressed != last_edge.pressed && now - last_edge.time >= TOUCH_DEBOUNCE_US &&
+        edge_head - edge_tail < TOUCH_EDGE_QUEUE_SIZE)
+    {
+        last_edge = (touch_edge_t){.time = now, .pressed = pressed};
+        edge_queue[edge_head++ % TOUCH_EDGE_QUEUE_SIZE] = last_edge;
+        accepted = true;
+    }
+    else
+    {
+        stats.rejected_edges++;
+    }
+    portEXIT_CRITICAL_SAFE(&edge_lock);
+
+    return accepted;
+}
+
+static bool pop_edge(touch_edge_t *edge)
+{
+    bool available;
 
-static const char *TAG = "TOUCH";
+    portENTER_CRITICAL(&edge_lock);
+    available = edge_tail != edge_head;
+    if (available)
+    {
+        *edge = edge_queue[edge_tail++ % TOUCH_EDGE_QUEUE_SIZE];
+    }
+    portEXIT_CRITICAL(&edge_lock);
 
-#define TOUCH_GPIO_PIN GPIO_NUM_2
-#define DEBOUNCE_TIME_MS 250 // Debounce time in milliseconds
-#define ESP_INTR_FLAG_DEFAULT 0
+    return available;
+}
 
-static QueueHandle_t gpio_evt_queue = NULL;
-static TimerHandle_t debounce_timer = NULL;
-static int last_stable_state = 1; // Last stable state (1 = not pressed)
-static int pending_state = 1;     // Pending state after debouncing
+static void touch_isr_handler(void *arg)
+{
+    int64_t now = vclock_now_us();
+    bool pressed = gpio_get_level(TOUCH_GPIO_PIN) == TOUCH_ACTIVE_LEVEL;
 
-// Timer callback for debouncing
-static void debounce_timer_callback(TimerHandle_t xTimer)
+    if (accept_edge(now, pressed))
+    {
+        TRACE("touch edge %u", pressed);
+
+        // run the state machine right away, also if it was waiting for a timeout
+        vclock_timer_stop(gesture_timer);
+        vclock_timer_start_once(gesture_timer, 0);
+    }
+}
+
+// `triggered_at` is the edge that completed the gesture, or the expired deadline for the held gestures
+static void dispatch(touch_gesture_t gesture, int64_t triggered_at)
 {
-    int current_level = gpio_get_level(TOUCH_GPIO_PIN);
+    touch_binding_t binding = bindings[gesture];
+    if (binding.action == NULL)
+    {
+        return;
+    }
+
+    int64_t start = vclock_now_us();
+    uint32_t latency = start - triggered_at;
+    dispatched_triggered_at = triggered_at;
+    binding.action(gesture, binding.ctx);
+    uint32_t duration = vclock_now_us() - start;
+
+    portENTER_CRITICAL(&edge_lock);
+    stats.gestures++;
+    stats.last_latency_us = latency;
+    stats.max_latency_us = latency > stats.max_latency_us ? latency : stats.max_latency_us;
+    stats.max_action_us = duration > stats.max_action_us ? duration : stats.max_action_us;
+    portEXIT_CRITICAL(&edge_lock);
 
-    // Check if state has remained stable
-    if (current_level == pending_state && current_level != last_stable_state)
+    TRACE("touch gesture %u latency %u us action %u us", gesture, latency, duration);
+    if (latency > TOUCH_LATENCY_BUDGET_US)
     {
-        last_stable_state = current_level;
+        ESP_LOGW(TAG, "Gesture %d dispatched after %" PRIu32 " us", gesture, latency);
+    }
+}
+
+// Fires the timeouts that expired up to `now`
+static void handle_timeouts(int64_t now)
+{
+    while (deadline != 0 && deadline <= now)
+    {
+        int64_t expired = deadline;
+
+        switch (state)
+        {
+        case TOUCH_STATE_PRESSED:
+            state = TOUCH_STATE_HELD;
+            deadline = expired + TOUCH_HOLD_REPEAT_US;
+            dispatch(TOUCH_GESTURE_LONG_PRESS, expired);
+            break;
+
+        case TOUCH_STATE_HELD:
+            deadline = expired + TOUCH_HOLD_REPEAT_US;
+            dispatch(TOUCH_GESTURE_HOLD_REPEAT, expired);
+            break;
+
+        case TOUCH_STATE_WAIT_SECOND_TAP:
+            // the tap was dispatched on its release already
+            state = TOUCH_STATE_IDLE;
+            deadline = 0;
+            break;
+
+        default:
+            deadline = 0;
+            break;
+        }
+    }
+}
 
-        if (current_level == 0)
+static void handle_edge(const touch_edge_t *edge)
+{
+    if (edge->pressed)
+    {
+        if (state == TOUCH_STATE_WAIT_SECOND_TAP)
         {
-            ESP_LOGI(TAG, "Touch detected (debounced)!");
+            state = TOUCH_STATE_SECOND_PRESSED;
+            deadline = 0;
+            dispatch(TOUCH_GESTURE_DOUBLE_TAP, edge->time);
         }
         else
         {
-            ESP_LOGI(TAG, "Touch released (debounced)!");
+            state = TOUCH_STATE_PRESSED;
+            deadline = edge->time + TOUCH_LONG_PRESS_US;
         }
+        return;
     }
-}
 
-// Interrupt Service Routine
-static void IRAM_ATTR gpio_isr_handler(void *arg)
-{
-    uint32_t gpio_num = (uint32_t)arg;
-    xQueueSendFromISR(gpio_evt_queue, &gpio_num, NULL);
+    // a tap is not held back for the double-tap window; a double-tap follows the tap it started with
+    touch_state_t released = state;
+    if (released == TOUCH_STATE_PRESSED && bindings[TOUCH_GESTURE_DOUBLE_TAP].action != NULL)
+    {
+        state = TOUCH_STATE_WAIT_SECOND_TAP;
+        deadline = edge->time + TOUCH_DOUBLE_TAP_US;
+    }
+    else
+    {
+        state = TOUCH_STATE_IDLE;
+        deadline = 0;
+    }
+    if (released == TOUCH_STATE_PRESSED)
+    {
+        dispatch(TOUCH_GESTURE_TAP, edge->time);
+    }
 }
 
-// Task for processing GPIO events
-static void gpio_task(void *arg)
+static void gesture_timer_callback(void *arg)
 {
-    uint32_t io_num;
+    touch_edge_t edge;
+    while (pop_edge(&edge))
+    {
+        // timeouts that expired before the edge happened come first
+        handle_timeouts(edge.time);
+        handle_edge(&edge);
+    }
+
+    int64_t now = vclock_now_us();
+    handle_timeouts(now);
 
-    for (;;)
+    // edges are not seen in light sleep, so the chip stays awake until the gesture is over
+    bool in_gesture = state != TOUCH_STATE_IDLE;
+    if (in_gesture && !gesture_lock_held)
     {
-        if (xQueueReceive(gpio_evt_queue, &io_num, portMAX_DELAY))
-        {
-            pending_state = gpio_get_level(TOUCH_GPIO_PIN);
+        power_lock_acquire(gesture_lock);
+    }
+    else if (!in_gesture && gesture_lock_held)
+    {
+        power_lock_release(gesture_lock);
+    }
+    gesture_lock_held = in_gesture;
 
-            // Restart timer for debouncing
-            xTimerReset(debounce_timer, 0);
-        }
+    // an edge dropped as a bounce may have been the real one; check the level again once the input settled
+    portENTER_CRITICAL(&edge_lock);
+    int64_t settle_at = last_edge.time + TOUCH_DEBOUNCE_US;
+    bool last_pressed = last_edge.pressed;
+    portEXIT_CRITICAL(&edge_lock);
+
+    int64_t next = deadline;
+    if (now < settle_at)
+    {
+        next = next == 0 || settle_at < next ? settle_at : next;
+    }
+    else if ((gpio_get_level(TOUCH_GPIO_PIN) == TOUCH_ACTIVE_LEVEL) != last_pressed &&
+             accept_edge(now, !last_pressed))
+    {
+        vclock_timer_start_once(gesture_timer, 0);
+        return;
+    }
+
+    if (next != 0)
+    {
+        // fails harmlessly if the ISR restarted the timer in the meantime
+        vclock_timer_start_once(gesture_timer, next > now ? next - now : 0);
+    }
+}
+
+esp_err_t touch_bind(touch_gesture_t gesture, touch_action_t action, void *ctx)
+{
+    if (gesture >= TOUCH_GESTURE_COUNT)
+    {
+        return ESP_ERR_INVALID_ARG;
     }
+
+    bindings[gesture] = (touch_binding_t){.action = action, .ctx = ctx};
+    return ESP_OK;
 }
 
-void init_touch(void)
+int64_t touch_triggered_at(void)
 {
+    return dispatched_triggered_at;
+}
+
+touch_stats_t touch_get_stats(void)
+{
+    portENTER_CRITICAL(&edge_lock);
+    touch_stats_t copy = stats;
+    portEXIT_CRITICAL(&edge_lock);
+    return copy;
+}
+
+esp_err_t touch_init(void)
+{
+    esp_err_t ret;
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = gesture_timer_callback,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "touch_gesture",
+    };
+    ret = vclock_timer_create(&timer_args, &gesture_timer);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to create gesture timer: %s", esp_err_to_name(ret));
+        goto exit;
+    }
+
+    ret = power_lock_create(POWER_NEED_AWAKE, "touch", &gesture_lock);
+    if (ret != ESP_OK)
+    {
+        goto cleanupTimer;
+    }
+
     gpio_config_t io_conf = {.intr_type = GPIO_INTR_ANYEDGE,
                              .mode = GPIO_MODE_INPUT,
                              .pin_bit_mask = (1ULL << TOUCH_GPIO_PIN),
                              .pull_down_en = GPIO_PULLDOWN_DISABLE,
                              .pull_up_en = GPIO_PULLUP_ENABLE};
+    ret = gpio_config(&io_conf);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to configure touch GPIO: %s", esp_err_to_name(ret));
+        goto cleanupTimer;
+    }
 
-    gpio_config(&io_conf);
-
-    // Create debounce timer
-    debounce_timer = xTimerCreate("debounce_timer", pdMS_TO_TICKS(DEBOUNCE_TIME_MS),
-                                  pdFALSE, // One-shot timer
-                                  NULL, debounce_timer_callback);
+    last_edge = (touch_edge_t){
+        .time = -TOUCH_DEBOUNCE_US,
+        .pressed = gpio_get_level(TOUCH_GPIO_PIN) == TOUCH_ACTIVE_LEVEL,
+    };
 
-    // Create event queue
-    gpio_evt_queue = xQueueCreate(10, sizeof(uint32_t));
+    // the service may already be installed by another component
+    ret = gpio_install_isr_service(0);
+    if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE)
+    {
+        ESP_LOGE(TAG, "Failed to install GPIO ISR service: %s", esp_err_to_name(ret));
+        goto cleanupTimer;
+    }
 
-    // Start task
-    xTaskCreate(gpio_task, "gpio_task", 2048, NULL, 10, NULL);
+    ret = gpio_isr_handler_add(TOUCH_GPIO_PIN, touch_isr_handler, NULL);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to add touch ISR handler: %s", esp_err_to_name(ret));
+        goto cleanupTimer;
+    }
 
-    // Install interrupt service
-    gpio_install_isr_service(ESP_INTR_FLAG_DEFAULT);
-    gpio_isr_handler_add(TOUCH_GPIO_PIN, gpio_isr_handler, (void *)TOUCH_GPIO_PIN);
+    ESP_LOGI(TAG, "Touch GPIO on pin %d initialized", TOUCH_GPIO_PIN);
+    goto exit;
 
-    ESP_LOGI(TAG, "Touch GPIO on pin %d initialized with debounce", TOUCH_GPIO_PIN);
-}
\ No newline at end of file
+cleanupTimer:
+    vclock_timer_delete(gesture_timer);
+    gesture_timer = NULL;
+exit:
+    return ret;
+}
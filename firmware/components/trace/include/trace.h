@@ -0,0 +1,61 @@
+#pragma once
+
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRACE_MAX_ARGS 4
+
+/// One fixed-size trace record, exactly as it is kept in the ring and dumped to the console
+typedef struct
+{
+    uint32_t seq;       ///< write index + 1, 0 while the slot is being written
+    uint32_t timestamp; ///< esp_timer time in us (low 32 bits, wraps after ~71 minutes)
+    uint32_t fmt;       ///< address of the format string in the application image
+    uint8_t core;
+    uint8_t nargs;
+    uint16_t reserved;
+    uint32_t args[TRACE_MAX_ARGS];
+} trace_record_t;
+
+/**
+ * @brief Records an event without formatting it.
+ *
+ * Only the address of the format string is stored; tools/trace_decode.py resolves it from the ELF of the
+ * running image and formats the record on the host. The format must therefore be a string literal and the
+ * arguments integers (up to TRACE_MAX_ARGS); pointers, including strings, are not supported.
+ *
+ * Lock-free and safe to call from ISRs and IRAM code, also while the flash cache is disabled.
+ */
+#if CONFIG_TRACE_ENABLE
+#define TRACE(fmt, ...)                                                                                                \
+    trace_record("" fmt "", TRACE_ARG_COUNT(__VA_ARGS__), (const uint32_t[TRACE_MAX_ARGS]){__VA_ARGS__})
+#else
+#define TRACE(fmt, ...)                                                                                                \
+    do                                                                                                                 \
+    {                                                                                                                  \
+    } while (0)
+#endif
+
+#define TRACE_ARG_COUNT_(_0, _1, _2, _3, _4, n, ...) n
+#define TRACE_ARG_COUNT(...) TRACE_ARG_COUNT_(0 __VA_OPT__(, ) __VA_ARGS__, 4, 3, 2, 1, 0)
+
+void trace_record(const char *fmt, uint32_t nargs, const uint32_t *args);
+
+/**
+ * @brief Copies the records still present in the ring, oldest first.
+ *
+ * Records overwritten or being written while copying are skipped.
+ *
+ * @param out   Destination array.
+ * @param max   Capacity of `out`.
+ * @return Number of records written to `out`.
+ */
+size_t trace_snapshot(trace_record_t *out, size_t max);
+
+/**
+ * @brief Registers the "trace" console command, which dumps the ring for tools/trace_decode.py.
+ */
+esp_err_t trace_register_console_command(void);
@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+"""Decodes the output of the "trace" console command.
+
+The firmware only stores the address of each format string; this script looks the strings up in the ELF
+of the image that produced the dump and formats the records on the host.
+
+    idf.py monitor | tee trace.log      # then type "trace"
+    python trace_decode.py build/Lighthouse.elf trace.log
+"""
+
+import argparse
+import hashlib
+import re
+import struct
+import sys
+
+from elftools.elf.elffile import ELFFile
+
+RECORD = struct.Struct('<IIIBBH4I')
+FORMAT_SPEC = re.compile(r'%([-+ #0]*\d*(?:\.\d+)?)(hh|h|ll|l|z|j|t)?([diuxXcsp%])')
+
+
+class Image:
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            data = f.read()
+        self.sha256 = hashlib.sha256(data).hexdigest()
+        elf = ELFFile(open(path, 'rb'))
+        self.segments = [(s['p_vaddr'], s.data()) for s in elf.iter_segments() if s['p_type'] == 'PT_LOAD']
+
+    def string_at(self, address):
+        for base, data in self.segments:
+            if base <= address < base + len(data):
+                end = data.find(b'\0', address - base)
+                return data[address - base:end].decode('utf-8', 'replace')
+        return None
+
+
+def format_record(fmt, args):
+    """Formats a record like printf; raises ValueError for a conversion TRACE cannot carry."""
+    args = iter(args)
+
+    def replace(match):
+        flags, _, conversion = match.groups()
+        if conversion == '%':
+            return '%'
+        value = next(args, 0)
+        if conversion in 'di':
+            value = struct.unpack('<i', struct.pack('<I', value))[0]
+            conversion = 'd'
+        elif conversion == 'u':
+            conversion = 'd'
+        elif conversion == 'p':
+            return '0x%08x' % value
+        elif conversion == 's':
+            # the firmware only stores integers, a pointer would be an address of the running image at best
+            raise ValueError('%s is not supported, TRACE arguments are integers')
+        return ('%' + flags + conversion) % value
+
+    return FORMAT_SPEC.sub(replace, fmt)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('elf', help='ELF of the image that produced the dump')
+    parser.add_argument('log', nargs='?', type=argparse.FileType('r'), default=sys.stdin,
+                        help='console output containing a trace dump (default: stdin)')
+    args = parser.parse_args()
+
+    image = Image(args.elf)
+    previous = None
+
+    for line in args.log:
+        line = line.strip()
+        match = re.search(r'TRACE BEGIN ([0-9a-f]+) (\d+)', line)
+        if match:
+            if not image.sha256.startswith(match.group(1)):
+                sys.exit('ELF does not match the running image (%s)' % match.group(1))
+            previous = None
+            continue
+
+        match = re.search(r'TRACE ([0-9a-f]{%d})$' % (RECORD.size * 2), line)
+        if not match:
+            continue
+
+        seq, timestamp, fmt_address, core, nargs, _, *values = RECORD.unpack(bytes.fromhex(match.group(1)))
+        fmt = image.string_at(fmt_address)
+        if fmt is None:
+            text = '<unknown format 0x%08x>' % fmt_address
+        else:
+            try:
+                text = format_record(fmt, values[:nargs])
+            except ValueError as error:
+                text = '<%s in %r>' % (error, fmt)
+                print('trace_decode: %s in %r' % (error, fmt), file=sys.stderr)
+
+        delta = '' if previous is None else '+%d' % ((timestamp - previous) & 0xFFFFFFFF)
+        previous = timestamp
+        print('%10u %12.3f ms %10s us  core %u  %s' % (seq - 1, timestamp / 1000, delta, core, text))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,155 @@
+#include "trace.h"
+
+#include <stdio.h>
+
+#include "esp_attr.h"
+#include "esp_console.h"
+#include "sdkconfig.h"
+#include "vclock.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+#include <inttypes.h>
+#else
+#include "esp_app_desc.h"
+#include "esp_cpu.h"
+#endif
+
+#if CONFIG_TRACE_ENABLE
+#define TRACE_RING_SIZE CONFIG_TRACE_BUFFER_RECORDS
+#else
+#define TRACE_RING_SIZE 1 // nothing is recorded, the console command reports an empty ring
+#endif
+#define TRACE_RING_MASK (TRACE_RING_SIZE - 1)
+
+_Static_assert((TRACE_RING_SIZE & TRACE_RING_MASK) == 0, "CONFIG_TRACE_BUFFER_RECORDS must be a power of two");
+_Static_assert(sizeof(trace_record_t) == 32, "the host decoder expects 32 byte records");
+
+static trace_record_t ring[TRACE_RING_SIZE];
+static uint32_t write_index;
+
+#if CONFIG_IDF_TARGET_LINUX
+/*
+ * Host pointers do not fit into a record. The format strings are stored as offset to this one instead, they
+ * are all in the .rodata of the same executable.
+ */
+static const char fmt_base[] = "trace";
+
+static uint32_t encode_fmt(const char *fmt)
+{
+    return (uint32_t)((intptr_t)fmt - (intptr_t)fmt_base);
+}
+
+static const char *decode_fmt(uint32_t fmt)
+{
+    return (const char *)((intptr_t)fmt_base + (int32_t)fmt);
+}
+#else
+static uint32_t encode_fmt(const char *fmt)
+{
+    return (uint32_t)fmt;
+}
+#endif
+
+/*
+ * Writers claim a slot with an atomic increment, so tasks on both cores and ISRs never wait for each other.
+ * The slot's seq is cleared while the record is filled in and published last; a reader only accepts a copy
+ * if seq matches the expected index before and after copying.
+ */
+void IRAM_ATTR trace_record(const char *fmt, uint32_t nargs, const uint32_t *args)
+{
+    uint32_t index = __atomic_fetch_add(&write_index, 1, __ATOMIC_RELAXED);
+    trace_record_t *slot = &ring[index & TRACE_RING_MASK];
+
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->timestamp = (uint32_t)vclock_now_us();
+    slot->fmt = encode_fmt(fmt);
+#if CONFIG_IDF_TARGET_LINUX
+    slot->core = 0;
+#else
+    slot->core = esp_cpu_get_core_id();
+#endif
+    slot->nargs = nargs;
+    for (uint32_t i = 0; i < TRACE_MAX_ARGS; i++)
+    {
+        slot->args[i] = args[i];
+    }
+
+    __atomic_store_n(&slot->seq, index + 1, __ATOMIC_RELEASE);
+}
+
+size_t trace_snapshot(trace_record_t *out, size_t max)
+{
+    uint32_t head = __atomic_load_n(&write_index, __ATOMIC_ACQUIRE);
+    uint32_t available = head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE;
+    if (available > max)
+    {
+        available = max;
+    }
+
+    size_t count = 0;
+    for (uint32_t index = head - available; index != head; index++)
+    {
+        const trace_record_t *slot = &ring[index & TRACE_RING_MASK];
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != index + 1)
+        {
+            continue;
+        }
+
+        out[count] = *slot;
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == index + 1)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+// printf instead of ESP_LOG, so the dump also works in release builds with logging compiled out
+static int trace_command(int argc, char **argv)
+{
+    static trace_record_t records[TRACE_RING_SIZE];
+    size_t count = trace_snapshot(records, TRACE_RING_SIZE);
+
+#if CONFIG_IDF_TARGET_LINUX
+    // the offsets are meaningless outside of this process, so the host build formats the records itself
+    for (size_t i = 0; i < count; i++)
+    {
+        const trace_record_t *r = &records[i];
+        printf("%10" PRIu32 " %12.3f ms  ", r->seq - 1, r->timestamp / 1000.0);
+        printf(decode_fmt(r->fmt), r->args[0], r->args[1], r->args[2], r->args[3]);
+        printf("\n");
+    }
+#else
+    // the decoder uses the ELF hash to refuse decoding against the wrong image
+    char elf_sha[17];
+    esp_app_get_elf_sha256(elf_sha, sizeof(elf_sha));
+    printf("TRACE BEGIN %s %u\n", elf_sha, (unsigned)count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const uint8_t *bytes = (const uint8_t *)&records[i];
+        printf("TRACE ");
+        for (size_t j = 0; j < sizeof(trace_record_t); j++)
+        {
+            printf("%02x", bytes[j]);
+        }
+        printf("\n");
+    }
+    printf("TRACE END\n");
+#endif
+    return 0;
+}
+
+esp_err_t trace_register_console_command(void)
+{
+    const esp_console_cmd_t command = {
+        .command = "trace",
+        .help = "Dump the trace ring, decode with components/trace/tools/trace_decode.py",
+        .func = trace_command,
+    };
+    return esp_console_cmd_register(&command);
+}
@@ -0,0 +1,286 @@
+#include "decode.h"
+
+#include <string.h>
+
+/*
+ * DCC (NMRA S-9.1, RCN-210): every bit is two levels of the same length, 58 us for a 1 and at least 100 us for
+ * a 0. A packet is a preamble of at least ten 1 bits, then bytes each led by a 0 and the packet closed by a 1;
+ * the last byte is the XOR of all others. Accessory packets (S-9.2.1, RCN-213) are three bytes.
+ */
+#define DCC_ONE_MIN_US 48
+#define DCC_ONE_MAX_US 68
+#define DCC_ZERO_MIN_US 86
+#define DCC_ZERO_MAX_US 12000
+#define DCC_PREAMBLE_MIN 10
+
+#define DCC_HALF_ONE 1
+#define DCC_HALF_ZERO 2
+
+enum
+{
+    DCC_STATE_PREAMBLE = 0,
+    DCC_STATE_BYTE,
+    DCC_STATE_SEPARATOR,
+};
+
+/*
+ * Märklin-Motorola: a word is 18 bits, each a short and a long level, sent twice with a gap in between. For
+ * accessories the bit takes 104 us: a 1 is 91 us first and 13 us second, a 0 the other way around. Bits pair up
+ * to trits: four address trits, one unused, then three output bits and the on bit, each sent twice.
+ */
+#define MM_BITS 18
+#define MM_GAP_MIN_US 200
+#define MM_PERIOD_MIN_US 80
+#define MM_PERIOD_MAX_US 130
+#define MM_SHORT_MAX_US 35
+#define MM_LONG_MIN_US 60
+#define MM_LAST_ONE_MIN_US 52 ///< the second part of the last bit runs into the gap, its first part tells it
+#define MM_MODULES 80
+
+static void dcc_restart(decode_dcc_t *dcc)
+{
+    dcc->state = DCC_STATE_PREAMBLE;
+    dcc->ones = 0;
+}
+
+static bool dcc_packet(decode_t *decoder, track_command_t *command)
+{
+    decode_dcc_t *dcc = &decoder->dcc;
+    uint8_t check = 0;
+    for (uint8_t i = 0; i < dcc->length; i++)
+    {
+        check ^= dcc->bytes[i];
+    }
+    if (dcc->length < 3 || check != 0)
+    {
+        decoder->errors[TRACK_PROTOCOL_DCC]++;
+        return false;
+    }
+    decoder->packets[TRACK_PROTOCOL_DCC]++;
+
+    // basic accessory: 10AAAAAA 1aaaCDDR, with the upper address bits aaa inverted
+    uint8_t b0 = dcc->bytes[0];
+    uint8_t b1 = dcc->bytes[1];
+    if (dcc->length != 3 || (b0 & 0xc0) != 0x80 || (b1 & 0x80) == 0)
+    {
+        return false;
+    }
+    uint16_t decoder_address = (b0 & 0x3f) | ((~b1 & 0x70) << 2);
+    // 0 is not a decoder and 511 the broadcast address, neither is a turnout of its own
+    if (decoder_address == 0 || decoder_address == 0x1ff)
+    {
+        return false;
+    }
+
+    *command = (track_command_t){
+        .protocol = TRACK_PROTOCOL_DCC,
+        .address = (decoder_address - 1) * 4 + ((b1 >> 1) & 0x03) + 1,
+        .direction = b1 & 0x01,
+        .activate = (b1 >> 3) & 0x01,
+    };
+    return true;
+}
+
+static bool dcc_bit(decode_t *decoder, bool bit, track_command_t *command)
+{
+    decode_dcc_t *dcc = &decoder->dcc;
+
+    switch (dcc->state)
+    {
+    case DCC_STATE_PREAMBLE:
+        if (bit)
+        {
+            dcc->ones += dcc->ones < UINT8_MAX;
+        }
+        else if (dcc->ones >= DCC_PREAMBLE_MIN)
+        {
+            dcc->state = DCC_STATE_BYTE;
+            dcc->bits = 0;
+            dcc->length = 0;
+        }
+        else
+        {
+            dcc->ones = 0;
+        }
+        return false;
+    case DCC_STATE_BYTE:
+        dcc->bytes[dcc->length] = (dcc->bytes[dcc->length] << 1) | bit;
+        if (++dcc->bits == 8)
+        {
+            dcc->length++;
+            dcc->state = DCC_STATE_SEPARATOR;
+        }
+        return false;
+    case DCC_STATE_SEPARATOR:
+    default:
+        if (!bit)
+        {
+            if (dcc->length == DECODE_DCC_MAX_BYTES)
+            {
+                decoder->errors[TRACK_PROTOCOL_DCC]++;
+                dcc_restart(dcc);
+                return false;
+            }
+            dcc->state = DCC_STATE_BYTE;
+            dcc->bits = 0;
+            return false;
+        }
+        // the end bit may already belong to the preamble of the next packet
+        dcc_restart(dcc);
+        dcc->ones = 1;
+        return dcc_packet(decoder, command);
+    }
+}
+
+static bool dcc_feed(decode_t *decoder, uint32_t duration_us, track_command_t *command)
+{
+    decode_dcc_t *dcc = &decoder->dcc;
+    uint8_t half;
+    if (duration_us >= DCC_ONE_MIN_US && duration_us <= DCC_ONE_MAX_US)
+    {
+        half = DCC_HALF_ONE;
+    }
+    else if (duration_us >= DCC_ZERO_MIN_US && duration_us <= DCC_ZERO_MAX_US)
+    {
+        half = DCC_HALF_ZERO;
+    }
+    else
+    {
+        dcc->half = 0;
+        dcc_restart(dcc);
+        return false;
+    }
+
+    if (dcc->half == 0)
+    {
+        dcc->half = half;
+        return false;
+    }
+    if (dcc->half != half)
+    {
+        // out of step by one level: pair this one with the next. Within a packet the bit is lost.
+        dcc->half = half;
+        if (dcc->state != DCC_STATE_PREAMBLE)
+        {
+            dcc_restart(dcc);
+        }
+        return false;
+    }
+    dcc->half = 0;
+    return dcc_bit(decoder, half == DCC_HALF_ONE, command);
+}
+
+// Trit of two bits: 00 is 0, 11 is 1, 10 is open (2); 01 does not exist
+static int mm_trit(uint32_t word, int index)
+{
+    uint32_t pair = (word >> (2 * index)) & 0x03;
+    return pair == 0x00 ? 0 : pair == 0x03 ? 1 : pair == 0x01 ? 2 : -1;
+}
+
+static bool mm_word(decode_t *decoder, uint32_t word, track_command_t *command)
+{
+    int module = 0;
+    int weight = 1;
+    for (int i = 0; i < 4; i++)
+    {
+        int trit = mm_trit(word, i);
+        if (trit < 0)
+        {
+            decoder->errors[TRACK_PROTOCOL_MM]++;
+            return false;
+        }
+        module += trit * weight;
+        weight *= 3;
+    }
+    decoder->packets[TRACK_PROTOCOL_MM]++;
+
+    // the unused trit is 0 on accessory words, and each data bit is sent twice
+    uint32_t data = word >> 10;
+    if (mm_trit(word, 4) != 0 || ((data ^ (data >> 1)) & 0x55) != 0 || module == MM_MODULES)
+    {
+        return false;
+    }
+    if (module == 0)
+    {
+        module = MM_MODULES;
+    }
+
+    uint8_t output = (data & 0x01) | ((data >> 1) & 0x02) | ((data >> 2) & 0x04);
+    *command = (track_command_t){
+        .protocol = TRACK_PROTOCOL_MM,
+        .address = (module - 1) * 4 + output / 2 + 1,
+        .direction = output & 0x01,
+        .activate = (data >> 6) & 0x01,
+    };
+    return true;
+}
+
+static bool mm_feed(decode_t *decoder, uint32_t duration_us, track_command_t *command)
+{
+    decode_mm_t *mm = &decoder->mm;
+
+    if (duration_us >= MM_GAP_MIN_US)
+    {
+        bool complete = mm->in_word && mm->bits == MM_BITS - 1 && mm->first_us != 0;
+        uint32_t word = mm->word | (uint32_t)(mm->first_us >= MM_LAST_ONE_MIN_US) << (MM_BITS - 1);
+        mm->in_word = true;
+        mm->bits = 0;
+        mm->first_us = 0;
+        mm->word = 0;
+        if (!complete)
+        {
+            mm->has_previous = false;
+            return false;
+        }
+
+        // a word only counts once it came twice in a row; the next pair has to come twice again
+        if (!mm->has_previous || mm->previous != word)
+        {
+            mm->previous = word;
+            mm->has_previous = true;
+            return false;
+        }
+        mm->has_previous = false;
+        return mm_word(decoder, word, command);
+    }
+
+    if (!mm->in_word)
+    {
+        return false;
+    }
+    if (mm->first_us == 0)
+    {
+        mm->first_us = duration_us;
+        return false;
+    }
+
+    uint32_t first_us = mm->first_us;
+    uint32_t period_us = first_us + duration_us;
+    uint32_t short_us = first_us < duration_us ? first_us : duration_us;
+    uint32_t long_us = first_us < duration_us ? duration_us : first_us;
+    mm->first_us = 0;
+    if (period_us < MM_PERIOD_MIN_US || period_us > MM_PERIOD_MAX_US || short_us > MM_SHORT_MAX_US ||
+        long_us < MM_LONG_MIN_US || mm->bits == MM_BITS - 1)
+    {
+        // not an accessory word, e.g. DCC or a locomotive word at half the rate
+        mm->in_word = false;
+        mm->has_previous = false;
+        return false;
+    }
+    mm->word |= (uint32_t)(first_us > duration_us) << mm->bits;
+    mm->bits++;
+    return false;
+}
+
+void decode_reset(decode_t *decoder)
+{
+    memset(decoder, 0, sizeof(*decoder));
+}
+
+bool decode_feed(decode_t *decoder, uint32_t duration_us, track_command_t *command)
+{
+    // both run on every level; a signal that is valid for one is rejected by the other within a bit or two
+    bool dcc = dcc_feed(decoder, duration_us, command);
+    bool mm = mm_feed(decoder, duration_us, command);
+    return dcc || mm;
+}
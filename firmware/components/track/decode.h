@@ -0,0 +1,68 @@
+#pragma once
+
+#include "track.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define DECODE_DCC_MAX_BYTES 6
+
+/**
+ * @brief A switching command for one turnout, the same for both protocols.
+ */
+typedef struct
+{
+    track_protocol_t protocol;
+    uint16_t address; ///< turnout address as the command station shows it, from 1
+    bool direction;   ///< true: straight / green, false: diverging / red
+    bool activate;    ///< true while the output is switched on; a command station sends on, then off
+} track_command_t;
+
+typedef struct
+{
+    uint8_t state;
+    uint8_t half;      ///< class of the unpaired first half of a bit, 0 if none
+    uint8_t ones;      ///< preamble bits seen
+    uint8_t bits;      ///< bits of the current byte
+    uint8_t length;    ///< complete bytes of the packet
+    uint8_t bytes[DECODE_DCC_MAX_BYTES];
+} decode_dcc_t;
+
+typedef struct
+{
+    bool in_word;      ///< a gap was seen and no invalid bit since
+    uint8_t bits;      ///< complete bits of the word
+    uint32_t first_us; ///< first part of the current bit, 0 if none
+    uint32_t word;
+    uint32_t previous; ///< last complete word, waiting for its repetition
+    bool has_previous;
+} decode_mm_t;
+
+/**
+ * @brief State of both decoders; the same signal goes to both and the one that recognises it wins.
+ */
+typedef struct
+{
+    decode_dcc_t dcc;
+    decode_mm_t mm;
+    uint32_t packets[TRACK_PROTOCOL_COUNT]; ///< packets with a valid checksum or repetition, of any kind
+    uint32_t errors[TRACK_PROTOCOL_COUNT];  ///< packets that were complete but failed the check
+} decode_t;
+
+/// Fed after a receive ended on an idle track; ends a packet like a long level would
+#define DECODE_GAP_US UINT32_MAX
+
+/**
+ * @brief Clears the decoders and the counters.
+ */
+void decode_reset(decode_t *decoder);
+
+/**
+ * @brief Feeds the duration of one level of the track signal.
+ *
+ * The polarity does not matter, neither protocol tells its bits by level. No allocation, no floating point;
+ * a few comparisons per edge.
+ *
+ * @return true if the level completed a valid accessory command, which is then in `command`.
+ */
+bool decode_feed(decode_t *decoder, uint32_t duration_us, track_command_t *command);
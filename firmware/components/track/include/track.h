@@ -0,0 +1,49 @@
+#pragma once
+
+#include "esp_err.h"
+
+#include <stdint.h>
+
+/**
+ * @brief Digital protocols on the track signal.
+ */
+typedef enum
+{
+    TRACK_PROTOCOL_DCC = 0, ///< NMRA DCC / RCN-210, basic accessory packets
+    TRACK_PROTOCOL_MM,      ///< Märklin-Motorola, accessory words
+    TRACK_PROTOCOL_COUNT,
+} track_protocol_t;
+
+typedef struct
+{
+    uint32_t packets[TRACK_PROTOCOL_COUNT]; ///< packets that passed the checksum (DCC) or repetition (MM)
+    uint32_t errors[TRACK_PROTOCOL_COUNT];  ///< complete packets that failed it
+    uint32_t commands;                      ///< accessory commands for a light address posted to the lights
+    uint32_t overruns;                      ///< symbols dropped because the decoder task fell behind
+} track_stats_t;
+
+/**
+ * @brief Starts receiving the track signal on CONFIG_TRACK_PIN and switching the lights by its accessory commands.
+ *
+ * A turnout command to CONFIG_TRACK_BEACON_ADDRESS switches the beacon, one to CONFIG_TRACK_OUTDOOR_ADDRESS the
+ * outdoor lamps: straight (green) is on, diverging (red) is off. Needs the light controller.
+ *
+ * @return
+ *     - ESP_OK: Receiving.
+ *     - Error codes of the RMT driver.
+ */
+esp_err_t track_init(void);
+
+/**
+ * @brief Returns the decoder counters.
+ */
+track_stats_t track_get_stats(void);
+
+/**
+ * @brief Registers the "track" console command, which shows the decoder counters.
+ *
+ * @return
+ *     - ESP_OK: Command registered.
+ *     - Error codes of esp_console_cmd_register().
+ */
+esp_err_t track_register_console_command(void);
@@ -0,0 +1,221 @@
+#!/usr/bin/env python3
+"""Generates a track signal for the track decoder and checks what the lights did with it.
+
+"generate" writes the edges of a multi-protocol command station as the RMT receiver of the host build plays
+them back: a continuous DCC stream of idle and locomotive packets with Märklin-Motorola words in between, and
+accessory commands for the light addresses at known times, one of them with a broken checksum. The timing has
+the jitter of a real booster. "check" compares the light states in the simulation timeline with the commands.
+
+    python track_trace.py generate track.trace
+    LIGHTHOUSE_SIM_VIRTUAL_TIME=1 LIGHTHOUSE_SIM_DURATION_MS=14000 LIGHTHOUSE_SIM_OUTPUT=track.txt \\
+        LIGHTHOUSE_TRACK_TRACE=track.trace build-linux/Lighthouse.elf
+    python track_trace.py check track.txt
+"""
+
+import argparse
+import random
+import re
+import sys
+
+# CONFIG_TRACK_BEACON_ADDRESS and CONFIG_TRACK_OUTDOOR_ADDRESS
+BEACON = 101
+OUTDOOR = 102
+
+# ms, protocol, turnout, straight (on), valid checksum
+COMMANDS = [
+    (1000, 'dcc', BEACON, True, True),
+    (2000, 'dcc', 5, True, True),
+    (3000, 'mm', OUTDOOR, False, True),
+    (4000, 'dcc', BEACON, False, False),
+    (5000, 'dcc', BEACON, False, True),
+    (7000, 'mm', BEACON, True, True),
+    (9000, 'dcc', OUTDOOR, True, True),
+    (11000, 'mm', BEACON, False, True),
+]
+INITIAL = (False, True)  # light_restore() on an empty flash: beacon off, outdoor lamps on
+END_MS = 13000
+
+DCC_ONE_US = 58
+DCC_ZERO_US = 100
+DCC_PREAMBLE = 14
+DCC_JITTER_US = 3
+MM_LONG_US = 91
+MM_SHORT_US = 13
+MM_JITTER_US = 1
+MM_WORD_GAP_US = 625
+MM_PAUSE_US = 1500
+REPEATS = 4
+
+LINE = re.compile(r'^(\d+)\.(\d{3}) (\S+) (.*)$')
+STATE = re.compile(r'state beacon=(\d) outdoor=(\d)')
+
+
+class Signal:
+    """Levels of the track signal; levels of the same polarity in a row merge into one."""
+
+    def __init__(self, rng):
+        self.rng = rng
+        self.levels = []
+        self.level = 1
+
+    def add(self, duration_us, level=None, jitter_us=0):
+        if level is None:
+            level = self.level
+            self.level ^= 1
+        else:
+            self.level = level ^ 1
+        duration_us += self.rng.randint(-jitter_us, jitter_us)
+        if self.levels and self.levels[-1][1] == level:
+            self.levels[-1][0] += duration_us
+        else:
+            self.levels.append([duration_us, level])
+
+    def duration_us(self):
+        return sum(duration for duration, _ in self.levels)
+
+    def dcc_bit(self, bit):
+        for _ in range(2):
+            self.add(DCC_ONE_US if bit else DCC_ZERO_US, jitter_us=DCC_JITTER_US)
+
+    def dcc_packet(self, data, valid=True):
+        check = 0
+        for byte in data:
+            check ^= byte
+        if not valid:
+            check ^= 0x01
+        for _ in range(DCC_PREAMBLE):
+            self.dcc_bit(1)
+        for byte in data + [check]:
+            self.dcc_bit(0)
+            for i in range(7, -1, -1):
+                self.dcc_bit((byte >> i) & 1)
+        self.dcc_bit(1)
+
+    def mm_words(self, bits, bit_scale=1):
+        """Sends a word twice; bit_scale 2 is the half rate of locomotive words."""
+        self.add(MM_PAUSE_US, level=0)
+        for word in range(2):
+            for bit in bits:
+                first, second = (MM_LONG_US, MM_SHORT_US) if bit else (MM_SHORT_US, MM_LONG_US)
+                self.add(first * bit_scale, level=1, jitter_us=MM_JITTER_US)
+                self.add(second * bit_scale, level=0, jitter_us=MM_JITTER_US)
+            self.add(MM_WORD_GAP_US if word == 0 else MM_PAUSE_US, level=0)
+
+
+def dcc_accessory(turnout, straight, activate):
+    decoder = (turnout - 1) // 4 + 1
+    pair = (turnout - 1) % 4
+    b0 = 0x80 | (decoder & 0x3f)
+    b1 = 0x80 | ((~decoder >> 2) & 0x70) | (activate << 3) | (pair << 1) | int(straight)
+    return [b0, b1]
+
+
+def mm_trits(value, count):
+    bits = []
+    for _ in range(count):
+        bits += {0: [0, 0], 1: [1, 1], 2: [1, 0]}[value % 3]
+        value //= 3
+    return bits
+
+
+def mm_accessory(turnout, straight, activate):
+    module = (turnout - 1) // 4 + 1
+    output = (turnout - 1) % 4 * 2 + int(straight)
+    bits = mm_trits(module % 80, 4) + [0, 0]
+    for bit in (output & 1, (output >> 1) & 1, (output >> 2) & 1, activate):
+        bits += [bit, bit]
+    return bits
+
+
+def generate(args):
+    rng = random.Random(args.seed)
+    signal = Signal(rng)
+    pending = sorted(COMMANDS)
+    locomotive = 0
+
+    while signal.duration_us() < END_MS * 1000:
+        if pending and signal.duration_us() >= pending[0][0] * 1000:
+            _, protocol, turnout, straight, valid = pending.pop(0)
+            # like a command station: the command repeated, then the output switched off again
+            for activate in (1, 0):
+                for _ in range(REPEATS):
+                    if protocol == 'dcc':
+                        signal.dcc_packet(dcc_accessory(turnout, straight, activate), valid)
+                    else:
+                        signal.mm_words(mm_accessory(turnout, straight, activate))
+            continue
+
+        # background traffic: DCC idle and speed packets, MM locomotive words at half the rate
+        locomotive += 1
+        if locomotive % 3 == 0:
+            signal.dcc_packet([0x03, 0x3f, 0x80 | locomotive % 64])
+        elif locomotive % 7 == 0:
+            signal.mm_words(mm_trits(24, 4) + [1, 1] + mm_trits(locomotive % 81, 4), bit_scale=2)
+        else:
+            signal.dcc_packet([0xff, 0x00])
+
+    time_us = 0
+    with open(args.trace, 'w') as out:
+        out.write('# <time us> <level>, generated by track_trace.py, seed %d\n' % args.seed)
+        for duration_us, level in signal.levels:
+            out.write('%d %d\n' % (time_us, level))
+            time_us += duration_us
+        out.write('%d %d\n' % (time_us, signal.level))
+    print('%d edges, %.1f s' % (len(signal.levels) + 1, time_us / 1e6))
+    return 0
+
+
+def check(args):
+    expected = []
+    state = INITIAL
+    for time_ms, _, turnout, straight, valid in sorted(COMMANDS):
+        if not valid or turnout not in (BEACON, OUTDOOR):
+            continue
+        state = (straight, state[1]) if turnout == BEACON else (state[0], straight)
+        expected.append((time_ms, state))
+
+    observed = []
+    state = None
+    for line in args.timeline:
+        match = LINE.match(line.rstrip('\n'))
+        if match is None or match.group(3) != 'ble' or STATE.match(match.group(4)) is None:
+            continue
+        time_ms = int(match.group(1)) + int(match.group(2)) / 1000
+        beacon, outdoor = STATE.match(match.group(4)).groups()
+        new_state = (beacon == '1', outdoor == '1')
+        if new_state != state and state is not None:
+            observed.append((time_ms, new_state))
+        state = new_state
+
+    errors = []
+    for i in range(max(len(expected), len(observed))):
+        if i >= len(observed):
+            errors.append('missing: %s at %d ms' % (expected[i][1], expected[i][0]))
+        elif i >= len(expected):
+            errors.append('unexpected: %s at %.3f ms' % (observed[i][1], observed[i][0]))
+        elif observed[i][1] != expected[i][1] or not 0 <= observed[i][0] - expected[i][0] <= args.tolerance_ms:
+            errors.append('%s at %.3f ms, expected %s at %d ms' %
+                          (observed[i][1], observed[i][0], expected[i][1], expected[i][0]))
+
+    print('%d light changes by track commands, %d expected' % (len(observed), len(expected)))
+    for error in errors:
+        print(error, file=sys.stderr)
+    return 1 if errors else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    commands = parser.add_subparsers(dest='command', required=True)
+    parser_generate = commands.add_parser('generate', help='write the edges of the track signal')
+    parser_generate.add_argument('trace')
+    parser_generate.add_argument('--seed', type=int, default=1, help='seed of the timing jitter')
+    parser_check = commands.add_parser('check', help='check the light states of a simulation timeline')
+    parser_check.add_argument('timeline', type=argparse.FileType('r'))
+    parser_check.add_argument('--tolerance-ms', type=float, default=100.0,
+                              help='allowed time from the start of a command until the lights changed')
+    args = parser.parse_args()
+    return generate(args) if args.command == 'generate' else check(args)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
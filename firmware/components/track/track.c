@@ -0,0 +1,284 @@
+#include "track.h"
+#include "decode.h"
+
+#include "driver/rmt_rx.h"
+#include "esp_attr.h"
+#include "esp_console.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "latency.h"
+#include "light.h"
+#include "light_command.h"
+#include "sdkconfig.h"
+#include "vclock.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+static const char *TAG = "track";
+
+#define TRACK_RESOLUTION_HZ 1000000   // one tick per microsecond, the unit the decoders work in
+#define TRACK_MEM_SYMBOLS 48          // memory of one RX channel on every target with ping-pong receive
+#define TRACK_RING_SYMBOLS 512        // power of two; about 50 ms of DCC
+#define TRACK_REPEAT_US (1000 * 1000) // repetitions of a command within this time are not posted again
+#define TRACK_TASK_STACK_SIZE 3072
+
+static const char *const protocol_names[TRACK_PROTOCOL_COUNT] = {
+    [TRACK_PROTOCOL_DCC] = "dcc",
+    [TRACK_PROTOCOL_MM] = "mm",
+};
+
+static const rmt_receive_config_t receive_config = {
+    .signal_range_min_ns = 2000,             // glitch filter, the shortest level is the 13 us of an MM bit
+    .signal_range_max_ns = 30 * 1000 * 1000, // a level this long ends the receive: the track is idle
+    .flags.en_partial_rx = true,
+};
+
+/*
+ * The RMT measures every level of the track signal in hardware and interrupts once per half of its memory, i.e.
+ * every 24 symbols (about 2.5 ms of DCC) instead of on every edge. The interrupt only copies the symbols into a
+ * ring; the task decodes them. Both protocols are fed the same durations, so the decoder does not need to know
+ * which command station drives the layout. The RMT driver holds the power management lock of its clock itself.
+ */
+static rmt_channel_handle_t channel;
+static rmt_symbol_word_t receive_buffer[TRACK_MEM_SYMBOLS];
+
+static portMUX_TYPE ring_lock = portMUX_INITIALIZER_UNLOCKED;
+static rmt_symbol_word_t ring[TRACK_RING_SYMBOLS];
+static uint32_t ring_head;
+static uint32_t ring_tail;
+static int64_t received_at_us; ///< when the newest symbols arrived, start of the track latency path
+static bool rearm = false;
+static track_stats_t stats;
+
+static TaskHandle_t task_handle = NULL;
+static StackType_t task_stack[TRACK_TASK_STACK_SIZE];
+static StaticTask_t task_buffer;
+
+// only used by the task
+static decode_t decoder;
+static track_command_t last_posted;
+static int64_t last_posted_at_us;
+
+static bool IRAM_ATTR track_receive_callback(rmt_channel_handle_t rx_chan, const rmt_rx_done_event_data_t *edata,
+                                             void *user_ctx)
+{
+    int64_t now_us = vclock_now_us();
+
+    portENTER_CRITICAL_ISR(&ring_lock);
+    for (size_t i = 0; i < edata->num_symbols; i++)
+    {
+        if (ring_head - ring_tail == TRACK_RING_SYMBOLS)
+        {
+            stats.overruns += edata->num_symbols - i;
+            break;
+        }
+        ring[ring_head++ % TRACK_RING_SYMBOLS] = edata->received_symbols[i];
+    }
+    received_at_us = now_us;
+    // the receive ended on an idle track, the task starts the next one
+    rearm = rearm || edata->flags.is_last;
+    portEXIT_CRITICAL_ISR(&ring_lock);
+
+    BaseType_t high_task_wakeup = pdFALSE;
+    vTaskNotifyGiveFromISR(task_handle, &high_task_wakeup);
+    return high_task_wakeup == pdTRUE;
+}
+
+static void handle(const track_command_t *command, int64_t start_us)
+{
+    // a command station sends every switching command as on and off; the on is the command
+    if (!command->activate)
+    {
+        return;
+    }
+
+    light_settings_t settings = {0};
+    uint32_t mask;
+    if (command->address == CONFIG_TRACK_BEACON_ADDRESS)
+    {
+        settings.beacon_enabled = command->direction;
+        mask = LIGHT_SETTING_BEACON_ENABLED;
+    }
+    else if (command->address == CONFIG_TRACK_OUTDOOR_ADDRESS)
+    {
+        settings.outdoor_enabled = command->direction;
+        mask = LIGHT_SETTING_OUTDOOR_ENABLED;
+    }
+    else
+    {
+        return;
+    }
+
+    // command stations repeat each packet several times; each posted command costs an NVS commit
+    int64_t now_us = vclock_now_us();
+    if (command->address == last_posted.address && command->direction == last_posted.direction &&
+        now_us - last_posted_at_us < TRACK_REPEAT_US)
+    {
+        return;
+    }
+    last_posted = *command;
+    last_posted_at_us = now_us;
+
+    ESP_LOGI(TAG, "%s turnout %u %s", protocol_names[command->protocol], command->address,
+             command->direction ? "straight" : "diverging");
+    if (light_command_post_timed(&settings, mask, LATENCY_PATH_TRACK, start_us) == ESP_OK)
+    {
+        portENTER_CRITICAL(&ring_lock);
+        stats.commands++;
+        portEXIT_CRITICAL(&ring_lock);
+    }
+}
+
+static void feed(uint32_t duration_us, int64_t start_us)
+{
+    track_command_t command;
+    if (decode_feed(&decoder, duration_us, &command))
+    {
+        handle(&command, start_us);
+    }
+}
+
+static void track_task(void *arg)
+{
+    while (true)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        portENTER_CRITICAL(&ring_lock);
+        uint32_t head = ring_head;
+        int64_t start_us = received_at_us;
+        bool receive_again = rearm;
+        rearm = false;
+        portEXIT_CRITICAL(&ring_lock);
+
+        // the interrupt only writes beyond head, so the symbols up to it are read without the lock
+        for (uint32_t i = ring_tail; i != head; i++)
+        {
+            rmt_symbol_word_t symbol = ring[i % TRACK_RING_SYMBOLS];
+            // a zero duration ends the receive; the idle track after it is a gap for both protocols
+            if (symbol.duration0 == 0)
+            {
+                feed(DECODE_GAP_US, start_us);
+                continue;
+            }
+            feed(symbol.duration0, start_us);
+            feed(symbol.duration1 == 0 ? DECODE_GAP_US : symbol.duration1, start_us);
+        }
+
+        portENTER_CRITICAL(&ring_lock);
+        ring_tail = head;
+        for (int protocol = 0; protocol < TRACK_PROTOCOL_COUNT; protocol++)
+        {
+            stats.packets[protocol] = decoder.packets[protocol];
+            stats.errors[protocol] = decoder.errors[protocol];
+        }
+        portEXIT_CRITICAL(&ring_lock);
+
+        if (receive_again)
+        {
+            esp_err_t ret = rmt_receive(channel, receive_buffer, sizeof(receive_buffer), &receive_config);
+            if (ret != ESP_OK)
+            {
+                ESP_LOGE(TAG, "Failed to restart receiving: %s", esp_err_to_name(ret));
+            }
+        }
+    }
+}
+
+esp_err_t track_init(void)
+{
+    if (channel != NULL)
+    {
+        return ESP_OK;
+    }
+
+    decode_reset(&decoder);
+    if (task_handle == NULL)
+    {
+        // an input like BLE, so it runs next to the light controller it posts to
+        task_handle = xTaskCreateStaticPinnedToCore(track_task, "track", TRACK_TASK_STACK_SIZE, NULL, 9,
+                                                    task_stack, &task_buffer, LIGHT_BLE_CORE);
+    }
+
+    rmt_rx_channel_config_t channel_config = {
+        .gpio_num = CONFIG_TRACK_PIN,
+        .clk_src = RMT_CLK_SRC_DEFAULT,
+        .resolution_hz = TRACK_RESOLUTION_HZ,
+        .mem_block_symbols = TRACK_MEM_SYMBOLS,
+    };
+    esp_err_t ret = rmt_new_rx_channel(&channel_config, &channel);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to create RMT RX channel: %s", esp_err_to_name(ret));
+        channel = NULL;
+        goto exit;
+    }
+
+    rmt_rx_event_callbacks_t callbacks = {.on_recv_done = track_receive_callback};
+    ret = rmt_rx_register_event_callbacks(channel, &callbacks, NULL);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to register RMT callbacks: %s", esp_err_to_name(ret));
+        goto cleanupChannel;
+    }
+
+    ret = rmt_enable(channel);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to enable RMT channel: %s", esp_err_to_name(ret));
+        goto cleanupChannel;
+    }
+
+    ret = rmt_receive(channel, receive_buffer, sizeof(receive_buffer), &receive_config);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to start receiving: %s", esp_err_to_name(ret));
+        goto cleanupEnabledChannel;
+    }
+
+    ESP_LOGI(TAG, "Track decoder on GPIO %d: beacon at turnout %d, outdoor lamps at turnout %d", CONFIG_TRACK_PIN,
+             CONFIG_TRACK_BEACON_ADDRESS, CONFIG_TRACK_OUTDOOR_ADDRESS);
+    goto exit;
+
+cleanupEnabledChannel:
+    rmt_disable(channel);
+cleanupChannel:
+    rmt_del_channel(channel);
+    channel = NULL;
+exit:
+    return ret;
+}
+
+track_stats_t track_get_stats(void)
+{
+    portENTER_CRITICAL(&ring_lock);
+    track_stats_t copy = stats;
+    portEXIT_CRITICAL(&ring_lock);
+    return copy;
+}
+
+// printf instead of ESP_LOG, so the output survives release builds with logging compiled out
+static int track_command(int argc, char **argv)
+{
+    track_stats_t current = track_get_stats();
+    for (int protocol = 0; protocol < TRACK_PROTOCOL_COUNT; protocol++)
+    {
+        printf("%-8s %" PRIu32 " packets, %" PRIu32 " errors\n", protocol_names[protocol], current.packets[protocol],
+               current.errors[protocol]);
+    }
+    printf("commands %" PRIu32 ", overruns %" PRIu32 "\n", current.commands, current.overruns);
+    return 0;
+}
+
+esp_err_t track_register_console_command(void)
+{
+    const esp_console_cmd_t command = {
+        .command = "track",
+        .help = "Show the packets and errors of the track signal decoder",
+        .func = track_command,
+    };
+    return esp_console_cmd_register(&command);
+}
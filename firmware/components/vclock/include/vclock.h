@@ -0,0 +1,103 @@
+#pragma once
+
+/*
+ * Time base of the light and touch logic. On the device these are esp_timer and FreeRTOS themselves. The
+ * host build can switch to a virtual clock that jumps to the next deadline as soon as every task is blocked,
+ * so hours of light behaviour run in seconds (see sim.h).
+ */
+
+#include "esp_attr.h"
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#if CONFIG_IDF_TARGET_LINUX
+
+typedef struct vclock_timer *vclock_timer_handle_t;
+
+/**
+ * @brief Microseconds since boot, like esp_timer_get_time().
+ */
+int64_t vclock_now_us(void);
+
+/**
+ * @brief Waits for a task notification, like ulTaskNotifyTake(); the timeout runs on the clock.
+ */
+uint32_t vclock_notify_take(BaseType_t clear_on_exit, TickType_t ticks_to_wait);
+
+/**
+ * @brief Waits for a task notification until the clock reaches `deadline_us`.
+ */
+uint32_t vclock_notify_take_until(BaseType_t clear_on_exit, int64_t deadline_us);
+
+/**
+ * @brief Blocks the calling task, like vTaskDelay(); notifications are left alone.
+ */
+void vclock_delay(TickType_t ticks);
+
+/**
+ * @brief One-shot timers with the semantics of esp_timer: starting a running or stopping an idle timer
+ * fails with ESP_ERR_INVALID_STATE. Callbacks run on a task of their own.
+ */
+esp_err_t vclock_timer_create(const esp_timer_create_args_t *args, vclock_timer_handle_t *out_handle);
+
+esp_err_t vclock_timer_start_once(vclock_timer_handle_t timer, uint64_t timeout_us);
+
+esp_err_t vclock_timer_stop(vclock_timer_handle_t timer);
+
+esp_err_t vclock_timer_delete(vclock_timer_handle_t timer);
+
+/**
+ * @brief Switches from real to virtual time; call before any task waits on the clock.
+ *
+ * Virtual time only advances while every task is blocked. Work done between two deadlines therefore
+ * takes no time at all, and waits on anything but the clock (e.g. a blocking read) stall the simulation.
+ */
+void vclock_use_virtual_time(void);
+
+#else
+
+typedef esp_timer_handle_t vclock_timer_handle_t;
+
+// forced inline, so it is as IRAM-safe as esp_timer_get_time() itself
+FORCE_INLINE_ATTR int64_t vclock_now_us(void)
+{
+    return esp_timer_get_time();
+}
+
+static inline uint32_t vclock_notify_take(BaseType_t clear_on_exit, TickType_t ticks_to_wait)
+{
+    return ulTaskNotifyTake(clear_on_exit, ticks_to_wait);
+}
+
+static inline void vclock_delay(TickType_t ticks)
+{
+    vTaskDelay(ticks);
+}
+
+static inline esp_err_t vclock_timer_create(const esp_timer_create_args_t *args, vclock_timer_handle_t *out_handle)
+{
+    return esp_timer_create(args, out_handle);
+}
+
+static inline esp_err_t vclock_timer_start_once(vclock_timer_handle_t timer, uint64_t timeout_us)
+{
+    return esp_timer_start_once(timer, timeout_us);
+}
+
+static inline esp_err_t vclock_timer_stop(vclock_timer_handle_t timer)
+{
+    return esp_timer_stop(timer);
+}
+
+static inline esp_err_t vclock_timer_delete(vclock_timer_handle_t timer)
+{
+    return esp_timer_delete(timer);
+}
+
+#endif
@@ -0,0 +1,346 @@
+#include "vclock.h"
+
+#include <stdlib.h>
+
+#include "esp_log.h"
+
+static const char *TAG = "vclock";
+
+#define VCLOCK_MAX_WAITERS 32
+#define VCLOCK_TASK_STACK_SIZE 4096
+#define VCLOCK_TIMER_TASK_PRIORITY (configMAX_PRIORITIES - 3) // like the esp_timer task
+
+typedef struct
+{
+    TaskHandle_t task;
+    int64_t deadline_us;
+    bool used;
+    bool fired;
+    bool suspended; ///< vclock_delay(): resumed instead of notified
+} vclock_waiter_t;
+
+struct vclock_timer
+{
+    esp_timer_cb_t callback;
+    void *arg;
+    bool armed;
+    int64_t deadline_us;
+    struct vclock_timer *next;
+};
+
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static bool virtual_time = false;
+static int64_t virtual_now_us;
+static vclock_waiter_t waiters[VCLOCK_MAX_WAITERS];
+
+static struct vclock_timer *timers;
+static TaskHandle_t timer_task_handle;
+
+int64_t vclock_now_us(void)
+{
+    return virtual_time ? __atomic_load_n(&virtual_now_us, __ATOMIC_RELAXED) : esp_timer_get_time();
+}
+
+static TickType_t ticks_until(int64_t deadline_us)
+{
+    int64_t remaining_us = deadline_us - esp_timer_get_time();
+    if (remaining_us <= 0)
+    {
+        return 0;
+    }
+    TickType_t ticks = pdMS_TO_TICKS((remaining_us + 999) / 1000);
+    return ticks > 0 ? ticks : 1;
+}
+
+static vclock_waiter_t *add_waiter(int64_t deadline_us, bool suspended)
+{
+    vclock_waiter_t *waiter = NULL;
+
+    portENTER_CRITICAL(&lock);
+    for (int i = 0; i < VCLOCK_MAX_WAITERS; i++)
+    {
+        if (!waiters[i].used)
+        {
+            waiter = &waiters[i];
+            *waiter = (vclock_waiter_t){
+                .task = xTaskGetCurrentTaskHandle(),
+                .deadline_us = deadline_us,
+                .used = true,
+                .suspended = suspended,
+            };
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&lock);
+
+    if (waiter == NULL)
+    {
+        ESP_LOGE(TAG, "More than %d tasks wait on the clock", VCLOCK_MAX_WAITERS);
+        abort();
+    }
+    return waiter;
+}
+
+// Returns true if the clock woke the waiter because its deadline was reached
+static bool remove_waiter(vclock_waiter_t *waiter)
+{
+    portENTER_CRITICAL(&lock);
+    bool fired = waiter->fired;
+    waiter->used = false;
+    portEXIT_CRITICAL(&lock);
+    return fired;
+}
+
+uint32_t vclock_notify_take_until(BaseType_t clear_on_exit, int64_t deadline_us)
+{
+    if (!virtual_time)
+    {
+        return ulTaskNotifyTake(clear_on_exit, ticks_until(deadline_us));
+    }
+    if (deadline_us <= vclock_now_us())
+    {
+        return ulTaskNotifyTake(clear_on_exit, 0);
+    }
+
+    // the clock wakes us with a notification of its own, which must not be mistaken for a real one
+    vclock_waiter_t *waiter = add_waiter(deadline_us, false);
+    uint32_t value = ulTaskNotifyTake(clear_on_exit, portMAX_DELAY);
+    if (!remove_waiter(waiter))
+    {
+        return value;
+    }
+    if (!clear_on_exit && value > 1)
+    {
+        // the clock's notification was taken, take the real one as the caller asked for
+        ulTaskNotifyTake(pdFALSE, 0);
+    }
+    return value - 1;
+}
+
+uint32_t vclock_notify_take(BaseType_t clear_on_exit, TickType_t ticks_to_wait)
+{
+    if (ticks_to_wait == portMAX_DELAY || !virtual_time)
+    {
+        return ulTaskNotifyTake(clear_on_exit, ticks_to_wait);
+    }
+    return vclock_notify_take_until(clear_on_exit,
+                                    vclock_now_us() + (int64_t)ticks_to_wait * portTICK_PERIOD_MS * 1000);
+}
+
+void vclock_delay(TickType_t ticks)
+{
+    if (!virtual_time)
+    {
+        vTaskDelay(ticks);
+        return;
+    }
+    if (ticks == 0)
+    {
+        taskYIELD();
+        return;
+    }
+
+    vclock_waiter_t *waiter = add_waiter(vclock_now_us() + (int64_t)ticks * portTICK_PERIOD_MS * 1000, true);
+    vTaskSuspend(NULL);
+    remove_waiter(waiter);
+}
+
+/*
+ * Runs at priority 1, below every task that waits on the clock: when it gets the CPU, everything else is
+ * blocked and nothing can happen before the next deadline, so the clock jumps there and wakes the waiter.
+ * Only app_main shares the priority, and it never waits on the clock.
+ */
+static void clock_task(void *arg)
+{
+    while (true)
+    {
+        vclock_waiter_t *next = NULL;
+
+        portENTER_CRITICAL(&lock);
+        for (int i = 0; i < VCLOCK_MAX_WAITERS; i++)
+        {
+            vclock_waiter_t *waiter = &waiters[i];
+            if (waiter->used && !waiter->fired && (next == NULL || waiter->deadline_us < next->deadline_us))
+            {
+                next = waiter;
+            }
+        }
+        if (next != NULL)
+        {
+            if (next->deadline_us > virtual_now_us)
+            {
+                __atomic_store_n(&virtual_now_us, next->deadline_us, __ATOMIC_RELAXED);
+            }
+            // woken under the lock, so a waiter that finds itself fired also has the notification
+            next->fired = true;
+            if (next->suspended)
+            {
+                vTaskResume(next->task);
+            }
+            else
+            {
+                xTaskNotifyGive(next->task);
+            }
+        }
+        portEXIT_CRITICAL(&lock);
+
+        if (next == NULL)
+        {
+            // nothing scheduled: only something outside of the clock, like a blocking read, can change that
+            vTaskDelay(1);
+        }
+    }
+}
+
+void vclock_use_virtual_time(void)
+{
+    if (virtual_time)
+    {
+        return;
+    }
+
+    virtual_now_us = esp_timer_get_time();
+    virtual_time = true;
+    xTaskCreate(clock_task, "vclock", VCLOCK_TASK_STACK_SIZE, NULL, 1, NULL);
+    ESP_LOGI(TAG, "Running on virtual time");
+}
+
+// Plays the esp_timer task: runs the callbacks of expired timers, one after the other
+static void timer_task(void *arg)
+{
+    while (true)
+    {
+        struct vclock_timer *next = NULL;
+        bool expired = false;
+        esp_timer_cb_t callback = NULL;
+        void *callback_arg = NULL;
+
+        portENTER_CRITICAL(&lock);
+        for (struct vclock_timer *timer = timers; timer != NULL; timer = timer->next)
+        {
+            if (timer->armed && (next == NULL || timer->deadline_us < next->deadline_us))
+            {
+                next = timer;
+            }
+        }
+        if (next != NULL && next->deadline_us <= vclock_now_us())
+        {
+            next->armed = false;
+            callback = next->callback;
+            callback_arg = next->arg;
+            expired = true;
+        }
+        int64_t deadline_us = next != NULL ? next->deadline_us : 0;
+        portEXIT_CRITICAL(&lock);
+
+        if (expired)
+        {
+            callback(callback_arg);
+        }
+        else if (next != NULL)
+        {
+            vclock_notify_take_until(pdTRUE, deadline_us);
+        }
+        else
+        {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        }
+    }
+}
+
+esp_err_t vclock_timer_create(const esp_timer_create_args_t *args, vclock_timer_handle_t *out_handle)
+{
+    if (args == NULL || args->callback == NULL || out_handle == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (timer_task_handle == NULL &&
+        xTaskCreate(timer_task, "vclock_timer", VCLOCK_TASK_STACK_SIZE, NULL, VCLOCK_TIMER_TASK_PRIORITY,
+                    &timer_task_handle) != pdPASS)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    struct vclock_timer *timer = calloc(1, sizeof(*timer));
+    if (timer == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    timer->callback = args->callback;
+    timer->arg = args->arg;
+
+    portENTER_CRITICAL(&lock);
+    timer->next = timers;
+    timers = timer;
+    portEXIT_CRITICAL(&lock);
+
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+esp_err_t vclock_timer_start_once(vclock_timer_handle_t timer, uint64_t timeout_us)
+{
+    if (timer == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&lock);
+    esp_err_t ret = timer->armed ? ESP_ERR_INVALID_STATE : ESP_OK;
+    if (ret == ESP_OK)
+    {
+        timer->armed = true;
+        timer->deadline_us = vclock_now_us() + (int64_t)timeout_us;
+    }
+    portEXIT_CRITICAL(&lock);
+
+    if (ret == ESP_OK)
+    {
+        xTaskNotifyGive(timer_task_handle);
+    }
+    return ret;
+}
+
+esp_err_t vclock_timer_stop(vclock_timer_handle_t timer)
+{
+    if (timer == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&lock);
+    esp_err_t ret = timer->armed ? ESP_OK : ESP_ERR_INVALID_STATE;
+    timer->armed = false;
+    portEXIT_CRITICAL(&lock);
+    return ret;
+}
+
+esp_err_t vclock_timer_delete(vclock_timer_handle_t timer)
+{
+    if (timer == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&lock);
+    esp_err_t ret = timer->armed ? ESP_ERR_INVALID_STATE : ESP_OK;
+    if (ret == ESP_OK)
+    {
+        for (struct vclock_timer **link = &timers; *link != NULL; link = &(*link)->next)
+        {
+            if (*link == timer)
+            {
+                *link = timer->next;
+                break;
+            }
+        }
+    }
+    portEXIT_CRITICAL(&lock);
+
+    if (ret == ESP_OK)
+    {
+        free(timer);
+    }
+    return ret;
+}
@@ -1,38 +1,196 @@
+#include "esp_console.h"
+#include "latency.h"
 #include "light.h"
+#include "light_command.h"
+#include "metrics.h"
+#include "ota.h"
 #include "persistence.h"
+#include "power.h"
 #include "remote_control.h"
+#include "schedule.h"
+#include "sdkconfig.h"
 #include "touch.h"
+#include "trace.h"
 
-void init_touch_gpio(void);
+#if CONFIG_FOGHORN
+#include "foghorn.h"
+#endif
+
+#if CONFIG_TRACK_DECODER
+#include "track.h"
+#endif
+
+#if CONFIG_IDF_TARGET_LINUX
+#include "sim.h"
+#endif
+
+static void start_console(void)
+{
+    esp_console_repl_t *repl = NULL;
+    esp_console_repl_config_t repl_config = ESP_CONSOLE_REPL_CONFIG_DEFAULT();
+    repl_config.prompt = "lighthouse>";
+
+#if defined(CONFIG_ESP_CONSOLE_UART_DEFAULT) || defined(CONFIG_ESP_CONSOLE_UART_CUSTOM)
+    esp_console_dev_uart_config_t hw_config = ESP_CONSOLE_DEV_UART_CONFIG_DEFAULT();
+    esp_err_t ret = esp_console_new_repl_uart(&hw_config, &repl_config, &repl);
+#elif defined(CONFIG_ESP_CONSOLE_USB_CDC)
+    esp_console_dev_usb_cdc_config_t hw_config = ESP_CONSOLE_DEV_CDC_CONFIG_DEFAULT();
+    esp_err_t ret = esp_console_new_repl_usb_cdc(&hw_config, &repl_config, &repl);
+#elif defined(CONFIG_ESP_CONSOLE_USB_SERIAL_JTAG)
+    esp_console_dev_usb_serial_jtag_config_t hw_config = ESP_CONSOLE_DEV_USB_SERIAL_JTAG_CONFIG_DEFAULT();
+    esp_err_t ret = esp_console_new_repl_usb_serial_jtag(&hw_config, &repl_config, &repl);
+#else
+    esp_err_t ret = ESP_ERR_NOT_SUPPORTED;
+#endif
+    if (ret != ESP_OK)
+    {
+        printf("Console not available: %s\n", esp_err_to_name(ret));
+        return;
+    }
+
+    metrics_register_console_command();
+    trace_register_console_command();
+    latency_register_console_command();
+    schedule_register_console_command();
+    power_register_console_command();
+    beacon_register_console_command();
+#if CONFIG_TRACK_DECODER
+    track_register_console_command();
+#endif
+#if CONFIG_FOGHORN
+    foghorn_register_console_command();
+#endif
+    esp_console_start_repl(repl);
+}
+
+static esp_err_t start_services(void)
+{
+    /// start light controller, all inputs post their commands to it
+    if (light_command_start() != ESP_OK)
+    {
+        printf("Failed to start light controller");
+        return ESP_FAIL;
+    }
+
+    /// start the calendar; it waits for the time from a phone
+    if (schedule_init() != ESP_OK)
+    {
+        printf("Failed to start schedule");
+        return ESP_FAIL;
+    }
+
+    /// activate BLE functions
+    if (remote_control_init() != ESP_OK)
+    {
+        printf("Failed to initialize remote control");
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+// the beacon state before the last tap, a double-tap puts it back
+static bool beacon_before_tap;
+
+static void toggle_beacon(touch_gesture_t gesture, void *ctx)
+{
+    beacon_before_tap = beacon_is_running();
+    light_settings_t settings = {.beacon_enabled = !beacon_before_tap};
+    light_command_post_timed(&settings, LIGHT_SETTING_BEACON_ENABLED, LATENCY_PATH_TOUCH, touch_triggered_at());
+}
+
+// off -> flicker -> steady -> dim -> off; the first tap of the double-tap already toggled the beacon, undo that
+static void cycle_outdoor_mode(touch_gesture_t gesture, void *ctx)
+{
+    light_settings_t settings = {
+        .beacon_enabled = beacon_before_tap, .outdoor_enabled = true, .outdoor_mode = outdoor_get_mode() + 1};
+    if (!outdoor_is_running())
+    {
+        settings.outdoor_mode = OUTDOOR_MODE_FLICKER;
+    }
+    else if (settings.outdoor_mode >= OUTDOOR_MODE_COUNT)
+    {
+        settings.outdoor_enabled = false;
+        settings.outdoor_mode = OUTDOOR_MODE_FLICKER;
+    }
+    light_command_post_timed(&settings,
+                             LIGHT_SETTING_BEACON_ENABLED | LIGHT_SETTING_OUTDOOR_ENABLED | LIGHT_SETTING_OUTDOOR_MODE,
+                             LATENCY_PATH_TOUCH, touch_triggered_at());
+}
+
+static void start_pairing(touch_gesture_t gesture, void *ctx)
+{
+    remote_control_start_pairing();
+}
+
+static void start_touch(void)
+{
+    touch_bind(TOUCH_GESTURE_TAP, toggle_beacon, NULL);
+    touch_bind(TOUCH_GESTURE_DOUBLE_TAP, cycle_outdoor_mode, NULL);
+    touch_bind(TOUCH_GESTURE_LONG_PRESS, start_pairing, NULL);
+
+    if (touch_init() != ESP_OK)
+    {
+        printf("Failed to initialize touch");
+    }
+}
 
 void app_main(void)
 {
+#if CONFIG_IDF_TARGET_LINUX
+    /// stand-ins for the hardware, has to come before anything touches NVS
+    sim_init();
+#endif
+
     /// init persistence
     persistence_init("lighthouse");
 
-    init_touch();
+    /// the lights come on first, layouts power all units at once and nobody should watch them boot
+    bool lights_restored = light_restore() == ESP_OK;
+    if (!lights_restored)
+    {
+        printf("Failed to restore lights");
+    }
+
+    metrics_init();
+
+    /// frequency bounds of the power profile; locks the light outputs already hold are kept
+    power_init();
+
+    /// a freshly updated image is only kept if everything came up
+    ota_confirm_image(start_services() == ESP_OK && lights_restored);
 
-    /// init WLED
-    if (wled_init() != ESP_OK)
+    start_touch();
+
+#if CONFIG_TRACK_DECODER
+    /// accessory commands of the layout's command station
+    if (track_init() != ESP_OK)
     {
-        printf("Failed to initialize WLED");
-        return;
+        printf("Failed to start track decoder");
     }
+#endif
 
-    /// start beacon service
-    if (beacon_init() != ESP_OK)
+#if CONFIG_FOGHORN
+    /// sounds with the beacon, so it needs the beacon up
+    if (foghorn_init() != ESP_OK)
     {
-        printf("Failed to initialize beacon");
-        return;
+        printf("Foghorn not available");
     }
+#endif
 
-    /// start outdoor light service
-    if (outdoor_start() != ESP_OK)
+#if CONFIG_IDF_TARGET_LINUX
+    /// the simulation stands in for the phone that sets the clock
+    int64_t utc_us;
+    if (sim_wall_clock_us(&utc_us))
     {
-        printf("Failed to start outdoor");
-        return;
+        schedule_set_time(utc_us, CONFIG_SCHEDULE_UTC_OFFSET * 60);
     }
+#endif
 
-    /// activate BLE functions
-    remote_control_init();
+    persistence_log_entries();
+
+    start_console();
+
+    /// from here on the firmware is expected to run without the heap
+    metrics_boot_complete();
 }